@@ -0,0 +1,477 @@
+// Host benchmark: the real FlashLogger.cpp against an emulated W25Q NOR chip.
+//
+// Fills the chip with SEN66 NDJSON records (same shape as main_control's
+// recordMeasurement; every 2000th tagged REC_TAG_ALERT; typed records with
+// --typed) and times the hot paths in simulated device time:
+// append, mount (begin -> index scan), queryLatest, queryTagged, queryLogs (predicate and where), queryAgg,
+// exportSinceWithMeta, exportRows, seekSeq and buildSummaries.
+//
+// Build (from the repo root):
+//   g++ -std=c++17 -O2 -Iapps/flashlogger/host -Iapps/flashlogger/src
+//       apps/flashlogger/bench/flashlogger_bench.cpp apps/flashlogger/src/FlashLogger.cpp
+//       apps/flashlogger/host/NorFlashEmulator.cpp -o flashlogger_bench
+//
+// Options:
+//   --fill-mb N        data to log before querying (default 8)
+//   --chip-mb N        emulated chip size (default 16)
+//   --clock-mhz N      SPI clock (default 20)
+//   --xfer byte|bulk   SPI transfer path (default bulk)
+//   --overhead-ns N    per SPIClass call driver overhead (default 1500)
+//   --interval-s N     seconds between records (default 60)
+//   --durability sync|group|deferred   append mode (default sync)
+//   --poll             run poll() between samples (erase-ahead pool, async work)
+//   --typed            log typed records (appendTyped, kSen66Schema) instead of NDJSON
+//   --compressed       typed samples in compressed blocks (cfg.compressTyped, implies --typed;
+//                      pair with --durability deferred, SYNC seals every sample)
+//   --rollups          minute/hour/day rollup rings (cfg.rollupSectors 16/16/2) and a queryAgg row from them
+//   --csv              machine-readable output
+
+#include "FlashLogger.h"
+#include "NorFlashEmulator.h"
+#include <Preferences.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+namespace {
+
+struct Options {
+  uint32_t fillMB = 8;
+  uint32_t chipMB = 16;
+  uint32_t clockMHz = 20;
+  FlashSpiXfer xfer = FLASH_XFER_BULK;
+  uint32_t overheadNs = 1500;
+  uint32_t intervalS = 60;
+  FlashDurability durability = FLASH_DURABLE_SYNC;
+  bool csv = false;
+  bool poll = false;
+  bool typed = false;
+  bool compressed = false;
+  bool rollups = false;
+};
+
+// Time the device sleeps between samples; excluded from the report.
+uint64_t gIdleUs = 0;
+
+struct Snapshot {
+  uint64_t simUs;
+  uint64_t frames;
+  uint64_t bytesRead;
+  uint64_t bytesProgrammed;
+  uint32_t spiCalls;
+  uint32_t erases;
+  uint32_t nvsWrites;
+  double wallMs;
+};
+
+Snapshot snap(const NorFlashEmulator& emu) {
+  Snapshot s;
+  s.simUs = hostsim::clockUs() - gIdleUs;
+  s.frames = emu.stats().frames;
+  s.bytesRead = emu.stats().bytesRead;
+  s.bytesProgrammed = emu.stats().bytesProgrammed;
+  s.spiCalls = SPI.calls();
+  s.erases = emu.stats().sectorErases;
+  s.nvsWrites = hostsim::nvs().writes;
+  s.wallMs = std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now().time_since_epoch()).count();
+  return s;
+}
+
+struct Report {
+  const Options& opt;
+  explicit Report(const Options& o) : opt(o) {
+    if (opt.csv) {
+      printf("op,ops,rows,sim_ms,sim_ms_per_op,ops_per_s,spi_frames_per_op,spi_calls_per_op,"
+             "bytes_read_per_op,bytes_programmed,erases,nvs_writes,wall_ms\n");
+    } else {
+      printf("%-22s %7s %8s %11s %11s %10s %10s %12s %12s %7s %6s\n",
+             "op", "ops", "rows", "sim ms", "ms/op", "ops/s", "frames/op", "bytesRd/op",
+             "programmed", "erases", "nvs");
+    }
+  }
+  void row(const char* op, uint32_t ops, uint32_t rows, const Snapshot& a, const Snapshot& b) const {
+    const double simMs = (b.simUs - a.simUs) / 1000.0;
+    const double perOp = ops ? simMs / ops : 0.0;
+    const double opsPerS = simMs > 0 ? ops * 1000.0 / simMs : 0.0;
+    const double frames = ops ? (double)(b.frames - a.frames) / ops : 0.0;
+    const double calls = ops ? (double)(b.spiCalls - a.spiCalls) / ops : 0.0;
+    const double rd = ops ? (double)(b.bytesRead - a.bytesRead) / ops : 0.0;
+    if (opt.csv) {
+      printf("%s,%u,%u,%.3f,%.4f,%.2f,%.1f,%.1f,%.1f,%llu,%u,%u,%.1f\n", op, ops, rows, simMs, perOp,
+             opsPerS, frames, calls, rd, (unsigned long long)(b.bytesProgrammed - a.bytesProgrammed),
+             b.erases - a.erases, b.nvsWrites - a.nvsWrites, b.wallMs - a.wallMs);
+    } else {
+      printf("%-22s %7u %8u %11.1f %11.3f %10.1f %10.1f %12.0f %12llu %7u %6u\n", op, ops, rows, simMs,
+             perOp, opsPerS, frames, rd, (unsigned long long)(b.bytesProgrammed - a.bytesProgrammed),
+             b.erases - a.erases, b.nvsWrites - a.nvsWrites);
+    }
+  }
+};
+
+// SEN66 + battery + RTC fields, slow random walk around indoor values.
+struct Sen66Model {
+  std::mt19937 rng{12345};
+  float pm25 = 12.0f, temp = 26.0f, hum = 55.0f, voc = 100.0f, nox = 1.0f, bat = 100.0f;
+
+  float walk(float v, float step, float lo, float hi) {
+    std::uniform_real_distribution<float> d(-step, step);
+    v += d(rng);
+    return v < lo ? lo : (v > hi ? hi : v);
+  }
+
+  void step() {
+    pm25 = walk(pm25, 1.5f, 1.0f, 150.0f);
+    temp = walk(temp, 0.05f, 18.0f, 38.0f);
+    hum = walk(hum, 0.3f, 20.0f, 95.0f);
+    voc = walk(voc, 3.0f, 1.0f, 500.0f);
+    nox = walk(nox, 0.2f, 1.0f, 50.0f);
+    bat = walk(bat - 0.001f, 0.01f, 5.0f, 100.0f);
+  }
+
+  // kSen66Schema order
+  uint16_t values(float* v) {
+    step();
+    const float out[] = { pm25 * 0.7f, pm25, pm25 * 1.3f, voc, nox, temp, hum, bat,
+                          3.3f + bat * 0.009f, temp - 1.5f };
+    memcpy(v, out, sizeof(out));
+    return 2 + 10 * 2;                                  // mask + ten 16-bit fields
+  }
+
+  String next(uint32_t unixTs) {
+    step();
+    String s;
+    s.reserve(200);
+    s += '{';
+    s += "\"ts\":"; s += String(unixTs);
+    s += ",\"pm1\":"; s += String(pm25 * 0.7f, 2);
+    s += ",\"pm25\":"; s += String(pm25, 2);
+    s += ",\"pm10\":"; s += String(pm25 * 1.3f, 2);
+    s += ",\"voc\":"; s += String(voc, 2);
+    s += ",\"nox\":"; s += String(nox, 2);
+    s += ",\"temp\":"; s += String(temp, 2);
+    s += ",\"humidity\":"; s += String(hum, 2);
+    s += ",\"battery_pct\":"; s += String(bat, 1);
+    s += ",\"battery_v\":"; s += String(3.3f + bat * 0.009f, 3);
+    s += ",\"rtc_temp\":"; s += String(temp - 1.5f, 2);
+    s += '}';
+    return s;
+  }
+};
+
+// main_control's recordMeasurement fields at the SEN66's resolution.
+const FieldDef kSen66Schema[] = {
+  {"pm1", FT_U16, 1}, {"pm25", FT_U16, 1}, {"pm10", FT_U16, 1}, {"voc", FT_U16, 1},
+  {"nox", FT_U16, 1}, {"temp", FT_I16, 2}, {"humidity", FT_U16, 2},
+  {"battery_pct", FT_U16, 1}, {"battery_v", FT_U16, 3}, {"rtc_temp", FT_I16, 2},
+};
+
+void countRow(const char*, void* user) { ++*(uint32_t*)user; }
+bool countRecord(const RecordHeader&, const String&, void* user) { ++*(uint32_t*)user; return true; }
+bool countSpan(const char*, size_t, const RecordMeta&, void* user) { ++*(uint32_t*)user; return true; }
+
+bool parseArgs(int argc, char** argv, Options& o) {
+  for (int i = 1; i < argc; ++i) {
+    const char* a = argv[i];
+    auto num = [&](uint32_t& dst) {
+      if (i + 1 >= argc) return false;
+      dst = (uint32_t)strtoul(argv[++i], nullptr, 10);
+      return true;
+    };
+    if (!strcmp(a, "--fill-mb")) { if (!num(o.fillMB)) return false; }
+    else if (!strcmp(a, "--chip-mb")) { if (!num(o.chipMB)) return false; }
+    else if (!strcmp(a, "--clock-mhz")) { if (!num(o.clockMHz)) return false; }
+    else if (!strcmp(a, "--overhead-ns")) { if (!num(o.overheadNs)) return false; }
+    else if (!strcmp(a, "--interval-s")) { if (!num(o.intervalS)) return false; }
+    else if (!strcmp(a, "--csv")) { o.csv = true; }
+    else if (!strcmp(a, "--poll")) { o.poll = true; }
+    else if (!strcmp(a, "--typed")) { o.typed = true; }
+    else if (!strcmp(a, "--compressed")) { o.typed = o.compressed = true; }
+    else if (!strcmp(a, "--rollups")) { o.rollups = true; }
+    else if (!strcmp(a, "--xfer") && i + 1 < argc) {
+      const char* m = argv[++i];
+      if (!strcmp(m, "byte")) o.xfer = FLASH_XFER_BYTE;
+      else if (!strcmp(m, "bulk")) o.xfer = FLASH_XFER_BULK;
+      else return false;
+    } else if (!strcmp(a, "--durability") && i + 1 < argc) {
+      const char* m = argv[++i];
+      if (!strcmp(m, "sync")) o.durability = FLASH_DURABLE_SYNC;
+      else if (!strcmp(m, "group")) o.durability = FLASH_DURABLE_GROUP;
+      else if (!strcmp(m, "deferred")) o.durability = FLASH_DURABLE_DEFERRED;
+      else return false;
+    } else {
+      return false;
+    }
+  }
+  return o.fillMB > 0 && o.fillMB < o.chipMB + 1 && o.clockMHz > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  if (!parseArgs(argc, argv, opt)) {
+    fprintf(stderr, "usage: %s [--fill-mb N] [--chip-mb N] [--clock-mhz N] [--xfer byte|bulk] "
+                    "[--overhead-ns N] [--interval-s N] [--durability sync|group|deferred] [--poll] [--typed] [--compressed] [--rollups] [--csv]\n", argv[0]);
+    return 2;
+  }
+  if (opt.chipMB & (opt.chipMB - 1)) {
+    fprintf(stderr, "--chip-mb must be a power of two (the JEDEC ID encodes log2 bytes)\n");
+    return 2;
+  }
+
+  const int kCs = 4;
+  NorFlashEmulator emu(opt.chipMB * 1024UL * 1024UL, kCs);
+  emu.attach(SPI);
+  SPI.setCallOverheadNs(opt.overheadNs);
+  Serial.setMuted(true);
+
+  RTC_DS3231 rtc;
+  uint32_t unixNow = 1735689600UL;  // 2025-01-01
+  rtc.adjust(DateTime(unixNow));
+
+  FlashLoggerConfig cfg;
+  cfg.rtc = &rtc;
+  cfg.spi_cs_pin = kCs;
+  cfg.spi_clock_hz = opt.clockMHz * 1000000UL;
+  cfg.spiXfer = opt.xfer;
+  cfg.durability = opt.durability;
+  cfg.totalSizeBytes = opt.chipMB * 1024UL * 1024UL;
+  cfg.compressTyped = opt.compressed;
+  if (opt.rollups) {
+    cfg.rollupSectors[ROLLUP_MINUTE] = 16;
+    cfg.rollupSectors[ROLLUP_HOUR]   = 16;
+    cfg.rollupSectors[ROLLUP_DAY]    = 2;
+  }
+
+  if (!opt.csv) {
+    static const char* kDurability[] = { "sync", "group", "deferred" };
+    printf("# chip=%uMB fill=%uMB clock=%uMHz xfer=%s overhead=%uns interval=%us durability=%s%s\n",
+           opt.chipMB, opt.fillMB, opt.clockMHz, opt.xfer == FLASH_XFER_BYTE ? "byte" : "bulk",
+           opt.overheadNs, opt.intervalS, kDurability[opt.durability], opt.compressed ? " compressed" : (opt.typed ? " typed" : ""));
+  }
+  Report rep(opt);
+
+  // ---- initial mount on a blank chip ----
+  FlashLogger* log = new FlashLogger();
+  Snapshot a = snap(emu);
+  if (!log->begin(cfg)) { fprintf(stderr, "begin failed\n"); return 1; }
+  Snapshot b = snap(emu);
+  rep.row("mount(blank)", 1, 0, a, b);
+  if (opt.typed && !log->registerSchema(1, kSen66Schema, sizeof(kSen66Schema) / sizeof(kSen66Schema[0]))) {
+    fprintf(stderr, "registerSchema failed\n");
+    return 1;
+  }
+
+  // ---- fill ----
+  Sen66Model sensor;
+  SyncCursor firstCursor{}, midCursor{};
+  log->getCursor(firstCursor);
+  const uint64_t target = (uint64_t)opt.fillMB * 1024ULL * 1024ULL;
+  uint64_t logged = 0;
+  uint32_t appended = 0;
+  uint64_t worstAppendUs = 0;
+  bool midTaken = false;
+  a = snap(emu);
+  while (logged < target) {
+    unixNow += opt.intervalS;
+    rtc.adjust(DateTime(unixNow));
+    const uint64_t idle0 = hostsim::clockUs();
+    if (opt.poll) {
+      while (log->poll()) hostsim::advanceUs(100);     // loop() between samples
+    }
+    const uint64_t pollUs = hostsim::clockUs() - idle0;
+    const uint64_t intervalUs = (uint64_t)opt.intervalS * 1000000ULL;
+    if (pollUs < intervalUs) hostsim::advanceUs(intervalUs - pollUs);
+    gIdleUs += (pollUs > intervalUs) ? pollUs : intervalUs;
+    uint32_t payLen;
+    bool ok;
+    uint64_t t0;
+    if (opt.typed) {
+      float v[10];
+      payLen = sensor.values(v);
+      t0 = hostsim::clockUs();
+      ok = log->appendTyped(1, v);
+    } else {
+      String rec = sensor.next(unixNow);
+      payLen = rec.length() + 1;                        // + '\n'
+      t0 = hostsim::clockUs();
+      ok = (appended % 2000 == 1999) ? log->append(rec, REC_TAG_ALERT) : log->append(rec);
+    }
+    if (!ok) break;
+    worstAppendUs = std::max<uint64_t>(worstAppendUs, hostsim::clockUs() - t0);
+    logged += sizeof(RecordHeader) + payLen + 1 + REC_TRAILER;  // + commit + trailer
+    ++appended;
+    if (!midTaken && logged >= target / 2) {
+      log->getCursor(midCursor);
+      midTaken = true;
+    }
+  }
+  log->flush();
+  b = snap(emu);
+  rep.row("append", appended, appended, a, b);
+  if (!opt.csv) {
+    printf("# append worst case %.3f ms\n", worstAppendUs / 1000.0);
+    printf("# flash used %.2f MB, %.1f bytes/sample\n", log->getUsedSpaceMB(),
+           log->getUsedSpaceMB() * 1024.0 * 1024.0 / appended);
+  }
+  if (emu.stats().busyViolations || emu.stats().andViolations) {
+    fprintf(stderr, "warning: %u busy violations, %u AND violations\n", emu.stats().busyViolations,
+            emu.stats().andViolations);
+  }
+
+  // ---- remount (what a wake from deep sleep pays) ----
+  delete log;
+  log = new FlashLogger();
+  a = snap(emu);
+  if (!log->begin(cfg)) { fprintf(stderr, "remount failed\n"); return 1; }
+  b = snap(emu);
+  rep.row("mount(full)", 1, 0, a, b);
+
+  // ---- checkpoint before sleep, then wake ----
+  log->checkpoint();
+  delete log;
+  log = new FlashLogger();
+  a = snap(emu);
+  if (!log->begin(cfg) || !log->mountedFromCheckpoint()) { fprintf(stderr, "checkpoint mount failed\n"); return 1; }
+  b = snap(emu);
+  rep.row("mount(ckpt)", 1, 0, a, b);
+
+  // ---- queries ----
+  const uint32_t lastTs = unixNow - DateTime::SECONDS_FROM_1970_TO_2000;
+  uint32_t rows = 0;
+  const uint32_t kRepeat = 5;
+
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) log->queryLatest(1, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryLatest(1)", kRepeat, rows, a, b);
+
+  rows = 0;
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) log->queryLatest(100, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryLatest(100)", kRepeat, rows, a, b);
+
+  rows = 0;
+  a = snap(emu);
+  log->queryTagged(REC_TAG_ALERT, 20, countRow, &rows);   // loads the zone maps with their tags
+  b = snap(emu);
+  rep.row("queryTagged(cold)", 1, rows, a, b);
+
+  rows = 0;
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) log->queryTagged(REC_TAG_ALERT, 20, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryTagged(alert,20)", kRepeat, rows, a, b);
+
+  QuerySpec lastDay;
+  lastDay.ts_from = lastTs > 86400 ? lastTs - 86400 : 0;
+  lastDay.ts_to = lastTs;
+  rows = 0;
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) log->queryLogs(lastDay, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryLogs(last 24h)", kRepeat, rows, a, b);
+
+  QuerySpec pred;
+  strncpy(pred.predicates[0].key, "pm25", sizeof(pred.predicates[0].key) - 1);
+  pred.predicates[0].op = PRED_GT;
+  pred.predicates[0].value = 35.0f;
+  pred.predicateCount = 1;
+  pred.includeKeys[0] = "ts";
+  pred.includeKeys[1] = "pm25";
+  rows = 0;
+  a = snap(emu);
+  log->queryLogs(pred, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryLogs(pm25>35)", 1, rows, a, b);
+
+  PredicateProgram expr;
+  if (!expr.compile("pm25>35 && (temp>30 || humidity>80)")) { fprintf(stderr, "compile failed\n"); return 1; }
+  QuerySpec where;
+  where.where = &expr;
+  where.includeKeys[0] = "ts";
+  where.includeKeys[1] = "pm25";
+  rows = 0;
+  a = snap(emu);
+  log->queryLogs(where, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryLogs(where)", 1, rows, a, b);
+
+  QuerySpec agg;
+  agg.addAgg("pm25", "avg,max,p95");
+  agg.group_by_seconds = 3600;
+  rows = 0;
+  a = snap(emu);
+  log->queryAgg(agg, countRow, &rows);
+  b = snap(emu);
+  rep.row("queryAgg(pm25,1h)", 1, rows, a, b);
+
+  if (opt.rollups) {
+    QuerySpec rolled;
+    rolled.addAgg("pm25", "avg,max");
+    rolled.group_by_seconds = 3600;
+    rolled.use_rollups = true;
+    rows = 0;
+    a = snap(emu);
+    log->queryAgg(rolled, countRow, &rows);
+    b = snap(emu);
+    rep.row("queryAgg(pm25,1h,rollups)", 1, rows, a, b);
+  }
+
+  rows = 0;
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) log->exportSinceWithMeta(firstCursor, 500, countRecord, &rows);
+  b = snap(emu);
+  rep.row("exportSince(oldest,500)", kRepeat, rows, a, b);
+
+  if (midTaken) {
+    rows = 0;
+    a = snap(emu);
+    for (uint32_t i = 0; i < kRepeat; ++i) log->exportSinceWithMeta(midCursor, 500, countRecord, &rows);
+    b = snap(emu);
+    rep.row("exportSince(mid,500)", kRepeat, rows, a, b);
+  }
+
+  char rowMem[512];
+  RowBuffer scratch(rowMem, sizeof(rowMem));
+  rows = 0;
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) {
+    log->exportRows(firstCursor, 500, OUT_CSV, countSpan, &rows, nullptr, nullptr, &scratch);
+  }
+  b = snap(emu);
+  rep.row("exportRows(csv,500)", kRepeat, rows, a, b);
+
+  SyncCursor seqCursor;
+  rows = 0;
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) rows += log->seekSeq(appended / 2 + i * 997, seqCursor) ? 1 : 0;
+  b = snap(emu);
+  rep.row("seekSeq(mid)", kRepeat, rows, a, b);
+
+  a = snap(emu);
+  for (uint32_t i = 0; i < kRepeat; ++i) log->buildSummaries();
+  b = snap(emu);
+  rep.row("buildSummaries", kRepeat, (uint32_t)log->lastDayCount(), a, b);
+
+  if (!opt.csv) {
+    const NorStats& st = emu.stats();
+    printf("# totals: frames=%llu read=%llu programmed=%llu pagePrograms=%u erases=%u bus=%.1f ms sim=%.1f s\n",
+           (unsigned long long)st.frames, (unsigned long long)st.bytesRead,
+           (unsigned long long)st.bytesProgrammed, st.pagePrograms, st.sectorErases, st.busNs / 1e6,
+           (hostsim::clockUs() - gIdleUs) / 1e6);
+    const FlashMemStats mem = log->memoryUsage();
+    printf("# ram: object=%u index=%u zones=%u summaries=%u buffer=%u schemas=%u total=%u (sectors=%u dayRuns=%u)\n",
+           mem.objectBytes, mem.indexBytes, mem.zoneBytes, mem.summaryBytes, mem.bufferBytes,
+           mem.schemaBytes, mem.totalBytes, mem.sectors, mem.dayRuns);
+  }
+  delete log;
+  return 0;
+}
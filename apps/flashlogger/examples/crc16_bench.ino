@@ -0,0 +1,42 @@
+#include <Arduino.h>
+
+#include "FlashLogger.h"
+
+// CRC16 micro-benchmark: cycles/byte of the bit-at-a-time reference versus
+// the slice-by-4 table routine used by FlashLogger, over typical record sizes
+// (page token = 12 B, NDJSON record ~ 200 B, one page, one sector).
+
+static uint8_t data[SECTOR_SIZE];
+
+static uint32_t cyclesFor(uint16_t (*fn)(const uint8_t*, uint32_t, uint16_t), uint32_t len,
+                          uint32_t iters, uint16_t& crcOut) {
+  uint16_t crc = 0xFFFF;
+  uint32_t t0 = ESP.getCycleCount();
+  for (uint32_t i = 0; i < iters; ++i) crc = fn(data, len, crc);
+  uint32_t t1 = ESP.getCycleCount();
+  crcOut = crc;
+  return t1 - t0;
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(500);
+  for (uint32_t i = 0; i < sizeof(data); ++i) data[i] = (uint8_t)(i * 73 + 11);
+
+  const uint32_t sizes[] = { 12, 200, PAGE_SIZE, SECTOR_SIZE };
+  Serial.println(F("len    bitwise c/B   table c/B   speedup   match"));
+  for (uint32_t len : sizes) {
+    const uint32_t iters = (64UL * 1024UL) / len + 1;
+    uint16_t a = 0, b = 0;
+    uint32_t ref = cyclesFor(FlashLogger::crc16Bitwise, len, iters, a);
+    uint32_t tab = cyclesFor(FlashLogger::crc16, len, iters, b);
+    float refCpb = (float)ref / (float)(len * iters);
+    float tabCpb = (float)tab / (float)(len * iters);
+    Serial.printf("%-6lu %11.2f %11.2f %8.1fx   %s\n", (unsigned long)len, refCpb, tabCpb,
+                  tabCpb > 0 ? refCpb / tabCpb : 0.0f, a == b ? "yes" : "NO");
+  }
+}
+
+void loop() {
+  delay(1000);
+}
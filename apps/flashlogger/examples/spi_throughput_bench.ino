@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <RTClib.h>
+
+#include "FlashLogger.h"
+
+#include "pins_cytron_maker_feather_aiot_s3.h"  // adjust board as needed
+
+// Measures raw flash throughput for each SPI transfer path:
+//   read    – sequential 0x03 reads into a 4 KB buffer
+//   program – page programs into a free scratch sector (erased before/after)
+//   scan    – readSectorHeader() over every sector (what begin() does)
+// Results are printed as MB/s plus the number of CS-framed transactions.
+
+RTC_DS3231 rtc;
+FlashLogger logger;
+
+static const char* xferName(FlashSpiXfer m) {
+  switch (m) {
+    case FLASH_XFER_BYTE: return "byte";
+    case FLASH_XFER_BULK: return "bulk";
+    case FLASH_XFER_DMA:  return "dma";
+  }
+  return "?";
+}
+
+static const char* readName(FlashReadMode m) {
+  switch (m) {
+    case FLASH_READ_NORMAL: return "0x03";
+    case FLASH_READ_FAST:   return "0x0B";
+    case FLASH_READ_DUAL:   return "0x3B";
+    case FLASH_READ_QUAD:   return "0x6B";
+    default:                return "auto";
+  }
+}
+
+static void runOne(FlashSpiXfer mode) {
+  if (!logger.setSpiTransfer(mode) && mode == FLASH_XFER_DMA) {
+    Serial.println(F("[bench] dma unavailable on this target, skipped"));
+    return;
+  }
+  FlashBenchResult r;
+  if (!logger.runIoBenchmark(r)) {
+    Serial.println(F("[bench] benchmark failed (out of memory)"));
+    return;
+  }
+  Serial.printf("[bench] %-4s %s read=%.2f MB/s program=%.2f MB/s scan=%lu sectors in %.1f ms tx=%lu dmaReads=%lu\n",
+                xferName(mode), readName(logger.readMode()), r.readMBps, r.programMBps,
+                (unsigned long)r.headerScanSectors, r.headerScanMs,
+                (unsigned long)r.io.transactions, (unsigned long)r.io.dmaReads);
+}
+
+void setup() {
+  Serial.begin(115200);
+  Wire.begin();
+  rtc.begin();
+
+  FlashLoggerConfig cfg;
+  cfg.rtc = &rtc;
+  cfg.spi_cs_pin = board_pins::cytron_maker_feather_aiot_s3::FLASH_CS;
+  cfg.spi_sck_pin = board_pins::cytron_maker_feather_aiot_s3::FLASH_SCK;
+  cfg.spi_mosi_pin = board_pins::cytron_maker_feather_aiot_s3::FLASH_MOSI;
+  cfg.spi_miso_pin = board_pins::cytron_maker_feather_aiot_s3::FLASH_MISO;
+  cfg.spi_clock_hz = 40'000'000;
+  cfg.readMode = FLASH_READ_AUTO;   // 0x0B on bulk, 0x3B/0x6B once DMA is active
+  // cfg.spi_wp_pin / cfg.spi_hd_pin enable quad reads if IO2/IO3 are wired
+  cfg.totalSizeBytes = 16UL * 1024UL * 1024UL;
+
+  if (!logger.begin(cfg)) {
+    Serial.println(F("FlashLogger init failed"));
+    while (true) delay(1000);
+  }
+
+  runOne(FLASH_XFER_BYTE);
+  runOne(FLASH_XFER_BULK);
+  runOne(FLASH_XFER_DMA);
+  logger.setSpiTransfer(FLASH_XFER_BULK);
+}
+
+void loop() {
+  delay(1000);
+}
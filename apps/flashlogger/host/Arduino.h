@@ -0,0 +1,235 @@
+#pragma once
+
+// Host-side Arduino shim for building FlashLogger natively (benchmarks/tests).
+// Only the subset the logger and its helpers touch is provided. Time is
+// simulated: delay()/micros() read a clock that the NOR emulator advances
+// with bus and program/erase time, so results are deterministic.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+using std::min;
+using std::max;
+
+// ---------- simulated clock ----------
+namespace hostsim {
+inline uint64_t& clockUs() { static uint64_t us = 0; return us; }
+inline void advanceUs(uint64_t us) { clockUs() += us; }
+
+typedef void (*PinWriteHook)(int pin, int level, void* user);
+struct PinHook { PinWriteHook fn = nullptr; void* user = nullptr; };
+inline PinHook& pinHook() { static PinHook h; return h; }
+inline void setPinWriteHook(PinWriteHook fn, void* user) { pinHook().fn = fn; pinHook().user = user; }
+}  // namespace hostsim
+
+inline unsigned long millis() { return (unsigned long)(hostsim::clockUs() / 1000ULL); }
+inline unsigned long micros() { return (unsigned long)hostsim::clockUs(); }
+inline void delay(unsigned long ms) { hostsim::advanceUs((uint64_t)ms * 1000ULL); }
+inline void delayMicroseconds(unsigned int us) { hostsim::advanceUs(us); }
+inline void yield() {}
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+inline void pinMode(int, int) {}
+inline void digitalWrite(int pin, int level) {
+  if (hostsim::pinHook().fn) hostsim::pinHook().fn(pin, level, hostsim::pinHook().user);
+}
+inline long random(long lo, long hi) { return hi > lo ? lo + (long)(rand() % (hi - lo)) : lo; }
+inline long random(long hi) { return random(0, hi); }
+
+struct __FlashStringHelper;
+#ifndef F
+#define F(x) reinterpret_cast<const __FlashStringHelper*>(x)
+#endif
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+// ---------- String (Arduino WString subset) ----------
+class String {
+ public:
+  String() = default;
+  String(const char* s) : _s(s ? s : "") {}
+  String(const char* s, unsigned int len) : _s(s ? std::string(s, len) : std::string()) {}
+  String(const std::string& s) : _s(s) {}
+  String(const __FlashStringHelper* s) : _s(reinterpret_cast<const char*>(s)) {}
+  explicit String(char c) : _s(1, c) {}
+  String(int v) : _s(std::to_string(v)) {}
+  String(unsigned int v) : _s(std::to_string(v)) {}
+  String(long v) : _s(std::to_string(v)) {}
+  String(unsigned long v) : _s(std::to_string(v)) {}
+  String(long long v) : _s(std::to_string(v)) {}
+  String(unsigned long long v) : _s(std::to_string(v)) {}
+  String(float v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+  String(double v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+
+  unsigned int length() const { return (unsigned int)_s.size(); }
+  const char* c_str() const { return _s.c_str(); }
+  bool isEmpty() const { return _s.empty(); }
+  void clear() { _s.clear(); }
+  bool reserve(unsigned int n) { _s.reserve(n); return true; }
+
+  char operator[](unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+  char& operator[](unsigned int i) { return _s[i]; }
+  char charAt(unsigned int i) const { return (*this)[i]; }
+  char* begin() { return &_s[0]; }
+  char* end() { return &_s[0] + _s.size(); }
+  const char* begin() const { return _s.data(); }
+  const char* end() const { return _s.data() + _s.size(); }
+
+  String& operator+=(const String& o) { _s += o._s; return *this; }
+  String& operator+=(const char* o) { if (o) _s += o; return *this; }
+  String& operator+=(char c) { _s += c; return *this; }
+  String& operator+=(int v) { _s += std::to_string(v); return *this; }
+  String& operator+=(unsigned int v) { _s += std::to_string(v); return *this; }
+  String& operator+=(long v) { _s += std::to_string(v); return *this; }
+  String& operator+=(unsigned long v) { _s += std::to_string(v); return *this; }
+  bool concat(const char* s, unsigned int n) { _s.append(s, n); return true; }
+  bool concat(const String& o) { _s += o._s; return true; }
+  bool concat(char c) { _s += c; return true; }
+
+  bool operator==(const String& o) const { return _s == o._s; }
+  bool operator==(const char* o) const { return o && _s == o; }
+  bool operator!=(const String& o) const { return _s != o._s; }
+  bool operator!=(const char* o) const { return !(*this == o); }
+  bool operator<(const String& o) const { return _s < o._s; }
+
+  int indexOf(char c, unsigned int from = 0) const { return pos(_s.find(c, from)); }
+  int indexOf(const char* s, unsigned int from = 0) const { return pos(_s.find(s, from)); }
+  int indexOf(const String& s, unsigned int from = 0) const { return pos(_s.find(s._s, from)); }
+  int lastIndexOf(char c) const { return pos(_s.rfind(c)); }
+  String substring(unsigned int from) const { return from >= _s.size() ? String() : String(_s.substr(from)); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= _s.size()) return String();
+    return String(_s.substr(from, std::min<size_t>(to, _s.size()) - from));
+  }
+  bool startsWith(const String& p) const { return _s.compare(0, p._s.size(), p._s) == 0; }
+  bool startsWith(const char* p) const { return startsWith(String(p)); }
+  bool endsWith(const String& p) const {
+    return _s.size() >= p._s.size() && _s.compare(_s.size() - p._s.size(), p._s.size(), p._s) == 0;
+  }
+  bool endsWith(const char* p) const { return endsWith(String(p)); }
+  bool equalsIgnoreCase(const String& o) const {
+    if (_s.size() != o._s.size()) return false;
+    for (size_t i = 0; i < _s.size(); ++i)
+      if (tolower((unsigned char)_s[i]) != tolower((unsigned char)o._s[i])) return false;
+    return true;
+  }
+  bool equalsIgnoreCase(const char* o) const { return equalsIgnoreCase(String(o)); }
+  void trim() {
+    size_t a = 0, b = _s.size();
+    while (a < b && isspace((unsigned char)_s[a])) ++a;
+    while (b > a && isspace((unsigned char)_s[b - 1])) --b;
+    _s = _s.substr(a, b - a);
+  }
+  void remove(unsigned int idx) { if (idx < _s.size()) _s.erase(idx); }
+  void remove(unsigned int idx, unsigned int n) { if (idx < _s.size()) _s.erase(idx, n); }
+  void toLowerCase() { for (auto& c : _s) c = (char)tolower((unsigned char)c); }
+  void toUpperCase() { for (auto& c : _s) c = (char)toupper((unsigned char)c); }
+  long toInt() const { return strtol(_s.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(_s.c_str(), nullptr); }
+  void toCharArray(char* buf, unsigned int n) const {
+    if (!n) return;
+    size_t k = std::min<size_t>(n - 1, _s.size());
+    memcpy(buf, _s.data(), k);
+    buf[k] = 0;
+  }
+
+  const std::string& str() const { return _s; }
+
+ private:
+  static int pos(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+  void fromDouble(double v, unsigned int decimals) {
+    char b[48];
+    snprintf(b, sizeof(b), "%.*f", (int)decimals, v);
+    _s = b;
+  }
+  std::string _s;
+};
+
+inline String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+inline String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+inline String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+inline String operator+(const String& a, char c) { String r(a); r += c; return r; }
+
+// ---------- Print / Stream / Serial ----------
+class Print {
+ public:
+  virtual ~Print() = default;
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t n) {
+    for (size_t i = 0; i < n; ++i) write(buf[i]);
+    return n;
+  }
+  size_t write(const char* s, size_t n) { return write((const uint8_t*)s, n); }
+  size_t print(const char* s) { return s ? write((const uint8_t*)s, strlen(s)) : 0; }
+  size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(const __FlashStringHelper* s) { return print(reinterpret_cast<const char*>(s)); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned int v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v, int d = 2) { return printf("%.*f", d, v); }
+  template <typename T>
+  size_t println(const T& v) { size_t n = print(v); return n + print("\n"); }
+  size_t println(double v, int d) { size_t n = print(v, d); return n + print("\n"); }
+  size_t println() { return print("\n"); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char stackBuf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(stackBuf, sizeof(stackBuf), fmt, ap);
+    va_end(ap);
+    if (n < 0) return 0;
+    if ((size_t)n < sizeof(stackBuf)) return write((const uint8_t*)stackBuf, (size_t)n);
+    std::string big((size_t)n + 1, '\0');
+    va_start(ap, fmt);
+    vsnprintf(&big[0], big.size(), fmt, ap);
+    va_end(ap);
+    return write((const uint8_t*)big.data(), (size_t)n);
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+};
+
+// Serial writes to stdout unless muted (benchmarks mute the logger's chatter).
+class HostSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+  void setMuted(bool m) { _muted = m; }
+  bool muted() const { return _muted; }
+  size_t write(uint8_t c) override { if (!_muted) fputc(c, stdout); return 1; }
+  size_t write(const uint8_t* b, size_t n) override { if (!_muted) fwrite(b, 1, n, stdout); return n; }
+  operator bool() const { return true; }
+ private:
+  bool _muted = false;
+};
+
+inline HostSerial Serial;
+
+// Collects everything written into a String (handy for asserting shell output).
+class StringStream : public Stream {
+ public:
+  size_t write(uint8_t c) override { _buf += (char)c; return 1; }
+  const String& str() const { return _buf; }
+  void clear() { _buf.clear(); }
+ private:
+  String _buf;
+};
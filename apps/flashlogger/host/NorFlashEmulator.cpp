@@ -0,0 +1,269 @@
+#include "NorFlashEmulator.h"
+
+namespace {
+void csHook(int pin, int level, void* user) {
+  NorFlashEmulator* emu = static_cast<NorFlashEmulator*>(user);
+  emu->csWrite(pin, level);
+}
+
+bool isReadOp(uint8_t op) {
+  switch (op) {
+    case 0x03: case 0x0B: case 0x3B: case 0x6B:
+    case 0x13: case 0x0C: case 0x3C: case 0x6C: case 0x5A:
+    case 0x05: case 0x35: case 0x15: case 0x9F:
+      return true;
+    default:
+      return false;
+  }
+}
+}  // namespace
+
+NorFlashEmulator::NorFlashEmulator(uint32_t capacityBytes, int csPin)
+    : _mem(capacityBytes, 0xFF), _cs(csPin) {
+  buildSfdp();
+}
+
+void NorFlashEmulator::attach(SPIClass& spi) {
+  spi.attach(this);
+  hostsim::setPinWriteHook(csHook, this);
+}
+
+void NorFlashEmulator::eraseAll() {
+  std::fill(_mem.begin(), _mem.end(), 0xFF);
+}
+
+void NorFlashEmulator::powerCycle() {
+  _dead = false;
+  _cutArmed = false;
+  _wel = false;
+  _fourByte = false;
+  _busyUntil = 0;
+  _progBusyUntil = 0;
+  _eraseBusy = false;
+  _suspended = false;
+  _selected = false;
+}
+
+bool NorFlashEmulator::busy() const {
+  const uint64_t now = hostsim::clockUs();
+  if (now < _progBusyUntil) return true;
+  if (_suspended) return now < _suspendReadyAt;
+  return now < _busyUntil;
+}
+
+uint32_t NorFlashEmulator::addrBytesFor(uint8_t op) const {
+  switch (op) {
+    case 0x13: case 0x0C: case 0x3C: case 0x6C: case 0x12: case 0x21: return 4;
+    case 0x5A: return 3;
+    default: return _fourByte ? 4 : 3;
+  }
+}
+
+void NorFlashEmulator::csWrite(int pin, int level) {
+  if (pin != _cs) return;
+  if (level == LOW && !_selected) beginFrame();
+  else if (level == HIGH && _selected) endFrame();
+}
+
+void NorFlashEmulator::beginFrame() {
+  _selected = true;
+  _phase = PH_CMD;
+  _op = 0;
+  _addr = 0;
+  _addrLeft = 0;
+  _dummyLeft = 0;
+  _outIdx = 0;
+  _pp.clear();
+  _srWriteN = 0;
+  _stats.frames++;
+}
+
+void NorFlashEmulator::startCommand(uint8_t op) {
+  _op = op;
+  const bool isStatus = (op == 0x05 || op == 0x35 || op == 0x15);
+  if (busy() && !isStatus && op != 0x75) {
+    _stats.busyViolations++;
+    _phase = PH_IGNORE;
+    return;
+  }
+  switch (op) {
+    case 0x03: case 0x13:
+      _addrLeft = (uint8_t)addrBytesFor(op); _dummyLeft = 0; _phase = PH_ADDR; break;
+    case 0x0B: case 0x3B: case 0x6B: case 0x0C: case 0x3C: case 0x6C: case 0x5A:
+      _addrLeft = (uint8_t)addrBytesFor(op); _dummyLeft = 1; _phase = PH_ADDR; break;
+    case 0x02: case 0x12: case 0x20: case 0x21:
+      _addrLeft = (uint8_t)addrBytesFor(op); _dummyLeft = 0; _phase = PH_ADDR; break;
+    case 0x05: case 0x35: case 0x15: case 0x9F:
+    case 0x01: case 0x31:
+      _phase = PH_DATA; break;
+    case 0x06: _wel = true; _phase = PH_IGNORE; break;
+    case 0x04: _wel = false; _phase = PH_IGNORE; break;
+    case 0xB7: _fourByte = true; _phase = PH_IGNORE; break;
+    case 0xE9: _fourByte = false; _phase = PH_IGNORE; break;
+    default: _phase = PH_IGNORE; break;   // 75/7A act on CS high; others are no-ops
+  }
+}
+
+void NorFlashEmulator::chargeNs(uint64_t ns) {
+  _stats.busNs += ns;
+  _nsAcc += ns;
+  if (_nsAcc >= 1000) { hostsim::advanceUs(_nsAcc / 1000); _nsAcc %= 1000; }
+}
+
+uint8_t NorFlashEmulator::spiXfer(uint8_t mosi, uint32_t clockHz) {
+  if (clockHz) chargeNs(8000000000ULL / clockHz);
+  if (!_selected || _dead) return 0xFF;
+
+  switch (_phase) {
+    case PH_CMD:
+      startCommand(mosi);
+      return 0xFF;
+    case PH_ADDR:
+      _addr = (_addr << 8) | mosi;
+      if (--_addrLeft == 0) _phase = _dummyLeft ? PH_DUMMY : PH_DATA;
+      return 0xFF;
+    case PH_DUMMY:
+      if (--_dummyLeft == 0) _phase = PH_DATA;
+      return 0xFF;
+    case PH_DATA:
+      if (isReadOp(_op)) return dataOut();
+      dataIn(mosi);
+      return 0xFF;
+    default:
+      return 0xFF;
+  }
+}
+
+uint8_t NorFlashEmulator::dataOut() {
+  _stats.bytesRead++;
+  switch (_op) {
+    case 0x05: return (uint8_t)((busy() ? 0x01 : 0x00) | (_wel ? 0x02 : 0x00));
+    case 0x35: return (uint8_t)((_qe ? 0x02 : 0x00) | (_suspended ? 0x80 : 0x00));
+    case 0x15: return (uint8_t)(_fourByte ? 0x01 : 0x00);
+    case 0x9F: {
+      uint8_t code = 0;
+      for (uint32_t c = capacity(); c > 1; c >>= 1) ++code;
+      const uint8_t id[3] = { 0xEF, 0x40, code };
+      uint8_t b = (_outIdx < 3) ? id[_outIdx] : 0x00;
+      ++_outIdx;
+      return b;
+    }
+    case 0x5A: {
+      uint32_t a = _addr + _outIdx++;
+      return (_sfdpEnabled && a < _sfdp.size()) ? _sfdp[a] : 0xFF;
+    }
+    default: {
+      if (_outIdx++ == 0 && _timing.tREAD_ns) chargeNs(_timing.tREAD_ns);
+      uint8_t b = _mem[_addr % capacity()];
+      ++_addr;
+      return b;
+    }
+  }
+}
+
+void NorFlashEmulator::dataIn(uint8_t b) {
+  if (_op == 0x02 || _op == 0x12) {
+    _pp.push_back(b);
+  } else if (_op == 0x01 || _op == 0x31) {
+    if (_srWriteN < 2) _srWrite[_srWriteN++] = b;
+  }
+}
+
+void NorFlashEmulator::endFrame() {
+  _selected = false;
+  if (_dead || (_phase == PH_IGNORE && _op != 0x75 && _op != 0x7A)) return;
+  const uint64_t now = hostsim::clockUs();
+
+  switch (_op) {
+    case 0x02: case 0x12: {
+      if (!_wel || _pp.empty()) break;
+      const uint32_t addr = _addr % capacity();
+      if (_suspended && (addr / 4096) == _eraseSector) break;  // not allowed in the erasing sector
+      const uint32_t pageBase = addr & ~0xFFu;
+      uint32_t off = addr & 0xFFu;
+      for (size_t i = 0; i < _pp.size(); ++i) {
+        if (_cutArmed) {
+          if (_cutBudget == 0) { _dead = true; break; }
+          --_cutBudget;
+        }
+        uint8_t& cell = _mem[pageBase + off];
+        if (_pp[i] != 0xFF && (_pp[i] & ~cell)) _stats.andViolations++;  // 0xFF = leave as is
+        cell &= _pp[i];
+        off = (off + 1) & 0xFFu;                   // wrap inside the page
+      }
+      _stats.pagePrograms++;
+      _stats.bytesProgrammed += _pp.size();
+      _progBusyUntil = now + _timing.tPP_us;
+      _wel = false;
+      break;
+    }
+    case 0x20: case 0x21: {
+      if (!_wel || _suspended) break;
+      if (_cutArmed && _cutBudget == 0) { _dead = true; break; }
+      const uint32_t base = (_addr % capacity()) & ~0xFFFu;
+      std::fill(_mem.begin() + base, _mem.begin() + base + 4096, 0xFF);
+      _stats.sectorErases++;
+      _busyUntil = now + _timing.tSE_us;
+      _eraseBusy = true;
+      _eraseSector = base / 4096;
+      _wel = false;
+      break;
+    }
+    case 0x01:
+      if (!_wel) break;
+      if (_srWriteN >= 2) _qe = (_srWrite[1] & 0x02) != 0;
+      _busyUntil = now + _timing.tW_us;
+      _eraseBusy = false;
+      _wel = false;
+      break;
+    case 0x31:
+      if (!_wel || !_srWriteN) break;
+      _qe = (_srWrite[0] & 0x02) != 0;
+      _busyUntil = now + _timing.tW_us;
+      _eraseBusy = false;
+      _wel = false;
+      break;
+    case 0x75:
+      if (_eraseBusy && !_suspended && now < _busyUntil) {
+        _suspended = true;
+        _suspendRemain = _busyUntil - now;
+        _suspendReadyAt = now + _timing.tSUS_us;
+        _stats.suspends++;
+      }
+      break;
+    case 0x7A:
+      if (_suspended) {
+        _suspended = false;
+        _busyUntil = now + _suspendRemain;
+        _stats.resumes++;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void NorFlashEmulator::buildSfdp() {
+  _sfdp.assign(0x80 + 9 * 4, 0xFF);
+  const uint8_t hdr[16] = {
+    'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF,      // signature, rev 1.6, 1 header
+    0x00, 0x06, 0x01, 0x09, 0x80, 0x00, 0x00, 0xFF   // BFPT v1.6, 9 dwords @0x80
+  };
+  memcpy(_sfdp.data(), hdr, sizeof(hdr));
+
+  const uint32_t capacityBits = capacity() * 8u;
+  uint32_t dw[9];
+  for (auto& d : dw) d = 0xFFFFFFFFu;
+  dw[0] = 0xFF800000u                 // reserved ones
+        | (1u << 22) | (1u << 21) | (1u << 20) | (1u << 16)  // 1-1-4, 1-4-4, 1-2-2, 1-1-2
+        | ((capacity() > 16u * 1024u * 1024u) ? (1u << 17) : 0u)  // 3- or 4-byte addressing
+        | (0x20u << 8) | (1u << 2) | 0x01u;                    // 4 KB erase = 0x20
+  dw[1] = capacityBits - 1u;
+  dw[2] = (0x6Bu << 24) | (8u << 16) | (0xEBu << 8) | (2u << 5) | 4u;
+  dw[3] = (0xBBu << 24) | (4u << 16) | (0x3Bu << 8) | 8u;
+  dw[7] = (0x52u << 24) | (0x0Fu << 16) | (0x20u << 8) | 0x0Cu;
+  dw[8] = 0xFFFF0000u | (0xD8u << 8) | 0x10u;
+  for (int i = 0; i < 9; ++i) {
+    for (int b = 0; b < 4; ++b) _sfdp[0x80 + i * 4 + b] = (uint8_t)(dw[i] >> (8 * b));
+  }
+}
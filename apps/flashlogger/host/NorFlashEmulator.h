@@ -0,0 +1,114 @@
+#pragma once
+
+// In-memory Winbond W25Qxx model for host builds of FlashLogger.
+//
+// - NOR semantics: programs AND into the array (1 -> 0 only), erase sets 0xFF,
+//   page programs wrap inside their 256-byte page.
+// - Command set: 03/0B/3B/6B reads, 02 PP, 20 SE, 06/04 WEL, 05/35/15 status,
+//   01/31 status writes, 9F JEDEC, 5A SFDP, 75/7A erase suspend/resume,
+//   B7/E9 4-byte mode and the 13/0C/3C/6C/12/21 4-byte opcodes.
+// - Timing: bus bytes are charged at the transaction clock (plus tREAD per
+//   read command); PP/SE/WRSR hold
+//   WIP for tPP/tSE/tW of simulated time. Commands issued while WIP is set are
+//   ignored (as the silicon does) and counted in stats().busyViolations.
+// - Fault injection: armPowerCut(n) lets n more bytes reach the array, then
+//   drops the rest of that program and everything after until powerCycle().
+
+#include "SPI.h"
+#include <vector>
+
+struct NorTiming {
+  uint32_t tPP_us  = 700;     // page program (typ. 0.4-0.8 ms)
+  uint32_t tSE_us  = 45000;   // 4 KB sector erase (typ. 45 ms, max 400 ms)
+  uint32_t tW_us   = 10000;   // status register write
+  uint32_t tSUS_us = 20;      // erase suspend latency
+  uint32_t tREAD_ns = 0;      // extra array latency per read command (0 = clock bound)
+};
+
+struct NorStats {
+  uint64_t frames;            // CS-low transactions
+  uint64_t bytesRead;         // data bytes shifted out (reads, status, ids)
+  uint64_t bytesProgrammed;   // data bytes accepted by page programs
+  uint32_t pagePrograms;
+  uint32_t sectorErases;
+  uint32_t suspends;
+  uint32_t resumes;
+  uint32_t busyViolations;    // frames ignored because WIP was set
+  uint32_t andViolations;     // non-0xFF program bytes that tried to set a 0 bit back to 1
+  uint64_t busNs;             // time spent clocking bytes
+};
+
+class NorFlashEmulator : public SpiDevice {
+ public:
+  NorFlashEmulator(uint32_t capacityBytes, int csPin);
+
+  // Routes the CS pin through digitalWrite() and attaches to the SPI bus.
+  void attach(SPIClass& spi);
+
+  uint8_t spiXfer(uint8_t mosi, uint32_t clockHz) override;
+  void csWrite(int pin, int level);
+
+  NorTiming& timing() { return _timing; }
+  const NorStats& stats() const { return _stats; }
+  void resetStats() { _stats = NorStats{}; }
+
+  uint32_t capacity() const { return (uint32_t)_mem.size(); }
+  uint8_t* data() { return _mem.data(); }
+  void eraseAll();
+
+  void armPowerCut(uint64_t bytesUntilCut) { _cutArmed = true; _cutBudget = bytesUntilCut; }
+  bool powerLost() const { return _dead; }
+  void powerCycle();
+
+  // Disable SFDP to exercise the JEDEC-only probe path.
+  void setSfdpEnabled(bool on) { _sfdpEnabled = on; }
+
+ private:
+  enum Phase : uint8_t { PH_CMD, PH_ADDR, PH_DUMMY, PH_DATA, PH_IGNORE };
+
+  bool busy() const;
+  void beginFrame();
+  void endFrame();
+  void startCommand(uint8_t op);
+  uint8_t dataOut();
+  void dataIn(uint8_t b);
+  void buildSfdp();
+  uint32_t addrBytesFor(uint8_t op) const;
+  void chargeNs(uint64_t ns);
+
+  std::vector<uint8_t> _mem;
+  std::vector<uint8_t> _sfdp;
+  int _cs;
+  NorTiming _timing;
+  NorStats _stats{};
+
+  // status
+  bool _wel = false;
+  bool _qe = false;
+  bool _fourByte = false;
+  uint64_t _busyUntil = 0;
+  uint64_t _progBusyUntil = 0;   // page program (may run while an erase is suspended)
+  bool _eraseBusy = false;      // current busy period is an erase
+  bool _suspended = false;
+  uint64_t _suspendRemain = 0;
+  uint64_t _suspendReadyAt = 0;
+  uint32_t _eraseSector = 0xFFFFFFFF;
+
+  // frame state
+  bool _selected = false;
+  Phase _phase = PH_CMD;
+  uint8_t _op = 0;
+  uint32_t _addr = 0;
+  uint8_t _addrLeft = 0;
+  uint8_t _dummyLeft = 0;
+  uint32_t _outIdx = 0;
+  std::vector<uint8_t> _pp;     // bytes received for PP
+  uint8_t _srWrite[2] = {0, 0};
+  uint8_t _srWriteN = 0;
+
+  uint64_t _nsAcc = 0;
+  bool _cutArmed = false;
+  uint64_t _cutBudget = 0;
+  bool _dead = false;
+  bool _sfdpEnabled = true;
+};
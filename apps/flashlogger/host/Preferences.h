@@ -0,0 +1,84 @@
+#pragma once
+
+// Host Preferences (ESP32 NVS) backed by an in-memory map. Opening a missing
+// namespace read-only fails, like the real library. Commits are counted so
+// benchmarks can report NVS traffic.
+
+#include "Arduino.h"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace hostsim {
+struct NvsStore {
+  std::map<std::string, std::map<std::string, std::vector<uint8_t>>> ns;
+  uint32_t writes = 0;
+};
+inline NvsStore& nvs() { static NvsStore s; return s; }
+}  // namespace hostsim
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool readOnly = false) {
+    auto& st = hostsim::nvs().ns;
+    if (readOnly && st.find(name) == st.end()) return false;
+    _ns = &st[name];
+    _ro = readOnly;
+    return true;
+  }
+  void end() { _ns = nullptr; }
+  bool clear() { if (!_ns || _ro) return false; _ns->clear(); return true; }
+  bool remove(const char* key) { return _ns && !_ro && _ns->erase(key) > 0; }
+  bool isKey(const char* key) { return _ns && _ns->count(key); }
+
+  size_t putBool(const char* k, bool v) { return put(k, &v, sizeof(v)); }
+  size_t putInt(const char* k, int32_t v) { return put(k, &v, sizeof(v)); }
+  size_t putUInt(const char* k, uint32_t v) { return put(k, &v, sizeof(v)); }
+  size_t putShort(const char* k, int16_t v) { return put(k, &v, sizeof(v)); }
+  size_t putUShort(const char* k, uint16_t v) { return put(k, &v, sizeof(v)); }
+  size_t putULong64(const char* k, uint64_t v) { return put(k, &v, sizeof(v)); }
+  size_t putString(const char* k, const char* v) { return put(k, v, strlen(v) + 1); }
+  size_t putString(const char* k, const String& v) { return putString(k, v.c_str()); }
+  size_t putBytes(const char* k, const void* v, size_t n) { return put(k, v, n); }
+
+  bool getBool(const char* k, bool d = false) { return get(k, d); }
+  int32_t getInt(const char* k, int32_t d = 0) { return get(k, d); }
+  uint32_t getUInt(const char* k, uint32_t d = 0) { return get(k, d); }
+  int16_t getShort(const char* k, int16_t d = 0) { return get(k, d); }
+  uint16_t getUShort(const char* k, uint16_t d = 0) { return get(k, d); }
+  uint64_t getULong64(const char* k, uint64_t d = 0) { return get(k, d); }
+  String getString(const char* k, const String& d = String()) {
+    const std::vector<uint8_t>* v = find(k);
+    return v ? String((const char*)v->data()) : d;
+  }
+  size_t getBytesLength(const char* k) { const std::vector<uint8_t>* v = find(k); return v ? v->size() : 0; }
+  size_t getBytes(const char* k, void* out, size_t n) {
+    const std::vector<uint8_t>* v = find(k);
+    if (!v || v->size() > n) return 0;
+    memcpy(out, v->data(), v->size());
+    return v->size();
+  }
+
+ private:
+  size_t put(const char* k, const void* v, size_t n) {
+    if (!_ns || _ro) return 0;
+    (*_ns)[k].assign((const uint8_t*)v, (const uint8_t*)v + n);
+    hostsim::nvs().writes++;
+    return n;
+  }
+  const std::vector<uint8_t>* find(const char* k) const {
+    if (!_ns) return nullptr;
+    auto it = _ns->find(k);
+    return it == _ns->end() ? nullptr : &it->second;
+  }
+  template <typename T>
+  T get(const char* k, T d) {
+    const std::vector<uint8_t>* v = find(k);
+    if (!v || v->size() != sizeof(T)) return d;
+    T out;
+    memcpy(&out, v->data(), sizeof(T));
+    return out;
+  }
+  std::map<std::string, std::vector<uint8_t>>* _ns = nullptr;
+  bool _ro = false;
+};
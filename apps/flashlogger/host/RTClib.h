@@ -0,0 +1,66 @@
+#pragma once
+
+// Host RTClib subset: DateTime/TimeSpan arithmetic and a settable RTC_DS3231.
+
+#include "Arduino.h"
+#include <time.h>
+
+class TimeSpan {
+ public:
+  TimeSpan(int32_t seconds = 0) : _s(seconds) {}
+  TimeSpan(int16_t days, int8_t hours, int8_t minutes, int8_t seconds)
+      : _s((int32_t)days * 86400L + (int32_t)hours * 3600 + (int32_t)minutes * 60 + seconds) {}
+  int32_t totalseconds() const { return _s; }
+ private:
+  int32_t _s;
+};
+
+class DateTime {
+ public:
+  static constexpr uint32_t SECONDS_FROM_1970_TO_2000 = 946684800UL;
+
+  DateTime(uint32_t unix = SECONDS_FROM_1970_TO_2000) : _unix(unix) { split(); }
+  DateTime(uint16_t y, uint8_t m, uint8_t d, uint8_t hh = 0, uint8_t mm = 0, uint8_t ss = 0) {
+    struct tm t {};
+    t.tm_year = y - 1900; t.tm_mon = m - 1; t.tm_mday = d;
+    t.tm_hour = hh; t.tm_min = mm; t.tm_sec = ss;
+    _unix = (uint32_t)timegm(&t);
+    split();
+  }
+
+  uint32_t unixtime() const { return _unix; }
+  uint32_t secondstime() const { return _unix - SECONDS_FROM_1970_TO_2000; }
+  uint16_t year() const { return _y; }
+  uint8_t month() const { return _m; }
+  uint8_t day() const { return _d; }
+  uint8_t hour() const { return _hh; }
+  uint8_t minute() const { return _mm; }
+  uint8_t second() const { return _ss; }
+
+  DateTime operator+(const TimeSpan& s) const { return DateTime(_unix + s.totalseconds()); }
+  DateTime operator-(const TimeSpan& s) const { return DateTime(_unix - s.totalseconds()); }
+  TimeSpan operator-(const DateTime& o) const { return TimeSpan((int32_t)(_unix - o._unix)); }
+
+ private:
+  void split() {
+    time_t t = (time_t)_unix;
+    struct tm out {};
+    gmtime_r(&t, &out);
+    _y = (uint16_t)(out.tm_year + 1900); _m = (uint8_t)(out.tm_mon + 1); _d = (uint8_t)out.tm_mday;
+    _hh = (uint8_t)out.tm_hour; _mm = (uint8_t)out.tm_min; _ss = (uint8_t)out.tm_sec;
+  }
+  uint32_t _unix;
+  uint16_t _y = 2000;
+  uint8_t _m = 1, _d = 1, _hh = 0, _mm = 0, _ss = 0;
+};
+
+// Returns exactly the adjusted time; benchmarks step it per record.
+class RTC_DS3231 {
+ public:
+  bool begin() { return true; }
+  DateTime now() { return DateTime(_unix); }
+  void adjust(const DateTime& dt) { _unix = dt.unixtime(); }
+  bool lostPower() { return false; }
+ private:
+  uint32_t _unix = 1735689600UL;  // 2025-01-01
+};
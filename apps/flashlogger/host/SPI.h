@@ -0,0 +1,72 @@
+#pragma once
+
+// Host SPIClass: forwards bytes to whatever device is attached (normally the
+// NorFlashEmulator) and charges a per-call driver overhead to the simulated
+// clock so byte-at-a-time and burst paths can be compared.
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+
+struct SPISettings {
+  SPISettings() = default;
+  SPISettings(uint32_t hz, uint8_t, uint8_t) : clockHz(hz) {}
+  uint32_t clockHz = 1000000;
+};
+
+class SpiDevice {
+ public:
+  virtual ~SpiDevice() = default;
+  // One byte in, one byte out at the given bus clock.
+  virtual uint8_t spiXfer(uint8_t mosi, uint32_t clockHz) = 0;
+};
+
+class SPIClass {
+ public:
+  void begin(int8_t = -1, int8_t = -1, int8_t = -1, int8_t = -1) { _begun = true; }
+  void end() { _begun = false; }
+  void beginTransaction(const SPISettings& s) { _clockHz = s.clockHz; charge(); }
+  void endTransaction() {}
+
+  uint8_t transfer(uint8_t b) {
+    charge();
+    return _dev ? _dev->spiXfer(b, _clockHz) : 0xFF;
+  }
+  void transferBytes(const uint8_t* data, uint8_t* out, uint32_t size) {
+    charge();
+    for (uint32_t i = 0; i < size; ++i) {
+      uint8_t r = _dev ? _dev->spiXfer(data ? data[i] : 0xFF, _clockHz) : 0xFF;
+      if (out) out[i] = r;
+    }
+  }
+  void writeBytes(const uint8_t* data, uint32_t size) { transferBytes(data, nullptr, size); }
+
+  // host-only
+  void attach(SpiDevice* dev) { _dev = dev; }
+  void setCallOverheadNs(uint32_t ns) { _callOverheadNs = ns; }
+  uint32_t calls() const { return _calls; }
+  void resetCalls() { _calls = 0; _overheadNsAcc = 0; }
+
+ private:
+  void charge() {
+    ++_calls;
+    _overheadNsAcc += _callOverheadNs;
+    if (_overheadNsAcc >= 1000) {
+      hostsim::advanceUs(_overheadNsAcc / 1000);
+      _overheadNsAcc %= 1000;
+    }
+  }
+  SpiDevice* _dev = nullptr;
+  uint32_t _clockHz = 1000000;
+  uint32_t _callOverheadNs = 0;
+  uint32_t _overheadNsAcc = 0;
+  uint32_t _calls = 0;
+  bool _begun = false;
+};
+
+inline SPIClass SPI;
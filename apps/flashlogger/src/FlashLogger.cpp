@@ -1,9 +1,45 @@
 #include "FlashLogger.h"
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include <Preferences.h>
 
+#if defined(ESP_PLATFORM) && __has_include(<driver/spi_master.h>)
+#include <driver/spi_master.h>
+#include <esp_heap_caps.h>
+#define FLASHLOGGER_HAS_SPI_MASTER 1
+#else
+#define FLASHLOGGER_HAS_SPI_MASTER 0
+#endif
+
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+#ifndef DRAM_ATTR
+#define DRAM_ATTR
+#endif
+
 namespace {
+  constexpr uint32_t DMA_CHUNK = 2048; // bounce buffer / max DMA transaction
+  constexpr uint32_t kUnixAt2000 = 946684800UL;  // RecordHeader::ts is seconds since 2000
+
+  // read capabilities reported by JEDEC/SFDP probe
+  constexpr uint8_t READ_CAP_FAST = 0x01;
+  constexpr uint8_t READ_CAP_DUAL = 0x02;
+  constexpr uint8_t READ_CAP_QUAD = 0x04;
+  constexpr uint32_t NORMAL_READ_MAX_HZ = 50000000; // 0x03 limit on W25Q parts
+
+  // Listing caches live on the heap and only grow; releaseCaches() frees them.
+  template <typename T>
+  bool growCache(T*& buf, int& cap, int n) {
+    if (n <= cap) return true;
+    T* grown = (T*)realloc(buf, n * sizeof(T));
+    if (!grown) return false;
+    buf = grown;
+    cap = n;
+    return true;
+  }
+
   int hexNibble(char c) {
     if (c >= '0' && c <= '9') return c - '0';
     if (c >= 'A' && c <= 'F') return c - 'A' + 10;
@@ -13,7 +49,41 @@ namespace {
 }
 
 // ===== CRC16 (Modbus/A001) =====
-uint16_t FlashLogger::crc16(const uint8_t* data, uint32_t len, uint16_t seed) {
+// Slice-by-4: T[0] is the classic byte table, T[k][i] = (T[k-1][i] >> 8) ^
+// T[0][T[k-1][i] & 0xFF]. 2 KB, generated at compile time and kept in DRAM so
+// the IRAM routine never touches flash cache. The ESP32 ROM crc16_le is
+// CRC-16/CCITT (poly 0x1021 reflected) and would change every stored CRC, so
+// it is not used.
+namespace {
+  struct Crc16Tables {
+    uint16_t t[4][256];
+    constexpr Crc16Tables() : t() {
+      for (int i = 0; i < 256; ++i) {
+        uint16_t c = (uint16_t)i;
+        for (int b = 0; b < 8; ++b) c = (c & 1) ? (uint16_t)((c >> 1) ^ 0xA001) : (uint16_t)(c >> 1);
+        t[0][i] = c;
+      }
+      for (int k = 1; k < 4; ++k)
+        for (int i = 0; i < 256; ++i)
+          t[k][i] = (uint16_t)((t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF]);
+    }
+  };
+  DRAM_ATTR constexpr Crc16Tables CRC16_TABLES;
+}
+
+IRAM_ATTR uint16_t FlashLogger::crc16(const uint8_t* data, uint32_t len, uint16_t seed) {
+  const uint16_t (*t)[256] = CRC16_TABLES.t;
+  uint16_t crc = seed;
+  while (len >= 4) {
+    crc = t[3][(crc ^ data[0]) & 0xFF] ^ t[2][((crc >> 8) ^ data[1]) & 0xFF] ^
+          t[1][data[2]] ^ t[0][data[3]];
+    data += 4; len -= 4;
+  }
+  while (len--) crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+  return crc;
+}
+
+uint16_t FlashLogger::crc16Bitwise(const uint8_t* data, uint32_t len, uint16_t seed) {
   uint16_t crc = seed;
   for (uint32_t i = 0; i < len; ++i) {
     crc ^= data[i];
@@ -23,19 +93,592 @@ uint16_t FlashLogger::crc16(const uint8_t* data, uint32_t len, uint16_t seed) {
   return crc;
 }
 
+// ===== v2.1 packed sector index =====
+bool SectorIndexMap::allocate(int sectors) {
+  if (sectors != _sectors || !_present) {
+    release();
+    const size_t bits = (size_t)(sectors + 7) / 8;
+    _present = (uint8_t*)malloc(bits);
+    _pushed  = (uint8_t*)malloc(bits);
+    if (!_present || !_pushed) { release(); return false; }
+    _sectors = sectors;
+  }
+  clearAll();
+  return true;
+}
+
+void SectorIndexMap::release() {
+  free(_present); free(_pushed); free(_runs); free(_chain);
+  _present = _pushed = nullptr;
+  _runs = nullptr;
+  _chain = nullptr;
+  _sectors = 0;
+  _runCount = _runCap = 0;
+  _chainCount = _chainCap = 0;
+}
+
+void SectorIndexMap::clearAll() {
+  if (_present) memset(_present, 0, (_sectors + 7) / 8);
+  if (_pushed)  memset(_pushed, 0, (_sectors + 7) / 8);
+  _runCount = 0;
+  _chainCount = 0;
+  for (OpenPtr& o : _open) o.sector = -1;
+}
+
+// Last run starting at or before s, or -1.
+int SectorIndexMap::runAtOrBefore(int s) const {
+  int lo = 0, hi = (int)_runCount - 1, hit = -1;
+  while (lo <= hi) {
+    const int mid = (lo + hi) / 2;
+    if (_runs[mid].first <= s) { hit = mid; lo = mid + 1; } else hi = mid - 1;
+  }
+  return hit;
+}
+
+int SectorIndexMap::findRun(int s) const {
+  const int r = runAtOrBefore(s);
+  return (r >= 0 && s < _runs[r].first + _runs[r].count) ? r : -1;
+}
+
+uint16_t SectorIndexMap::day(int s) const {
+  const int r = present(s) ? findRun(s) : -1;
+  return r >= 0 ? _runs[r].day : 0;
+}
+
+bool SectorIndexMap::insertRun(int at, const DayRun& r) {
+  if (_runCount == _runCap) {
+    const uint16_t cap = _runCap ? (uint16_t)(_runCap * 2) : 16;
+    DayRun* grown = (DayRun*)realloc(_runs, cap * sizeof(DayRun));
+    if (!grown) return false;
+    _runs = grown;
+    _runCap = cap;
+  }
+  memmove(&_runs[at + 1], &_runs[at], (_runCount - at) * sizeof(DayRun));
+  _runs[at] = r;
+  _runCount++;
+  return true;
+}
+
+void SectorIndexMap::dropFromRun(int s) {
+  const int r = findRun(s);
+  if (r < 0) return;
+  DayRun& run = _runs[r];
+  const int last = run.first + run.count - 1;
+  if (run.count == 1) {
+    memmove(&_runs[r], &_runs[r + 1], (_runCount - r - 1) * sizeof(DayRun));
+    _runCount--;
+  } else if (s == run.first) {
+    run.first++; run.count--;
+  } else if (s == last) {
+    run.count--;
+  } else {                                        // split around s
+    const DayRun tail = { (uint16_t)(s + 1), (uint16_t)(last - s), run.day };
+    run.count = (uint16_t)(s - run.first);
+    insertRun(r + 1, tail);
+  }
+}
+
+void SectorIndexMap::set(int s, uint16_t dayID, bool isPushed) {
+  if (!inRange(s)) return;
+  dropOpen(s);
+  setPushed(s, isPushed);
+  const int r = present(s) ? findRun(s) : -1;
+  _present[s >> 3] |= (uint8_t)(1u << (s & 7));
+  if (r >= 0 && _runs[r].day == dayID) return;
+  if (r >= 0) dropFromRun(s);
+
+  const int at = runAtOrBefore(s) + 1;             // s is in no run now
+  const bool joinL = at > 0 && _runs[at - 1].day == dayID &&
+                     _runs[at - 1].first + _runs[at - 1].count == s;
+  const bool joinR = at < _runCount && _runs[at].day == dayID && _runs[at].first == s + 1;
+  if (joinL && joinR) {
+    _runs[at - 1].count += 1 + _runs[at].count;
+    memmove(&_runs[at], &_runs[at + 1], (_runCount - at - 1) * sizeof(DayRun));
+    _runCount--;
+  } else if (joinL) {
+    _runs[at - 1].count++;
+  } else if (joinR) {
+    _runs[at].first--; _runs[at].count++;
+  } else if (!insertRun(at, { (uint16_t)s, 1, dayID })) {
+    _present[s >> 3] &= (uint8_t)~(1u << (s & 7));   // out of heap: leave it unindexed
+  }
+}
+
+void SectorIndexMap::setPushed(int s, bool on) {
+  if (!inRange(s)) return;
+  if (on) _pushed[s >> 3] |= (uint8_t)(1u << (s & 7));
+  else    _pushed[s >> 3] &= (uint8_t)~(1u << (s & 7));
+}
+
+void SectorIndexMap::clear(int s) {
+  if (!present(s)) return;
+  dropFromRun(s);
+  dropOpen(s);
+  _present[s >> 3] &= (uint8_t)~(1u << (s & 7));
+  _pushed[s >> 3]  &= (uint8_t)~(1u << (s & 7));
+  const int r = chainFind(s);
+  if (r >= 0) chainTrim(r);
+}
+
+uint32_t SectorIndexMap::writePtr(int s) const {
+  for (const OpenPtr& o : _open) if (o.sector == s) return o.addr;
+  return (uint32_t)s * SECTOR_SIZE + sizeof(SectorHeader);
+}
+
+// Keeps the OPEN_MAX most recently written sectors; the current sector is
+// updated on every append, so it is never the one evicted.
+void SectorIndexMap::setWritePtr(int s, uint32_t addr) {
+  OpenPtr* slot = nullptr;
+  for (OpenPtr& o : _open) if (o.sector == s) slot = &o;
+  for (OpenPtr& o : _open) if (!slot && o.sector < 0) slot = &o;
+  if (!slot) {                                    // evict the least recently written
+    slot = &_open[0];
+    for (OpenPtr& o : _open)
+      if ((uint16_t)(_openAge - o.age) > (uint16_t)(_openAge - slot->age)) slot = &o;
+  }
+  *slot = { (int16_t)s, ++_openAge, addr };
+}
+
+void SectorIndexMap::dropOpen(int s) {
+  for (OpenPtr& o : _open) if (o.sector == s) o.sector = -1;
+}
+
+uint32_t SectorIndexMap::bytes() const {
+  return 2u * ((_sectors + 7) / 8) + _runCap * sizeof(DayRun) + _chainCap * sizeof(ChainRun) +
+         sizeof(*this);
+}
+
+// ---- allocation chain ----
+bool SectorIndexMap::chainInsert(int at, const ChainRun& r) {
+  if (_chainCount == _chainCap) {
+    const uint16_t cap = _chainCap ? (uint16_t)(_chainCap * 2) : 4;
+    ChainRun* grown = (ChainRun*)realloc(_chain, cap * sizeof(ChainRun));
+    if (!grown) return false;
+    _chain = grown;
+    _chainCap = cap;
+  }
+  memmove(&_chain[at + 1], &_chain[at], (_chainCount - at) * sizeof(ChainRun));
+  _chain[at] = r;
+  _chainCount++;
+  return true;
+}
+
+bool SectorIndexMap::chainPushRun(const ChainRun& r) {
+  if (!r.count || r.first + r.count > _sectors) return false;
+  return chainInsert(_chainCount, r);
+}
+
+int SectorIndexMap::chainFind(int s) const {
+  for (int r = 0; r < _chainCount; ++r)
+    if (s >= _chain[r].first && s < _chain[r].first + _chain[r].count) return r;
+  return -1;
+}
+
+// First present sector of run r walking from `from` by `step`, or -1.
+int SectorIndexMap::chainScan(int r, int from, int step) const {
+  const int lo = _chain[r].first, hi = lo + _chain[r].count - 1;
+  for (int x = from; x >= lo && x <= hi; x += step) if (present(x)) return x;
+  return -1;
+}
+
+int SectorIndexMap::chainFirst() const {
+  for (int r = 0; r < _chainCount; ++r) {
+    const int x = chainScan(r, _chain[r].first, 1);
+    if (x >= 0) return x;
+  }
+  return -1;
+}
+
+int SectorIndexMap::chainLast() const {
+  for (int r = (int)_chainCount - 1; r >= 0; --r) {
+    const int x = chainScan(r, _chain[r].first + _chain[r].count - 1, -1);
+    if (x >= 0) return x;
+  }
+  return -1;
+}
+
+int SectorIndexMap::chainNext(int s) const {
+  int r = chainFind(s);
+  if (r < 0) return chainFirst();                 // erased from the old end meanwhile
+  int x = chainScan(r, s + 1, 1);
+  while (x < 0 && ++r < _chainCount) x = chainScan(r, _chain[r].first, 1);
+  return x;
+}
+
+int SectorIndexMap::chainPrev(int s) const {
+  int r = chainFind(s);
+  if (r < 0) return -1;
+  int x = chainScan(r, s - 1, -1);
+  while (x < 0 && --r >= 0) x = chainScan(r, _chain[r].first + _chain[r].count - 1, -1);
+  return x;
+}
+
+void SectorIndexMap::chainRemove(int s) {
+  const int r = chainFind(s);
+  if (r < 0) return;
+  ChainRun& run = _chain[r];
+  const int last = run.first + run.count - 1;
+  if (run.count == 1) {
+    memmove(&_chain[r], &_chain[r + 1], (_chainCount - r - 1) * sizeof(ChainRun));
+    _chainCount--;
+  } else if (s == run.first) {
+    run.first++; run.count--;
+  } else if (s == last) {
+    run.count--;
+  } else {                                        // split around s
+    const ChainRun tail = { (uint16_t)(s + 1), (uint16_t)(last - s) };
+    run.count = (uint16_t)(s - run.first);
+    chainInsert(r + 1, tail);
+  }
+}
+
+// Holes at either end of a run are dropped, empty runs with them.
+void SectorIndexMap::chainTrim(int r) {
+  ChainRun& run = _chain[r];
+  while (run.count && !present(run.first)) { run.first++; run.count--; }
+  while (run.count && !present(run.first + run.count - 1)) run.count--;
+  if (run.count) return;
+  memmove(&_chain[r], &_chain[r + 1], (_chainCount - r - 1) * sizeof(ChainRun));
+  _chainCount--;
+}
+
+// The newest run grows over s when only unchained holes lie in between.
+void SectorIndexMap::chainAppend(int s) {
+  if (!inRange(s)) return;
+  chainRemove(s);
+  if (_chainCount) {
+    ChainRun& tail = _chain[_chainCount - 1];
+    int x = tail.first + tail.count;
+    while (x < s && !present(x) && chainFind(x) < 0) ++x;
+    if (x == s) {
+      tail.count = (uint16_t)(s + 1 - tail.first);
+      return;
+    }
+  }
+  chainInsert(_chainCount, { (uint16_t)s, 1 });
+}
+
+// ===== v2.1 zone map mirror =====
+namespace {
+constexpr uint8_t  ZONE_EMPTY_LO = 0xFF;   // lo > hi: nothing recorded
+constexpr uint8_t  ZONE_EMPTY_HI = 0x00;
+constexpr uint32_t ZONE_SLOT     = 360;    // seconds per time slot
+
+// 8-bit order-preserving code: 0x80 = 0, 0x80 +/- m = +/- 2^((m - 1) / 8 - 4)
+// (about 9% steps from 0.0625 to ~3400); 0x00 / 0xFF are -inf / +inf.
+float zoneValue(uint8_t c) {
+  if (c == 0x00) return -INFINITY;
+  if (c == 0xFF) return INFINITY;
+  const int m = (int)c - 0x80;
+  if (m == 0) return 0.0f;
+  const float a = exp2f((float)(abs(m) - 1) / 8.0f - 4.0f);
+  return m > 0 ? a : -a;
+}
+
+// Rounded down for lower bounds, up for upper bounds.
+uint8_t zoneCode(float v, bool up) {
+  if (isnan(v)) return up ? 0xFF : 0x00;
+  int m = 0;
+  const float a = fabsf(v);
+  if (a > 0.0f) {
+    const float f = (log2f(a) + 4.0f) * 8.0f + 1.0f;
+    m = ((v > 0.0f) == up) ? (int)ceilf(f) : (int)floorf(f);
+    if (m < 0) m = 0;
+    if (m > 128) m = 128;
+  }
+  int c = v > 0.0f ? min(0x80 + m, 0xFF) : 0x80 - m;
+  while (up ? (c < 0xFF && zoneValue((uint8_t)c) < v) : (c > 0x00 && zoneValue((uint8_t)c) > v)) {
+    c += up ? 1 : -1;                     // exp2f/log2f rounding at the edges
+  }
+  return (uint8_t)c;
+}
+
+uint8_t zoneSlot(uint32_t ts, uint16_t dayID) {
+  const uint32_t start = (uint32_t)dayID * 86400UL;
+  if (ts < start) return 0x00;
+  if (ts - start >= 86400UL) return 0xFF;
+  return (uint8_t)(1 + (ts - start) / ZONE_SLOT);
+}
+}  // namespace
+
+bool SectorZoneMap::allocate(int sectors, const char* keys) {
+  uint8_t n = 0;
+  memset(_keys, 0, sizeof(_keys));
+  for (const char* p = keys; p && *p && n < ZONE_FIELDS; ) {
+    while (*p == ',' || *p == ' ') ++p;
+    const char* e = p;
+    while (*e && *e != ',' && *e != ' ') ++e;
+    if (e > p) {
+      strncpy(_keys[n], p, min<size_t>(e - p, sizeof(_keys[n]) - 1));
+      const uint16_t crc = FlashLogger::crc16((const uint8_t*)_keys[n], strlen(_keys[n]));
+      _crc[n++] = crc ? crc : 1;          // 0 marks an unused footer slot
+    }
+    p = e;
+  }
+  const uint8_t stride = (uint8_t)(2 + 2 * n);
+  if (sectors != _sectors || stride != _stride || !_zones) {
+    release();
+    _loaded = (uint8_t*)malloc((size_t)(sectors + 7) / 8);
+    _zones  = (uint8_t*)malloc((size_t)sectors * stride);
+    if (!_loaded || !_zones) { release(); return false; }
+    _sectors = sectors;
+    _stride  = stride;
+  }
+  _fields = n;
+  clearAll();
+  return true;
+}
+
+void SectorZoneMap::release() {
+  free(_loaded); free(_zones); free(_tags);
+  _loaded = _zones = _tags = nullptr;
+  _sectors = 0;
+}
+
+void SectorZoneMap::clearAll() {
+  if (_loaded) memset(_loaded, 0, (_sectors + 7) / 8);
+}
+
+void SectorZoneMap::reset(int s) {
+  if (!inRange(s)) return;
+  uint8_t* e = entry(s);
+  e[0] = ZONE_EMPTY_LO;
+  e[1] = ZONE_EMPTY_HI;
+  memset(e + 2, ZONE_EMPTY_LO, _fields);
+  memset(e + 2 + _fields, ZONE_EMPTY_HI, _fields);
+  setTags(s, 0);
+  _loaded[s >> 3] |= (uint8_t)(1u << (s & 7));
+}
+
+void SectorZoneMap::setTags(int s, uint8_t tags) {
+  if (!_tags) return;
+  const uint8_t shift = (uint8_t)((s & 1) * 4);
+  _tags[s >> 1] = (uint8_t)((_tags[s >> 1] & ~(0x0F << shift)) | ((tags >> 4) << shift));
+}
+
+// Entries loaded so far have no tags; they load again, footer and all.
+bool SectorZoneMap::trackTags() {
+  if (_tags) return true;
+  if (!_zones) return false;
+  _tags = (uint8_t*)calloc((size_t)(_sectors + 1) / 2, 1);
+  if (!_tags) return false;
+  clearAll();
+  return true;
+}
+
+void SectorZoneMap::load(int s, uint16_t dayID, const ZoneFooter& z) {
+  if (!inRange(s)) return;
+  reset(s);
+  uint8_t* e = entry(s);
+  if (z.count) {
+    e[0] = zoneSlot(z.tsMin, dayID);
+    e[1] = zoneSlot(z.tsMax, dayID);
+  }
+  setTags(s, z.tags);
+  for (uint8_t i = 0; i < _fields; ++i) {
+    int j = 0;
+    while (j < ZONE_FIELDS && z.keyCrc[j] != _crc[i]) ++j;
+    if (j == ZONE_FIELDS) {               // field not kept when the footer was written
+      e[2 + i] = 0x00;
+      e[2 + _fields + i] = 0xFF;
+    } else if (z.lo[j] <= z.hi[j]) {
+      e[2 + i] = zoneCode(z.lo[j], false);
+      e[2 + _fields + i] = zoneCode(z.hi[j], true);
+    }
+  }
+}
+
+void SectorZoneMap::add(int s, uint16_t dayID, uint32_t ts, uint8_t tags, const float* vals) {
+  if (!loaded(s)) return;                 // loaded from flash on first use instead
+  uint8_t* e = entry(s);
+  if (_tags) setTags(s, tagsOf(s) | (tags & REC_TAG_MASK));
+  const uint8_t slot = zoneSlot(ts, dayID);
+  e[0] = min(e[0], slot);
+  e[1] = max(e[1], slot);
+  for (uint8_t i = 0; i < _fields; ++i) {
+    if (isnan(vals[i])) continue;
+    e[2 + i] = min(e[2 + i], zoneCode(vals[i], false));
+    e[2 + _fields + i] = max(e[2 + _fields + i], zoneCode(vals[i], true));
+  }
+}
+
+// Mirrors recordMatchesTime/recordMatchesPredicates on the sector's bounds.
+bool SectorZoneMap::mayMatch(int s, uint16_t dayID, const QuerySpec& q) const {
+  if (!loaded(s)) return true;
+  const uint8_t* e = entry(s);
+  if (e[0] > e[1]) return false;          // no records
+  if ((q.tags & REC_TAG_MASK) && _tags && !(tagsOf(s) & q.tags)) return false;
+  if (!q.day_from && !q.day_to) {
+    const uint32_t start = (uint32_t)dayID * 86400UL;
+    const uint32_t lo = e[0] == 0x00 ? 0 : start + (e[0] - 1) * ZONE_SLOT;
+    const uint32_t hi = e[1] == 0xFF ? 0xFFFFFFFFUL : start + e[1] * ZONE_SLOT - 1;
+    if (hi < q.ts_from || lo > q.ts_to) return false;
+  }
+  constexpr float kFloatEps = 0.0001f;
+  for (uint8_t p = 0; p < q.predicateCount; ++p) {
+    const FieldPredicate& pred = q.predicates[p];
+    uint8_t i = 0;
+    while (i < _fields && strncmp(pred.key, _keys[i], sizeof(_keys[i])) != 0) ++i;
+    if (i == _fields) continue;
+    if (e[2 + i] > e[2 + _fields + i]) return false;   // no record has the field
+    const float lo = zoneValue(e[2 + i]);
+    const float hi = zoneValue(e[2 + _fields + i]);
+    switch (pred.op) {
+      case PRED_LT: if (lo >= pred.value) return false; break;
+      case PRED_LE: if (lo > pred.value + kFloatEps) return false; break;
+      case PRED_GT: if (hi <= pred.value) return false; break;
+      case PRED_GE: if (hi + kFloatEps < pred.value) return false; break;
+      case PRED_EQ: if (pred.value < lo - kFloatEps || pred.value > hi + kFloatEps) return false; break;
+      case PRED_NE: break;
+    }
+  }
+  if (q.where) {
+    const PredicateProgram& w = *q.where;
+    PredicateProgram::Bounds b;
+    for (uint8_t k = 0; k < w.keys(); ++k) {
+      uint8_t i = 0;
+      while (i < _fields && strncmp(w.key(k), _keys[i], sizeof(_keys[i])) != 0) ++i;
+      if (i == _fields) continue;
+      if (e[2 + i] > e[2 + _fields + i]) {
+        b.state[k] = PredicateProgram::Bounds::ABSENT;
+      } else {
+        b.state[k] = PredicateProgram::Bounds::RANGE;
+        b.lo[k] = zoneValue(e[2 + i]);
+        b.hi[k] = zoneValue(e[2 + _fields + i]);
+      }
+    }
+    if (!w.mayMatch(b)) return false;
+  }
+  return true;
+}
+
+bool SectorZoneMap::startsAfter(int s, uint16_t dayID, uint32_t ts) const {
+  if (!loaded(s)) return false;
+  const uint8_t* e = entry(s);
+  if (e[0] > e[1] || e[0] == 0x00) return false;
+  return (uint32_t)dayID * 86400UL + (e[0] - 1) * ZONE_SLOT > ts;
+}
+
+uint32_t SectorZoneMap::bytes() const {
+  return sizeof(*this) + (_zones ? (uint32_t)(_sectors + 7) / 8 + (uint32_t)_sectors * _stride : 0) +
+         (_tags ? (uint32_t)(_sectors + 1) / 2 : 0);
+}
+
 // ===== ctor =====
 FlashLogger::FlashLogger(uint8_t csPin) : _cs(csPin) {}
 
+FlashLogger::~FlashLogger() {
+  if (_eraseSuspended) resumeErase();
+  free(_wbBuf);
+  free(_blk);
+  free(_schemas);
+  free(_rollup);
+  releaseCaches();
+  dmaRelease();
+}
+
+// Chip size from the probe (SFDP density, else the JEDEC capacity byte), or
+// the configured size when the probe has none. Addresses past the real size
+// alias on the chip, so the chip wins over the config. The log lives in
+// [regionOffset, regionOffset + regionBytes); sector numbers, record
+// addresses and cursors are relative to its start, and the journal and
+// factory sectors are its last three, with the rollup rings (if any) below
+// them. Past 16 MB the 4-byte forms are used.
+bool FlashLogger::setGeometry(uint32_t capacityBytes) {
+  uint32_t chip = capacityBytes;
+  if (_chipBytes) {
+    if (_chipBytes != chip) Serial.printf("FlashLogger: chip has %lu bytes, config says %lu\n",
+                                          (unsigned long)_chipBytes, (unsigned long)chip);
+    chip = _chipBytes;
+  }
+  const uint32_t base = (_cfg.regionOffset + SECTOR_SIZE - 1) & ~(uint32_t)(SECTOR_SIZE - 1);
+  uint32_t bytes = (base < chip) ? chip - base : 0;
+  if (_cfg.regionBytes && _cfg.regionBytes < bytes) bytes = _cfg.regionBytes;
+  uint32_t sectors = bytes / SECTOR_SIZE;
+  if (sectors > MAX_SECTORS) sectors = MAX_SECTORS;
+  if (sectors < 16) {
+    Serial.printf("FlashLogger: region at 0x%lX has %lu sectors, need 16\n", (unsigned long)base, (unsigned long)sectors);
+    return false;
+  }
+  _regionBase = base;
+  _addr4 = (uint64_t)base + (uint64_t)sectors * SECTOR_SIZE > (1ULL << 24);
+  if (chip > (1UL << 24)) {
+    // volatile and may be left over from a warm reset, so always set it
+    const uint8_t cmd = (_addr4 && _cfg.en4b) ? CMD_EN4B : CMD_EX4B;
+    busBegin(); busWrite(&cmd, 1); busEnd();
+  }
+  _sectorCount   = (int)sectors;
+  _factorySector = _sectorCount - 1;
+  _journalSector = _factorySector - 2;
+  uint32_t rollup = 0;
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) rollup += _cfg.rollupSectors[t];
+  if (rollup && rollup + 16 > (uint32_t)_journalSector) {
+    Serial.printf("FlashLogger: %lu rollup sectors leave the log too small, rollups off\n", (unsigned long)rollup);
+    rollup = 0;
+  }
+  _logEnd = _journalSector - (int)rollup;
+  free(_rollup);
+  _rollup = rollup ? (RollupState*)calloc(1, sizeof(RollupState)) : nullptr;
+  if (rollup && !_rollup) Serial.println("FlashLogger: no heap for rollups");   // area stays reserved
+  for (int t = 0, at = _logEnd; _rollup && t < ROLLUP_TIERS; ++t) {
+    _rollup->ring[t].first = at;
+    _rollup->ring[t].count = _cfg.rollupSectors[t];
+    _rollup->ring[t].cur   = -1;
+    at += _rollup->ring[t].count;
+  }
+  if (!_index.allocate(_sectorCount)) Serial.println("FlashLogger: no heap for the sector index");
+  if (!_zones.allocate(_sectorCount, _cfg.zoneKeys)) Serial.println("FlashLogger: no heap for zone maps");
+  _zOpenSector = -1;
+  return true;
+}
+
+// 3-byte opcode -> the form for the current address mode. In EN4B mode the
+// chip takes 4 address bytes on the plain opcodes.
+uint8_t FlashLogger::addrOpcode(uint8_t op) const {
+  if (!_addr4 || _cfg.en4b) return op;
+  switch (op) {
+    case CMD_READ:      return CMD_READ4;
+    case CMD_FAST_READ: return CMD_FAST_READ4;
+    case CMD_READ_DUAL: return CMD_READ_DUAL4;
+    case CMD_READ_QUAD: return CMD_READ_QUAD4;
+    case CMD_PP:        return CMD_PP4;
+    case CMD_SE:        return CMD_SE4;
+    default:            return op;
+  }
+}
+
+FlashMemStats FlashLogger::memoryUsage() const {
+  FlashMemStats m{};
+  m.objectBytes  = sizeof(FlashLogger);
+  m.indexBytes   = _index.bytes() - sizeof(SectorIndexMap);    // the map itself is in the object
+  m.zoneBytes    = _zones.bytes() - sizeof(SectorZoneMap);
+  m.summaryBytes = _dayCap * sizeof(DaySummary) + _sectCap * sizeof(SectorSummary);
+  m.bufferBytes  = (_wbBuf ? _wbCap : 0) + (_blk ? sizeof(OpenBlock) : 0);
+  m.schemaBytes  = _schemas ? SCHEMA_SLOTS * sizeof(RecordSchema) : 0;
+  m.rollupBytes  = _rollup ? sizeof(RollupState) : 0;
+  m.totalBytes   = m.objectBytes + m.indexBytes + m.zoneBytes + m.summaryBytes + m.bufferBytes +
+                   m.schemaBytes + m.rollupBytes;
+  m.sectors      = (uint16_t)_sectorCount;
+  m.dayRuns      = _index.runCount();
+  return m;
+}
+
+void FlashLogger::releaseCaches() {
+  free(_days);  _days = nullptr;  _dayCap = 0;  _dayCount = 0;
+  free(_sects); _sects = nullptr; _sectCap = 0; _sectCount = 0;
+}
+
 // ===== begin =====
 bool FlashLogger::begin(RTC_DS3231* rtc) {
   _rtc = rtc;
 
-  SPI.begin(17, 18, 8, _cs);
+  _spi = &SPI;
+  _spi->begin(17, 18, 8, _cs);
   pinMode(_cs, OUTPUT);
   digitalWrite(_cs, HIGH);
   delay(5);
 
-  for (int i = 0; i < MAX_SECTORS; ++i) _index[i] = {false, 0, false, 0};
+  setGeometry(4096UL * SECTOR_SIZE);          // legacy layout: 16 MB
 
   if (!loadFactoryInfo()) {
     memset(&_factory, 0, sizeof(_factory));
@@ -49,7 +692,7 @@ bool FlashLogger::begin(RTC_DS3231* rtc) {
     _factory.bootCounter = 0;
     _factory.startHint = 0;
     _factory.badCount = 0;
-    sectorErase(sectorBaseAddr(FACTORY_SECTOR), false);
+    sectorErase(sectorBaseAddr(_factorySector), false);
     saveFactoryInfo();
   } else {
     if (_factory.defaultDateStyle >= 1 && _factory.defaultDateStyle <= 3)
@@ -57,26 +700,30 @@ bool FlashLogger::begin(RTC_DS3231* rtc) {
   }
 
   // bump boot counter & set generation
+  journalMount();
+  _seqCounter = 0;
+  const uint32_t lastBoot = restoreMetaState() ? _factory.bootCounter : 0;
+  restoreSchemas();
   _factory.bootCounter++;
-  saveFactoryInfo();
   _generation = _factory.bootCounter;
 
-  scanAllSectorsBuildIndex();
-  if (!loadAnchorsFromNVS()) buildAnchors(true);
+  mountIndex(lastBoot);
+  recoverSeq();
+  saveMetaState();
 
   DateTime now = _rtc->now();
   _currentDay = dayIDFromDateTime(now);
+  _mountDay = _currentDay;
 
   selectOrCreateTodaySector();
   if (_currentSector >= 0) {
     findLastWritePositionInSector(_currentSector);
-    _writeAddr = _index[_currentSector].writePtr;
+    _writeAddr = _index.writePtr(_currentSector);
   } else {
     Serial.println("FlashLogger: no sector available!");
     return false;
   }
 
-  _seqCounter  = 0;
   _todayBytes  = 0;
   _lowSpace    = false;
 
@@ -100,16 +747,28 @@ bool FlashLogger::begin(const FlashLoggerConfig& cfg) {
   if (cfg.spi_cs_pin >= 0) _cs = (uint8_t)cfg.spi_cs_pin;
 
   // SPI setup (respect custom pins if provided)
+  dmaRelease();
+  _spi = cfg.spi ? cfg.spi : &SPI;
+  _xfer = FLASH_XFER_BULK;
   if (cfg.spi_sck_pin >= 0 && cfg.spi_mosi_pin >= 0 && cfg.spi_miso_pin >= 0) {
-    SPI.begin(cfg.spi_sck_pin, cfg.spi_miso_pin, cfg.spi_mosi_pin, cfg.spi_cs_pin);
+    _spi->begin(cfg.spi_sck_pin, cfg.spi_miso_pin, cfg.spi_mosi_pin, cfg.spi_cs_pin);
   } else {
-    SPI.begin(); // defaults
+    _spi->begin(); // defaults
   }
   pinMode(_cs, OUTPUT);
   digitalWrite(_cs, HIGH);
   delay(5);
+  setSpiTransfer(_cfg.spiXfer);
+  _readModeReq = _cfg.readMode;
+  _durability = _cfg.durability;
+  _wbUsed = 0; _wbCount = 0; _wbTimed = false; _wbAsync = false;
+  if (_blk) _blk->count = 0;
+  _as = AS_IDLE; _chipBusy = false; _eraseCount = 0;
+  probeReadCaps();
+  applyReadMode();
+  Serial.printf("FlashLogger: JEDEC %06lX, read mode %u\n", (unsigned long)_jedecId, (unsigned)_readMode);
 
-  for (int i = 0; i < MAX_SECTORS; ++i) _index[i] = {false, 0, false, 0};
+  if (!setGeometry(_cfg.totalSizeBytes)) return false;
 
   if (!loadFactoryInfo()) {
     memset(&_factory, 0, sizeof(_factory));
@@ -123,7 +782,7 @@ bool FlashLogger::begin(const FlashLoggerConfig& cfg) {
     _factory.bootCounter = 0;
     _factory.startHint = 0;
     _factory.badCount = 0;
-    sectorErase(sectorBaseAddr(FACTORY_SECTOR), false);
+    sectorErase(sectorBaseAddr(_factorySector), false);
     saveFactoryInfo();
   } else {
     if (_factory.defaultDateStyle >= 1 && _factory.defaultDateStyle <= 3)
@@ -140,19 +799,27 @@ bool FlashLogger::begin(const FlashLoggerConfig& cfg) {
   // Set factory info once if empty (reuse your existing setFactoryInfo logic)
   setFactoryInfo(cfg.model, cfg.flashModel, cfg.deviceId);
 
+  if (!journalMount() && _jActive >= 0) Serial.println("FlashLogger: metadata journal formatted");
+  _seqCounter = 0;
+  const bool haveState = restoreMetaState();
+  restoreSchemas();
+  const uint32_t lastBoot = haveState ? _factory.bootCounter : 0;
   _factory.bootCounter++;
-  saveFactoryInfo();
   _generation = _factory.bootCounter;
 
   if (_cfg.persistConfig) {
     saveConfigToNVS(_cfg, _cfg.configNamespace ? _cfg.configNamespace : "flcfg");
   }
 
-  scanAllSectorsBuildIndex();
-  if (!loadAnchorsFromNVS()) buildAnchors(true);
+  bool moved = false;
+  const bool ringsFree = rollupClaim(moved);
+  if (!ringsFree) Serial.println("FlashLogger: unpushed log data in the rollup area, rollups off until it can move");
+  mountIndex(moved ? 0 : lastBoot);     // a checkpoint doesn't list the copies
+  recoverSeq();
+  if (ringsFree) rollupMount();
 
-  uint32_t storedUnix = 0;
-  if (!loadLastTimestampNVS(storedUnix)) storedUnix = 0;
+  uint32_t storedUnix = _lastGoodUnix;
+  if (!haveState && !loadLastTimestampNVS(storedUnix)) storedUnix = 0;
   _lastGoodUnix = storedUnix;
   if (_rtc) {
     uint32_t bootUnix = _rtc->now().unixtime();
@@ -160,7 +827,6 @@ bool FlashLogger::begin(const FlashLoggerConfig& cfg) {
       _rtcHealthy = true;
       _rtcWarningShown = false;
       _lastGoodUnix = bootUnix;
-      saveLastTimestampNVS(bootUnix);
     } else {
       _rtcHealthy = false;
       _rtcWarningShown = false;
@@ -171,20 +837,25 @@ bool FlashLogger::begin(const FlashLoggerConfig& cfg) {
     _rtcWarningShown = false;
     Serial.println("FlashLogger: RTC not available; logging paused.");
   }
+  saveMetaState();                      // boot counter, RTC and seq floors, one record
 
   DateTime now = _rtc ? _rtc->now() : DateTime((uint32_t)_lastGoodUnix);
   _currentDay = dayIDFromDateTime(now);
+  _mountDay = _currentDay;
 
   selectOrCreateTodaySector();
   if (_currentSector >= 0) {
     findLastWritePositionInSector(_currentSector);
-    _writeAddr = _index[_currentSector].writePtr;
+    _writeAddr = _index.writePtr(_currentSector);
   } else {
     Serial.println("FlashLogger: no sector available!");
     return false;
   }
 
-  _seqCounter = 0;
+  _poolCount = 0;
+  _poolScan  = (_currentSector + 1) % _logEnd;
+  while (poolRefillStep(true)) yield();
+
   _todayBytes = 0;
   _lowSpace = false;
 
@@ -202,10 +873,41 @@ void FlashLogger::setCsvColumns(const char* cols) {
   _csvCols[sizeof(_csvCols)-1] = 0;
 }
 
-// ===== append (atomic: header -> payload -> commit) =====
+// ===== append (atomic: header + payload -> commit) =====
 bool FlashLogger::append(const String& json) {
-  if (_currentSector < 0) return false;
+  return append(json, _durability);
+}
+
+bool FlashLogger::append(const String& json, FlashDurability mode) {
+  return appendRecord(json, 0, mode, false, nullptr, nullptr);
+}
+
+bool FlashLogger::append(const String& json, uint8_t tags) {
+  return append(json, tags, _durability);
+}
+
+bool FlashLogger::append(const String& json, uint8_t tags, FlashDurability mode) {
+  return appendRecord(json, tags, mode, false, nullptr, nullptr);
+}
+
+// ===== v2.1 async engine =====
+// Stages like DEFERRED; poll() programs the buffer one page per step. Blocks
+// only where a sync append would flush anyway (buffer full, day/sector roll).
+bool FlashLogger::appendAsync(const String& json, FlashOpCallback cb, void* user) {
+  return appendRecord(json, 0, FLASH_DURABLE_DEFERRED, true, cb, user);
+}
+
+bool FlashLogger::appendRecord(const String& json, uint8_t tags, FlashDurability mode, bool async,
+                               FlashOpCallback cb, void* user) {
+  // Newline-terminated payload (no NUL)
+  String payload = json;
+  if (payload.isEmpty() || payload[payload.length()-1] != '\n') payload += '\n';
+  return appendPayload((const uint8_t*)payload.c_str(), (uint16_t)payload.length(), tags & REC_TAG_MASK, 0,
+                       mode, async, cb, user);
+}
 
+// RTC time for a new record; false (append blocked) without a sane clock.
+bool FlashLogger::appendClock(DateTime& now, uint32_t& unixNow) {
   if (!_rtc) {
     if (!_rtcWarningShown) Serial.println("FlashLogger: RTC unavailable; append blocked.");
     _rtcHealthy = false;
@@ -213,8 +915,8 @@ bool FlashLogger::append(const String& json) {
     return false;
   }
 
-  DateTime now = _rtc->now();
-  uint32_t unixNow = now.unixtime();
+  now = _rtc->now();
+  unixNow = now.unixtime();
   if (!isRtcTimestampValid(unixNow)) {
     if (!_rtcWarningShown) Serial.println("FlashLogger: RTC timestamp invalid/backwards; append blocked.");
     _rtcHealthy = false;
@@ -223,16 +925,43 @@ bool FlashLogger::append(const String& json) {
   }
   _rtcHealthy = true;
   _rtcWarningShown = false;
+  return true;
+}
 
-  // Newline-terminated payload (no NUL)
-  String payload = json;
-  if (payload.isEmpty() || payload[payload.length()-1] != '\n') payload += '\n';
-  const uint16_t payLen = (uint16_t)payload.length();
-  const uint32_t need   = sizeof(RecordHeader) + payLen + 1; // + commit
+bool FlashLogger::appendPayload(const uint8_t* payload, uint16_t payLen, uint8_t flags, uint8_t schemaId,
+                                FlashDurability mode, bool async, FlashOpCallback cb, void* user,
+                                const RecordHeader* block) {
+  if (_currentSector < 0) return false;
+
+  // A block is stored at its first sample's time, under that sample's seq.
+  // Anything else lands after the open block, so that is sealed first.
+  DateTime now;
+  uint32_t unixNow;
+  if (block) {
+    now = DateTime(block->ts + kUnixAt2000);
+    unixNow = now.unixtime();
+  } else {
+    sealBlock();
+    if (!appendClock(now, unixNow)) return false;
+  }
+
+  const uint32_t need   = sizeof(RecordHeader) + payLen + 1 + REC_TRAILER; // + commit + back link
+
+  if (!_wbBuf) {
+    _wbCap = (_cfg.writeBufferBytes < PAGE_SIZE) ? PAGE_SIZE : _cfg.writeBufferBytes;
+    _wbBuf = (uint8_t*)malloc(_wbCap);
+    if (!_wbBuf) _wbCap = 0;             // records go straight to flash
+  }
+  auto wbHasRoom = [&]() {
+    return _wbBuf && _wbCount < WB_MAX_RECORDS && (uint32_t)_wbUsed + need <= _wbCap;
+  };
+  flushIfDue();
+  if (_wbUsed && !wbHasRoom()) flush();
 
   // New day?
   uint16_t today = dayIDFromDateTime(now);
   if (today != _currentDay) {
+    flush();                             // buffered records belong to the old sector
     _currentDay  = today;
     _todayBytes  = 0;
     _lowSpace    = false;
@@ -258,6 +987,7 @@ bool FlashLogger::append(const String& json) {
 
   // Sector full?
   if (!sectorHasSpace(_currentSector, need)) {
+    flush();
     if (!moveToNextSectorSameDay()) {
       Serial.println("FlashLogger: out of sectors; append aborted.");
       return false;
@@ -268,162 +998,459 @@ bool FlashLogger::append(const String& json) {
   RecordHeader rh{};
   rh.len   = payLen;
   rh.ts    = now.secondstime();
-  rh.seq   = _seqCounter++;
-  rh.flags = 0;
-  rh.rsv   = 0;
-  rh.crc   = crc16((const uint8_t*)payload.c_str(), payLen, 0xFFFF);
-
-  // Write: header
-  pageProgram(_index[_currentSector].writePtr, (const uint8_t*)&rh, sizeof(rh));
-  if (!verifyWrite(_index[_currentSector].writePtr, (const uint8_t*)&rh, sizeof(rh))) {
-    Serial.println("Header verify FAIL (append), aborting record.");
-    return false;
-  }
-  _index[_currentSector].writePtr += sizeof(rh);
-
-  // Write: payload
-  pageProgram(_index[_currentSector].writePtr, (const uint8_t*)payload.c_str(), payLen);
-  if (!verifyWrite(_index[_currentSector].writePtr, (const uint8_t*)payload.c_str(), payLen)) {
-    Serial.println("Payload verify FAIL (append), aborting record.");
-    return false;
-  }
-  _index[_currentSector].writePtr += payLen;
-
-  // Write: commit
-  uint8_t cm = REC_COMMIT;
-  pageProgram(_index[_currentSector].writePtr, &cm, 1);
-  if (!verifyWrite(_index[_currentSector].writePtr, &cm, 1)) {
-    Serial.println("Commit verify FAIL (append), aborting record.");
-    return false;
+  rh.seq   = block ? block->seq : _seqCounter++;
+  rh.flags = REC_FLAG_BACKLINK | flags;
+  rh.rsv   = schemaId;
+  rh.crc   = crc16(payload, payLen, 0xFFFF);
+
+  const uint32_t recAddr = _index.writePtr(_currentSector);
+  const uint16_t backOff = (uint16_t)(recAddr - sectorBaseAddr(_currentSector));
+  if (wbHasRoom()) {
+    // Stage: header + payload, commit byte left erased until the batch lands
+    if (_wbUsed == 0) {
+      _wbSector  = _currentSector;
+      _wbAddr    = recAddr;
+      _wbFirstMs = millis();
+    }
+    uint8_t* dst = _wbBuf + _wbUsed;
+    memcpy(dst, &rh, sizeof(rh));
+    memcpy(dst + sizeof(rh), payload, payLen);
+    dst[sizeof(rh) + payLen] = 0xFF;
+    memcpy(dst + sizeof(rh) + payLen + 1, &backOff, REC_TRAILER);
+    _wbCb[_wbCount]     = cb;
+    _wbCbUser[_wbCount] = user;
+    _wbCommit[_wbCount++] = (uint16_t)(_wbUsed + sizeof(rh) + payLen);
+    _wbUsed = (uint16_t)(_wbUsed + need);
+    _wbLastUnix = unixNow;
+    if (mode == FLASH_DURABLE_GROUP) _wbTimed = true;
+    if (async) _wbAsync = true;
+    _index.setWritePtr(_currentSector, _index.writePtr(_currentSector) + need);
+    if (mode == FLASH_DURABLE_SYNC && !flush()) return false;
+  } else {
+    // Larger than the buffer (or no buffer): one-record batch
+    uint8_t* rec = (uint8_t*)malloc(need);
+    if (!rec) return false;
+    memcpy(rec, &rh, sizeof(rh));
+    memcpy(rec + sizeof(rh), payload, payLen);
+    const uint16_t commitOff = (uint16_t)(sizeof(rh) + payLen);
+    rec[commitOff] = 0xFF;
+    memcpy(rec + commitOff + 1, &backOff, REC_TRAILER);
+    const bool ok = programBatch(recAddr, rec, need, &commitOff, 1);
+    free(rec);
+    if (cb) cb(FLASH_OP_APPEND, ok, rh.seq, user);
+    if (!ok) {
+      Serial.println("Record verify FAIL (append), sealing sector.");
+      sealSector(_currentSector);
+      return false;
+    }
+    _index.setWritePtr(_currentSector, _index.writePtr(_currentSector) + need);
   }
-  _index[_currentSector].writePtr += 1;
 
-  _writeAddr  = _index[_currentSector].writePtr;
+  if (_zOpenSector == _currentSector || _zones.loaded(_currentSector)) zoneAppend(rh, payload);
+  if (!block) rollupFeed(rh, payload);                 // block samples were fed one by one
+  _writeAddr  = _index.writePtr(_currentSector);
   _todayBytes += need;
-  _lastGoodUnix = unixNow;
-  saveLastTimestampNVS(unixNow);
+  if (!block) _lastGoodUnix = unixNow;
 
   Serial.printf("APPEND @0x%06lX (sec %d) len=%u\n",
                 _writeAddr - need, _currentSector, (unsigned)payLen);
   return true;
 }
 
-// ===== formatted print (CRC + commit enforced) =====
-void FlashLogger::printFormattedLogs() {
-  buildSummaries();
-  for (int i = 0; i < _dayCount; ++i) {
-    const uint16_t day = _days[i].dayID;
-    char dateBuf[20]; formatDayID(day, dateBuf, sizeof(dateBuf));
-    Serial.println("----------------------------------");
-    Serial.printf("date %s\n{\n", dateBuf);
+// ===== v2.1 group commit =====
+bool FlashLogger::flush() {
+  const bool sealed = sealBlock();
+  drainBatch();
+  if (!_wbUsed) return sealed;
+  const bool ok = programBatch(_wbAddr, _wbBuf, _wbUsed, _wbCommit, _wbCount);
+  completeBatch(_wbCount, _wbUsed, ok);
+  if (ok && _jActive >= 0 && _lastGoodUnix - _stateSavedUnix >= STATE_SAVE_SECS) saveMetaState();  // RTC and seq floors
+  return ok && sealed;
+}
 
-    // print all sectors that belong to this day (order doesn’t matter)
-    for (int s = 0; s < MAX_SECTORS; ++s) {
-      if (s == FACTORY_SECTOR) continue;
-      if (!_index[s].present) continue;
-      if (_index[s].dayID != day) continue;
-      printSectorData(s);
-      yield();
-    }
-    Serial.println("}\n----------------------------------");
+// Retire the first `recs` records (`bytes` long) of the buffer: report to
+// callbacks, slide the rest down. A failed batch seals the sector, so
+// everything staged behind it fails with it.
+void FlashLogger::completeBatch(uint8_t recs, uint16_t bytes, bool ok) {
+  if (!ok) {
+    Serial.printf("FlashLogger: batch verify FAIL (%u records), sealing sector %d\n",
+                  (unsigned)_wbCount, _wbSector);
+    sealSector(_wbSector);
+    recs  = _wbCount;
+    bytes = _wbUsed;
+  }
+  for (uint8_t k = 0; k < recs; ++k) {
+    if (!_wbCb[k]) continue;
+    RecordHeader rh;
+    memcpy(&rh, _wbBuf + (k ? _wbCommit[k - 1] + 1 + REC_TRAILER : 0), sizeof(rh));
+    _wbCb[k](FLASH_OP_APPEND, ok, rh.seq, _wbCbUser[k]);
   }
-}
 
+  memmove(_wbBuf, _wbBuf + bytes, _wbUsed - bytes);
+  for (uint8_t k = recs; k < _wbCount; ++k) {
+    _wbCommit[k - recs] = (uint16_t)(_wbCommit[k] - bytes);
+    _wbCb[k - recs]     = _wbCb[k];
+    _wbCbUser[k - recs] = _wbCbUser[k];
+  }
+  _wbUsed  = (uint16_t)(_wbUsed - bytes);
+  _wbCount = (uint8_t)(_wbCount - recs);
+  _wbAddr += bytes;
+  _wbInflight = 0;
+  _wbInflightRecs = 0;
+  if (!_wbUsed) { _wbTimed = false; _wbAsync = false; }
+}
 
-// ===== raw dump (valid records only) =====
-void FlashLogger::readAll() {
-  Serial.println("=== RAW DUMP (valid records only) ===");
-  uint8_t b;
+bool FlashLogger::flushIfDue() {
+  if (_blk && _blk->count && _blk->timed &&
+      (uint32_t)(millis() - _blk->firstMs) >= _cfg.groupCommitMs) {
+    sealBlock();
+  }
+  if (!_wbUsed || !_wbTimed) return true;
+  if ((uint32_t)(millis() - _wbFirstMs) < _cfg.groupCommitMs) return true;
+  return flush();
+}
 
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
+// Two phases: (1) records with their commit bytes still erased, read back;
+// (2) commit bytes stamped with one program per page they fall in (0xFF
+// between them leaves the record data untouched). A cut in either phase
+// leaves uncommitted records, which readers stop at and mount seals.
+bool FlashLogger::programBatch(uint32_t addr, const uint8_t* data, uint32_t len,
+                               const uint16_t* commitOffs, uint8_t commits) {
+  pageProgram(addr, data, len);
+  if (!verifyWrite(addr, data, len)) return false;
+
+  uint8_t span[PAGE_SIZE];
+  uint8_t i = 0;
+  while (i < commits) {
+    const uint8_t from = i;
+    uint32_t first, n;
+    i = commitSpan(addr, commitOffs, from, commits, span, first, n);
+    pageProgram(first, span, n);
+    readData(first, span, n);
+    for (uint8_t k = from; k < i; ++k)
+      if (span[addr + commitOffs[k] - first] != REC_COMMIT) return false;
+  }
+  return true;
+}
 
-    uint32_t base = sectorBaseAddr(s);
-    Serial.printf("\n[SECTOR %d @ 0x%06lX] dayID=%u pushed=%d\n",
-                  s, base, _index[s].dayID, (int)_index[s].pushed);
-
-    uint32_t ptr = base + sizeof(SectorHeader);
-    while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-      RecordHeader rh;
-      readData(ptr, (uint8_t*)&rh, sizeof(rh));
-      if (rh.len == 0xFFFF || rh.len == 0x0000) break;
-      if (ptr + sizeof(rh) + rh.len + 1 > base + SECTOR_SIZE) break;
-
-      // read payload + compute crc
-      uint32_t p = ptr + sizeof(rh);
-      uint16_t remaining = rh.len;
-      uint16_t crc = 0xFFFF;
-      static uint8_t buf[PAGE_SIZE];
-
-      while (remaining) {
-        uint16_t chunk = min<uint16_t>(remaining, PAGE_SIZE);
-        readData(p, buf, chunk);
-        crc = crc16(buf, chunk, crc);
-        for (int i=0;i<chunk;i++) Serial.write(buf[i]);
-        p += chunk;
-        remaining -= chunk;
-        yield();
-      }
+// Commit bytes [from, ret) that share a page, as one 0xFF-padded span.
+uint8_t FlashLogger::commitSpan(uint32_t addr, const uint16_t* commitOffs, uint8_t from,
+                                uint8_t commits, uint8_t* span, uint32_t& first,
+                                uint32_t& n) const {
+  first = addr + commitOffs[from];
+  const uint32_t pageEnd = (first & ~(uint32_t)(PAGE_SIZE - 1)) + PAGE_SIZE;
+  uint32_t last = first;
+  memset(span, 0xFF, PAGE_SIZE);
+  uint8_t i = from;
+  while (i < commits && addr + commitOffs[i] < pageEnd) {
+    last = addr + commitOffs[i];
+    span[last - first] = REC_COMMIT;
+    ++i;
+  }
+  n = last - first + 1;
+  return i;
+}
 
-      // commit check
-      readData(ptr + sizeof(rh) + rh.len, &b, 1);
-      if (b != REC_COMMIT || crc != rh.crc) {
-        Serial.println(F("[corrupt/partial record skipped]"));
-        break;
-      }
+bool FlashLogger::eraseAsync(int sector, FlashOpCallback cb, void* user) {
+  if (sector < 0 || isMetaSector(sector)) return false;
+  if (sector == _currentSector || (_wbUsed && sector == _wbSector)) return false;
+  return queueErase(sector, cb, user, true);
+}
 
-      ptr += sizeof(rh) + rh.len + 1;
-    }
-  }
-  Serial.println("\n=== END RAW DUMP ===");
+bool FlashLogger::queueErase(int sector, FlashOpCallback cb, void* user, bool count) {
+  if (_eraseCount >= ERASE_QUEUE || eraseQueued(sector)) return false;
+  if (_ckptLive) ckptTouch(sector);
+  _eraseQ[(_eraseHead + _eraseCount++) % ERASE_QUEUE] = { sector, cb, user, count };
+  return true;
 }
 
-// ===== push marking =====
-void FlashLogger::markDayPushed(uint16_t dayID) {
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (_index[s].present && _index[s].dayID == dayID) {
-      _index[s].pushed = true;
-      SectorHeader hdr;
-      if (readSectorHeader(s, hdr)) {
-        hdr.pushed = 1;
-        pageProgram(sectorBaseAddr(s), (const uint8_t*)&hdr, sizeof(SectorHeader));
-        verifyWrite(sectorBaseAddr(s), (const uint8_t*)&hdr, sizeof(SectorHeader));
-      }
-    }
-  }
-  Serial.printf("Marked day %u as pushed.\n", dayID);
+bool FlashLogger::eraseQueued(int sector) const {
+  for (uint8_t i = 0; i < _eraseCount; ++i)
+    if (_eraseQ[(_eraseHead + i) % ERASE_QUEUE].sector == sector) return true;
+  return false;
 }
-void FlashLogger::markCurrentDayPushed() { markDayPushed(_currentDay); }
 
-// ===== gc (generation-aware note in print) =====
-void FlashLogger::gc() {
+// Same selection as gc(); intents are marked now, erases run from poll().
+uint8_t FlashLogger::gcAsync() {
   DateTime now = _rtc->now();
   uint16_t todayID = dayIDFromDateTime(now);
-  Serial.println("🧹 GC: checking sectors...");
-
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    if (!_index[s].pushed) continue;
-
+  uint8_t queued = 0;
+  for (int s = 0; s < _sectorCount && _eraseCount < ERASE_QUEUE; ++s) {
+    if (s == _factorySector) continue;
+    if (!_index.present(s) || !_index.pushed(s)) continue;
+    if (s == _currentSector || eraseQueued(s)) continue;
     SectorHeader hdr;
     if (!readSectorHeader(s, hdr)) continue;
+    if (!isOlderThanNDays(todayID, hdr.dayID, _cfg.retentionDays)) continue;
+    if (!markSectorEraseIntent(s)) continue;
+    if (eraseAsync(s)) ++queued;
+  }
+  return queued;
+}
 
-    if (isOlderThanNDays(todayID, hdr.dayID, 7)) {
-      if (!markSectorEraseIntent(s)) {
-        Serial.printf("  skip sector %d: failed to mark erase intent\n", s);
+// One step per call: never waits on WIP. Batches go before erases so a
+// queued GC can't hold records in RAM for long.
+bool FlashLogger::poll() {
+  if (_eraseSuspended) {
+    resumeErase();
+    return true;
+  }
+  if (_chipBusy) {
+    if (readStatusReg() & 0x01) return true;
+    _chipBusy = false;
+  }
+  switch (_as) {
+    case AS_IDLE:
+      if (_wbAsync && _wbUsed) {
+        _wbInflight     = _wbUsed;
+        _wbInflightRecs = _wbCount;
+        _asOff = 0;
+        _as = AS_PROGRAM;
+      } else if (_eraseCount) {
+        // Drop the sector from the index now: reads that preempt the erase
+        // must not walk a half-erased sector.
+        const int s = _eraseQ[_eraseHead].sector;
+        _index.clear(s);
+        issueErase(sectorBaseAddr(s));
+        _as = AS_ERASE;
+        return true;
+      } else {
+        if (!_jSpareClean && _jActive >= 0) {         // erase-ahead for the next compaction
+          queueErase(journalSpare(), onJournalErase, this, false);
+          return true;
+        }
+        if (rollupEraseAhead()) return true;
+        return poolRefillStep(false);
+      }
+      // fall through
+    case AS_PROGRAM: {
+      const uint32_t addr = _wbAddr + _asOff;
+      const uint32_t room = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+      const uint32_t n    = min<uint32_t>(room, _wbInflight - _asOff);
+      issueProgram(addr, _wbBuf + _asOff, n);
+      _asOff = (uint16_t)(_asOff + n);
+      if (_asOff >= _wbInflight) _as = AS_VERIFY;
+      return true;
+    }
+    case AS_VERIFY:
+      if (!verifyWrite(_wbAddr, _wbBuf, _wbInflight)) {
+        _as = AS_IDLE;
+        completeBatch(_wbInflightRecs, _wbInflight, false);
+        return true;
+      }
+      _asRec = 0;
+      _as = AS_COMMIT;
+      // fall through
+    case AS_COMMIT:
+      if (_asRec < _wbInflightRecs) {
+        uint8_t span[PAGE_SIZE];
+        uint32_t first, n;
+        _asRec = commitSpan(_wbAddr, _wbCommit, _asRec, _wbInflightRecs, span, first, n);
+        issueProgram(first, span, n);
+        return true;
+      }
+      _as = AS_COMMIT_CHECK;
+      // fall through
+    case AS_COMMIT_CHECK: {
+      bool ok = true;
+      for (uint8_t k = 0; k < _wbInflightRecs && ok; ++k) {
+        uint8_t c;
+        readData(_wbAddr + _wbCommit[k], &c, 1);
+        ok = (c == REC_COMMIT);
+      }
+      _as = AS_IDLE;
+      completeBatch(_wbInflightRecs, _wbInflight, ok);
+      return true;
+    }
+    case AS_ERASE: {
+      const EraseJob job = _eraseQ[_eraseHead];
+      _eraseHead = (uint8_t)((_eraseHead + 1) % ERASE_QUEUE);
+      _eraseCount--;
+      _as = AS_IDLE;
+      const bool ok = finishErase(sectorBaseAddr(job.sector), job.count);
+      if (job.cb) job.cb(FLASH_OP_ERASE, ok, (uint32_t)job.sector, job.user);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Finish the batch in flight (if any) with blocking waits.
+void FlashLogger::drainBatch() {
+  while (_as != AS_IDLE && _as != AS_ERASE) {
+    if (_chipBusy) waitChipIdle();
+    poll();
+  }
+}
+
+void FlashLogger::drainAsync() {
+  while (poll()) {
+    if (_chipBusy) delay(1);
+  }
+}
+
+// ===== v2.1 pre-erased pool =====
+bool FlashLogger::poolTake(int& sector) {
+  if (!_poolCount) return false;
+  sector = _pool[0];
+  memmove(&_pool[0], &_pool[1], (--_poolCount) * sizeof(int));
+  return true;
+}
+
+void FlashLogger::poolDrop(int sector) {
+  for (uint8_t i = 0; i < _poolCount; ++i) {
+    if (_pool[i] != sector) continue;
+    memmove(&_pool[i], &_pool[i + 1], (_poolCount - i - 1) * sizeof(int));
+    _poolCount--;
+    return;
+  }
+}
+
+bool FlashLogger::sectorBlank(int sector) {
+  uint8_t buf[PAGE_SIZE];
+  const uint32_t base = sectorBaseAddr(sector);
+  for (uint32_t off = 0; off < SECTOR_SIZE; off += PAGE_SIZE) {
+    readData(base + off, buf, PAGE_SIZE);
+    for (uint8_t b : buf) if (b != 0xFF) return false;
+  }
+  return true;
+}
+
+void FlashLogger::onPoolErase(FlashOpKind, bool ok, uint32_t ref, void* user) {
+  FlashLogger* self = static_cast<FlashLogger*>(user);
+  if (ok && self->_poolCount < POOL_MAX) self->_pool[self->_poolCount++] = (int)ref;
+}
+
+// One candidate per call, walking forward from the write head like
+// moveToNextSectorSameDay. Blank sectors join as-is (no wear); anything else
+// unused is erased first (async from poll(), inline when blocking).
+// Returns false once the pool is full or nothing is left to add.
+bool FlashLogger::poolRefillStep(bool blocking) {
+  const uint8_t want = (_cfg.erasedPoolSize < POOL_MAX) ? _cfg.erasedPoolSize : POOL_MAX;
+  uint8_t erasing = 0;
+  for (uint8_t i = 0; i < _eraseCount; ++i)
+    if (_eraseQ[(_eraseHead + i) % ERASE_QUEUE].cb == onPoolErase) ++erasing;
+  if (_poolCount + erasing >= want || _eraseCount >= ERASE_QUEUE) return false;
+
+  for (int tries = 0; tries < _sectorCount; ++tries) {
+    const int s = _poolScan;
+    _poolScan = (_poolScan + 1) % _logEnd;
+    if (s == _currentSector || _index.present(s) || isBadSector(s)) continue;
+    bool pooled = false;
+    for (uint8_t i = 0; i < _poolCount; ++i) pooled |= (_pool[i] == s);
+    if (pooled || eraseQueued(s)) continue;
+
+    if (sectorBlank(s)) {
+      _pool[_poolCount++] = s;
+    } else if (blocking) {
+      sectorErase(sectorBaseAddr(s));
+      if (!isBadSector(s)) _pool[_poolCount++] = s;
+    } else {
+      eraseAsync(s, onPoolErase, this);
+    }
+    return true;
+  }
+  return false;
+}
+
+void FlashLogger::refillErasedPool() {
+  flush();
+  while (poolRefillStep(true)) yield();
+}
+
+void FlashLogger::sealSector(int sector) {
+  if (sector < 0 || sector >= _sectorCount) return;
+  _index.setWritePtr(sector, sectorBaseAddr(sector) + SECTOR_SIZE);
+  if (sector == _currentSector) _writeAddr = _index.writePtr(sector);
+}
+
+// ===== formatted print (CRC + commit enforced) =====
+void FlashLogger::printFormattedLogs() {
+  flush();
+  buildSummaries();
+  for (int i = 0; i < _dayCount; ++i) {
+    const uint16_t day = _days[i].dayID;
+    char dateBuf[20]; formatDayID(day, dateBuf, sizeof(dateBuf));
+    Serial.println("----------------------------------");
+    Serial.printf("date %s\n{\n", dateBuf);
+
+    // print all sectors that belong to this day (order doesn’t matter)
+    for (int s = 0; s < _sectorCount; ++s) {
+      if (s == _factorySector) continue;
+      if (!_index.present(s)) continue;
+      if (_index.day(s) != day) continue;
+      printSectorData(s);
+      yield();
+    }
+    Serial.println("}\n----------------------------------");
+  }
+}
+
+
+// ===== raw dump (valid records only) =====
+void FlashLogger::readAll() {
+  flush();
+  Serial.println("=== RAW DUMP (valid records only) ===");
+
+  for (int s = _index.chainFirst(); s >= 0; s = _index.chainNext(s)) {
+
+    uint32_t base = sectorBaseAddr(s);
+    Serial.printf("\n[SECTOR %d @ 0x%06lX] dayID=%u pushed=%d\n",
+                  s, base, _index.day(s), (int)_index.pushed(s));
+
+    printSectorData(s);
+  }
+  Serial.println("\n=== END RAW DUMP ===");
+}
+
+// ===== push marking =====
+void FlashLogger::markDayPushed(uint16_t dayID) {
+  for (int s = 0; s < _sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    if (_index.present(s) && _index.day(s) == dayID) {
+      _index.setPushed(s, true);
+      SectorHeader hdr;
+      if (readSectorHeader(s, hdr) && hdr.pushed == 0xFF) {
+        hdr.pushed = 1;
+        pageProgram(sectorBaseAddr(s), (const uint8_t*)&hdr, sizeof(SectorHeader));
+        verifyWrite(sectorBaseAddr(s), (const uint8_t*)&hdr, sizeof(SectorHeader));
+      }
+    }
+  }
+  Serial.printf("Marked day %u as pushed.\n", dayID);
+}
+void FlashLogger::markCurrentDayPushed() { markDayPushed(_currentDay); }
+
+// ===== gc (generation-aware note in print) =====
+void FlashLogger::gc() {
+  flush();
+  drainAsync();
+  DateTime now = _rtc->now();
+  uint16_t todayID = dayIDFromDateTime(now);
+  Serial.println("🧹 GC: checking sectors...");
+
+  for (int s = 0; s < _sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    if (!_index.present(s)) continue;
+    if (!_index.pushed(s)) continue;
+
+    SectorHeader hdr;
+    if (!readSectorHeader(s, hdr)) continue;
+
+    if (isOlderThanNDays(todayID, hdr.dayID, _cfg.retentionDays)) {
+      if (!markSectorEraseIntent(s)) {
+        Serial.printf("  skip sector %d: failed to mark erase intent\n", s);
         continue;
       }
       uint32_t base = sectorBaseAddr(s);
       sectorErase(base); // counts erase & verifies (quarantine if fail)
-      _index[s] = {false, 0, false, 0};
+      _index.clear(s);
       Serial.printf("  erased sector %d (day=%u, gen=%lu)\n", s, hdr.dayID, (unsigned long)hdr.generation);
     }
     yield();
   }
-  buildAnchors(true);
+  rollupGc(todayID);
+  refillErasedPool();
 }
 
 // ===== setDateStyle =====
@@ -435,23 +1462,302 @@ void FlashLogger::setDateStyle(uint8_t style) {
 }
 
 // ===== low-level =====
+// All flash traffic goes through busBegin/busWrite/busRead/busEnd so the three
+// transfer paths (byte, bulk, DMA) share one command layer.
+void FlashLogger::busBegin() {
+  const uint32_t hz = _cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000;
+  _io.transactions++;
+#if FLASHLOGGER_HAS_SPI_MASTER
+  if (_xfer == FLASH_XFER_DMA) {
+    spi_device_acquire_bus((spi_device_handle_t)_dmaDev, portMAX_DELAY);
+    digitalWrite(_cs, LOW);
+    return;
+  }
+#endif
+  _spi->beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
+  digitalWrite(_cs, LOW);
+}
+
+void FlashLogger::busEnd() {
+  digitalWrite(_cs, HIGH);
+#if FLASHLOGGER_HAS_SPI_MASTER
+  if (_xfer == FLASH_XFER_DMA) {
+    spi_device_release_bus((spi_device_handle_t)_dmaDev);
+    return;
+  }
+#endif
+  _spi->endTransaction();
+}
+
+void FlashLogger::busWrite(const uint8_t* data, uint32_t len) {
+  switch (_xfer) {
+    case FLASH_XFER_BYTE:
+      for (uint32_t i = 0; i < len; ++i) _spi->transfer(data[i]);
+      break;
+#if FLASHLOGGER_HAS_SPI_MASTER
+    case FLASH_XFER_DMA: {
+      spi_device_handle_t dev = (spi_device_handle_t)_dmaDev;
+      while (len) {
+        uint32_t n = len > DMA_CHUNK ? DMA_CHUNK : len;
+        spi_transaction_t t = {};
+        t.length = n * 8;
+        if (n <= 4) {
+          t.flags = SPI_TRANS_USE_TXDATA;
+          memcpy(t.tx_data, data, n);
+        } else {
+          memcpy(_dmaBuf, data, n);
+          t.tx_buffer = _dmaBuf;
+        }
+        spi_device_polling_transmit(dev, &t);
+        data += n; len -= n;
+      }
+      break;
+    }
+#endif
+    default:
+      _spi->writeBytes(data, len);
+      break;
+  }
+  _io.bytesWritten += len;
+}
+
+void FlashLogger::busRead(uint8_t* buf, uint32_t len, uint8_t lines) {
+  (void)lines;                         // only the DMA path drives dual/quad
+  _io.bytesRead += len;
+  switch (_xfer) {
+    case FLASH_XFER_BYTE:
+      for (uint32_t i = 0; i < len; ++i) buf[i] = _spi->transfer(0x00);
+      break;
+#if FLASHLOGGER_HAS_SPI_MASTER
+    case FLASH_XFER_DMA: {
+      spi_device_handle_t dev = (spi_device_handle_t)_dmaDev;
+      const bool queued = len >= _cfg.dmaMinBytes;
+      if (queued) _io.dmaReads++;
+      while (len) {
+        uint32_t n = len > DMA_CHUNK ? DMA_CHUNK : len;
+        spi_transaction_t t = {};
+        t.rxlength = n * 8;
+        if (lines == 4)      t.flags = SPI_TRANS_MODE_QIO;
+        else if (lines == 2) t.flags = SPI_TRANS_MODE_DIO;
+        if (n <= 4) {
+          t.flags |= SPI_TRANS_USE_RXDATA;
+        } else {
+          t.rx_buffer = _dmaBuf;
+        }
+        // short reads poll; long reads sleep on the DMA completion interrupt
+        if (queued) spi_device_transmit(dev, &t);
+        else        spi_device_polling_transmit(dev, &t);
+        memcpy(buf, (n <= 4) ? t.rx_data : _dmaBuf, n);
+        buf += n; len -= n;
+      }
+      break;
+    }
+#endif
+    default:
+      // in-place burst; MOSI idles high while clocking data in
+      memset(buf, 0xFF, len);
+      _spi->transferBytes(buf, buf, len);
+      break;
+  }
+}
+
+void FlashLogger::busCmdAddr(uint8_t cmd, uint32_t addr, bool wide) {
+  uint8_t b[5];
+  uint8_t n = 0;
+  b[n++] = cmd;
+  if (wide) b[n++] = (uint8_t)((addr >> 24) & 0xFF);
+  b[n++] = (uint8_t)((addr >> 16) & 0xFF);
+  b[n++] = (uint8_t)((addr >> 8) & 0xFF);
+  b[n++] = (uint8_t)(addr & 0xFF);
+  busWrite(b, n);
+  _io.bytesWritten -= n;         // count payload only
+}
+
+bool FlashLogger::dmaInit() {
+#if FLASHLOGGER_HAS_SPI_MASTER
+  if (_dmaDev) return true;
+  if (_cfg.spi_sck_pin < 0 || _cfg.spi_mosi_pin < 0 || _cfg.spi_miso_pin < 0) return false;
+  const spi_host_device_t host = (_cfg.spi_host >= 0) ? (spi_host_device_t)_cfg.spi_host : SPI2_HOST;
+
+  spi_bus_config_t bus = {};
+  bus.mosi_io_num   = _cfg.spi_mosi_pin;
+  bus.miso_io_num   = _cfg.spi_miso_pin;
+  bus.sclk_io_num   = _cfg.spi_sck_pin;
+  bus.quadwp_io_num = _cfg.spi_wp_pin;   // -1 unless quad reads are wired
+  bus.quadhd_io_num = _cfg.spi_hd_pin;
+  bus.max_transfer_sz = DMA_CHUNK;
+  esp_err_t err = spi_bus_initialize(host, &bus, SPI_DMA_CH_AUTO);
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return false;
+
+  spi_device_interface_config_t dev = {};
+  dev.clock_speed_hz = (int)(_cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000);
+  dev.mode           = 0;
+  dev.spics_io_num   = -1;           // CS stays under our control (multi-phase frames)
+  dev.queue_size     = 1;
+  dev.flags          = SPI_DEVICE_HALFDUPLEX;
+  spi_device_handle_t handle = nullptr;
+  if (spi_bus_add_device(host, &dev, &handle) != ESP_OK) {
+    spi_bus_free(host);
+    return false;
+  }
+  _dmaBuf = (uint8_t*)heap_caps_malloc(DMA_CHUNK, MALLOC_CAP_DMA);
+  if (!_dmaBuf) {
+    spi_bus_remove_device(handle);
+    spi_bus_free(host);
+    return false;
+  }
+  _dmaDev = handle;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void FlashLogger::dmaRelease() {
+#if FLASHLOGGER_HAS_SPI_MASTER
+  if (!_dmaDev) return;
+  const spi_host_device_t host = (_cfg.spi_host >= 0) ? (spi_host_device_t)_cfg.spi_host : SPI2_HOST;
+  spi_bus_remove_device((spi_device_handle_t)_dmaDev);
+  spi_bus_free(host);
+  heap_caps_free(_dmaBuf);
+  _dmaDev = nullptr;
+  _dmaBuf = nullptr;
+#endif
+}
+
+bool FlashLogger::setSpiTransfer(FlashSpiXfer mode) {
+  if (mode == _xfer) return true;
+  bool ok = true;
+  bool reattach = false;
+  if (mode == FLASH_XFER_DMA) {
+    _spi->end();                       // spi_master takes over the pins
+    if (!dmaInit()) {
+      Serial.println("FlashLogger: DMA path unavailable, using bulk transfers");
+      mode = FLASH_XFER_BULK;
+      ok = false;
+      reattach = true;
+    }
+  } else if (_xfer == FLASH_XFER_DMA) {
+    dmaRelease();
+    reattach = true;
+  }
+  if (reattach) {
+    if (_cfg.spi_sck_pin >= 0 && _cfg.spi_mosi_pin >= 0 && _cfg.spi_miso_pin >= 0) {
+      _spi->begin(_cfg.spi_sck_pin, _cfg.spi_miso_pin, _cfg.spi_mosi_pin, _cfg.spi_cs_pin);
+    } else {
+      _spi->begin();
+    }
+  }
+  _xfer = mode;
+  applyReadMode();                     // dual/quad need the DMA path
+  return ok;
+}
+
+// ===== read mode (v2.1) =====
+// 0x0B is universal on SPI NOR; 1-1-2 / 1-1-4 come from the SFDP basic
+// parameter table (DWORD1 bits 16 and 22). Winbond parts without SFDP are
+// assumed to support both, anything that answers 00/FF stays on 0x03.
+void FlashLogger::probeReadCaps() {
+  const uint8_t cmd = CMD_JEDEC_ID;
+  uint8_t id[3] = { 0, 0, 0 };
+  busBegin();
+  busWrite(&cmd, 1);
+  busRead(id, sizeof(id));
+  busEnd();
+  _jedecId  = ((uint32_t)id[0] << 16) | ((uint32_t)id[1] << 8) | id[2];
+  _readCaps = 0;
+  _chipBytes = 0;
+  if (id[0] == 0x00 || id[0] == 0xFF) return;
+  _readCaps = READ_CAP_FAST;
+
+  uint8_t hdr[16];
+  readSfdp(0, hdr, sizeof(hdr));
+  if (memcmp(hdr, "SFDP", 4) == 0) {
+    // first parameter header (offset 8) is always the BFPT
+    uint32_t ptr = (uint32_t)hdr[12] | ((uint32_t)hdr[13] << 8) | ((uint32_t)hdr[14] << 16);
+    uint8_t d[8];
+    readSfdp(ptr, d, sizeof(d));
+    uint32_t dw1 = (uint32_t)d[0] | ((uint32_t)d[1] << 8) | ((uint32_t)d[2] << 16) | ((uint32_t)d[3] << 24);
+    uint32_t dw2 = (uint32_t)d[4] | ((uint32_t)d[5] << 8) | ((uint32_t)d[6] << 16) | ((uint32_t)d[7] << 24);
+    if (dw1 & (1UL << 16)) _readCaps |= READ_CAP_DUAL;
+    if (dw1 & (1UL << 22)) _readCaps |= READ_CAP_QUAD;
+    // DWORD2: density in bits, N-1 or (bit 31) 2^N; >= 4 GB is left to the cap
+    const uint64_t bits = (dw2 & 0x80000000UL) ? ((dw2 & 0x7FFFFFFFUL) < 35 ? 1ULL << (dw2 & 0x7FFFFFFFUL) : 0)
+                                               : (uint64_t)dw2 + 1;
+    if (bits >= 8ULL * 65536 && bits < (8ULL << 32)) _chipBytes = (uint32_t)(bits / 8);
+  } else if (id[0] == 0xEF) {
+    _readCaps |= READ_CAP_DUAL | READ_CAP_QUAD;
+  }
+  if (!_chipBytes && id[2] >= 16 && id[2] < 32) _chipBytes = 1UL << id[2];   // W25Q: log2 bytes
+}
+
+void FlashLogger::readSfdp(uint32_t addr, uint8_t* buf, uint32_t len) {
+  const uint8_t dummy = 0xFF;
+  busBegin();
+  busCmdAddr(CMD_READ_SFDP, addr);
+  busWrite(&dummy, 1);
+  busRead(buf, len);
+  busEnd();
+}
+
+// Sets SR2.QE (non-volatile, written once). Tries the SR2 write (0x31) first
+// and falls back to the two-byte 0x01 form used by older W25Q revisions.
+bool FlashLogger::enableQuad() {
+  uint8_t cmd = CMD_RDSR2;
+  uint8_t sr2 = 0;
+  busBegin(); busWrite(&cmd, 1); busRead(&sr2, 1); busEnd();
+  if (sr2 & SR2_QE) return true;
+
+  uint8_t w[3] = { CMD_WRSR2, (uint8_t)(sr2 | SR2_QE), 0 };
+  writeEnable();
+  busBegin(); busWrite(w, 2); busEnd();
+  waitWhileBusy(50);
+  busBegin(); busWrite(&cmd, 1); busRead(&sr2, 1); busEnd();
+  if (sr2 & SR2_QE) return true;
+
+  w[0] = CMD_WRSR; w[1] = readStatusReg(); w[2] = (uint8_t)(sr2 | SR2_QE);
+  writeEnable();
+  busBegin(); busWrite(w, 3); busEnd();
+  waitWhileBusy(50);
+  busBegin(); busWrite(&cmd, 1); busRead(&sr2, 1); busEnd();
+  return (sr2 & SR2_QE) != 0;
+}
+
+void FlashLogger::applyReadMode() {
+  FlashReadMode m = _readModeReq;
+  const bool multiLine = (_xfer == FLASH_XFER_DMA);
+  const bool quadPins  = multiLine && _cfg.spi_wp_pin >= 0 && _cfg.spi_hd_pin >= 0;
+  if (m == FLASH_READ_AUTO) {
+    m = FLASH_READ_QUAD;
+    // single-line 0x0B only pays off above the 0x03 clock limit
+    if (!multiLine && _cfg.spi_clock_hz <= NORMAL_READ_MAX_HZ) m = FLASH_READ_NORMAL;
+  }
+  if (m == FLASH_READ_QUAD && !((_readCaps & READ_CAP_QUAD) && quadPins && enableQuad())) m = FLASH_READ_DUAL;
+  if (m == FLASH_READ_DUAL && !((_readCaps & READ_CAP_DUAL) && multiLine)) m = FLASH_READ_FAST;
+  if (m == FLASH_READ_FAST && !(_readCaps & READ_CAP_FAST)) m = FLASH_READ_NORMAL;
+  _readMode = m;
+}
+
+bool FlashLogger::setReadMode(FlashReadMode mode) {
+  _readModeReq = mode;
+  applyReadMode();
+  return mode == FLASH_READ_AUTO || _readMode == mode;
+}
+
 void FlashLogger::writeEnable() {
-  const uint32_t hz = _cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000;
-  SPI.beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
-  digitalWrite(_cs, LOW);
-  SPI.transfer(CMD_WREN);
-  digitalWrite(_cs, HIGH);
-  SPI.endTransaction();
+  const uint8_t cmd = CMD_WREN;
+  busBegin();
+  busWrite(&cmd, 1);
+  busEnd();
 }
 
 uint8_t FlashLogger::readStatusReg() {
-  const uint32_t hz = _cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000;
-  SPI.beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
-  digitalWrite(_cs, LOW);
-  SPI.transfer(CMD_RDSR1);
-  uint8_t sr = SPI.transfer(0x00);
-  digitalWrite(_cs, HIGH);
-  SPI.endTransaction();
+  const uint8_t cmd = CMD_RDSR1;
+  uint8_t sr = 0;
+  busBegin();
+  busWrite(&cmd, 1);
+  busRead(&sr, 1);
+  busEnd();
   return sr;
 }
 
@@ -460,78 +1766,152 @@ void FlashLogger::waitWhileBusy(uint32_t timeout_ms) {
   while (true) {
     if ((readStatusReg() & 0x01) == 0) break;
     delay(1);
-    if (timeout_ms && (millis() - start) >= timeout_ms) break;
+    if (timeout_ms && (uint32_t)(millis() - start) >= timeout_ms) break;
   }
 }
 
-void FlashLogger::readData(uint32_t addr, uint8_t* buf, uint16_t len) {
-  const uint32_t hz = _cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000;
-  SPI.beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
-  digitalWrite(_cs, LOW);
-  SPI.transfer(CMD_READ);
-  SPI.transfer((addr >> 16) & 0xFF);
-  SPI.transfer((addr >> 8)  & 0xFF);
-  SPI.transfer(addr         & 0xFF);
-  for (uint16_t i = 0; i < len; ++i) buf[i] = SPI.transfer(0x00);
-  digitalWrite(_cs, HIGH);
-  SPI.endTransaction();
+// Blocking paths call this before touching a chip poll() left busy.
+void FlashLogger::waitChipIdle() {
+  waitWhileBusy(1000);
+  _chipBusy = false;
+}
+
+// Reads and page programs (mayPreempt) park an async erase instead of waiting
+// it out; erases and status writes need the chip to themselves.
+void FlashLogger::prepareChip(bool mayPreempt) {
+  if (_eraseSuspended) {
+    if (mayPreempt) return;
+    resumeErase();
+  }
+  if (!_chipBusy) return;
+  if (mayPreempt && _as == AS_ERASE && suspendErase()) return;
+  waitChipIdle();
+}
+
+// W25Q erase suspend: WIP drops within tSUS (20 us) and SR2.SUS is set. An
+// erase needs some run time between resume and the next suspend to make
+// progress, so back-to-back preemptions are spaced by ERASE_MIN_RUN_US.
+bool FlashLogger::suspendErase() {
+  const uint32_t ran = micros() - _resumeAtUs;
+  if (_resumeAtUs && ran < ERASE_MIN_RUN_US) delayMicroseconds(ERASE_MIN_RUN_US - ran);
+
+  const uint32_t t0 = micros();
+  const uint8_t cmd = CMD_ERASE_SUSPEND;
+  busBegin();
+  busWrite(&cmd, 1);
+  busEnd();
+  while (readStatusReg() & 0x01) {
+    if ((uint32_t)(micros() - t0) > 1000) return false;
+    delayMicroseconds(5);
+  }
+  _chipBusy = false;
+
+  const uint8_t rd = CMD_RDSR2;
+  uint8_t sr2 = 0;
+  busBegin();
+  busWrite(&rd, 1);
+  busRead(&sr2, 1);
+  busEnd();
+  if (!(sr2 & SR2_SUS)) return true;     // erase finished before the suspend landed
+
+  const uint32_t lat = micros() - t0;
+  if (lat > _io.suspendMaxUs) _io.suspendMaxUs = lat;
+  _io.eraseSuspends++;
+  _eraseSuspended = true;
+  _suspendAtUs = t0;
+  return true;
+}
+
+void FlashLogger::resumeErase() {
+  const uint8_t cmd = CMD_ERASE_RESUME;
+  busBegin();
+  busWrite(&cmd, 1);
+  busEnd();
+  _resumeAtUs = micros();
+  _io.suspendHeldUs += _resumeAtUs - _suspendAtUs;
+  _eraseSuspended = false;
+  _chipBusy = true;
+}
+
+void FlashLogger::readData(uint32_t addr, uint8_t* buf, uint32_t len) {
+  static const uint8_t kReadOp[] = { CMD_READ, CMD_FAST_READ, CMD_READ_DUAL, CMD_READ_QUAD };
+  if (_chipBusy) prepareChip(true);
+  busBegin();
+  busCmdAddr(addrOpcode(kReadOp[_readMode]), _regionBase + addr, _addr4);
+  if (_readMode != FLASH_READ_NORMAL) {
+    const uint8_t dummy = 0xFF;          // 8 dummy clocks
+    busWrite(&dummy, 1);
+    _io.bytesWritten--;
+  }
+  busRead(buf, len, _readMode == FLASH_READ_QUAD ? 4 : (_readMode == FLASH_READ_DUAL ? 2 : 1));
+  busEnd();
 }
 
 // chunk-safe page program (won't cross 256-byte page boundary)
 void FlashLogger::pageProgram(uint32_t addr, const uint8_t* buf, uint32_t len) {
+  if (_ckptLive) ckptTouch((int)(addr / SECTOR_SIZE));
   while (len) {
     uint32_t pageOff = addr & (PAGE_SIZE - 1);
     uint32_t room    = PAGE_SIZE - pageOff;
     uint32_t n       = (len < room) ? len : room;
 
-    writeEnable();
-    const uint32_t hz = _cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000;
-    SPI.beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
-    digitalWrite(_cs, LOW);
-    SPI.transfer(CMD_PP);
-    SPI.transfer((addr >> 16) & 0xFF);
-    SPI.transfer((addr >> 8)  & 0xFF);
-    SPI.transfer(addr         & 0xFF);
-    for (uint32_t i = 0; i < n; ++i) SPI.transfer(buf[i]);
-    digitalWrite(_cs, HIGH);
-    SPI.endTransaction();
+    issueProgram(addr, buf, n);
     waitWhileBusy(20);
+    _chipBusy = false;
 
     addr += n; buf += n; len -= n;
     yield();
   }
 }
 
-void FlashLogger::sectorErase(uint32_t addr, bool countErase) {
+// Caller keeps n inside one page.
+void FlashLogger::issueProgram(uint32_t addr, const uint8_t* buf, uint32_t len) {
+  if (_poolCount) poolDrop((int)(addr / SECTOR_SIZE));
+  prepareChip(true);
   writeEnable();
-  const uint32_t hz = _cfg.spi_clock_hz ? _cfg.spi_clock_hz : 40000000;
-  SPI.beginTransaction(SPISettings(hz, MSBFIRST, SPI_MODE0));
-  digitalWrite(_cs, LOW);
-  SPI.transfer(CMD_SE);
-  SPI.transfer((addr >> 16) & 0xFF);
-  SPI.transfer((addr >> 8)  & 0xFF);
-  SPI.transfer(addr         & 0xFF);
-  digitalWrite(_cs, HIGH);
-  SPI.endTransaction();
+  busBegin();
+  busCmdAddr(addrOpcode(CMD_PP), _regionBase + addr, _addr4);
+  busWrite(buf, len);
+  busEnd();
+  _chipBusy = true;
+}
+
+void FlashLogger::issueErase(uint32_t addr) {
+  prepareChip(false);
+  writeEnable();
+  busBegin();
+  busCmdAddr(addrOpcode(CMD_SE), _regionBase + addr, _addr4);
+  busEnd();
+  _chipBusy = true;
+}
+
+void FlashLogger::sectorErase(uint32_t addr, bool countErase) {
+  if (_ckptLive) ckptTouch((int)(addr / SECTOR_SIZE));
+  issueErase(addr);
   waitWhileBusy(1000);
+  _chipBusy = false;
+  finishErase(addr, countErase);
+}
 
-  // VERIFY ERASE; quarantine if failed
+// VERIFY ERASE; quarantine if failed. The wear counter goes to the journal.
+bool FlashLogger::finishErase(uint32_t addr, bool countErase) {
   if (!verifyErase(addr)) {
     int s = (int)(addr / SECTOR_SIZE);
     Serial.printf("Erase verify FAILED on sector %d -> quarantine\n", s);
     quarantineSector(s);
-    return;
+    return false;
   }
 
   if (countErase) {
     _factory.totalEraseOps++;
-    saveFactoryInfo();
+    saveMetaState();
   }
+  return true;
 }
 
 // ===== sector/header helpers =====
 bool FlashLogger::readSectorHeader(int sector, SectorHeader& hdr) {
-  if (sector == FACTORY_SECTOR) return false;
+  if (sector == _factorySector) return false;
   uint32_t base = sectorBaseAddr(sector);
   uint8_t buf[sizeof(SectorHeader)];
   readData(base, buf, sizeof(SectorHeader));
@@ -543,21 +1923,28 @@ void FlashLogger::writeSectorHeader(int sector, uint16_t dayID, bool pushed) {
   SectorHeader hdr {};
   hdr.magic  = 0x4C4F4747UL;
   hdr.dayID  = dayID;
-  hdr.pushed = pushed ? 1 : 0;
-  hdr.reserved = 0;
+  hdr.pushed = pushed ? 1 : 0xFF;        // both left erased so the push and
+  hdr.reserved = 0xFF;                   // erase-intent marks can be programmed later
   hdr.generation = _generation;
   pageProgram(sectorBaseAddr(sector), (const uint8_t*)&hdr, sizeof(SectorHeader));
   if (!verifyWrite(sectorBaseAddr(sector), (const uint8_t*)&hdr, sizeof(SectorHeader))) {
     Serial.printf("Header write verify FAILED on sector %d -> quarantine\n", sector);
     quarantineSector(sector);
   }
+  _zones.reset(sector);
+  zoneStart(_zOpen);
+  _zOpenSector = sector;
 }
 
 bool FlashLogger::markSectorEraseIntent(int sector) {
-  if (sector == FACTORY_SECTOR) return false;
+  if (sector == _factorySector) return false;
   SectorHeader hdr;
   if (!readSectorHeader(sector, hdr)) return false;
   if (hdr.reserved == HEADER_INTENT_ERASE) return true;
+  // Headers from before v2.1 hold reserved = 0, which can't take the mark.
+  // Such a sector is erased unmarked once the index knows it was pushed; a
+  // cut before the erase only leaves it for the next gc().
+  if (hdr.reserved == 0) return _index.pushed(sector);
   hdr.reserved = HEADER_INTENT_ERASE;
   pageProgram(sectorBaseAddr(sector), (const uint8_t*)&hdr, sizeof(SectorHeader));
   if (!verifyWrite(sectorBaseAddr(sector), (const uint8_t*)&hdr, sizeof(SectorHeader))) {
@@ -568,38 +1955,112 @@ bool FlashLogger::markSectorEraseIntent(int sector) {
 }
 
 bool FlashLogger::sectorIsEmpty(int sector) {
-  if (sector == FACTORY_SECTOR) return false;
+  if (isMetaSector(sector)) return false;
+  if (eraseQueued(sector)) return false;           // poll() still owns it
   uint8_t b;
   readData(sectorBaseAddr(sector), &b, 1);
   return (b == 0xFF);
 }
 
+// v2.1: the scan also rebuilds the allocation chain. Sectors come back in
+// physical order; each stretch with ascending keys becomes one piece. Pieces
+// that do not interleave are chained by their first key (the usual case:
+// the wrap point splits the ring in two); interleaved ones are merged sector
+// by sector, re-reading their keys.
 void FlashLogger::scanAllSectorsBuildIndex() {
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    _index[s] = {false, 0, false, 0};
-    SectorHeader hdr;
-    if (readSectorHeader(s, hdr)) {
-      if (hdr.reserved == HEADER_INTENT_ERASE) {
-        Serial.printf("[recovery] pending GC erase on sector %d\n", s);
-        sectorErase(sectorBaseAddr(s));
-        continue;
+  struct Piece { uint16_t first, last; SectorOrderKey lo, hi; };
+  Piece* pieces = nullptr;
+  int n = 0, cap = 0;
+  _index.clearAll();
+  _zones.clearAll();
+  for (int s = 0; s < _sectorCount; ++s) {
+    SectorOrderKey k;
+    scanSectorHeader(s, &k);
+    if (!_index.present(s)) continue;
+    if (n && pieces[n - 1].hi < k) {
+      pieces[n - 1].last = (uint16_t)s;
+      pieces[n - 1].hi = k;
+      continue;
+    }
+    if (n == cap) {
+      Piece* grown = (Piece*)realloc(pieces, (cap ? cap * 2 : 8) * sizeof(Piece));
+      if (!grown) continue;               // out of heap: indexed, but left unchained
+      pieces = grown;
+      cap = cap ? cap * 2 : 8;
+    }
+    pieces[n++] = { (uint16_t)s, (uint16_t)s, k, k };
+  }
+
+  for (int i = 1; i < n; ++i) {           // by first key
+    const Piece p = pieces[i];
+    int j = i;
+    for (; j > 0 && p.lo < pieces[j - 1].lo; --j) pieces[j] = pieces[j - 1];
+    pieces[j] = p;
+  }
+  bool interleaved = false;
+  for (int i = 0; i + 1 < n; ++i) interleaved |= !(pieces[i].hi < pieces[i + 1].lo);
+
+  if (!interleaved) {
+    for (int i = 0; i < n; ++i) {
+      for (int s = pieces[i].first; s <= pieces[i].last; ++s)
+        if (_index.present(s)) _index.chainAppend(s);
+    }
+  } else {
+    // first = cursor, lo = its key; a piece is done once first > last
+    for (;;) {
+      int best = -1;
+      for (int i = 0; i < n; ++i) {
+        if (pieces[i].first > pieces[i].last) continue;
+        if (best < 0 || pieces[i].lo < pieces[best].lo) best = i;
       }
-      _index[s].present = true;
-      _index[s].dayID   = hdr.dayID;
-      _index[s].pushed  = (hdr.pushed != 0);
-      _index[s].writePtr = sectorBaseAddr(s) + sizeof(SectorHeader); // provisional
+      if (best < 0) break;
+      Piece& p = pieces[best];
+      _index.chainAppend(p.first);
+      int s = p.first + 1;
+      while (s <= p.last && !_index.present(s)) ++s;
+      p.first = (uint16_t)s;
+      SectorHeader hdr;
+      if (s <= p.last) readSectorKey(s, hdr, p.lo);
+      yield();
+    }
+  }
+  free(pieces);
+}
+
+// Sector header and the first record header in one read.
+bool FlashLogger::readSectorKey(int sector, SectorHeader& hdr, SectorOrderKey& key) {
+  uint8_t buf[sizeof(SectorHeader) + sizeof(RecordHeader)];
+  readData(sectorBaseAddr(sector), buf, sizeof(buf));
+  RecordHeader rh;
+  memcpy(&hdr, buf, sizeof(hdr));
+  memcpy(&rh, buf + sizeof(hdr), sizeof(rh));
+  const bool has = rh.len != 0xFFFF && rh.len != 0;
+  key = { hdr.generation, has ? rh.ts : 0xFFFFFFFFu, has ? rh.seq : 0xFFFFFFFFu };
+  return hdr.magic == 0x4C4F4747UL;     // 'LOGG'
+}
+
+void FlashLogger::scanSectorHeader(int s, SectorOrderKey* key) {
+  _index.clear(s);
+  if (isMetaSector(s)) return;
+  SectorHeader hdr;
+  SectorOrderKey k;
+  if (readSectorKey(s, hdr, k)) {
+    if (hdr.reserved == HEADER_INTENT_ERASE) {
+      Serial.printf("[recovery] pending GC erase on sector %d\n", s);
+      sectorErase(sectorBaseAddr(s));
+      return;
     }
+    _index.set(s, hdr.dayID, hdr.pushed == 1);
+    if (key) *key = k;
   }
 }
 
 int FlashLogger::nextRoundRobinStart() {
-  for (int attempts = 0; attempts < MAX_SECTORS; ++attempts) {
-    uint16_t s = (_factory.startHint + attempts) % (MAX_SECTORS - 1); // [0..MAX-2]
-    if (s == FACTORY_SECTOR) continue;
+  for (int attempts = 0; attempts < _sectorCount; ++attempts) {
+    uint16_t s = (_factory.startHint + attempts) % _logEnd; // data sectors only
     if (!isBadSector(s)) {
-      _factory.startHint = (s + 1) % (MAX_SECTORS - 1);
-      saveFactoryInfo();
+      _factory.startHint = (s + 1) % _logEnd;
+      saveMetaState();
       return s;
     }
   }
@@ -607,24 +2068,23 @@ int FlashLogger::nextRoundRobinStart() {
 }
 
 void FlashLogger::selectOrCreateTodaySector() {
-  int last = -1;
-  for (int s = MAX_SECTORS - 1; s >= 0; --s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (_index[s].present && _index[s].dayID == _currentDay && !isBadSector(s)) {
-      last = s; break;
-    }
+  // keep writing into the newest sector if it is today's
+  const int last = _index.chainLast();
+  if (last >= 0 && _index.day(last) == _currentDay && !isBadSector(last)) {
+    _currentSector = last;
+    return;
   }
-  if (last >= 0) { _currentSector = last; return; }
+  zoneSeal(last);
 
   int start = nextRoundRobinStart();
-  for (int off = 0; off < MAX_SECTORS - 1; ++off) {
-    int s = (start + off) % (MAX_SECTORS - 1);
-    if (s == FACTORY_SECTOR) continue;
+  for (int off = 0; off < _logEnd; ++off) {
+    int s = (start + off) % _logEnd;
     if (isBadSector(s)) continue;
     if (sectorIsEmpty(s)) {
       sectorErase(sectorBaseAddr(s));
       writeSectorHeader(s, _currentDay, false);
-      _index[s] = {true, _currentDay, false, sectorBaseAddr(s) + sizeof(SectorHeader)};
+      _index.set(s, _currentDay, false);
+      _index.chainAppend(s);
       _currentSector = s;
       return;
     }
@@ -635,57 +2095,64 @@ void FlashLogger::selectOrCreateTodaySector() {
 
 // header-aware rebuild to last valid record
 void FlashLogger::findLastWritePositionInSector(int sector) {
+  _index.setWritePtr(sector, scanWritePtr(sector));
+}
+
+uint32_t FlashLogger::scanWritePtr(int sector) {
   uint32_t base = sectorBaseAddr(sector);
   uint32_t ptr  = base + sizeof(SectorHeader);
 
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    RecordHeader rh;
-    readData(ptr, (uint8_t*)&rh, sizeof(rh));
-    if (rh.len == 0xFFFF || rh.len == 0x0000) break;
-    if (ptr + sizeof(rh) + rh.len + 1 > base + SECTOR_SIZE) break;
-
-    // commit byte
-    uint8_t cm=0;
-    readData(ptr + sizeof(rh) + rh.len, &cm, 1);
-    if (cm != REC_COMMIT) break;
-
-    // CRC check (no print)
-    static uint8_t buf[PAGE_SIZE];
-    uint32_t p = ptr + sizeof(rh);
-    uint16_t remaining = rh.len;
-    uint16_t crc = 0xFFFF;
-
-    while (remaining) {
-      uint16_t chunk = min<uint16_t>(remaining, PAGE_SIZE);
-      readData(p, buf, chunk);
-      crc = crc16(buf, chunk, crc);
-      p += chunk;
-      remaining -= chunk;
+  RecordIterator it(*this);
+  it.setRaw(true);
+  if (it.open(sector, false)) {          // the write pointer is what we are after
+    while (it.next() && it.payloadCrc() == it.header().crc) {
+      ptr = it.nextAddr();
       yield();
     }
-    if (crc != rh.crc) break;
+  }
 
-    ptr += sizeof(rh) + rh.len + 1;
+  // Anything programmed past the last valid record is a torn write (power
+  // lost mid-record or mid-batch): seal the sector so nothing lands on it.
+  const uint32_t end = base + SECTOR_SIZE;
+  uint8_t probe[64];
+  for (uint32_t p = ptr; p < end; p += sizeof(probe)) {
+    uint32_t n = min<uint32_t>(sizeof(probe), end - p);
+    readData(p, probe, n);
+    bool erased = true;
+    for (uint32_t k = 0; k < n; ++k) if (probe[k] != 0xFF) { erased = false; break; }
+    if (!erased) { ptr = end; break; }
   }
-  _index[sector].writePtr = ptr;
+  return ptr;
 }
 
 bool FlashLogger::sectorHasSpace(int sector, uint32_t needBytes) {
   uint32_t base = sectorBaseAddr(sector);
-  uint32_t wp   = _index[sector].writePtr;
-  return (wp + needBytes) <= (base + SECTOR_SIZE);
+  uint32_t wp   = _index.writePtr(sector);
+  return (wp + needBytes) <= (base + ZONE_DATA_END);
 }
 
 bool FlashLogger::moveToNextSectorSameDay() {
-  for (int s = _currentSector + 1; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
+  zoneSeal(_currentSector);
+  int s;
+  if (poolTake(s)) {                    // already erased: header only
+    writeSectorHeader(s, _currentDay, false);
+    _index.set(s, _currentDay, false);
+    _index.chainAppend(s);
+    _currentSector = s;
+    _writeAddr = _index.writePtr(s);
+    Serial.printf("Rolled to pooled sector %d for day %u\n", s, _currentDay);
+    return true;
+  }
+  for (int off = 1; off <= _logEnd; ++off) {     // v2.1: wraps around the ring
+    s = (_currentSector + off) % _logEnd;
     if (isBadSector(s)) continue;
     if (sectorIsEmpty(s)) {
       sectorErase(sectorBaseAddr(s));
       writeSectorHeader(s, _currentDay, false);
-      _index[s] = {true, _currentDay, false, sectorBaseAddr(s) + sizeof(SectorHeader)};
+      _index.set(s, _currentDay, false);
+      _index.chainAppend(s);
       _currentSector = s;
-      _writeAddr = _index[s].writePtr;
+      _writeAddr = _index.writePtr(s);
       Serial.printf("Rolled to next sector %d for day %u\n", s, _currentDay);
       return true;
     }
@@ -702,11 +2169,11 @@ bool FlashLogger::isBadSector(int sector) const {
 }
 
 void FlashLogger::quarantineSector(int sector) {
-  if (sector <= 0 || sector >= FACTORY_SECTOR) return;
+  if (sector <= 0 || isMetaSector(sector)) return;
   if (isBadSector(sector)) return;
   if (_factory.badCount < 16) {
     _factory.badList[_factory.badCount++] = sector;
-    saveFactoryInfo();
+    saveMetaState();
   }
 }
 
@@ -731,27 +2198,624 @@ bool FlashLogger::verifyWrite(uint32_t addr, const uint8_t* buf, uint32_t len) {
   return true;
 }
 
-// ===== factory info helpers =====
-bool FlashLogger::loadFactoryInfo() {
-  uint8_t buf[sizeof(FactoryInfo)];
-  readData(sectorBaseAddr(FACTORY_SECTOR), buf, sizeof(FactoryInfo));
-  memcpy(&_factory, buf, sizeof(FactoryInfo));
-  return (_factory.magic == 0x46414354UL);
-}
-
-void FlashLogger::saveFactoryInfo() {
-  // Ensure the factory sector is clean before writing
-  sectorErase(sectorBaseAddr(FACTORY_SECTOR), false); // don’t count toward wear
-  pageProgram(sectorBaseAddr(FACTORY_SECTOR), (const uint8_t*)&_factory, sizeof(FactoryInfo));
+// ===== v2.1 metadata journal =====
+// Ping-pong between _journalSector and _journalSector + 1. The sector with
+// the higher epoch is active; records are appended to it and never rewritten.
+// When it fills, the newest valid record of each (type, name) is copied to
+// the spare (erased ahead of time by poll()) and the spare's header is
+// written last, so a cut during compaction leaves the old sector in charge.
+namespace {
+  constexpr uint32_t JOURNAL_HDR  = 16;
+  constexpr uint16_t JOURNAL_KEY  = 24;
+  constexpr uint8_t  JOURNAL_KEEP = 16;   // distinct (type, name) kept by compaction
+  constexpr uint8_t  JOURNAL_NAMES = JOURNAL_KEEP - 5;   // cursors; the rest are the unkeyed types
+  constexpr uint32_t journalSize(uint32_t len) {
+    return (sizeof(JournalRecHeader) + len + 15u) & ~15u;
+  }
 }
 
+bool FlashLogger::journalMount() {
+  uint32_t epoch[2] = {0, 0};
+  for (int i = 0; i < 2; ++i) {
+    uint32_t h[2];
+    readData(sectorBaseAddr(_journalSector + i), (uint8_t*)h, sizeof(h));
+    if (h[0] == JOURNAL_MAGIC && h[1] != 0xFFFFFFFFUL) epoch[i] = h[1];
+  }
+  _jActive = -1;
+  _jSeq = 0;
+  _jSchemaAt = 0;
+  if (!epoch[0] && !epoch[1]) {
+    // First mount (or a pre-journal unit): claim both sectors.
+    if (!evictLogSector(_journalSector) || !evictLogSector(_journalSector + 1)) {
+      Serial.println("FlashLogger: unpushed log data in the journal sectors, journal off until it can move");
+      return false;
+    }
+    sectorErase(sectorBaseAddr(_journalSector), false);
+    sectorErase(sectorBaseAddr(_journalSector + 1), false);
+    const uint32_t h[2] = { JOURNAL_MAGIC, 1 };
+    pageProgram(sectorBaseAddr(_journalSector), (const uint8_t*)h, sizeof(h));
+    _jActive = _journalSector;
+    _jEpoch = 1;
+    _jHead = sectorBaseAddr(_journalSector) + JOURNAL_HDR;
+    _jSpareClean = true;
+    return false;
+  }
 
-bool FlashLogger::isOlderThanNDays(uint16_t baseDay, uint16_t targetDay, uint16_t n) {
-  if (baseDay >= targetDay) return (baseDay - targetDay) >= n;
-  return false;
+  _jActive = (epoch[1] > epoch[0]) ? _journalSector + 1 : _journalSector;
+  _jEpoch  = epoch[_jActive - _journalSector];
+  const uint32_t end = sectorBaseAddr(_jActive) + SECTOR_SIZE;
+  uint32_t p = sectorBaseAddr(_jActive) + JOURNAL_HDR;
+  while (p + sizeof(JournalRecHeader) <= end) {
+    JournalRecHeader rh;
+    readData(p, (uint8_t*)&rh, sizeof(rh));
+    if (rh.magic == 0xFFFF) break;                     // erased: append here
+    if (rh.magic != JREC_MAGIC || p + journalSize(rh.len) > end) {
+      p = end;                                         // torn header: compact on next write
+      break;
+    }
+    if (rh.seq >= _jSeq) _jSeq = rh.seq + 1;
+    if (rh.type == JREC_SCHEMA) _jSchemaAt = p;
+    p += journalSize(rh.len);
+  }
+  _jHead = p;
+  _jSpareClean = sectorBlank(journalSpare());
+  return true;
 }
 
-// ===== printing helpers =====
+// Firmware before v2.1 logged into the journal sectors, and a smaller
+// rollup config into today's rings. An unpushed log sector there is copied
+// verbatim to a blank log sector, else over a pushed one, header page last.
+// A copy left by a mount that lost power before the erase is reused.
+// false = nowhere to put it.
+bool FlashLogger::evictLogSector(int sector) {
+  SectorHeader hdr;
+  if (!readSectorHeader(sector, hdr) || hdr.pushed == 1) return true;
+  const uint32_t src = sectorBaseAddr(sector);
+  uint8_t buf[PAGE_SIZE];
+  auto same = [&](int s) {
+    for (uint32_t off = 0; off < SECTOR_SIZE; off += PAGE_SIZE) {
+      readData(src + off, buf, PAGE_SIZE);
+      if (!verifyWrite(sectorBaseAddr(s) + off, buf, PAGE_SIZE)) return false;
+    }
+    return true;
+  };
+
+  int dst = -1;
+  for (int pass = 0; pass < 3 && dst < 0; ++pass) {
+    for (int s = 0; s < _logEnd && dst < 0; ++s) {
+      if (isBadSector(s)) continue;
+      SectorHeader h{};
+      const bool logg = readSectorHeader(s, h);
+      if (pass == 0 && logg && memcmp(&h, &hdr, sizeof(h)) == 0 && same(s)) return true;
+      if (pass == 1 && !logg && h.magic == 0xFFFFFFFFUL && sectorBlank(s)) dst = s;
+      if (pass == 2 && logg && h.pushed == 1) dst = s;
+    }
+  }
+  if (dst < 0) return false;
+  if (!sectorBlank(dst)) sectorErase(sectorBaseAddr(dst), false);
+  for (uint32_t off = SECTOR_SIZE; off > 0; off -= PAGE_SIZE) {
+    readData(src + off - PAGE_SIZE, buf, PAGE_SIZE);
+    pageProgram(sectorBaseAddr(dst) + off - PAGE_SIZE, buf, PAGE_SIZE);
+  }
+  return same(dst);
+}
+
+// Header first: a cut before the payload lands leaves a record whose CRC
+// fails, which readers skip (its length is intact). Small records go out as
+// one program.
+bool FlashLogger::journalAppend(uint8_t type, const char* key, const void* a, uint16_t alen,
+                                const void* b, uint16_t blen) {
+  if (_jActive < 0) return false;
+  JournalRecHeader rh{};
+  rh.magic = JREC_MAGIC;
+  rh.type  = type;
+  rh.keyed = key ? 1 : 0;
+  rh.len   = (uint16_t)((key ? JOURNAL_KEY : 0) + alen + blen);
+  const uint32_t size = journalSize(rh.len);
+  if (size > SECTOR_SIZE - JOURNAL_HDR) return false;
+  char name[JOURNAL_KEY] = {0};
+  if (key) strncpy(name, key, JOURNAL_KEY - 1);
+  if (key && !journalNameRoom(name)) {
+    Serial.printf("FlashLogger: journal holds %u names, '%s' refused\n", (unsigned)JOURNAL_NAMES, name);
+    return false;
+  }
+  if (_jHead + size > sectorBaseAddr(_jActive) + SECTOR_SIZE) {
+    if (!journalCompact(size)) return false;
+    if (_jHead + size > sectorBaseAddr(_jActive) + SECTOR_SIZE) return false;
+  }
+
+  rh.seq = _jSeq++;
+  uint16_t crc = crc16((const uint8_t*)&rh.seq, sizeof(rh.seq));
+  if (key)  crc = crc16((const uint8_t*)name, JOURNAL_KEY, crc);
+  if (alen) crc = crc16((const uint8_t*)a, alen, crc);
+  if (blen) crc = crc16((const uint8_t*)b, blen, crc);
+  rh.crc = crc;
+
+  uint32_t p = _jHead;
+  if (sizeof(rh) + rh.len <= PAGE_SIZE) {
+    uint8_t rec[PAGE_SIZE];
+    uint32_t n = 0;
+    memcpy(rec, &rh, sizeof(rh));                 n += sizeof(rh);
+    if (key)  { memcpy(rec + n, name, JOURNAL_KEY); n += JOURNAL_KEY; }
+    if (alen) { memcpy(rec + n, a, alen);           n += alen; }
+    if (blen) { memcpy(rec + n, b, blen);           n += blen; }
+    pageProgram(p, rec, n);
+  } else {
+    pageProgram(p, (const uint8_t*)&rh, sizeof(rh));  p += sizeof(rh);
+    if (key)  { pageProgram(p, (const uint8_t*)name, JOURNAL_KEY); p += JOURNAL_KEY; }
+    if (alen) { pageProgram(p, (const uint8_t*)a, alen); p += alen; }
+    if (blen) pageProgram(p, (const uint8_t*)b, blen);
+  }
+  _jHead += size;
+  return true;
+}
+
+// Compaction keeps every name ever journalled, so the count is capped:
+// true if `name` is already in the active sector or another one still fits.
+bool FlashLogger::journalNameRoom(const char* name) {
+  char seen[JOURNAL_NAMES][JOURNAL_KEY];
+  uint8_t n = 0;
+  uint32_t p = sectorBaseAddr(_jActive) + JOURNAL_HDR;
+  while (p < _jHead) {
+    JournalRecHeader rh;
+    readData(p, (uint8_t*)&rh, sizeof(rh));
+    if (rh.magic != JREC_MAGIC) break;
+    if (rh.keyed) {
+      char got[JOURNAL_KEY];
+      readData(p + sizeof(rh), (uint8_t*)got, JOURNAL_KEY);
+      if (memcmp(got, name, JOURNAL_KEY) == 0) return true;
+      uint8_t k = 0;
+      while (k < n && memcmp(seen[k], got, JOURNAL_KEY) != 0) ++k;
+      if (k == n && n < JOURNAL_NAMES) memcpy(seen[n++], got, JOURNAL_KEY);
+    }
+    p += journalSize(rh.len);
+  }
+  return n < JOURNAL_NAMES;
+}
+
+bool FlashLogger::journalRecValid(uint32_t addr, const JournalRecHeader& rh) {
+  uint8_t buf[64];
+  uint16_t crc = crc16((const uint8_t*)&rh.seq, sizeof(rh.seq));
+  for (uint32_t off = 0; off < rh.len; off += sizeof(buf)) {
+    const uint32_t n = min<uint32_t>(sizeof(buf), rh.len - off);
+    readData(addr + sizeof(rh) + off, buf, n);
+    crc = crc16(buf, n, crc);
+  }
+  return crc == rh.crc;
+}
+
+// Newest valid payload of (type, key) -> out (name stripped). Returns its
+// length, or -1 if there is none or it does not fit.
+int FlashLogger::journalRead(uint8_t type, const char* key, void* out, uint16_t maxLen) {
+  if (_jActive < 0) return -1;
+  char name[JOURNAL_KEY] = {0};
+  if (key) strncpy(name, key, JOURNAL_KEY - 1);
+  uint32_t best = 0, bestLen = 0;
+  uint32_t p = sectorBaseAddr(_jActive) + JOURNAL_HDR;
+  while (p < _jHead) {
+    JournalRecHeader rh;
+    readData(p, (uint8_t*)&rh, sizeof(rh));
+    if (rh.magic != JREC_MAGIC) break;
+    if (rh.type == type && rh.keyed == (key ? 1 : 0)) {
+      bool match = true;
+      if (key) {
+        char got[JOURNAL_KEY];
+        readData(p + sizeof(rh), (uint8_t*)got, JOURNAL_KEY);
+        match = memcmp(got, name, JOURNAL_KEY) == 0;
+      }
+      if (match && journalRecValid(p, rh)) { best = p; bestLen = rh.len; }
+    }
+    p += journalSize(rh.len);
+  }
+  if (!best) return -1;
+  const uint32_t skip = key ? JOURNAL_KEY : 0;
+  const uint32_t len  = bestLen - skip;
+  if (len > maxLen) return -1;
+  readData(best + sizeof(JournalRecHeader) + skip, (uint8_t*)out, len);
+  return (int)len;
+}
+
+// The kept records and the `need` bytes about to be appended must fit the
+// spare. If they do not, the index body and its head are left behind (the
+// next checkpoint() writes them again); if that is still not enough the
+// compaction is refused and the active sector stays in charge.
+bool FlashLogger::journalCompact(uint32_t need) {
+  const int spare = journalSpare();
+  while (_as == AS_ERASE) {             // poll() may be erasing the spare right now
+    if (_chipBusy || _eraseSuspended) prepareChip(false);
+    poll();
+  }
+  if (!_jSpareClean) {
+    sectorErase(sectorBaseAddr(spare), false);
+    if (!sectorBlank(spare)) return false;
+    _jSpareClean = true;
+  }
+
+  struct Keep { uint8_t type; char name[JOURNAL_KEY]; uint32_t addr; uint32_t size; };
+  Keep keep[JOURNAL_KEEP];
+  uint8_t kept = 0;
+  uint32_t p = sectorBaseAddr(_jActive) + JOURNAL_HDR;
+  while (p < _jHead) {
+    JournalRecHeader rh;
+    readData(p, (uint8_t*)&rh, sizeof(rh));
+    if (rh.magic != JREC_MAGIC) break;
+    const uint32_t size = journalSize(rh.len);
+    if (journalRecValid(p, rh)) {
+      char name[JOURNAL_KEY] = {0};
+      if (rh.keyed) readData(p + sizeof(rh), (uint8_t*)name, JOURNAL_KEY);
+      uint8_t k = 0;
+      while (k < kept && !(keep[k].type == rh.type && memcmp(keep[k].name, name, JOURNAL_KEY) == 0)) ++k;
+      if (k == JOURNAL_KEEP) {
+        Serial.println("FlashLogger: journal holds too many names, compaction refused");
+        return false;
+      }
+      keep[k].type = rh.type;
+      memcpy(keep[k].name, name, JOURNAL_KEY);
+      keep[k].addr = p;
+      keep[k].size = size;
+      if (k == kept) ++kept;
+    }
+    p += size;
+  }
+
+  uint32_t total = need;
+  for (uint8_t k = 0; k < kept; ++k) total += keep[k].size;
+  if (total > SECTOR_SIZE - JOURNAL_HDR) {
+    for (uint8_t k = 0; k < kept; ++k) {
+      if (keep[k].type != JREC_INDEX && keep[k].type != JREC_CKPT) continue;
+      total -= keep[k].size;
+      keep[k].size = 0;
+    }
+    _ckptLive = false;
+  }
+  if (total > SECTOR_SIZE - JOURNAL_HDR) {
+    Serial.println("FlashLogger: journal full, compaction refused");
+    return false;
+  }
+
+  uint8_t buf[PAGE_SIZE];
+  uint32_t dst = sectorBaseAddr(spare) + JOURNAL_HDR;
+  for (uint8_t k = 0; k < kept; ++k) {
+    for (uint32_t off = 0; off < keep[k].size; off += PAGE_SIZE) {
+      const uint32_t n = min<uint32_t>(PAGE_SIZE, keep[k].size - off);
+      readData(keep[k].addr + off, buf, n);
+      pageProgram(dst + off, buf, n);
+    }
+    dst += keep[k].size;
+  }
+  const uint32_t h[2] = { JOURNAL_MAGIC, _jEpoch + 1 };
+  pageProgram(sectorBaseAddr(spare), (const uint8_t*)h, sizeof(h));
+
+  _jActive = spare;
+  _jEpoch++;
+  _jHead = dst;
+  _jSpareClean = false;                 // the old sector; poll() erases it
+  return true;
+}
+
+void FlashLogger::onJournalErase(FlashOpKind, bool ok, uint32_t ref, void* user) {
+  FlashLogger* self = static_cast<FlashLogger*>(user);
+  if (ok && (int)ref == self->journalSpare()) self->_jSpareClean = true;
+}
+
+// Runtime fields of FactoryInfo live in the journal; the factory sector is
+// only rewritten for identity changes (setFactoryInfo, date style).
+bool FlashLogger::restoreMetaState() {
+  MetaState ms{};
+  if (journalRead(JREC_STATE, nullptr, &ms, sizeof(ms)) < (int)offsetof(MetaState, seqFloor)) return false;
+  _lastGoodUnix          = ms.lastGoodUnix;
+  _factory.bootCounter   = ms.bootCounter;
+  _factory.totalEraseOps = ms.totalEraseOps;
+  _factory.startHint     = ms.startHint;
+  _factory.badCount      = ms.badCount;
+  memcpy(_factory.badList, ms.badList, sizeof(ms.badList));
+  _seqCounter            = ms.seqFloor;
+  return true;
+}
+
+void FlashLogger::saveMetaState() {
+  if (_jActive < 0) {                  // journal refused at mount: pre-v2.1 behaviour
+    saveFactoryInfo();
+    return;
+  }
+  MetaState ms{};
+  ms.lastGoodUnix  = _lastGoodUnix;
+  ms.bootCounter   = _factory.bootCounter;
+  ms.totalEraseOps = _factory.totalEraseOps;
+  ms.startHint     = _factory.startHint;
+  ms.badCount      = _factory.badCount;
+  memcpy(ms.badList, _factory.badList, sizeof(ms.badList));
+  ms.seqFloor      = _seqCounter;
+  if (journalAppend(JREC_STATE, nullptr, &ms, sizeof(ms))) _stateSavedUnix = _lastGoodUnix;
+}
+
+// Schemas are journalled as one record holding every slot in use. The mount
+// walk remembers the newest one; only a torn copy costs a journalRead().
+void FlashLogger::restoreSchemas() {
+  if (!_jSchemaAt) return;
+  const uint32_t cap = SCHEMA_SLOTS * sizeof(RecordSchema);
+  if (!_schemas) _schemas = (RecordSchema*)calloc(SCHEMA_SLOTS, sizeof(RecordSchema));
+  if (!_schemas) return;
+  JournalRecHeader rh;
+  readData(_jSchemaAt, (uint8_t*)&rh, sizeof(rh));
+  int n;
+  if (rh.len <= cap && journalRecValid(_jSchemaAt, rh)) {
+    readData(_jSchemaAt + sizeof(rh), (uint8_t*)_schemas, rh.len);
+    n = rh.len;
+  } else {
+    n = journalRead(JREC_SCHEMA, nullptr, _schemas, cap);
+  }
+  if (n <= 0 || n % sizeof(RecordSchema)) {
+    free(_schemas);
+    _schemas = nullptr;
+    return;
+  }
+  memset((uint8_t*)_schemas + n, 0, cap - n);
+}
+
+// ===== v2.1 mount checkpoint =====
+// checkpoint() journals the sector index and chain (JREC_INDEX body,
+// rewritten only when it changes) and a small head naming the boot and the
+// sectors that may still change: the current sector and the erased pool. The
+// next begin() trusts the body if the head belongs to the previous boot, then
+// rescans only those sectors. Writing or erasing any other data sector voids
+// the head first.
+//
+// Body: {CKPT_MAGIC, u16 bodyId, u16 runBytes, u16 anchorCount, u16 chainRuns},
+// then runs of data sectors as {u8 count, u8 code}: code 0x7F = not present,
+// otherwise bit 7 = pushed and bits 0..6 = day delta to the previous run, with
+// 0x7E = absolute day in the next two bytes. Then the anchors of older
+// bodies, 12 bytes each (none are written since the zone maps replaced them),
+// then the allocation chain as {u16 first, u16 count}, oldest first.
+namespace {
+  constexpr uint8_t  CKPT_ABSENT  = 0x7F;
+  constexpr uint8_t  CKPT_ABS_DAY = 0x7E;
+  constexpr uint32_t CKPT_BODY_HDR = 12;
+  constexpr uint32_t CKPT_ANCHOR   = 12;
+  constexpr uint32_t CKPT_CHAIN    = 4;
+  constexpr uint16_t CKPT_ANCHORS_MAX = 128;
+  static_assert(sizeof(SectorIndexMap::ChainRun) == CKPT_CHAIN, "ChainRun is stored as-is");
+}
+
+void FlashLogger::mountIndex(uint32_t lastBoot) {
+  _ckptLive = false;
+  _ckptMounted = loadCheckpoint(lastBoot);
+  if (_ckptMounted) return;
+  scanAllSectorsBuildIndex();
+}
+
+// v2.1: seq continues after the newest record on flash; the journalled floor
+// covers a log that was erased since (factory reset, gc of every sector).
+void FlashLogger::recoverSeq() {
+  for (int s = _index.chainLast(); s >= 0; s = _index.chainPrev(s)) {
+    uint32_t addr;
+    if (!findLastRecord(s, addr)) continue;
+    RecordHeader rh;
+    readData(addr, (uint8_t*)&rh, sizeof(rh));
+    uint16_t samples = 1;
+    if (rh.flags & REC_FLAG_COMPRESSED) readData(addr + sizeof(rh), (uint8_t*)&samples, sizeof(samples));
+    if (rh.seq + samples > _seqCounter) _seqCounter = rh.seq + samples;
+    return;
+  }
+}
+
+bool FlashLogger::loadCheckpoint(uint32_t lastBoot) {
+  CkptHead h;
+  if (!lastBoot || journalRead(JREC_CKPT, nullptr, &h, sizeof(h)) != (int)sizeof(h)) return false;
+  if (h.generation != lastBoot || !h.touchCount || h.touchCount > 1 + POOL_MAX) return false;
+
+  uint8_t* body = (uint8_t*)malloc(CKPT_BODY_MAX);
+  if (!body) return false;
+  const int len = journalRead(JREC_INDEX, nullptr, body, CKPT_BODY_MAX);
+  const bool ok = ckptApplyBody(body, len, h.bodyId);
+  free(body);
+  if (!ok) return false;
+
+  // Touched sectors were the chain's tail or allocated after the body was
+  // written: re-append them, oldest first.
+  SectorOrderKey keys[1 + POOL_MAX];
+  uint16_t order[1 + POOL_MAX];
+  int n = 0;
+  for (uint8_t i = 0; i < h.touchCount; ++i) {
+    scanSectorHeader(h.touch[i], &keys[n]);
+    if (_index.present(h.touch[i])) order[n++] = h.touch[i];
+  }
+  for (int i = 1; i < n; ++i) {
+    const SectorOrderKey k = keys[i];
+    const uint16_t s = order[i];
+    int j = i;
+    for (; j > 0 && k < keys[j - 1]; --j) { keys[j] = keys[j - 1]; order[j] = order[j - 1]; }
+    keys[j] = k;
+    order[j] = s;
+  }
+  for (int i = 0; i < n; ++i) _index.chainAppend(order[i]);
+  return true;
+}
+
+uint16_t FlashLogger::ckptBuildBody(uint8_t* out, uint16_t bodyId) {
+  uint32_t n = CKPT_BODY_HDR;
+  uint16_t prevDay = 0;
+  for (int s = 0; s < _logEnd; ) {
+    const bool present = _index.present(s);
+    const bool pushed  = _index.pushed(s);
+    const uint16_t day = _index.day(s);
+    int run = 1;
+    while (s + run < _logEnd && run < 255) {
+      const int x = s + run;
+      if (_index.present(x) != present ||
+          (present && (_index.day(x) != day || _index.pushed(x) != pushed))) break;
+      ++run;
+    }
+    if (n + 4 > CKPT_BODY_MAX) return 0;
+    out[n++] = (uint8_t)run;
+    if (!present) {
+      out[n++] = CKPT_ABSENT;
+    } else {
+      const uint8_t flag = pushed ? 0x80 : 0x00;
+      if (day >= prevDay && day - prevDay < CKPT_ABS_DAY) {
+        out[n++] = flag | (uint8_t)(day - prevDay);
+      } else {
+        out[n++] = flag | CKPT_ABS_DAY;
+        out[n++] = (uint8_t)day;
+        out[n++] = (uint8_t)(day >> 8);
+      }
+      prevDay = day;
+    }
+    s += run;
+  }
+  const uint16_t runBytes = (uint16_t)(n - CKPT_BODY_HDR);
+  const uint16_t anchors = 0;
+
+  const uint16_t chainRuns = _index.chainRunCount();
+  if (n + chainRuns * CKPT_CHAIN > CKPT_BODY_MAX) return 0;
+  for (uint16_t i = 0; i < chainRuns; ++i, n += CKPT_CHAIN) {
+    memcpy(out + n, &_index.chainRun(i), CKPT_CHAIN);
+  }
+
+  const uint32_t magic = CKPT_MAGIC;
+  memcpy(out, &magic, 4);
+  memcpy(out + 4, &bodyId, 2);
+  memcpy(out + 6, &runBytes, 2);
+  memcpy(out + 8, &anchors, 2);
+  memcpy(out + 10, &chainRuns, 2);
+  return (uint16_t)n;
+}
+
+bool FlashLogger::ckptApplyBody(const uint8_t* in, int len, uint16_t bodyId) {
+  if (len < (int)CKPT_BODY_HDR) return false;
+  uint32_t magic; uint16_t id, runBytes, anchors, chainRuns;
+  memcpy(&magic, in, 4);
+  memcpy(&id, in + 4, 2);
+  memcpy(&runBytes, in + 6, 2);
+  memcpy(&anchors, in + 8, 2);
+  memcpy(&chainRuns, in + 10, 2);
+  if (magic != CKPT_MAGIC || id != bodyId || anchors > CKPT_ANCHORS_MAX ||
+      len != (int)(CKPT_BODY_HDR + runBytes + anchors * CKPT_ANCHOR + chainRuns * CKPT_CHAIN)) {
+    return false;
+  }
+
+  _index.clearAll();
+  _zones.clearAll();
+  const uint8_t* p = in + CKPT_BODY_HDR;
+  const uint8_t* end = p + runBytes;
+  uint16_t day = 0;
+  int s = 0;
+  while (p + 2 <= end) {
+    const uint8_t run = *p++;
+    const uint8_t code = *p++;
+    if (!run || s + run > _logEnd) return false;
+    if (code != CKPT_ABSENT) {
+      if ((code & 0x7F) == CKPT_ABS_DAY) {
+        if (p + 2 > end) return false;
+        day = (uint16_t)(p[0] | (p[1] << 8));
+        p += 2;
+      } else {
+        day = (uint16_t)(day + (code & 0x7F));
+      }
+      for (int k = 0; k < run; ++k) {
+        _index.set(s + k, day, (code & 0x80) != 0);
+      }
+    }
+    s += run;
+  }
+  if (p != end || s != _logEnd) return false;
+
+  p += anchors * CKPT_ANCHOR;
+  for (uint16_t i = 0; i < chainRuns; ++i, p += CKPT_CHAIN) {
+    SectorIndexMap::ChainRun r;
+    memcpy(&r, p, CKPT_CHAIN);
+    if (r.first + r.count > _logEnd || !_index.chainPushRun(r)) return false;
+  }
+  return true;
+}
+
+bool FlashLogger::ckptTouched(int sector) const {
+  for (uint8_t i = 0; i < _ckpt.touchCount; ++i)
+    if (_ckpt.touch[i] == sector) return true;
+  return false;
+}
+
+void FlashLogger::ckptTouch(int sector) {
+  if (isMetaSector(sector) || ckptTouched(sector)) return;
+  _ckptLive = false;
+  const CkptHead voided {};
+  journalAppend(JREC_CKPT, nullptr, &voided, sizeof(voided));
+}
+
+bool FlashLogger::checkpoint() {
+  if (_currentSector < 0 || _jActive < 0) return false;
+  flush();
+  drainAsync();
+  rollupSave();
+  saveMetaState();
+
+  CkptHead h {};
+  h.generation = _generation;
+  h.touch[h.touchCount++] = (uint16_t)_currentSector;
+  for (uint8_t i = 0; i < _poolCount; ++i) h.touch[h.touchCount++] = (uint16_t)_pool[i];
+  _ckpt = h;                                       // ckptTouched() now sees the new list
+
+  uint8_t* body = (uint8_t*)malloc(2 * CKPT_BODY_MAX);
+  if (!body) return false;
+  uint8_t* prev = body + CKPT_BODY_MAX;
+  const int prevLen = journalRead(JREC_INDEX, nullptr, prev, CKPT_BODY_MAX);
+  uint16_t prevId = 0;
+  uint32_t prevMagic = 0;
+  if (prevLen >= (int)CKPT_BODY_HDR) {
+    memcpy(&prevMagic, prev, 4);
+    memcpy(&prevId, prev + 4, 2);
+  }
+  if (prevMagic != CKPT_MAGIC) prevId = 0;
+
+  uint16_t len = ckptBuildBody(body, prevId);
+  bool ok = len != 0;
+  if (ok && (prevId == 0 || (int)len != prevLen || memcmp(body, prev, len) != 0)) {
+    h.bodyId = (uint16_t)(prevId + 1);
+    if (!h.bodyId) h.bodyId = 1;
+    memcpy(body + 4, &h.bodyId, 2);
+    if (_jHead + journalSize(len) > sectorBaseAddr(_jActive) + SECTOR_SIZE) {
+      // Compaction would carry the old body along; retire it first.
+      journalAppend(JREC_INDEX, nullptr, &prevId, sizeof(prevId));
+    }
+    ok = journalAppend(JREC_INDEX, nullptr, body, len);
+  } else {
+    h.bodyId = prevId;
+  }
+  free(body);
+  if (!ok) {
+    Serial.println("FlashLogger: checkpoint skipped (index too large)");
+    return false;
+  }
+  if (!journalAppend(JREC_CKPT, nullptr, &h, sizeof(h))) return false;
+  _ckpt = h;
+  _ckptLive = true;
+  if (!_jSpareClean && queueErase(journalSpare(), onJournalErase, this, false)) {
+    drainAsync();                       // not on the next wake's compaction
+  }
+  return true;
+}
+
+// ===== factory info helpers =====
+bool FlashLogger::loadFactoryInfo() {
+  uint8_t buf[sizeof(FactoryInfo)];
+  readData(sectorBaseAddr(_factorySector), buf, sizeof(FactoryInfo));
+  memcpy(&_factory, buf, sizeof(FactoryInfo));
+  return (_factory.magic == 0x46414354UL);
+}
+
+void FlashLogger::saveFactoryInfo() {
+  // Ensure the factory sector is clean before writing
+  sectorErase(sectorBaseAddr(_factorySector), false); // don’t count toward wear
+  pageProgram(sectorBaseAddr(_factorySector), (const uint8_t*)&_factory, sizeof(FactoryInfo));
+}
+
+
+bool FlashLogger::isOlderThanNDays(uint16_t baseDay, uint16_t targetDay, uint16_t n) {
+  if (baseDay >= targetDay) return (baseDay - targetDay) >= n;
+  return false;
+}
+
+// ===== printing helpers =====
 void FlashLogger::formatDate(const DateTime& dt, char* out, size_t outLen) const {
   switch (_dateStyle) {
     case DATE_THAI: snprintf(out, outLen, "%02d/%02d/%02d", dt.day(), dt.month(), (dt.year()-2000)); break;
@@ -762,53 +2826,37 @@ void FlashLogger::formatDate(const DateTime& dt, char* out, size_t outLen) const
 }
 
 void FlashLogger::printSectorData(int sector) {
-  uint32_t base = sectorBaseAddr(sector);
-  uint32_t ptr  = base + sizeof(SectorHeader);
-
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    RecordHeader rh;
-    readData(ptr, (uint8_t*)&rh, sizeof(rh));
-    if (rh.len == 0xFFFF || rh.len == 0x0000) break;
-    if (ptr + sizeof(rh) + rh.len + 1 > base + SECTOR_SIZE) break;
-
-    // read payload & compute CRC while printing
-    uint32_t p = ptr + sizeof(rh);
-    uint16_t remaining = rh.len;
-    uint16_t crc = 0xFFFF;
-    static uint8_t buf[PAGE_SIZE];
-
-    while (remaining) {
-      uint16_t chunk = min<uint16_t>(remaining, PAGE_SIZE);
-      readData(p, buf, chunk);
-      crc = crc16(buf, chunk, crc);
-      for (int i=0;i<chunk;i++) Serial.write(buf[i]); // prints newline too
-      p += chunk;
-      remaining -= chunk;
-      yield();
-    }
-
-    uint8_t cm=0;
-    readData(ptr + sizeof(rh) + rh.len, &cm, 1);
-    if (cm != REC_COMMIT || crc != rh.crc) {
+  RecordIterator it(*this);
+  String spill;
+  if (!it.open(sector)) return;
+  while (it.next()) {
+    const uint8_t* p = it.payload(spill);
+    if (crc16(p, it.header().len) != it.header().crc) {
       Serial.println(F("[corrupt/partial record skipped]"));
       break;
     }
-
-    ptr += sizeof(rh) + rh.len + 1;
+    if (it.header().flags & REC_FLAG_TYPED) {
+      String line;
+      renderJson(it.header(), p, line);
+      Serial.print(line);
+    } else {
+      Serial.write(p, it.header().len);        // prints newline too
+    }
+    yield();
   }
 }
 
 // ===== capacity / stats =====
 uint32_t FlashLogger::countUsedSectors() const {
   uint32_t used = 0;
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (_index[s].present) used++;
+  for (int s = 0; s < _sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    if (_index.present(s)) used++;
   }
   return used;
 }
 float FlashLogger::getFreeSpaceMB() {
-  float totalMB = (MAX_SECTORS - 1) * (SECTOR_SIZE / 1024.0f / 1024.0f);
+  float totalMB = (_sectorCount - 1) * (SECTOR_SIZE / 1024.0f / 1024.0f);
   float usedMB  = countUsedSectors() * (SECTOR_SIZE / 1024.0f / 1024.0f);
   return max(0.0f, totalMB - usedMB);
 }
@@ -816,14 +2864,14 @@ float FlashLogger::getUsedSpaceMB() {
   return countUsedSectors() * (SECTOR_SIZE / 1024.0f / 1024.0f);
 }
 float FlashLogger::getUsedPercent() {
-  float totalMB = (MAX_SECTORS - 1) * (SECTOR_SIZE / 1024.0f / 1024.0f);
+  float totalMB = (_sectorCount - 1) * (SECTOR_SIZE / 1024.0f / 1024.0f);
   float usedMB  = getUsedSpaceMB();
   if (totalMB <= 0.0f) return 0.0f;
   return (usedMB / totalMB) * 100.0f;
 }
 float FlashLogger::getFlashHealth() {
   const float kCycles = 100000.0f;
-  float avgCycles = (_factory.totalEraseOps) / max(1.0f, (float)(MAX_SECTORS - 1));
+  float avgCycles = (_factory.totalEraseOps) / max(1.0f, (float)(_sectorCount - 1));
   float health = 1.0f - (avgCycles / kCycles);
   if (health < 0) health = 0;
   return health * 100.0f;
@@ -838,7 +2886,7 @@ uint16_t FlashLogger::estimateDaysRemaining(float avgBytesPerDay) {
 }
 FlashStats FlashLogger::getFlashStats(float avgBytesPerDay) {
   FlashStats s{};
-  s.totalMB = (MAX_SECTORS - 1) * (SECTOR_SIZE / 1024.0f / 1024.0f);
+  s.totalMB = (_sectorCount - 1) * (SECTOR_SIZE / 1024.0f / 1024.0f);
   s.usedMB  = getUsedSpaceMB();
   s.freeMB  = max(0.0f, s.totalMB - s.usedMB);
   s.usedPercent = (s.totalMB > 0) ? (s.usedMB / s.totalMB) * 100.0f : 0.0f;
@@ -847,14 +2895,80 @@ FlashStats FlashLogger::getFlashStats(float avgBytesPerDay) {
   return s;
 }
 
+// ===== v2.1 bus throughput benchmark =====
+bool FlashLogger::runIoBenchmark(FlashBenchResult& out, uint32_t readBytes, int scratchSector) {
+  flush();
+  out = FlashBenchResult{};
+  uint8_t* buf = (uint8_t*)malloc(SECTOR_SIZE);
+  if (!buf) return false;
+  const FlashIoStats before = _io;
+
+  // sequential read in sector-sized bursts
+  const uint32_t flashBytes = (uint32_t)(_sectorCount - 1) * SECTOR_SIZE;
+  if (readBytes > flashBytes) readBytes = flashBytes;
+  uint32_t t0 = micros();
+  for (uint32_t off = 0; off < readBytes; off += SECTOR_SIZE) {
+    uint32_t n = min<uint32_t>(SECTOR_SIZE, readBytes - off);
+    readData(off, buf, n);
+    yield();
+  }
+  uint32_t us = micros() - t0;
+  out.readBytes = readBytes;
+  out.readMBps  = us ? (float)readBytes / (float)us : 0.0f; // bytes/us == MB/s
+
+  // page programs into a free scratch sector (erased again afterwards)
+  if (scratchSector < 0) {
+    for (int s = _sectorCount - 2; s >= 0; --s) {
+      if (isMetaSector(s) || s == _currentSector) continue;
+      if (_index.present(s) || isBadSector(s)) continue;
+      if (sectorIsEmpty(s)) { scratchSector = s; break; }
+    }
+  }
+  if (scratchSector >= 0 && !isMetaSector(scratchSector) && !_index.present(scratchSector)) {
+    const uint32_t base = sectorBaseAddr(scratchSector);
+    for (uint32_t i = 0; i < SECTOR_SIZE; ++i) buf[i] = (uint8_t)(i * 31u + 7u);
+    sectorErase(base);
+    t0 = micros();
+    pageProgram(base, buf, SECTOR_SIZE);
+    us = micros() - t0;
+    if (!verifyWrite(base, buf, SECTOR_SIZE)) Serial.println("bench: program verify FAILED");
+    sectorErase(base);
+    out.programBytes = SECTOR_SIZE;
+    out.programMBps  = us ? (float)SECTOR_SIZE / (float)us : 0.0f;
+  }
+
+  // header scan (same access pattern as scanAllSectorsBuildIndex, read-only)
+  t0 = micros();
+  for (int s = 0; s < _sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    SectorHeader hdr;
+    readSectorHeader(s, hdr);
+    out.headerScanSectors++;
+  }
+  out.headerScanMs = (micros() - t0) / 1000.0f;
+
+  out.io.transactions = _io.transactions - before.transactions;
+  out.io.bytesRead    = _io.bytesRead    - before.bytesRead;
+  out.io.bytesWritten = _io.bytesWritten - before.bytesWritten;
+  out.io.dmaReads     = _io.dmaReads     - before.dmaReads;
+  free(buf);
+  return true;
+}
+
 // ===== factory info public =====
 bool FlashLogger::setFactoryInfo(const String& model, const String& flashModel, const String& deviceID) {
   bool changed = false;
   if (_factory.magic != 0x46414354UL) return false;
 
-  if (model.length())      { strncpy(_factory.model, model.c_str(), sizeof(_factory.model)-1); changed = true; }
-  if (flashModel.length()) { strncpy(_factory.flashModel, flashModel.c_str(), sizeof(_factory.flashModel)-1); changed = true; }
-  if (deviceID.length())   { strncpy(_factory.deviceId, deviceID.c_str(), sizeof(_factory.deviceId)-1); changed = true; }
+  // Only differing fields count: begin() calls this on every boot.
+  auto put = [&changed](char* dst, size_t cap, const String& v) {
+    if (!v.length() || strncmp(dst, v.c_str(), cap - 1) == 0) return;
+    strncpy(dst, v.c_str(), cap - 1);
+    changed = true;
+  };
+  put(_factory.model, sizeof(_factory.model), model);
+  put(_factory.flashModel, sizeof(_factory.flashModel), flashModel);
+  put(_factory.deviceId, sizeof(_factory.deviceId), deviceID);
 
   if (_factory.firstDayID == 0) { _factory.firstDayID = dayIDFromDateTime(_rtc->now()); changed = true; }
   _factory.defaultDateStyle = (uint8_t)_dateStyle;
@@ -882,19 +2996,28 @@ bool FlashLogger::factoryReset(const String& code12) {
   if (code12 != "847291506314") return false;
 
   Serial.println("FACTORY RESET: erasing all data sectors...");
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (_index[s].present || sectorIsEmpty(s) == false) {
+  prepareChip(false);
+  _as = AS_IDLE; _eraseCount = 0;                 // drop queued async work
+  _wbUsed = 0; _wbCount = 0; _wbTimed = false; _wbAsync = false;   // drop buffered records
+  if (_blk) _blk->count = 0;
+  for (int s = 0; s < _journalSector; ++s) {     // rollup rings too
+    if (_index.present(s) || sectorIsEmpty(s) == false) {
       sectorErase(sectorBaseAddr(s)); // counts erase, verifies; may quarantine
-      _index[s] = {false, 0, false, 0};
+      _index.clear(s);
     }
     yield();
   }
+  for (uint8_t t = 0; _rollup && t < ROLLUP_TIERS; ++t) {
+    _rollup->ring[t].cur = -1;
+    _rollup->ring[t].gen = _rollup->ring[t].seq = 0;
+    _rollup->ring[t].open = false;
+  }
+  rollupSave();
   _currentDay = dayIDFromDateTime(_rtc->now());
   selectOrCreateTodaySector();
   if (_currentSector >= 0) {
     findLastWritePositionInSector(_currentSector);
-    _writeAddr = _index[_currentSector].writePtr;
+    _writeAddr = _index.writePtr(_currentSector);
   }
   Serial.println("FACTORY RESET: done.");
   return true;
@@ -933,25 +3056,13 @@ bool FlashLogger::parseDateYYYYMMDD(const String& s, uint16_t& outDayID) {
 // ===== valid-bytes scan (header-aware) =====
 uint32_t FlashLogger::computeValidBytesInSector(int sector, uint32_t& firstTs, uint32_t& lastTs) {
   firstTs = 0; lastTs = 0;
-  uint32_t base = sectorBaseAddr(sector);
-  uint32_t ptr  = base + sizeof(SectorHeader);
   uint32_t bytes = 0;
-
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    RecordHeader rh;
-    readData(ptr, (uint8_t*)&rh, sizeof(rh));
-    if (rh.len == 0xFFFF || rh.len == 0x0000) break;
-    if (ptr + sizeof(rh) + rh.len + 1 > base + SECTOR_SIZE) break;
-    uint8_t cm=0;
-    readData(ptr + sizeof(rh) + rh.len, &cm, 1);
-    if (cm != REC_COMMIT) break;
-
-    if (!firstTs) firstTs = rh.ts;
-    lastTs = rh.ts;
-
-    uint32_t rec = sizeof(RecordHeader) + rh.len + 1;
-    bytes += rec;
-    ptr   += rec;
+  RecordIterator it(*this, RecordIterator::SKIM);
+  if (!it.open(sector)) return 0;
+  while (it.next()) {
+    if (!firstTs) firstTs = it.header().ts;
+    lastTs = it.header().ts;
+    if (!it.sample()) bytes += it.nextAddr() - it.addr();
     yield();
   }
   return bytes;
@@ -964,17 +3075,17 @@ void FlashLogger::summarizeSector(int sector, SectorSummary& out) {
   if (!readSectorHeader(sector, hdr)) return;
   out.sector = sector;
   out.dayID  = hdr.dayID;
-  out.pushed = (hdr.pushed != 0);
+  out.pushed = (hdr.pushed == 1);
   out.bytes  = computeValidBytesInSector(sector, out.firstTs, out.lastTs);
 }
 void FlashLogger::summarizeDay(uint16_t dayID, DaySummary& out) {
   out = {};
   out.dayID = dayID;
   out.pushed = true;
-  for (int s=0; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    if (_index[s].dayID != dayID) continue;
+  for (int s=0; s<_sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    if (!_index.present(s)) continue;
+    if (_index.day(s) != dayID) continue;
     SectorSummary ss; summarizeSector(s, ss);
     out.sectors++;
     out.bytes += ss.bytes;
@@ -987,19 +3098,20 @@ void FlashLogger::summarizeDay(uint16_t dayID, DaySummary& out) {
 
 // ===== build cached day list =====
 void FlashLogger::buildSummaries() {
+  flush();
   _dayCount = 0;
   uint16_t seen[MAX_DAYS_CACHE]; int seenN = 0;
 
-  for (int s=0; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    uint16_t d = _index[s].dayID;
+  for (int s=0; s<_sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    if (!_index.present(s)) continue;
+    uint16_t d = _index.day(s);
     bool dup=false; for(int i=0;i<seenN;i++){ if (seen[i]==d){ dup=true; break; } }
     if (!dup && seenN < MAX_DAYS_CACHE) seen[seenN++] = d;
     yield();
   }
+  if (!growCache(_days, _dayCap, seenN)) return;
   for (int i=0;i<seenN;i++) {
-    if (_dayCount >= MAX_DAYS_CACHE) break;
     summarizeDay(seen[i], _days[_dayCount++]);
     yield();
   }
@@ -1025,11 +3137,14 @@ void FlashLogger::listDays() {
 }
 void FlashLogger::listSectors(uint16_t dayID) {
   _sectCount = 0;
-  for (int s=0; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    if (_index[s].dayID != dayID) continue;
-    if (_sectCount >= MAX_SECT_CACHE) break;
+  int want = 0;
+  for (int s=0; s<_sectorCount && want < MAX_SECT_CACHE; ++s)
+    if (s != _factorySector && _index.present(s) && _index.day(s) == dayID) ++want;
+  if (!growCache(_sects, _sectCap, want)) want = 0;
+  for (int s=0; s<_sectorCount && _sectCount < want; ++s) {
+    if (s == _factorySector) continue;
+    if (!_index.present(s)) continue;
+    if (_index.day(s) != dayID) continue;
     summarizeSector(s, _sects[_sectCount++]);
     yield();
   }
@@ -1085,10 +3200,10 @@ void FlashLogger::printSelected() {
     Serial.println("----------------------------------");
     char dateBuf[20]; formatDayID(day, dateBuf, sizeof(dateBuf));
     Serial.printf("date %s\n{\n", dateBuf);
-    for (int s=0; s<MAX_SECTORS; ++s) {
-      if (s == FACTORY_SECTOR) continue;
-      if (!_index[s].present) continue;
-      if (_index[s].dayID != day) continue;
+    for (int s=0; s<_sectorCount; ++s) {
+      if (s == _factorySector) continue;
+      if (!_index.present(s)) continue;
+      if (_index.day(s) != day) continue;
       printSectorData(s);
       yield();
     }
@@ -1104,6 +3219,7 @@ void FlashLogger::printSelected() {
 bool FlashLogger::handleCommand(const String& cmdIn, Stream& io) {
   String cmd = cmdIn; cmd.trim();
   if (!cmd.length()) return false;
+  flush();
 
   if (cmd.equalsIgnoreCase("help")) {
     io.println("Commands:");
@@ -1194,7 +3310,11 @@ bool FlashLogger::handleCommand(const String& cmdIn, Stream& io) {
   if (cmd.equalsIgnoreCase("pf"))     { printFormattedLogs(); return true; }
   if (cmd.equalsIgnoreCase("stats"))  { auto fs=getFlashStats(3500.0f);
     io.printf("Total: %.2f MB  Used: %.2f MB  Free: %.2f MB  Used: %.1f%%  Health: %.1f%%  EstDays: %u\n",
-              fs.totalMB, fs.usedMB, fs.freeMB, fs.usedPercent, fs.healthPercent, fs.estimatedDaysLeft); return true; }
+              fs.totalMB, fs.usedMB, fs.freeMB, fs.usedPercent, fs.healthPercent, fs.estimatedDaysLeft);
+    const FlashMemStats m = memoryUsage();
+    io.printf("RAM: %u B (index %u, zones %u, listings %u, buffer %u, schemas %u)  Sectors: %u  DayRuns: %u\n",
+              (unsigned)m.totalBytes, (unsigned)m.indexBytes, (unsigned)m.zoneBytes, (unsigned)m.summaryBytes,
+              (unsigned)m.bufferBytes, (unsigned)m.schemaBytes, (unsigned)m.sectors, (unsigned)m.dayRuns); return true; }
   if (cmd.equalsIgnoreCase("factory")){ printFactoryInfo(); return true; }
   if (cmd.equalsIgnoreCase("gc"))     { gc(); return true; }
 
@@ -1242,91 +3362,16 @@ bool FlashLogger::recordMatchesTime(uint16_t recDay, uint32_t ts, const QuerySpe
   if (ts < q.ts_from || ts > q.ts_to) return false;
   return true;
 }
-bool FlashLogger::jsonExtractKeyValue(const char* json, const char* key, String& outVal) const {
-  // Find "key":
-  char pat[32];
-  snprintf(pat, sizeof(pat), "\"%s\"", key);
-  const char* p = strstr(json, pat);
-  if (!p) return false;
-  p += strlen(pat);
-  while (*p && (*p==' ' || *p=='\t' || *p==':')) p++;
-  if (!*p) return false;
-
-  // Number or string
-  if (*p == '\"') {
-    const char* q = ++p;
-    while (*q && *q != '\"') q++;
-    outVal = String("\"") + String(p, q-p) + String("\"");
-    return true;
-  } else {
-    const char* q = p;
-    while (*q && *q!='\n' && *q!='\r' && *q!=',' && *q!='}') q++;
-    outVal = String(p, q-p);
-    outVal.trim();
-    return outVal.length() > 0;
-  }
-}
-
-void FlashLogger::buildCsvLine(uint32_t ts, const char* payload, uint16_t len, const char* cols, String& out) const {
-  out = "";
-  // simple CSV: split cols by comma
-  String colsS(cols);
-  colsS.trim();
-  int start = 0;
-  bool first = true;
-  while (start < colsS.length()) {
-    int comma = colsS.indexOf(',', start);
-    String col = (comma >= 0) ? colsS.substring(start, comma) : colsS.substring(start);
-    col.trim();
-    String val;
-    if (col.equalsIgnoreCase("ts")) {
-      val = String(ts);
-    } else {
-      // pull from JSON
-      jsonExtractKeyValue(payload, col.c_str(), val);
-      // remove quotes around strings for CSV cleanliness
-      if (val.startsWith("\"") && val.endsWith("\"")) {
-        val = val.substring(1, val.length()-1);
-      }
-    }
-    if (!first) out += ",";
-    out += val.length() ? val : "";
-    first = false;
-    if (comma < 0) break;
-    start = comma + 1;
-  }
-}
-
-void FlashLogger::buildJsonFiltered(const char* payload, uint16_t len,
-                                    const char* const* keys, bool compact, String& out) {
-  if (!keys || !keys[0]) {
-    // no filter → pass-through (ensure newline)
-    out = String(payload, len);
-    if (out.length()==0 || out[out.length()-1] != '\n') out += '\n';
-    return;
-  }
-  // build {"k1":v1,"k2":v2,...}
-  out = "{";
-  bool first = true;
-  for (int i=0; i<8 && keys[i]; ++i) {
-    String v;
-    if (jsonExtractKeyValue(payload, keys[i], v)) {
-      if (!first) out += ",";
-      out += "\""; out += keys[i]; out += "\":";
-      out += v;
-      first = false;
-    }
-  }
-  out += "}\n";
-  if (!compact) {
-    // (optional pretty — keeping compact for now)
-  }
-}
-
 bool FlashLogger::formatPayload(uint32_t ts, const String& payload, OutFmt fmt, String& out) const {
   if (fmt == OUT_CSV) {
-    buildCsvLine(ts, payload.c_str(), payload.length(), _csvCols, out);
-    if (out.length()==0 || out[out.length()-1] != '\n') out += '\n';
+    RecordHeader rh{};
+    rh.len = payload.length();
+    rh.ts  = ts;
+    RowPlan plan;
+    plan.columns(_csvCols);
+    RowBuffer row;
+    renderRow(rh, (const uint8_t*)payload.c_str(), plan, row);
+    out = row.data();
     return true;
   }
   out = payload;
@@ -1378,133 +3423,1161 @@ bool FlashLogger::addPredicateFromToken(QuerySpec& q, const String& token, Strea
   return true;
 }
 
-bool FlashLogger::recordMatchesPredicates(const char* payload, uint16_t len, const QuerySpec& q) const {
-  if (q.predicateCount == 0) return true;
-  String value;
-  constexpr float kFloatEps = 0.0001f;
-  for (uint8_t i = 0; i < q.predicateCount; ++i) {
-    const FieldPredicate& pred = q.predicates[i];
-    if (!jsonExtractKeyValue(payload, pred.key, value)) return false;
-    value.trim();
-    if (!value.length()) return false;
-    bool numeric = true;
-    for (size_t j=0;j<value.length();++j) {
-      char c = value[j];
-      if (!(isdigit((unsigned char)c) || c=='-' || c=='+' || c=='.')) { numeric = false; break; }
+// ===== v2.1 typed records =====
+namespace {
+  uint8_t fieldSize(FieldType t) { return (t == FT_I16 || t == FT_U16) ? 2 : 4; }
+
+  int64_t fieldScale(uint8_t decimals) {
+    int64_t p = 1;
+    while (decimals--) p *= 10;
+    return p;
+  }
+
+  uint8_t encodeField(const FieldDef& f, float v, uint8_t* out) {
+    if (f.type == FT_F32) {
+      memcpy(out, &v, 4);
+      return 4;
     }
-    if (!numeric) return false;
-    float actual = value.toFloat();
-    switch (pred.op) {
-      case PRED_LT: if (!(actual < pred.value)) return false; break;
-      case PRED_LE: if (!(actual <= pred.value + kFloatEps)) return false; break;
-      case PRED_GT: if (!(actual > pred.value)) return false; break;
-      case PRED_GE: if (!(actual + kFloatEps >= pred.value)) return false; break;
-      case PRED_EQ: if (fabsf(actual - pred.value) > kFloatEps) return false; break;
-      case PRED_NE: if (fabsf(actual - pred.value) <= kFloatEps) return false; break;
+    int64_t lo = INT32_MIN, hi = INT32_MAX;
+    switch (f.type) {
+      case FT_I16: lo = INT16_MIN; hi = INT16_MAX;  break;
+      case FT_U16: lo = 0;         hi = UINT16_MAX; break;
+      case FT_U32: lo = 0;         hi = UINT32_MAX; break;
+      default: break;
     }
+    int64_t x = llround((double)v * (double)fieldScale(f.decimals));
+    x = x < lo ? lo : (x > hi ? hi : x);
+    const uint32_t raw = (uint32_t)x;
+    memcpy(out, &raw, fieldSize(f.type));         // little endian, like the headers
+    return fieldSize(f.type);
+  }
+
+  // value / 10^decimals printed exactly, e.g. -2125 @ 2 -> "-21.25"
+  int fixedText(int64_t v, uint8_t decimals, char* buf, size_t cap) {
+    decimals = decimals > 9 ? 9 : decimals;
+    if (!decimals) return snprintf(buf, cap, "%lld", (long long)v);
+    const int64_t p = fieldScale(decimals);
+    const uint64_t a = v < 0 ? (uint64_t)(-v) : (uint64_t)v;
+    return snprintf(buf, cap, "%s%llu.%0*llu", v < 0 ? "-" : "", (unsigned long long)(a / p),
+                    (int)decimals, (unsigned long long)(a % p));
+  }
+
+  // One stored field as a number and/or its output text; returns the text length.
+  int fieldAt(const FieldDef& f, const uint8_t* p, float* num, char* text, size_t cap) {
+    if (f.type == FT_F32) {
+      float v;
+      memcpy(&v, p, 4);
+      if (num) *num = v;
+      return text ? snprintf(text, cap, "%.*f", (int)f.decimals, (double)v) : 0;
+    }
+    uint32_t raw = 0;
+    memcpy(&raw, p, fieldSize(f.type));
+    int64_t v;
+    switch (f.type) {
+      case FT_I16: v = (int16_t)raw;  break;
+      case FT_U16: v = (uint16_t)raw; break;
+      case FT_I32: v = (int32_t)raw;  break;
+      default:     v = raw;           break;
+    }
+    if (num) *num = (float)((double)v / (double)fieldScale(f.decimals));
+    return text ? fixedText(v, f.decimals, text, cap) : 0;
+  }
+
+  int schemaField(const RecordSchema& s, const char* key) {
+    for (uint8_t i = 0; i < s.count; ++i) {
+      if (strncmp(s.fields[i].key, key, sizeof(s.fields[i].key)) == 0) return i;
+    }
+    return -1;
   }
-  return true;
 }
 
-bool FlashLogger::buildPageToken(int sector, uint32_t addr, uint16_t dayID, uint8_t dir, String& out) const {
-  uint8_t raw[14];
-  raw[0] = 'P'; raw[1] = 'T'; raw[2] = '1'; raw[3] = dir;
-  raw[4] = (uint8_t)(dayID & 0xFF);
-  raw[5] = (uint8_t)((dayID >> 8) & 0xFF);
-  int16_t s = (int16_t)sector;
-  raw[6] = (uint8_t)(s & 0xFF);
-  raw[7] = (uint8_t)((s >> 8) & 0xFF);
-  raw[8]  = (uint8_t)(addr & 0xFF);
-  raw[9]  = (uint8_t)((addr >> 8)  & 0xFF);
-  raw[10] = (uint8_t)((addr >> 16) & 0xFF);
-  raw[11] = (uint8_t)((addr >> 24) & 0xFF);
-  uint16_t crc = crc16(raw, 12, 0xFFFF);
-  raw[12] = (uint8_t)(crc & 0xFF);
-  raw[13] = (uint8_t)((crc >> 8) & 0xFF);
+bool FlashLogger::registerSchema(uint8_t id, const FieldDef* fields, uint8_t count) {
+  if (!id || !fields || !count || count > SCHEMA_FIELDS_MAX) return false;
+  RecordSchema s{};
+  s.id    = id;
+  s.count = count;
+  for (uint8_t i = 0; i < count; ++i) {
+    const FieldDef& f = fields[i];
+    if (!f.key[0] || f.type < FT_I16 || f.type > FT_F32 || f.decimals > 9) return false;
+    strncpy(s.fields[i].key, f.key, sizeof(s.fields[i].key) - 1);
+    s.fields[i].type     = f.type;
+    s.fields[i].decimals = f.decimals;
+  }
+  if (const RecordSchema* have = schema(id)) return memcmp(have, &s, sizeof(s)) == 0;
 
-  static const char kHexDigits[] = "0123456789ABCDEF";
-  out = "";
-  out.reserve(28);
-  for (int i = 0; i < 14; ++i) {
-    out += kHexDigits[raw[i] >> 4];
-    out += kHexDigits[raw[i] & 0x0F];
+  if (!_schemas) _schemas = (RecordSchema*)calloc(SCHEMA_SLOTS, sizeof(RecordSchema));
+  if (!_schemas) return false;
+  uint8_t slot = 0;
+  while (slot < SCHEMA_SLOTS && _schemas[slot].id) ++slot;
+  if (slot == SCHEMA_SLOTS) return false;
+  _schemas[slot] = s;
+  if (!journalAppend(JREC_SCHEMA, nullptr, _schemas, (uint16_t)((slot + 1) * sizeof(RecordSchema)))) {
+    _schemas[slot] = RecordSchema{};
+    return false;
   }
   return true;
 }
 
-bool FlashLogger::parsePageToken(const String& token, int& sector, uint32_t& addr,
-                                 uint16_t& dayID, uint8_t& dir) const {
-  String t = token;
-  t.trim();
-  if (t.length() != 28) return false;
-  uint8_t raw[14];
-  for (int i = 0; i < 14; ++i) {
-    int hi = hexNibble(t[2*i]);
-    int lo = hexNibble(t[2*i + 1]);
-    if (hi < 0 || lo < 0) return false;
-    raw[i] = (uint8_t)((hi << 4) | lo);
+const RecordSchema* FlashLogger::schema(uint8_t id) const {
+  if (!_schemas || !id) return nullptr;
+  for (uint8_t i = 0; i < SCHEMA_SLOTS; ++i) {
+    if (_schemas[i].id == id) return &_schemas[i];
   }
-  if (raw[0] != 'P' || raw[1] != 'T' || raw[2] != '1') return false;
-  uint16_t crc = crc16(raw, 12, 0xFFFF);
-  if ((uint8_t)(crc & 0xFF) != raw[12] || (uint8_t)((crc >> 8) & 0xFF) != raw[13]) return false;
-  dir = raw[3];
-  dayID = (uint16_t)raw[4] | ((uint16_t)raw[5] << 8);
-  sector = (int16_t)((uint16_t)raw[6] | ((uint16_t)raw[7] << 8));
-  addr = (uint32_t)raw[8] | ((uint32_t)raw[9] << 8) | ((uint32_t)raw[10] << 16) | ((uint32_t)raw[11] << 24);
-  return true;
+  return nullptr;
 }
-bool FlashLogger::emitRecord(uint16_t recDay, uint32_t ts, const uint8_t* payload, uint16_t len,
-                             const QuerySpec& q, RowCallback onRow, void* user) {
-  if (!onRow) return false;
-  static String line;
-  if (q.out == OUT_JSONL) {
-    buildJsonFiltered((const char*)payload, len, q.includeKeys, q.compact_json, line);
-  } else { // CSV
-    buildCsvLine(ts, (const char*)payload, len, _csvCols, line);
-    line += "\n";
-  }
-  onRow(line.c_str(), user);
-  return true;
-}
-uint32_t FlashLogger::queryLogs(const QuerySpec& q, RowCallback onRow, void* user,
-                                const String* pageToken, String* nextToken) {
-  if (!onRow) return 0;
-  if (nextToken) *nextToken = "";
 
-  bool resume = false;
-  int resumeSector = 0;
-  uint32_t resumeAddr = 0;
-  if (pageToken && pageToken->length()) {
-    int tokSector; uint32_t tokAddr; uint16_t tokDay; uint8_t tokDir;
-    if (parsePageToken(*pageToken, tokSector, tokAddr, tokDay, tokDir) &&
-        tokDir == PAGE_DIR_FWD && tokSector >= 0 && tokSector < MAX_SECTORS &&
-        tokSector != FACTORY_SECTOR) {
-      resume = true;
-      resumeSector = tokSector;
-      resumeAddr = tokAddr;
-    }
+const RecordSchema* FlashLogger::schemaFor(const RecordHeader& rh) const {
+  return (rh.flags & REC_FLAG_TYPED) ? schema(rh.rsv) : nullptr;
+}
+
+bool FlashLogger::appendTyped(uint8_t schemaId, const float* values) {
+  return appendTyped(schemaId, values, _durability);
+}
+
+bool FlashLogger::appendTyped(uint8_t schemaId, const float* values, FlashDurability mode) {
+  const RecordSchema* s = schema(schemaId);
+  if (!s || !values) return false;
+  uint8_t buf[2 + SCHEMA_FIELDS_MAX * 4];
+  uint16_t mask = 0;
+  uint16_t n = 2;
+  for (uint8_t i = 0; i < s->count; ++i) {
+    if (isnan(values[i])) continue;
+    mask |= (uint16_t)(1u << i);
+    n += encodeField(s->fields[i], values[i], buf + n);
   }
+  memcpy(buf, &mask, sizeof(mask));
+  if (_cfg.compressTyped) return appendSample(schemaId, buf, n, mode);
+  return appendPayload(buf, n, REC_FLAG_TYPED, schemaId, mode, false, nullptr, nullptr);
+}
 
-  uint32_t emitted = 0;
-  uint32_t sample  = 0;
+// Field `field` of a typed payload as a number and/or its output text.
+bool FlashLogger::typedField(const RecordSchema& s, const uint8_t* payload, uint16_t len,
+                             uint8_t field, float* num, String* text) const {
+  if (field >= s.count || len < 2) return false;
+  uint16_t mask;
+  memcpy(&mask, payload, sizeof(mask));
+  if (!(mask & (1u << field))) return false;
+  uint32_t off = 2;
+  for (uint8_t i = 0; i < field; ++i) {
+    if (mask & (1u << i)) off += fieldSize(s.fields[i].type);
+  }
+  const FieldDef& f = s.fields[field];
+  if (off + fieldSize(f.type) > len) return false;
+  char buf[32];
+  fieldAt(f, payload + off, num, text ? buf : nullptr, sizeof(buf));
+  if (text) *text = buf;
+  return true;
+}
 
-  if (_anchorCount == 0) buildAnchors();
+bool FlashLogger::recordNumber(const RecordHeader& rh, const uint8_t* payload, const char* key, float& out) const {
+  if (!(rh.flags & REC_FLAG_TYPED)) return jsonNumber((const char*)payload, rh.len, key, out);
+  const RecordSchema* s = schemaFor(rh);
+  const int i = s ? schemaField(*s, key) : -1;
+  return i >= 0 && typedField(*s, payload, rh.len, (uint8_t)i, &out, nullptr);
+}
 
-  auto locateNextForward = [&](int curSector, uint32_t nextPtr, int& outSector, uint32_t& outAddr) -> bool {
-    if (curSector >= 0) {
-      uint32_t base = sectorBaseAddr(curSector);
-      if (nextPtr < base + SECTOR_SIZE && isValidRecordAt(nextPtr)) {
-        outSector = curSector;
-        outAddr = nextPtr;
-        return true;
-      }
-    }
-    int start = (curSector >= 0) ? curSector + 1 : 0;
-    for (int s = start; s < MAX_SECTORS; ++s) {
-      if (s == FACTORY_SECTOR) continue;
-      if (!_index[s].present) continue;
-      uint32_t firstAddr;
-      if (findFirstRecord(s, firstAddr)) {
+// Typed records come out as {"ts":<unix>,"k1":v1,...} in schema order, the
+// shape the NDJSON producers log; an unknown schema keeps only ts and its id.
+void FlashLogger::renderJson(const RecordHeader& rh, const uint8_t* payload, String& out) const {
+  RowBuffer row;
+  renderJson(rh, payload, row);
+  out = row.data();
+}
+
+void FlashLogger::renderJson(const RecordHeader& rh, const uint8_t* payload, RowBuffer& out) const {
+  out.clear();
+  if (!(rh.flags & REC_FLAG_TYPED)) {
+    out.put((const char*)payload, rh.len);
+    if (!rh.len || payload[rh.len - 1] != '\n') out.put('\n');
+    return;
+  }
+  out.put("{\"ts\":");
+  out.putUnsigned(rh.ts + kUnixAt2000);
+  const RecordSchema* s = schemaFor(rh);
+  if (!s || rh.len < 2) {
+    out.put(",\"schema\":");
+    out.putUnsigned(rh.rsv);
+    out.put("}\n");
+    return;
+  }
+  uint16_t mask;
+  memcpy(&mask, payload, sizeof(mask));
+  uint32_t off = 2;
+  char text[32];
+  for (uint8_t i = 0; i < s->count; ++i) {
+    if (!(mask & (1u << i))) continue;
+    const FieldDef& f = s->fields[i];
+    if (off + fieldSize(f.type) > rh.len) break;
+    out.put(",\"");
+    out.put(f.key, strnlen(f.key, sizeof(f.key)));
+    out.put("\":");
+    out.put(text, fieldAt(f, payload + off, nullptr, text, sizeof(text)));
+    off += fieldSize(f.type);
+  }
+  out.put("}\n");
+}
+
+// ===== v2.1 compiled predicates =====
+namespace {
+  void skipSpace(const char*& p) { while (*p == ' ' || *p == '\t') ++p; }
+  bool isKeyChar(char c) { return isalnum((unsigned char)c) || c == '_' || c == '.'; }
+  constexpr uint8_t kExprDepthMax = 8;
+}
+
+void PredicateProgram::clear() {
+  _ops = _keys = _textUsed = 0;
+  _err = nullptr;
+  schemaId = 0;
+}
+
+bool PredicateProgram::compare(PredicateOp op, float actual, float value) {
+  constexpr float kFloatEps = 0.0001f;
+  switch (op) {
+    case PRED_LT: return actual < value;
+    case PRED_LE: return actual <= value + kFloatEps;
+    case PRED_GT: return actual > value;
+    case PRED_GE: return actual + kFloatEps >= value;
+    case PRED_EQ: return fabsf(actual - value) <= kFloatEps;
+    case PRED_NE: return fabsf(actual - value) > kFloatEps;
+  }
+  return false;
+}
+
+bool PredicateProgram::emit(const Ins& ins) {
+  if (_ops >= MAX_OPS) return fail("expression too long");
+  _ins[_ops++] = ins;
+  return true;
+}
+
+bool PredicateProgram::compile(const char* expr) {
+  clear();
+  if (!expr) return fail("empty expression");
+  const char* p = expr;
+  skipSpace(p);
+  if (!*p) return fail("empty expression");
+  if (!parseOr(p, 0)) return false;
+  skipSpace(p);
+  if (*p) return fail("unexpected text");
+  return true;
+}
+
+bool PredicateProgram::addCompare(const char* key, PredicateOp op, float value) {
+  if (_err) return false;
+  const char* p = key;
+  uint8_t slot;
+  if (!parseKey(p, slot) || *p) return fail("bad key");
+  const bool first = _ops == 0;
+  if (!emit({I_CMP, slot, (uint8_t)op, 0, 0, value})) return false;
+  return first || emit({I_AND, 0, 0, 0, 0, 0.0f});
+}
+
+bool PredicateProgram::keySlot(const char* key, uint8_t& slot) {
+  if (_err) return false;
+  const char* p = key;
+  if (!parseKey(p, slot) || *p) return fail("bad key");
+  return true;
+}
+
+bool PredicateProgram::parseOr(const char*& p, uint8_t depth) {
+  if (!parseAnd(p, depth)) return false;
+  for (;;) {
+    skipSpace(p);
+    if (p[0] != '|' || p[1] != '|') return true;
+    p += 2;
+    if (!parseAnd(p, depth) || !emit({I_OR, 0, 0, 0, 0, 0.0f})) return false;
+  }
+}
+
+bool PredicateProgram::parseAnd(const char*& p, uint8_t depth) {
+  if (!parseFactor(p, depth)) return false;
+  for (;;) {
+    skipSpace(p);
+    if (p[0] != '&' || p[1] != '&') return true;
+    p += 2;
+    if (!parseFactor(p, depth) || !emit({I_AND, 0, 0, 0, 0, 0.0f})) return false;
+  }
+}
+
+bool PredicateProgram::parseKey(const char*& p, uint8_t& slot) {
+  const char* k = p;
+  while (isKeyChar(*p)) ++p;
+  const size_t n = p - k;
+  if (!n) return fail("key expected");
+  if (n >= sizeof(_key[0])) return fail("key too long");
+  for (slot = 0; slot < _keys; ++slot) {
+    if (strncmp(_key[slot], k, n) == 0 && !_key[slot][n]) return true;
+  }
+  if (_keys >= MAX_KEYS) return fail("too many keys");
+  memcpy(_key[_keys], k, n);
+  _key[_keys][n] = 0;
+  slot = _keys++;
+  return true;
+}
+
+bool PredicateProgram::parseFactor(const char*& p, uint8_t depth) {
+  if (depth >= kExprDepthMax) return fail("nested too deep");
+  skipSpace(p);
+  if (*p == '!' && p[1] != '=') {
+    ++p;
+    return parseFactor(p, depth + 1) && emit({I_NOT, 0, 0, 0, 0, 0.0f});
+  }
+  if (*p == '(') {
+    ++p;
+    if (!parseOr(p, depth + 1)) return false;
+    skipSpace(p);
+    if (*p != ')') return fail("')' expected");
+    ++p;
+    return true;
+  }
+  uint8_t slot;
+  if (strncmp(p, "exists(", 7) == 0) {
+    p += 7;
+    skipSpace(p);
+    if (!parseKey(p, slot)) return false;
+    skipSpace(p);
+    if (*p != ')') return fail("')' expected");
+    ++p;
+    return emit({I_EXISTS, slot, 0, 0, 0, 0.0f});
+  }
+  if (!parseKey(p, slot)) return false;
+  skipSpace(p);
+  PredicateOp op;
+  if (p[0] == '<' && p[1] == '=')      { op = PRED_LE; p += 2; }
+  else if (p[0] == '>' && p[1] == '=') { op = PRED_GE; p += 2; }
+  else if (p[0] == '!' && p[1] == '=') { op = PRED_NE; p += 2; }
+  else if (p[0] == '=' && p[1] == '=') { op = PRED_EQ; p += 2; }
+  else if (*p == '<') { op = PRED_LT; ++p; }
+  else if (*p == '>') { op = PRED_GT; ++p; }
+  else if (*p == '=') { op = PRED_EQ; ++p; }
+  else return fail("operator expected");
+  skipSpace(p);
+  if (*p == '"') {
+    if (op != PRED_EQ && op != PRED_NE) return fail("text compares with = or != only");
+    const char* t = ++p;
+    while (*p && *p != '"') ++p;
+    if (!*p) return fail("unterminated text");
+    const size_t n = p++ - t;
+    if (n > 0xFF || _textUsed + n > MAX_TEXT) return fail("text too long");
+    memcpy(_text + _textUsed, t, n);
+    const Ins ins = {I_TEXT, slot, (uint8_t)op, _textUsed, (uint8_t)n, 0.0f};
+    _textUsed += n;
+    return emit(ins);
+  }
+  char* end;
+  const float value = strtof(p, &end);
+  if (end == p) return fail("number expected");
+  p = end;
+  return emit({I_CMP, slot, (uint8_t)op, 0, 0, value});
+}
+
+// Postfix run on a bit stack; compile() keeps it within MAX_OPS entries.
+bool PredicateProgram::eval(const Values& v) const {
+  uint32_t stack = 0;
+  uint8_t  sp = 0;
+  for (uint8_t i = 0; i < _ops; ++i) {
+    const Ins& in = _ins[i];
+    const uint8_t bit = 1u << in.key;
+    bool r;
+    switch (in.code) {
+      case I_CMP:
+        r = (v.number & bit) && compare((PredicateOp)in.op, v.num[in.key], in.value);
+        break;
+      case I_TEXT:
+        r = (v.present & bit) && !(v.number & bit) &&
+            ((v.textLen[in.key] == in.textLen &&
+              memcmp(v.text[in.key], _text + in.textOff, in.textLen) == 0) == (in.op == PRED_EQ));
+        break;
+      case I_EXISTS:
+        r = v.present & bit;
+        break;
+      case I_NOT:
+        r = !((stack >> --sp) & 1);
+        break;
+      default: {
+        const bool b = (stack >> --sp) & 1;
+        const bool a = (stack >> --sp) & 1;
+        r = in.code == I_AND ? (a && b) : (a || b);
+        break;
+      }
+    }
+    stack = (stack & ~(1UL << sp)) | ((uint32_t)r << sp);
+    ++sp;
+  }
+  return sp && (stack & 1);
+}
+
+// Per node: can some record make it true, can some make it false. Records
+// may lack any field, so a leaf can always be false.
+bool PredicateProgram::mayMatch(const Bounds& b) const {
+  uint32_t canTrue = 0, canFalse = 0;
+  uint8_t  sp = 0;
+  constexpr float kFloatEps = 0.0001f;
+  for (uint8_t i = 0; i < _ops; ++i) {
+    const Ins& in = _ins[i];
+    bool t = true, f = true;
+    switch (in.code) {
+      case I_CMP:
+        if (b.state[in.key] == Bounds::ABSENT) {
+          t = false;
+        } else if (b.state[in.key] == Bounds::RANGE) {
+          const float lo = b.lo[in.key], hi = b.hi[in.key];
+          switch ((PredicateOp)in.op) {
+            case PRED_LT: t = lo < in.value; break;
+            case PRED_LE: t = lo <= in.value + kFloatEps; break;
+            case PRED_GT: t = hi > in.value; break;
+            case PRED_GE: t = hi + kFloatEps >= in.value; break;
+            case PRED_EQ: t = in.value >= lo - kFloatEps && in.value <= hi + kFloatEps; break;
+            case PRED_NE: break;
+          }
+        }
+        break;
+      case I_TEXT:
+      case I_EXISTS:
+        t = b.state[in.key] != Bounds::ABSENT;
+        break;
+      case I_NOT:
+        --sp;
+        t = (canFalse >> sp) & 1;
+        f = (canTrue >> sp) & 1;
+        break;
+      default: {
+        --sp;
+        const bool bt = (canTrue >> sp) & 1, bf = (canFalse >> sp) & 1;
+        --sp;
+        const bool at = (canTrue >> sp) & 1, af = (canFalse >> sp) & 1;
+        if (in.code == I_AND) { t = at && bt; f = af || bf; }
+        else                  { t = at || bt; f = af && bf; }
+        break;
+      }
+    }
+    canTrue  = (canTrue & ~(1UL << sp)) | ((uint32_t)t << sp);
+    canFalse = (canFalse & ~(1UL << sp)) | ((uint32_t)f << sp);
+    ++sp;
+  }
+  return !sp || (canTrue & 1);
+}
+
+// The filter a query runs: its where program plus the fixed predicates.
+bool FlashLogger::compileFilter(const QuerySpec& q, PredicateProgram& out) const {
+  if (q.where) {
+    if (q.where->error()) return false;
+    out = *q.where;
+  } else {
+    out.clear();
+  }
+  out.schemaId = 0;
+  for (uint8_t i = 0; i < q.predicateCount; ++i) {
+    const FieldPredicate& pred = q.predicates[i];
+    if (!out.addCompare(pred.key, pred.op, pred.value)) return false;
+  }
+  return true;
+}
+
+// One pass over the record for every key of the program: typed fields by
+// position, JSON through jsonFields.
+void FlashLogger::scanValues(const RecordHeader& rh, const uint8_t* payload, const PredicateProgram& prog,
+                             PredicateProgram::Values& v) const {
+  v.present = v.number = 0;
+  const uint8_t keys = prog.keys();
+  if (rh.flags & REC_FLAG_TYPED) {
+    for (uint8_t k = 0; k < keys; ++k) {
+      if (strcmp(prog.key(k), "ts") != 0) continue;
+      v.num[k] = (float)(rh.ts + kUnixAt2000);
+      v.present |= 1u << k;
+      v.number  |= 1u << k;
+    }
+    const RecordSchema* s = schemaFor(rh);
+    if (!s || rh.len < 2) return;
+    if (prog.schemaId != s->id) {
+      for (uint8_t i = 0; i < s->count; ++i) {
+        uint8_t k = 0;
+        while (k < keys && strncmp(prog.key(k), s->fields[i].key, sizeof(s->fields[i].key)) != 0) ++k;
+        prog.fieldKey[i] = k < keys ? k : 0xFF;
+      }
+      prog.schemaId = s->id;
+    }
+    uint16_t mask;
+    memcpy(&mask, payload, sizeof(mask));
+    uint32_t off = 2;
+    for (uint8_t i = 0; i < s->count; ++i) {
+      if (!(mask & (1u << i))) continue;
+      const FieldDef& f = s->fields[i];
+      const uint8_t n = fieldSize(f.type);
+      if (off + n > rh.len) return;
+      const uint8_t k = prog.fieldKey[i];
+      if (k != 0xFF) {
+        fieldAt(f, payload + off, &v.num[k], nullptr, 0);
+        v.present |= 1u << k;
+        v.number  |= 1u << k;
+      }
+      off += n;
+    }
+    return;
+  }
+
+  const char* names[PredicateProgram::MAX_KEYS] = {};
+  FieldSpan span[PredicateProgram::MAX_KEYS];
+  for (uint8_t k = 0; k < keys; ++k) names[k] = prog.key(k);
+  const char* json = (const char*)payload;
+  v.present = (uint8_t)jsonFields(json, rh.len, names, keys, span);
+  for (uint8_t k = 0; k < keys; ++k) {
+    if (!(v.present & (1u << k))) continue;
+    const FieldSpan& s = span[k];
+    if (s.len >= 2 && json[s.off] == '"') {
+      v.text[k] = json + s.off + 1;
+      v.textLen[k] = s.len - 2 > 0xFF ? 0xFF : (uint8_t)(s.len - 2);
+    } else if (jsonSpanNumber(json, s, v.num[k])) {
+      v.number |= 1u << k;
+    }
+  }
+}
+
+bool FlashLogger::recordMatchesPredicates(const RecordHeader& rh, const uint8_t* payload,
+                                          const PredicateProgram& filter) const {
+  if (filter.empty()) return true;
+  PredicateProgram::Values v;
+  scanValues(rh, payload, filter, v);
+  return filter.eval(v);
+}
+
+// ===== v2.1 row plans =====
+// Top-level members of a JSON object, one pass, first occurrence of a key
+// wins. Values are bounded by len: payloads are views into a read window.
+uint16_t FlashLogger::jsonFields(const char* json, uint16_t len, const char* const* keys, uint8_t count,
+                                 FieldSpan* out) {
+  const char* p = json;
+  const char* end = json + len;
+  const uint16_t all = (uint16_t)((1UL << count) - 1);
+  uint16_t found = 0;
+  auto space = [&]() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p; };
+  auto string = [&]() -> bool {           // p on the opening quote; leaves p past the closing one
+    for (++p; p < end && *p != '"'; ++p) {
+      if (*p == '\\') ++p;
+    }
+    return p++ < end;
+  };
+  space();
+  if (p >= end || *p != '{') return 0;
+  ++p;
+  while (found != all) {
+    space();
+    if (p < end && *p == ',') { ++p; space(); }
+    if (p >= end || *p != '"') break;
+    const char* k = p + 1;
+    if (!string()) break;
+    const size_t klen = p - 1 - k;
+    space();
+    if (p >= end || *p != ':') break;
+    ++p;
+    space();
+    if (p >= end) break;
+    const char* val = p;
+    if (*p == '"') {
+      if (!string()) break;
+    } else if (*p == '{' || *p == '[') {
+      int depth = 0;
+      while (p < end) {
+        if (*p == '"') { if (!string()) break; continue; }
+        if (*p == '{' || *p == '[') ++depth;
+        else if ((*p == '}' || *p == ']') && --depth == 0) { ++p; break; }
+        ++p;
+      }
+    } else {
+      while (p < end && *p != ',' && *p != '}' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') ++p;
+    }
+    for (uint8_t i = 0; i < count; ++i) {
+      if ((found & (1u << i)) || strncmp(keys[i], k, klen) != 0 || keys[i][klen]) continue;
+      out[i].off = (uint16_t)(val - json);
+      out[i].len = (uint16_t)(p - val);
+      found |= 1u << i;
+    }
+  }
+  return found;
+}
+
+// Digits, sign and point only, like the old string-based lookup accepted.
+bool FlashLogger::jsonSpanNumber(const char* json, const FieldSpan& v, float& out) {
+  char num[24];
+  if (!v.len || v.len >= sizeof(num)) return false;
+  for (uint16_t i = 0; i < v.len; ++i) {
+    const char c = json[v.off + i];
+    if (!(isdigit((unsigned char)c) || c == '-' || c == '+' || c == '.')) return false;
+  }
+  memcpy(num, json + v.off, v.len);
+  num[v.len] = 0;
+  out = strtof(num, nullptr);
+  return true;
+}
+
+bool FlashLogger::jsonNumber(const char* json, uint16_t len, const char* key, float& out) const {
+  FieldSpan v;
+  return jsonFields(json, len, &key, 1, &v) && jsonSpanNumber(json, v, out);
+}
+
+bool RowPlan::add(const char* name, size_t len) {
+  if (_count >= MAX_COLS || _used + len + 1 > sizeof(_names)) return false;
+  char* dst = _names + _used;
+  memcpy(dst, name, len);
+  dst[len] = 0;
+  _used += len + 1;
+  _name[_count++] = dst;
+  return true;
+}
+
+void RowPlan::columns(const char* csv) {
+  _csv = true;
+  _count = _used = 0;
+  _tsMask = 0;
+  schemaId = 0;
+  const char* p = csv ? csv : "";
+  while (isspace((unsigned char)*p)) ++p;
+  while (*p) {
+    const char* comma = strchr(p, ',');
+    const char* e = comma ? comma : p + strlen(p);
+    const char* a = p;
+    while (a < e && isspace((unsigned char)*a)) ++a;
+    const char* b = e;
+    while (b > a && isspace((unsigned char)b[-1])) --b;
+    if (!add(a, b - a)) break;
+    if (b - a == 2 && tolower((unsigned char)a[0]) == 't' && tolower((unsigned char)a[1]) == 's') {
+      _tsMask |= 1u << (_count - 1);
+    }
+    if (!comma) break;
+    p = comma + 1;
+  }
+}
+
+void RowPlan::keys(const char* const* keys) {
+  _csv = false;
+  _count = _used = 0;
+  _tsMask = 0;
+  schemaId = 0;
+  for (int i = 0; keys && i < 8 && keys[i]; ++i) {
+    if (!add(keys[i], strlen(keys[i]))) break;
+  }
+}
+
+void FlashLogger::rowPlan(const QuerySpec& q, RowPlan& plan) const {
+  if (q.out == OUT_CSV) plan.columns(_csvCols);
+  else                  plan.keys(q.includeKeys);
+}
+
+// CSV: one line of the plan's columns, strings unquoted, missing values
+// empty. JSONL: {"k":v,...} of the keys present, or the whole record when
+// the plan has none. Both end in '\n'.
+void FlashLogger::renderRow(const RecordHeader& rh, const uint8_t* payload, const RowPlan& plan,
+                            RowBuffer& out) const {
+  if (!plan.csv() && !plan.count()) {
+    renderJson(rh, payload, out);
+    return;
+  }
+  const uint8_t n = plan.count();
+  FieldSpan span[RowPlan::MAX_COLS];
+  uint16_t found = 0;
+  char text[RowPlan::MAX_COLS][24];          // typed values, formatted
+  const char* src = (const char*)payload;
+  if (rh.flags & REC_FLAG_TYPED) {
+    for (uint8_t c = 0; c < n; ++c) {
+      if (plan.csv() || strcmp(plan.names()[c], "ts") != 0) continue;
+      span[c] = { 0, (uint16_t)snprintf(text[c], sizeof(text[c]), "%lu", (unsigned long)(rh.ts + kUnixAt2000)) };
+      found |= 1u << c;
+    }
+    const RecordSchema* s = schemaFor(rh);
+    if (s && rh.len >= 2) {
+      if (plan.schemaId != s->id) {
+        for (uint8_t i = 0; i < s->count; ++i) {
+          uint8_t c = 0;
+          while (c < n && strncmp(plan.names()[c], s->fields[i].key, sizeof(s->fields[i].key)) != 0) ++c;
+          plan.fieldCol[i] = c < n ? c : 0xFF;
+        }
+        plan.schemaId = s->id;
+      }
+      uint16_t mask;
+      memcpy(&mask, payload, sizeof(mask));
+      uint32_t off = 2;
+      for (uint8_t i = 0; i < s->count; ++i) {
+        if (!(mask & (1u << i))) continue;
+        const uint8_t size = fieldSize(s->fields[i].type);
+        if (off + size > rh.len) break;
+        const uint8_t c = plan.fieldCol[i];
+        if (c != 0xFF && !(found & (1u << c))) {
+          span[c] = { 0, (uint16_t)fieldAt(s->fields[i], payload + off, nullptr, text[c], sizeof(text[c])) };
+          found |= 1u << c;
+        }
+        off += size;
+      }
+    }
+  } else {
+    found = jsonFields(src, rh.len, plan.names(), n, span);
+  }
+  auto value = [&](uint8_t c) -> const char* {
+    return (rh.flags & REC_FLAG_TYPED) ? text[c] : src + span[c].off;
+  };
+
+  out.clear();
+  if (plan.csv()) {
+    for (uint8_t c = 0; c < n; ++c) {
+      if (c) out.put(',');
+      if (plan.isTs(c)) {
+        out.putUnsigned(rh.ts);
+      } else if (found & (1u << c)) {
+        const char* v = value(c);
+        uint16_t len = span[c].len;
+        if (len >= 2 && v[0] == '"' && v[len - 1] == '"') { ++v; len -= 2; }
+        out.put(v, len);
+      }
+    }
+    out.put('\n');
+    return;
+  }
+  out.put('{');
+  bool first = true;
+  for (uint8_t c = 0; c < n; ++c) {
+    if (!(found & (1u << c))) continue;
+    if (!first) out.put(',');
+    out.put('"');
+    out.put(plan.names()[c]);
+    out.put("\":");
+    out.put(value(c), span[c].len);
+    first = false;
+  }
+  out.put("}\n");
+}
+
+// ===== v2.1 span rows =====
+RowBuffer::~RowBuffer() {
+  if (_owned) free(_buf);
+}
+
+// Doubles, starting at 256 bytes; a caller's buffer is copied over once.
+bool RowBuffer::reserve(size_t n) {
+  if (n + 1 <= _cap) return true;
+  size_t cap = _cap < 256 ? 256 : _cap;
+  while (cap < n + 1) cap *= 2;
+  char* p = (char*)malloc(cap);
+  if (!p) return false;
+  if (_len) memcpy(p, _buf, _len);
+  p[_len] = 0;
+  if (_owned) free(_buf);
+  _buf = p;
+  _cap = cap;
+  _owned = true;
+  ++_grows;
+  return true;
+}
+
+bool RowBuffer::put(const char* s, size_t n) {
+  if (!reserve(_len + n)) return false;
+  memcpy(_buf + _len, s, n);
+  _len += n;
+  _buf[_len] = 0;
+  return true;
+}
+
+bool RowBuffer::putUnsigned(uint32_t v) {
+  char digits[10];
+  int n = 0;
+  do { digits[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+  if (!reserve(_len + n)) return false;
+  while (n) _buf[_len++] = digits[--n];
+  _buf[_len] = 0;
+  return true;
+}
+
+// One row to the sink. Without a plan, stored JSON goes out straight from
+// the payload view and typed records are rendered.
+bool FlashLogger::emitRow(RecordIterator& it, const uint8_t* payload, const RowPlan* plan, RowBuffer& buf,
+                          RowSink sink, void* user) const {
+  RecordMeta meta;
+  meta.header = it.header();
+  meta.dayID  = it.day();
+  meta.sector = (int16_t)it.sector();
+  meta.addr   = it.addr();
+  meta.sample = it.sample();
+  if (!plan && !(meta.header.flags & REC_FLAG_TYPED)) {
+    return sink((const char*)payload, meta.header.len, meta, user);
+  }
+  if (plan) renderRow(meta.header, payload, *plan, buf);
+  else      renderJson(meta.header, payload, buf);
+  return sink(buf.data(), buf.length(), meta, user);
+}
+
+namespace {
+  struct RowCallbackSink {
+    RowCallback onRow;
+    void* user;
+    static bool call(const char* data, size_t, const RecordMeta&, void* u) {
+      const RowCallbackSink* s = static_cast<const RowCallbackSink*>(u);
+      s->onRow(data, s->user);
+      return true;
+    }
+  };
+
+  // onRecord gets a String; one is kept for the whole export.
+  struct RecordCallbackSink {
+    bool (*onRecord)(const RecordHeader&, const String&, void*);
+    void* user;
+    String text;
+    static bool call(const char* data, size_t len, const RecordMeta& meta, void* u) {
+      RecordCallbackSink* s = static_cast<RecordCallbackSink*>(u);
+      s->text = "";
+      s->text.concat(data, len);
+      return s->onRecord(meta.header, s->text, s->user);
+    }
+  };
+}
+
+
+// ===== v2.1 compressed sample blocks =====
+namespace {
+  uint8_t leadingZeros(uint32_t x)  { return x ? (uint8_t)__builtin_clz(x) : 32; }
+  uint8_t trailingZeros(uint32_t x) { return x ? (uint8_t)__builtin_ctz(x) : 32; }
+
+  // zigzag delta-of-delta: '0', '10'+7, '110'+9, '1110'+12, '1111'+32 bits
+  const uint8_t kDodWidth[4] = { 7, 9, 12, 32 };
+}
+
+void SampleCodec::begin(const RecordSchema& s, uint32_t ts) {
+  _s     = &s;
+  _bits  = 0;
+  _n     = 0;
+  _mask  = (uint16_t)((1u << s.count) - 1);
+  _ts    = ts;
+  _delta = 0;
+  memset(_prev, 0, sizeof(_prev));
+  memset(_lead, 0, sizeof(_lead));
+  memset(_trail, 0xFF, sizeof(_trail));
+}
+
+// Bytes are cleared as the stream reaches them, so buf needs no init.
+bool SampleCodec::putBits(uint8_t* buf, uint16_t cap, uint32_t v, uint8_t n) {
+  if (_bits + n > (uint32_t)cap * 8) return false;
+  while (n) {
+    const uint8_t used = _bits & 7;
+    const uint8_t take = min<uint8_t>(n, 8 - used);
+    if (!used) buf[_bits >> 3] = 0;
+    buf[_bits >> 3] |= (uint8_t)(((v >> (n - take)) & ((1u << take) - 1)) << (8 - used - take));
+    _bits += take;
+    n -= take;
+  }
+  return true;
+}
+
+bool SampleCodec::getBits(const uint8_t* buf, uint16_t len, uint8_t n, uint32_t& v) {
+  if (_bits + n > (uint32_t)len * 8) return false;
+  v = 0;
+  while (n) {
+    const uint8_t used = _bits & 7;
+    const uint8_t take = min<uint8_t>(n, 8 - used);
+    v = (v << take) | ((buf[_bits >> 3] >> (8 - used - take)) & ((1u << take) - 1));
+    _bits += take;
+    n -= take;
+  }
+  return true;
+}
+
+// Gorilla XOR on the stored bits: unchanged, inside the previous window of
+// meaningful bits, or a new window (leading zeros, length, bits).
+bool SampleCodec::putValue(uint8_t* buf, uint16_t cap, uint8_t field, uint8_t width, uint32_t raw) {
+  const uint32_t x = raw ^ _prev[field];
+  _prev[field] = raw;
+  if (!x) return putBits(buf, cap, 0, 1);
+  const uint8_t lead  = (uint8_t)(leadingZeros(x) - (32 - width));
+  const uint8_t trail = trailingZeros(x);
+  if (_trail[field] != 0xFF && lead >= _lead[field] && trail >= _trail[field]) {
+    return putBits(buf, cap, 0x2, 2) &&
+           putBits(buf, cap, x >> _trail[field], (uint8_t)(width - _lead[field] - _trail[field]));
+  }
+  const uint8_t meaningful = (uint8_t)(width - lead - trail);
+  const uint8_t lenBits = width == 32 ? 5 : 4;
+  _lead[field]  = lead;
+  _trail[field] = trail;
+  return putBits(buf, cap, 0x3, 2) && putBits(buf, cap, lead, lenBits) &&
+         putBits(buf, cap, meaningful - 1, lenBits) && putBits(buf, cap, x >> trail, meaningful);
+}
+
+bool SampleCodec::put(uint8_t* buf, uint16_t cap, uint32_t ts, const uint8_t* payload, uint16_t len) {
+  if (!_s || len < 2) return false;
+  const SampleCodec before = *this;
+  uint16_t mask;
+  memcpy(&mask, payload, sizeof(mask));
+  bool ok = true;
+  if (_n) {
+    const int32_t delta = (int32_t)(ts - _ts);
+    const int32_t dod   = delta - _delta;
+    const uint32_t z    = ((uint32_t)dod << 1) ^ (uint32_t)(dod >> 31);
+    if (!z) {
+      ok = putBits(buf, cap, 0, 1);
+    } else {
+      uint8_t k = 0;
+      while (k < 3 && z >= (1u << kDodWidth[k])) ++k;
+      const uint32_t prefix = k < 3 ? (0xFu >> (3 - k)) << 1 : 0xFu;   // '10' .. '1111'
+      ok = putBits(buf, cap, prefix, k < 3 ? k + 2 : 4) && putBits(buf, cap, z, kDodWidth[k]);
+    }
+    _ts    = ts;
+    _delta = delta;
+  }
+  if (mask == _mask) {
+    ok = ok && putBits(buf, cap, 0, 1);
+  } else {
+    ok = ok && putBits(buf, cap, 1, 1) && putBits(buf, cap, mask, _s->count);
+    _mask = mask;
+  }
+  uint16_t off = 2;
+  for (uint8_t i = 0; ok && i < _s->count; ++i) {
+    if (!(mask & (1u << i))) continue;
+    const uint8_t size = fieldSize(_s->fields[i].type);
+    uint32_t raw = 0;
+    if (off + size > len) { ok = false; break; }
+    memcpy(&raw, payload + off, size);
+    off += size;
+    ok = putValue(buf, cap, i, (uint8_t)(size * 8), raw);
+  }
+  if (ok) {
+    ++_n;
+    return true;
+  }
+  *this = before;
+  if (_bits & 7) buf[_bits >> 3] &= (uint8_t)(0xFF00u >> (_bits & 7));
+  return false;
+}
+
+bool SampleCodec::get(const uint8_t* buf, uint16_t len, uint32_t& ts, uint8_t* out, uint16_t& outLen) {
+  if (!_s) return false;
+  uint32_t b;
+  if (_n) {
+    if (!getBits(buf, len, 1, b)) return false;
+    if (b) {
+      uint8_t k = 0;
+      while (k < 3) {
+        if (!getBits(buf, len, 1, b)) return false;
+        if (!b) break;
+        ++k;
+      }
+      uint32_t z;
+      if (!getBits(buf, len, kDodWidth[k], z)) return false;
+      _delta += (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+    }
+    _ts += (uint32_t)_delta;
+  }
+  ts = _ts;
+  if (!getBits(buf, len, 1, b)) return false;
+  if (b) {
+    if (!getBits(buf, len, _s->count, b)) return false;
+    _mask = (uint16_t)b;
+  }
+  memcpy(out, &_mask, sizeof(_mask));
+  uint16_t off = 2;
+  for (uint8_t i = 0; i < _s->count; ++i) {
+    if (!(_mask & (1u << i))) continue;
+    const uint8_t size  = fieldSize(_s->fields[i].type);
+    const uint8_t width = (uint8_t)(size * 8);
+    uint32_t x = 0;
+    if (!getBits(buf, len, 1, b)) return false;
+    if (b) {
+      if (!getBits(buf, len, 1, b)) return false;
+      if (!b) {
+        if (_trail[i] == 0xFF) return false;
+        if (!getBits(buf, len, (uint8_t)(width - _lead[i] - _trail[i]), x)) return false;
+        x <<= _trail[i];
+      } else {
+        const uint8_t lenBits = width == 32 ? 5 : 4;
+        uint32_t lead, meaningful;
+        if (!getBits(buf, len, lenBits, lead) || !getBits(buf, len, lenBits, meaningful)) return false;
+        meaningful += 1;
+        if (lead + meaningful > width) return false;
+        _lead[i]  = (uint8_t)lead;
+        _trail[i] = (uint8_t)(width - lead - meaningful);
+        if (!getBits(buf, len, (uint8_t)meaningful, x)) return false;
+        x <<= _trail[i];
+      }
+    }
+    _prev[i] ^= x;
+    memcpy(out + off, &_prev[i], size);
+    off += size;
+  }
+  outLen = off;
+  ++_n;
+  return true;
+}
+
+// The sample joins the open block; one for another schema or day, or with
+// no room left for it, is sealed first. Without RAM for a block the sample
+// is stored as a plain typed record.
+bool FlashLogger::appendSample(uint8_t schemaId, const uint8_t* payload, uint16_t len,
+                               FlashDurability mode) {
+  if (_currentSector < 0) return false;
+  DateTime now;
+  uint32_t unixNow;
+  if (!appendClock(now, unixNow)) return false;
+  if (!_blk) _blk = (OpenBlock*)calloc(1, sizeof(OpenBlock));
+  if (!_blk) return appendPayload(payload, len, REC_FLAG_TYPED, schemaId, mode, false, nullptr, nullptr);
+
+  flushIfDue();
+  const uint32_t ts  = now.secondstime();
+  const uint16_t day = dayIDFromDateTime(now);
+  if (_blk->count && (_blk->schemaId != schemaId || _blk->day != day ||
+                      !_blk->codec.put(_blk->buf, _blk->cap, ts, payload, len))) {
+    sealBlock();
+  }
+  if (!_blk->count) {
+    blockStart(schemaId, ts, day);
+    if (!_blk->codec.put(_blk->buf, _blk->cap, ts, payload, len)) return false;
+  }
+  _blk->count++;
+  _seqCounter++;
+  if (mode < _blk->mode) _blk->mode = mode;
+  if (mode == FLASH_DURABLE_GROUP) _blk->timed = true;
+  _lastGoodUnix = unixNow;
+  RecordHeader rh{};
+  rh.len   = len;
+  rh.ts    = ts;
+  rh.seq   = _seqCounter - 1;
+  rh.flags = REC_FLAG_TYPED;
+  rh.rsv   = schemaId;
+  rollupFeed(rh, payload);
+  if (mode == FLASH_DURABLE_SYNC) return sealBlock();        // on flash before returning
+  if (_blk->codec.bytes() + 2 > _blk->cap) sealBlock();     // page full
+  return true;
+}
+
+// The record ends at the close of the page the write pointer is in (or the
+// next one, when that leaves less than BLOCK_MIN), or at the end of the
+// sector's data area. A new day or a full sector starts past a new header.
+void FlashLogger::blockStart(uint8_t schemaId, uint32_t ts, uint16_t day) {
+  const uint32_t base = sectorBaseAddr(_currentSector);
+  uint32_t off = _index.writePtr(_currentSector) - base;
+  if (day != _currentDay || off + BLOCK_MIN > ZONE_DATA_END) off = sizeof(SectorHeader);
+  uint32_t room = PAGE_SIZE - off % PAGE_SIZE;
+  if (room < BLOCK_MIN) room += PAGE_SIZE;
+  if (off + room > ZONE_DATA_END) room = ZONE_DATA_END - off;
+  room -= sizeof(RecordHeader) + sizeof(uint16_t) + 1 + REC_TRAILER;   // header, count, commit, link
+
+  _blk->schemaId = schemaId;
+  _blk->count    = 0;
+  _blk->cap      = (uint16_t)min<uint32_t>(room, BLOCK_STREAM_MAX);
+  _blk->day      = day;
+  _blk->ts       = ts;
+  _blk->seq      = _seqCounter;
+  _blk->firstMs  = millis();
+  _blk->mode     = FLASH_DURABLE_DEFERRED;
+  _blk->timed    = false;
+  _blk->codec.begin(*schema(schemaId), ts);
+}
+
+// The block is detached before it is appended: a flush or sector move
+// inside appendPayload() must not seal it again.
+bool FlashLogger::sealBlock() {
+  if (!_blk || !_blk->count) return true;
+  uint8_t rec[sizeof(uint16_t) + BLOCK_STREAM_MAX];
+  const uint16_t n = _blk->codec.bytes();
+  memcpy(rec, &_blk->count, sizeof(uint16_t));
+  memcpy(rec + sizeof(uint16_t), _blk->buf, n);
+  RecordHeader first{};
+  first.ts  = _blk->ts;
+  first.seq = _blk->seq;
+  _blk->count = 0;
+  return appendPayload(rec, (uint16_t)(sizeof(uint16_t) + n), REC_FLAG_TYPED | REC_FLAG_COMPRESSED,
+                       _blk->schemaId, _blk->mode, false, nullptr, nullptr, &first);
+}
+
+// Tokens: PT1 = record address; PT2 adds a sample index (compressed blocks).
+bool FlashLogger::buildPageToken(int sector, uint32_t addr, uint16_t sample, uint16_t dayID,
+                                 uint8_t dir, String& out) const {
+  uint8_t raw[16];
+  const int n = sample ? 16 : 14;
+  raw[0] = 'P'; raw[1] = 'T'; raw[2] = sample ? '2' : '1'; raw[3] = dir;
+  raw[4] = (uint8_t)(dayID & 0xFF);
+  raw[5] = (uint8_t)((dayID >> 8) & 0xFF);
+  int16_t s = (int16_t)sector;
+  raw[6] = (uint8_t)(s & 0xFF);
+  raw[7] = (uint8_t)((s >> 8) & 0xFF);
+  raw[8]  = (uint8_t)(addr & 0xFF);
+  raw[9]  = (uint8_t)((addr >> 8)  & 0xFF);
+  raw[10] = (uint8_t)((addr >> 16) & 0xFF);
+  raw[11] = (uint8_t)((addr >> 24) & 0xFF);
+  raw[12] = (uint8_t)(sample & 0xFF);
+  raw[13] = (uint8_t)(sample >> 8);
+  uint16_t crc = crc16(raw, n - 2, 0xFFFF);
+  raw[n - 2] = (uint8_t)(crc & 0xFF);
+  raw[n - 1] = (uint8_t)((crc >> 8) & 0xFF);
+
+  static const char kHexDigits[] = "0123456789ABCDEF";
+  out = "";
+  out.reserve(2 * n);
+  for (int i = 0; i < n; ++i) {
+    out += kHexDigits[raw[i] >> 4];
+    out += kHexDigits[raw[i] & 0x0F];
+  }
+  return true;
+}
+
+bool FlashLogger::parsePageToken(const String& token, int& sector, uint32_t& addr, uint16_t& sample,
+                                 uint16_t& dayID, uint8_t& dir) const {
+  String t = token;
+  t.trim();
+  if (t.length() != 28 && t.length() != 32) return false;
+  const int n = (int)t.length() / 2;
+  uint8_t raw[16];
+  for (int i = 0; i < n; ++i) {
+    int hi = hexNibble(t[2*i]);
+    int lo = hexNibble(t[2*i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    raw[i] = (uint8_t)((hi << 4) | lo);
+  }
+  if (raw[0] != 'P' || raw[1] != 'T' || raw[2] != (n == 16 ? '2' : '1')) return false;
+  uint16_t crc = crc16(raw, n - 2, 0xFFFF);
+  if ((uint8_t)(crc & 0xFF) != raw[n - 2] || (uint8_t)((crc >> 8) & 0xFF) != raw[n - 1]) return false;
+  sample = n == 16 ? (uint16_t)(raw[12] | (raw[13] << 8)) : 0;
+  dir = raw[3];
+  dayID = (uint16_t)raw[4] | ((uint16_t)raw[5] << 8);
+  sector = (int16_t)((uint16_t)raw[6] | ((uint16_t)raw[7] << 8));
+  addr = (uint32_t)raw[8] | ((uint32_t)raw[9] << 8) | ((uint32_t)raw[10] << 16) | ((uint32_t)raw[11] << 24);
+  return true;
+}
+uint32_t FlashLogger::queryLogs(const QuerySpec& q, RowCallback onRow, void* user,
+                                const String* pageToken, String* nextToken) {
+  if (!onRow) return 0;
+  RowCallbackSink adapter{onRow, user};
+  return queryLogs(q, RowCallbackSink::call, &adapter, pageToken, nextToken);
+}
+
+uint32_t FlashLogger::queryLogs(const QuerySpec& q, RowSink sink, void* user, const String* pageToken,
+                                String* nextToken, RowBuffer* scratch) {
+  if (!sink) return 0;
+  PredicateProgram match;
+  if (!compileFilter(q, match)) return 0;
+  RowPlan plan;
+  rowPlan(q, plan);
+  RowBuffer own;
+  RowBuffer& buf = scratch ? *scratch : own;
+  String spill;
+  flush();
+  if (nextToken) *nextToken = "";
+
+  bool resume = false;
+  int resumeSector = 0;
+  uint32_t resumeAddr = 0;
+  uint16_t resumeSample = 0;
+  if (pageToken && pageToken->length()) {
+    int tokSector; uint32_t tokAddr; uint16_t tokSample, tokDay; uint8_t tokDir;
+    if (parsePageToken(*pageToken, tokSector, tokAddr, tokSample, tokDay, tokDir) &&
+        tokDir == PAGE_DIR_FWD && tokSector >= 0 && tokSector < _sectorCount &&
+        tokSector != _factorySector) {
+      resume = true;
+      resumeSector = tokSector;
+      resumeAddr = tokAddr;
+      resumeSample = tokSample;
+    }
+  }
+
+  uint32_t emitted = 0;
+  uint32_t sample  = 0;
+
+  auto locateNextForward = [&](int curSector, int& outSector, uint32_t& outAddr) -> bool {
+    for (int s = _index.chainNext(curSector); s >= 0; s = _index.chainNext(s)) {
+      uint32_t firstAddr;
+      if (findFirstRecord(s, firstAddr)) {
         outSector = s;
         outAddr = firstAddr;
         return true;
@@ -1513,59 +4586,53 @@ uint32_t FlashLogger::queryLogs(const QuerySpec& q, RowCallback onRow, void* use
     return false;
   };
 
-  for (int s = 0; s < MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present)  continue;
-    if (resume && s < resumeSector) continue;
+  // v2.1: sectors in allocation (= time) order
+  for (int s = resume ? resumeSector : _index.chainFirst(); s >= 0; s = _index.chainNext(s)) {
+    if (!_index.present(s))  continue;
 
-    if (!sectorMaybeInRangeByAnchor(s, q.day_from, q.day_to, q.ts_from, q.ts_to)) continue;
+    if (!sectorMayMatch(s, q)) {
+      if (sectorAfterRange(s, q)) break;
+      continue;
+    }
 
-    const uint32_t base = sectorBaseAddr(s);
-    uint32_t ptr = base + sizeof(SectorHeader);
+    RecordIterator it(*this);
+    if (!it.open(s)) continue;
+    bool more;
     if (resume && s == resumeSector) {
-      if (isValidRecordAt(resumeAddr)) {
-        ptr = resumeAddr;
-      } else {
-        if (!findFirstRecord(s, ptr)) { resume = false; continue; }
-      }
+      more = (it.seek(resumeAddr) && it.toSample(resumeSample)) || (it.open(s) && it.next());
       resume = false;
+    } else {
+      more = it.next();
     }
 
-    while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-      RecordHeader rh; uint16_t recDay;
-      if (!readRecordMeta(ptr, rh, recDay)) break;
-
-      uint32_t nextPtr = ptr + sizeof(rh) + rh.len + 1;
-
-      if (recordMatchesTime(recDay, rh.ts, q)) {
-        static uint8_t buf[PAGE_SIZE];
-        String payload; payload.reserve(rh.len + 8);
-        uint32_t p = ptr + sizeof(rh);
-        uint16_t remaining = rh.len;
-        while (remaining) {
-          uint16_t chunk = remaining > PAGE_SIZE ? PAGE_SIZE : remaining;
-          readData(p, buf, chunk);
-          payload += String((const char*)buf, chunk);
-          p += chunk; remaining -= chunk;
-          yield();
-        }
-        if (!recordMatchesPredicates(payload.c_str(), payload.length(), q)) {
-          ptr = nextPtr;
-          continue;
-        }
+    for (; more; more = it.next()) {
+      const RecordHeader& rh = it.header();
+      const uint16_t recDay = it.day();
+      // records out of the time range (or without the tags) only need their headers
+      const bool inRange = recordMatchesTime(recDay, rh.ts, q) && recordMatchesTags(rh, q);
+      it.setMode(inRange ? RecordIterator::BURST : RecordIterator::SKIM);
+
+      if (inRange) {
+        const uint8_t* payload = it.payload(spill);
+        if (!recordMatchesPredicates(rh, payload, match)) continue;
         if (q.sample_every <= 1 || (sample++ % q.sample_every == 0)) {
-          if (emitRecord(recDay, rh.ts, (const uint8_t*)payload.c_str(), rh.len, q, onRow, user)) {
+          if (!emitRow(it, payload, &plan, buf, sink, user)) return emitted;
+          {
             emitted++;
             if (q.max_records && emitted >= q.max_records) {
               if (nextToken) {
                 int tokenSector;
                 uint32_t tokenAddr;
-                if (locateNextForward(s, nextPtr, tokenSector, tokenAddr)) {
+                uint16_t tokenSample = 0;
+                bool found = it.next();
+                if (found) { tokenSector = s; tokenAddr = it.addr(); tokenSample = it.sample(); }
+                else found = locateNextForward(s, tokenSector, tokenAddr);
+                if (found) {
                   uint16_t tokenDay = recDay;
-                  if (tokenSector >= 0 && tokenSector < MAX_SECTORS && _index[tokenSector].present) {
-                    tokenDay = _index[tokenSector].dayID;
+                  if (tokenSector >= 0 && tokenSector < _sectorCount && _index.present(tokenSector)) {
+                    tokenDay = _index.day(tokenSector);
                   }
-                  buildPageToken(tokenSector, tokenAddr, tokenDay, PAGE_DIR_FWD, *nextToken);
+                  buildPageToken(tokenSector, tokenAddr, tokenSample, tokenDay, PAGE_DIR_FWD, *nextToken);
                 } else {
                   *nextToken = "";
                 }
@@ -1575,8 +4642,6 @@ uint32_t FlashLogger::queryLogs(const QuerySpec& q, RowCallback onRow, void* use
           }
         }
       }
-
-      ptr = nextPtr;
       yield();
     }
   }
@@ -1585,130 +4650,955 @@ uint32_t FlashLogger::queryLogs(const QuerySpec& q, RowCallback onRow, void* use
 
 uint32_t FlashLogger::queryLatest(uint32_t N, RowCallback onRow, void* user,
                                   const String* pageToken, String* nextToken) {
-  if (!onRow || N == 0) return 0;
+  if (!onRow) return 0;
+  RowCallbackSink adapter{onRow, user};
+  return queryLatest(N, RowCallbackSink::call, &adapter, pageToken, nextToken);
+}
+
+uint32_t FlashLogger::queryLatest(uint32_t N, RowSink sink, void* user, const String* pageToken,
+                                  String* nextToken, RowBuffer* scratch) {
+  if (!sink || N == 0) return 0;
+  flush();
   if (nextToken) *nextToken = "";
 
   bool resume = false;
   int resumeSector = -1;
   uint32_t resumeAddr = 0;
+  uint16_t resumeSample = 0;
   if (pageToken && pageToken->length()) {
-    int tokSector; uint32_t tokAddr; uint16_t tokDay; uint8_t tokDir;
-    if (parsePageToken(*pageToken, tokSector, tokAddr, tokDay, tokDir) &&
-        tokDir == PAGE_DIR_REV && tokSector >= 0 && tokSector < MAX_SECTORS &&
-        tokSector != FACTORY_SECTOR) {
+    int tokSector; uint32_t tokAddr; uint16_t tokSample, tokDay; uint8_t tokDir;
+    if (parsePageToken(*pageToken, tokSector, tokAddr, tokSample, tokDay, tokDir) &&
+        tokDir == PAGE_DIR_REV && tokSector >= 0 && tokSector < _sectorCount &&
+        tokSector != _factorySector) {
       resume = true;
       resumeSector = tokSector;
       resumeAddr = tokAddr;
+      resumeSample = tokSample;
     }
   }
 
   QuerySpec fmt;
   fmt.out = _outFmt;
-  fmt.compact_json = true;
+  RowPlan plan;
+  rowPlan(fmt, plan);
+  RowBuffer own;
+  RowBuffer& buf = scratch ? *scratch : own;
+  String spill;
 
   uint32_t emitted = 0;
+  bool stopped = false;
 
-  for (int s = MAX_SECTORS - 1; s >= 0 && emitted < N; --s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    if (resume && s > resumeSector) continue;
+  // Older record for the next page token: `prevAddr` in sector s, else the
+  // newest record (newest sample of a block) of an earlier sector.
+  auto buildToken = [&](int s, uint32_t prevAddr, uint16_t prevSample, uint16_t recDay) {
+    if (!nextToken) return;
+    int tokenSector = -1;
+    uint32_t tokenAddr = 0;
+    uint16_t tokenSample = 0;
+    if (prevAddr) {
+      tokenSector = s;
+      tokenAddr = prevAddr;
+      tokenSample = prevSample;
+    } else {
+      for (int s2 = _index.chainPrev(s); s2 >= 0; s2 = _index.chainPrev(s2)) {
+        uint32_t lastAddr;
+        if (findLastRecord(s2, lastAddr)) {
+          RecordHeader rh; uint16_t d;
+          tokenSector = s2;
+          tokenAddr = lastAddr;
+          if (readRecordMeta(lastAddr, rh, d) && (rh.flags & REC_FLAG_COMPRESSED)) {
+            tokenSample = RecordIterator::SAMPLE_LAST;
+          }
+          break;
+        }
+      }
+    }
+    if (tokenSector < 0) {
+      *nextToken = "";
+      return;
+    }
+    const uint16_t tokenDay = _index.present(tokenSector) ? _index.day(tokenSector) : recDay;
+    buildPageToken(tokenSector, tokenAddr, tokenSample, tokenDay, PAGE_DIR_REV, *nextToken);
+  };
+  // true once the N-th row is out or the sink stops
+  auto emitOne = [&](RecordIterator& it) {
+    const uint8_t* payload = it.payload(spill);
+    stopped = !emitRow(it, payload, &plan, buf, sink, user);
+    return stopped || ++emitted >= N;
+  };
+
+  for (int s = resume ? resumeSector : _index.chainLast(); s >= 0 && emitted < N;
+       s = _index.chainPrev(s)) {
+    if (!_index.present(s)) continue;
 
-    uint32_t addr;
+    // v2.1: newest first through the record trailers, one burst per window
+    const uint32_t base = sectorBaseAddr(s);
+    RecordIterator it(*this);
+    if (!it.open(s)) continue;
+    bool more = false;
     if (resume && s == resumeSector) {
-      if (isValidRecordAt(resumeAddr)) {
-        addr = resumeAddr;
-      } else {
-        if (!findLastRecord(s, addr)) { resume = false; continue; }
-      }
+      more = it.seek(resumeAddr) && it.toSample(resumeSample);
       resume = false;
-    } else {
-      if (!findLastRecord(s, addr)) continue;
     }
-
-    while (emitted < N) {
-      RecordHeader rh; uint16_t recDay;
-      if (!readRecordMeta(addr, rh, recDay)) break;
-
-      static uint8_t buf[PAGE_SIZE];
-      String payload; payload.reserve(rh.len + 8);
-      uint32_t p = addr + sizeof(rh);
-      uint16_t remaining = rh.len;
-      while (remaining) {
-        uint16_t chunk = remaining > PAGE_SIZE ? PAGE_SIZE : remaining;
-        readData(p, buf, chunk);
-        payload += String((const char*)buf, chunk);
-        p += chunk;
-        remaining -= chunk;
-        yield();
+    if (!more) more = it.last();
+    uint32_t stop = more ? 0 : base + SECTOR_SIZE;   // records below have no trailer
+    while (more) {
+      const uint32_t at = it.addr();
+      if (emitOne(it)) {
+        if (stopped) return emitted;
+        const uint16_t recDay = it.day();
+        uint32_t prevAddr = 0;
+        uint16_t prevSample = 0;
+        if (it.prev()) { prevAddr = it.addr(); prevSample = it.sample(); }
+        else findPrevRecordAddr(s, at, prevAddr);
+        buildToken(s, prevAddr, prevSample, recDay);
+        return emitted;
       }
+      more = it.prev();
+      if (!more) stop = at;
+      yield();
+    }
+    if (stop <= base + sizeof(SectorHeader)) continue;
 
-      if (emitRecord(recDay, rh.ts, (const uint8_t*)payload.c_str(), rh.len, fmt, onRow, user)) {
-        ++emitted;
-        if (emitted >= N) {
-          if (nextToken) {
-            int tokenSector = -1;
-            uint32_t tokenAddr = 0;
-            bool hasMore = false;
-            uint32_t prevAddr;
-            if (findPrevRecordAddr(s, addr, prevAddr)) {
-              tokenSector = s;
-              tokenAddr = prevAddr;
-              hasMore = true;
-            } else {
-              for (int s2 = s - 1; s2 >= 0; --s2) {
-                if (s2 == FACTORY_SECTOR) continue;
-                if (!_index[s2].present) continue;
-                uint32_t lastAddr;
-                if (findLastRecord(s2, lastAddr)) {
-                  tokenSector = s2;
-                  tokenAddr = lastAddr;
-                  hasMore = true;
-                  break;
-                }
-              }
-            }
-            if (hasMore) {
-              uint16_t tokenDay = recDay;
-              if (tokenSector >= 0 && tokenSector < MAX_SECTORS && _index[tokenSector].present) {
-                tokenDay = _index[tokenSector].dayID;
-              }
-              buildPageToken(tokenSector, tokenAddr, tokenDay, PAGE_DIR_REV, *nextToken);
-            } else {
-              *nextToken = "";
-            }
-          }
-          return emitted;
-        }
+    // Records from older firmware: one skim pass for the offsets below
+    // `stop`, then bursts walking backwards.
+    uint16_t offs[SECTOR_SIZE / 16];          // smallest record: 14 + 1 + commit
+    int n = 0;
+    uint32_t lastEnd = 0;
+    it.setMode(RecordIterator::SKIM);
+    it.open(s);
+    while (n < (int)(sizeof(offs) / sizeof(offs[0])) && it.next() && it.addr() < stop) {
+      offs[n++] = (uint16_t)(it.addr() - base);
+      lastEnd = it.nextAddr();
+    }
+    it.setMode(RecordIterator::BURST);
+    for (int i = n - 1; i >= 0; --i) {
+      if (!it.seek(base + offs[i], (i + 1 < n) ? base + offs[i + 1] : lastEnd)) break;
+      if (emitOne(it)) {
+        if (!stopped) buildToken(s, i > 0 ? base + offs[i - 1] : 0, 0, it.day());
+        return emitted;
       }
-
-      uint32_t prevAddr;
-      if (!findPrevRecordAddr(s, addr, prevAddr)) break;
-      addr = prevAddr;
       yield();
     }
   }
   return emitted;
 }
 
-uint32_t FlashLogger::queryRange(uint32_t ts_from, uint32_t ts_to, RowCallback onRow, void* user) {
-  QuerySpec q; q.ts_from = ts_from; q.ts_to = ts_to; q.out = _outFmt;
-  return queryLogs(q, onRow, user);
+uint32_t FlashLogger::queryRange(uint32_t ts_from, uint32_t ts_to, RowCallback onRow, void* user) {
+  QuerySpec q; q.ts_from = ts_from; q.ts_to = ts_to; q.out = _outFmt;
+  return queryLogs(q, onRow, user);
+}
+
+uint32_t FlashLogger::queryBattery(RowCallback onRow, void* user) {
+  QuerySpec q; q.out = _outFmt;
+  q.includeKeys[0] = "bat"; q.includeKeys[1] = nullptr;
+  return queryLogs(q, onRow, user);
+}
+
+// ===== v2.1 aggregation =====
+namespace {
+  void sortFloats(float* v, uint32_t n) {   // insertion sort, n <= 5
+    for (uint32_t i = 1; i < n; ++i) {
+      const float x = v[i];
+      uint32_t j = i;
+      for (; j && v[j - 1] > x; --j) v[j] = v[j - 1];
+      v[j] = x;
+    }
+  }
+
+  // P-square quantile estimate (Jain & Chlamtac): five markers track the
+  // minimum, p/2, p, (1+p)/2 and the maximum; no samples are kept.
+  struct Quantile {
+    float    p;
+    uint32_t n;
+    float    h[5];       // marker heights
+    float    pos[5];     // marker positions
+    float    want[5];    // desired positions
+    float    step[5];
+
+    void reset(float pct) {
+      p = pct;
+      n = 0;
+      const float s[5] = { 0.0f, p / 2, p, (1 + p) / 2, 1.0f };
+      memcpy(step, s, sizeof(step));
+    }
+
+    void add(float x) {
+      if (n < 5) {
+        h[n++] = x;
+        if (n == 5) {
+          sortFloats(h, 5);
+          const float w[5] = { 1.0f, 1 + 2 * p, 1 + 4 * p, 3 + 2 * p, 5.0f };
+          for (int i = 0; i < 5; ++i) pos[i] = (float)(i + 1);
+          memcpy(want, w, sizeof(want));
+        }
+        return;
+      }
+      int k;
+      if (x < h[0])       { h[0] = x; k = 0; }
+      else if (x >= h[4]) { h[4] = x; k = 3; }
+      else                { k = 0; while (x >= h[k + 1]) ++k; }
+      for (int i = k + 1; i < 5; ++i) pos[i] += 1;
+      for (int i = 0; i < 5; ++i) want[i] += step[i];
+      ++n;
+      for (int i = 1; i < 4; ++i) {
+        const float d = want[i] - pos[i];
+        if (!((d >= 1 && pos[i + 1] - pos[i] > 1) || (d <= -1 && pos[i - 1] - pos[i] < -1))) continue;
+        const float s = d >= 0 ? 1.0f : -1.0f;
+        const float par = h[i] + s / (pos[i + 1] - pos[i - 1]) *
+                          ((pos[i] - pos[i - 1] + s) * (h[i + 1] - h[i]) / (pos[i + 1] - pos[i]) +
+                           (pos[i + 1] - pos[i] - s) * (h[i] - h[i - 1]) / (pos[i] - pos[i - 1]));
+        if (h[i - 1] < par && par < h[i + 1]) {
+          h[i] = par;
+        } else {
+          const int j = i + (int)s;
+          h[i] += s * (h[j] - h[i]) / (pos[j] - pos[i]);
+        }
+        pos[i] += s;
+      }
+    }
+
+    float value() const {
+      if (n >= 5) return h[2];
+      float v[5];
+      memcpy(v, h, sizeof(v));
+      sortFloats(v, n);
+      return v[(uint32_t)(p * (n - 1) + 0.5f)];   // nearest rank
+    }
+  };
+
+  struct AggState {
+    uint32_t n;
+    float    lo, hi;
+    double   sum;
+    Quantile q;
+
+    void reset(const AggSpec& a) {
+      n = 0;
+      sum = 0;
+      if (a.op == AGG_PCT) q.reset(a.pct / 100.0f);
+    }
+    void add(const AggSpec& a, float v) {
+      if (!n || v < lo) lo = v;
+      if (!n || v > hi) hi = v;
+      ++n;
+      sum += v;
+      if (a.op == AGG_PCT) q.add(v);
+    }
+    void merge(const RollupStat& r) {        // a stored bucket; not for AGG_PCT
+      if (!r.count) return;
+      if (!n || r.min < lo) lo = r.min;
+      if (!n || r.max > hi) hi = r.max;
+      n += r.count;
+      sum += (double)r.mean * r.count;
+    }
+    // Value text ("" when the bucket had none); trailing zeros trimmed.
+    int text(const AggSpec& a, char* buf, size_t cap) const {
+      if (a.op == AGG_COUNT) return snprintf(buf, cap, "%lu", (unsigned long)n);
+      if (!n) return 0;
+      double v;
+      switch (a.op) {
+        case AGG_MIN: v = lo;         break;
+        case AGG_MAX: v = hi;         break;
+        case AGG_SUM: v = sum;        break;
+        case AGG_PCT: v = q.value();  break;
+        default:      v = sum / n;    break;
+      }
+      int len = snprintf(buf, cap, "%.3f", v);
+      if (len <= 0 || (size_t)len >= cap) return 0;
+      while (buf[len - 1] == '0') --len;
+      if (buf[len - 1] == '.') --len;
+      if (len == 2 && buf[0] == '-' && buf[1] == '0') buf[0] = '0', len = 1;
+      buf[len] = 0;
+      return len;
+    }
+  };
+
+  const char* const kAggName[] = { "count", "min", "max", "avg", "sum" };
+
+  bool parseAggOp(const char* op, size_t len, AggSpec& out) {
+    for (uint8_t i = 0; i < 5; ++i) {
+      if (strlen(kAggName[i]) == len && strncmp(op, kAggName[i], len) == 0) {
+        out.op = (AggOp)i;
+        out.pct = 0;
+        return true;
+      }
+    }
+    if (len < 2 || len > 3 || op[0] != 'p') return false;
+    uint8_t pct = 0;
+    for (size_t i = 1; i < len; ++i) {
+      if (!isdigit((unsigned char)op[i])) return false;
+      pct = pct * 10 + (op[i] - '0');
+    }
+    if (pct < 1 || pct > 99) return false;
+    out.op = AGG_PCT;
+    out.pct = pct;
+    return true;
+  }
+
+  // Row start: device seconds for CSV, unix time for JSONL.
+  void putAggTs(RowBuffer& buf, bool csv, uint32_t ts) {
+    buf.clear();
+    if (csv) {
+      buf.putUnsigned(ts);
+    } else {
+      buf.put("{\"ts\":");
+      buf.putUnsigned(ts + kUnixAt2000);
+    }
+  }
+
+  // ",<v>" (CSV) or ",\"<key>_<op>\":<v|null>" (JSONL).
+  void putAggField(RowBuffer& buf, bool csv, const AggSpec& a, const AggState& acc) {
+    char text[24];
+    const int len = acc.text(a, text, sizeof(text));
+    if (csv) {
+      buf.put(',');
+      buf.put(text, len);
+      return;
+    }
+    buf.put(",\"");
+    buf.put(a.key);
+    buf.put('_');
+    if (a.op == AGG_PCT) { buf.put('p'); buf.putUnsigned(a.pct); }
+    else                 buf.put(kAggName[a.op]);
+    buf.put("\":");
+    if (len) buf.put(text, len);
+    else     buf.put("null");
+  }
+}
+
+bool QuerySpec::addAgg(const char* key, const char* op) {
+  const size_t keyLen = key ? strlen(key) : 0;
+  if (!keyLen || keyLen >= sizeof(aggs[0].key) || !op) return false;
+  AggSpec add[MAX_AGGS];
+  uint8_t n = 0;
+  for (const char* p = op; ; ++p) {
+    const char* end = strchr(p, ',');
+    const size_t len = end ? (size_t)(end - p) : strlen(p);
+    if (aggCount + n >= MAX_AGGS || !parseAggOp(p, len, add[n])) return false;
+    memcpy(add[n].key, key, keyLen + 1);
+    ++n;
+    if (!end) break;
+    p = end;
+  }
+  memcpy(aggs + aggCount, add, n * sizeof(AggSpec));
+  aggCount += n;
+  return true;
+}
+
+bool FlashLogger::parseSeconds(const char* text, uint32_t& seconds) {
+  if (!text || !isdigit((unsigned char)*text)) return false;
+  char* end;
+  const unsigned long v = strtoul(text, &end, 10);
+  uint32_t unit;
+  switch (*end) {
+    case 0: case 's': unit = 1;     break;
+    case 'm':         unit = 60;    break;
+    case 'h':         unit = 3600;  break;
+    case 'd':         unit = 86400; break;
+    default:          return false;
+  }
+  if (*end && end[1]) return false;
+  if (v > 0xFFFFFFFFUL / unit) return false;
+  seconds = (uint32_t)(v * unit);
+  return true;
+}
+
+uint32_t FlashLogger::queryAgg(const QuerySpec& q, RowCallback onRow, void* user) {
+  if (!onRow) return 0;
+  RowCallbackSink adapter{onRow, user};
+  return queryAgg(q, RowCallbackSink::call, &adapter);
+}
+
+// One pass in log order; values for the filter and the aggregates come from
+// the same scanValues() call. A bucket closes when a record falls outside it,
+// so a clock stepped back starts a fresh row rather than reopening an old one.
+// With use_rollups and a fitting tier the rows come from its stored buckets.
+uint32_t FlashLogger::queryAgg(const QuerySpec& q, RowSink sink, void* user, RowBuffer* scratch) {
+  if (!sink || !q.aggCount || q.aggCount > QuerySpec::MAX_AGGS) return 0;
+  PredicateProgram prog;
+  if (!compileFilter(q, prog)) return 0;
+  uint8_t slot[QuerySpec::MAX_AGGS];
+  for (uint8_t i = 0; i < q.aggCount; ++i) {
+    if (!prog.keySlot(q.aggs[i].key, slot[i])) return 0;
+  }
+  RowBuffer own;
+  RowBuffer& buf = scratch ? *scratch : own;
+  String spill;
+  flush();
+
+  const bool csv = q.out == OUT_CSV;
+  AggState acc[QuerySpec::MAX_AGGS];
+  RecordMeta meta{};
+  bool open = false;
+  uint32_t bucket = 0;
+  uint32_t emitted = 0;
+
+  auto emitBucket = [&]() {
+    putAggTs(buf, csv, meta.header.ts);
+    for (uint8_t i = 0; i < q.aggCount; ++i) putAggField(buf, csv, q.aggs[i], acc[i]);
+    buf.put(csv ? "\n" : "}\n");
+    if (!sink(buf.data(), buf.length(), meta, user)) return false;
+    ++emitted;
+    return true;
+  };
+  // To the bucket of ts; false once the sink or max_records ends the query.
+  auto enter = [&](uint32_t ts, uint16_t day, int s, uint32_t addr, uint16_t sample) {
+    const uint32_t at = q.group_by_seconds ? ts - ts % q.group_by_seconds : bucket;
+    if (open && at == bucket) return true;
+    if (open && (!emitBucket() || (q.max_records && emitted >= q.max_records))) return false;
+    for (uint8_t i = 0; i < q.aggCount; ++i) acc[i].reset(q.aggs[i]);
+    bucket = q.group_by_seconds ? at : ts;
+    meta.header = RecordHeader{};
+    meta.header.ts = bucket;
+    meta.dayID  = day;
+    meta.sector = (int16_t)s;
+    meta.addr   = addr;
+    meta.sample = sample;
+    open = true;
+    return true;
+  };
+
+  uint8_t tier, keyOf[QuerySpec::MAX_AGGS];
+  if (q.use_rollups && rollupTierFor(q, tier, keyOf)) {
+    RecordIterator it(*this);
+    RollupStat st[ROLLUP_KEYS_MAX];
+    RecordMeta rm;
+    uint16_t mask;
+    int k = 0;
+    while (rollupNext(tier, it, k, st, mask, rm)) {
+      if (!recordMatchesTime(rm.dayID, rm.header.ts, q)) continue;
+      if (!enter(rm.header.ts, rm.dayID, rm.sector, rm.addr, 0)) return emitted;
+      for (uint8_t i = 0; i < q.aggCount; ++i) {
+        if (mask & (1u << keyOf[i])) acc[i].merge(st[keyOf[i]]);
+      }
+      yield();
+    }
+    if (open) emitBucket();
+    return emitted;
+  }
+
+  for (int s = _index.chainFirst(); s >= 0; s = _index.chainNext(s)) {
+    if (!_index.present(s)) continue;
+    if (!sectorMayMatch(s, q)) {
+      if (sectorAfterRange(s, q)) break;
+      continue;
+    }
+    RecordIterator it(*this);
+    if (!it.open(s)) continue;
+    for (bool more = it.next(); more; more = it.next()) {
+      const RecordHeader& rh = it.header();
+      const bool inRange = recordMatchesTime(it.day(), rh.ts, q) && recordMatchesTags(rh, q);
+      it.setMode(inRange ? RecordIterator::BURST : RecordIterator::SKIM);
+      if (!inRange) continue;
+      const uint8_t* payload = it.payload(spill);
+      PredicateProgram::Values v;
+      scanValues(rh, payload, prog, v);
+      if (!prog.empty() && !prog.eval(v)) continue;
+
+      if (!enter(rh.ts, it.day(), s, it.addr(), it.sample())) return emitted;
+      for (uint8_t i = 0; i < q.aggCount; ++i) {
+        if (v.number & (1u << slot[i])) acc[i].add(q.aggs[i], v.num[slot[i]]);
+      }
+      yield();
+    }
+  }
+  if (open) emitBucket();
+  return emitted;
+}
+
+// ===== v2.1 record tags =====
+bool FlashLogger::parseTags(const char* text, uint8_t& tags) {
+  static const struct { const char* name; uint8_t bit; } kTags[] = {
+    { "measurement", REC_TAG_MEASUREMENT }, { "event", REC_TAG_EVENT },
+    { "alert", REC_TAG_ALERT }, { "diag", REC_TAG_DIAG },
+  };
+  tags = 0;
+  for (const char* p = text; p && *p; ) {
+    const char* e = p;
+    while (*e && *e != ',') ++e;
+    uint8_t bit = 0;
+    for (const auto& t : kTags) {
+      if (strlen(t.name) == (size_t)(e - p) && strncmp(t.name, p, e - p) == 0) bit = t.bit;
+    }
+    if (!bit) return false;
+    tags |= bit;
+    p = *e ? e + 1 : e;
+  }
+  return tags != 0;
+}
+
+uint32_t FlashLogger::queryTagged(uint8_t tags, uint32_t N, RowCallback onRow, void* user) {
+  if (!onRow) return 0;
+  RowCallbackSink adapter{onRow, user};
+  return queryTagged(tags, N, RowCallbackSink::call, &adapter);
+}
+
+// Newest sector first. A sector the zone map lets through is skimmed for
+// the offsets of matching records (one header frame each, blocks left
+// undecoded: samples carry no tags), then those are read back newest first.
+uint32_t FlashLogger::queryTagged(uint8_t tags, uint32_t N, RowSink sink, void* user, RowBuffer* scratch) {
+  QuerySpec q;
+  q.out  = _outFmt;
+  q.tags = tags & REC_TAG_MASK;
+  if (!sink || !N || !q.tags) return 0;
+  flush();
+  RowPlan plan;
+  rowPlan(q, plan);
+  RowBuffer own;
+  RowBuffer& buf = scratch ? *scratch : own;
+  String spill;
+  uint32_t emitted = 0;
+  uint16_t offs[SECTOR_SIZE / 16];          // smallest record: 14 + 1 + commit
+  for (int s = _index.chainLast(); s >= 0 && emitted < N; s = _index.chainPrev(s)) {
+    if (!_index.present(s) || !sectorMayMatch(s, q)) continue;
+    const uint32_t base = sectorBaseAddr(s);
+    RecordIterator it(*this, RecordIterator::SKIM);
+    it.setRaw(true);
+    if (!it.open(s)) continue;
+    int n = 0;
+    while (n < (int)(sizeof(offs) / sizeof(offs[0])) && it.next()) {
+      if (recordMatchesTags(it.header(), q)) offs[n++] = (uint16_t)(it.addr() - base);
+    }
+    it.setMode(RecordIterator::BURST);
+    for (int i = n - 1; i >= 0 && emitted < N; --i) {
+      if (!it.seek(base + offs[i])) continue;
+      if (!emitRow(it, it.payload(spill), &plan, buf, sink, user)) return emitted;
+      ++emitted;
+      yield();
+    }
+  }
+  return emitted;
+}
+
+// ===== v2.1 rollup tiers =====
+namespace {
+  // JREC_ROLLUP: each tier's open bucket, for the keys it was taken with.
+  struct RollupOpenRec {
+    uint16_t   keyCrc;
+    uint8_t    open[ROLLUP_TIERS];
+    uint8_t    rsv;
+    uint32_t   bucket[ROLLUP_TIERS];
+    RollupStat stat[ROLLUP_TIERS][ROLLUP_KEYS_MAX];
+  };
+
+  // Stored payload -> stat per key (zeroed when absent); returns the mask.
+  uint16_t rollupStats(const uint8_t* p, uint16_t len, uint8_t keys, RollupStat* out) {
+    memset(out, 0, ROLLUP_KEYS_MAX * sizeof(RollupStat));
+    uint16_t mask;
+    if (!p || len < sizeof(mask)) return 0;
+    memcpy(&mask, p, sizeof(mask));
+    uint16_t got = 0;
+    uint32_t off = sizeof(mask);
+    for (uint8_t k = 0; k < ROLLUP_KEYS_MAX && off + sizeof(RollupStat) <= len; ++k) {
+      if (!(mask & (1u << k))) continue;
+      if (k < keys) {
+        memcpy(&out[k], p + off, sizeof(RollupStat));
+        got |= 1u << k;
+      }
+      off += sizeof(RollupStat);
+    }
+    return got;
+  }
+}
+
+uint32_t FlashLogger::rollupSeconds(RollupTier tier) {
+  static const uint32_t kWidth[ROLLUP_TIERS] = { 60, 3600, 86400 };
+  return tier < ROLLUP_TIERS ? kWidth[tier] : 0;
+}
+
+// Rings were placed by setGeometry(); this finds each one's newest sector,
+// write pointer and seq, and takes back the open buckets checkpoint() saved
+// unless the ring has stored them since. Sectors from another layout or key
+// list are left alone until the ring reaches them; new buckets never go
+// into one.
+void FlashLogger::rollupMount() {
+  if (!_rollup) return;
+  RollupState& ro = *_rollup;
+  ro.keys = 0;
+  memset(ro.key, 0, sizeof(ro.key));
+  for (const char* p = _cfg.rollupKeys; p && *p && ro.keys < ROLLUP_KEYS_MAX; ) {
+    while (*p == ',' || *p == ' ') ++p;
+    const char* e = p;
+    while (*e && *e != ',' && *e != ' ') ++e;
+    if (e > p && (size_t)(e - p) < sizeof(ro.key[0])) memcpy(ro.key[ro.keys++], p, e - p);
+    p = e;
+  }
+  ro.crc = crc16((const uint8_t*)ro.key, sizeof(ro.key));
+  if (!ro.keys) return;
+
+  RollupOpenRec saved;
+  const bool haveSaved = journalRead(JREC_ROLLUP, nullptr, &saved, sizeof(saved)) == (int)sizeof(saved) &&
+                         saved.keyCrc == ro.crc;
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) {
+    RollupRing& r = ro.ring[t];
+    if (!r.count) continue;
+    for (int k = 0; k < r.count; ++k) {
+      SectorHeader h;
+      readData(sectorBaseAddr(r.first + k), (uint8_t*)&h, sizeof(h));
+      if (h.magic != ROLLUP_MAGIC || h.reserved != t || (r.cur >= 0 && h.generation <= r.gen)) continue;
+      r.cur = r.first + k;
+      r.gen = h.generation;
+    }
+    r.nextClean = sectorBlank(rollupAfter(r));
+    bool stored = false;
+    uint32_t last = 0;
+    if (r.cur >= 0) {
+      r.wp = scanWritePtr(r.cur);
+      if (!rollupSectorOk(r.cur, t)) r.wp = sectorBaseAddr(r.cur) + SECTOR_SIZE;   // other keys: start afresh
+      for (int k = 0; k < r.count && !stored; ++k) {          // newest sector with a record
+        const int s = r.first + (r.cur - r.first - k + r.count) % r.count;
+        RecordIterator it(*this);
+        if (!rollupSectorOk(s, t) || !it.open(s) || !it.last()) continue;
+        r.seq  = it.header().seq + 1;
+        last   = it.header().ts;
+        stored = true;
+      }
+    }
+    if (haveSaved && saved.open[t] && (!stored || saved.bucket[t] > last)) {
+      r.open   = true;
+      r.bucket = saved.bucket[t];
+      memcpy(r.stat, saved.stat[t], sizeof(r.stat));
+    }
+  }
+}
+
+// Log sectors in the rollup area (older firmware, or a smaller rollup
+// config) are moved into the log and erased before a ring can reach them.
+// false = one had nowhere to go; it stays and rollups are off this boot.
+bool FlashLogger::rollupClaim(bool& moved) {
+  for (int s = _logEnd; s < _journalSector; ++s) {
+    SectorHeader h;
+    if (!readSectorHeader(s, h)) continue;
+    if (!evictLogSector(s)) return false;
+    sectorErase(sectorBaseAddr(s));
+    moved = true;
+  }
+  return true;
+}
+
+void FlashLogger::rollupSave() {
+  if (!_rollup || !_rollup->keys) return;
+  const RollupState& ro = *_rollup;
+  RollupOpenRec rec {};
+  rec.keyCrc = ro.crc;
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) {
+    rec.open[t]   = ro.ring[t].open ? 1 : 0;
+    rec.bucket[t] = ro.ring[t].bucket;
+    memcpy(rec.stat[t], ro.ring[t].stat, sizeof(rec.stat[t]));
+  }
+  // The largest index body, one of each other unkeyed record and every
+  // cursor fit one journal sector, so compaction only drops the body when a
+  // record is waiting to be appended.
+  static_assert(journalSize(CKPT_BODY_MAX) + journalSize(sizeof(MetaState)) + journalSize(sizeof(CkptHead)) +
+                journalSize(SCHEMA_SLOTS * sizeof(RecordSchema)) + journalSize(sizeof(RollupOpenRec)) +
+                JOURNAL_NAMES * journalSize(JOURNAL_KEY + sizeof(SyncCursor)) <= SECTOR_SIZE - JOURNAL_HDR,
+                "journal records outgrow a sector");
+  journalAppend(JREC_ROLLUP, nullptr, &rec, sizeof(rec));
+}
+
+bool FlashLogger::rollupSectorOk(int sector, uint8_t tier) {
+  if (sector < 0) return false;
+  SectorHeader h;
+  readData(sectorBaseAddr(sector), (uint8_t*)&h, sizeof(h));
+  return h.magic == ROLLUP_MAGIC && h.reserved == tier && h.dayID == _rollup->crc;
+}
+
+// Each tier's bucket is the one of the record's time; a record in another
+// bucket stores the open one first (a bucket without values stores nothing).
+void FlashLogger::rollupFeed(const RecordHeader& rh, const uint8_t* payload) {
+  if (!_rollup || !_rollup->keys) return;
+  RollupState& ro = *_rollup;
+  float vals[ROLLUP_KEYS_MAX];
+  for (uint8_t k = 0; k < ro.keys; ++k) {
+    if (!recordNumber(rh, payload, ro.key[k], vals[k])) vals[k] = NAN;
+  }
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) {
+    RollupRing& r = ro.ring[t];
+    if (!r.count) continue;
+    const uint32_t at = rh.ts - rh.ts % rollupSeconds((RollupTier)t);
+    if (!r.open || at != r.bucket) {
+      if (r.open) rollupWrite(t);
+      memset(r.stat, 0, sizeof(r.stat));
+      r.bucket = at;
+      r.open = true;
+    }
+    for (uint8_t k = 0; k < ro.keys; ++k) {
+      const float v = vals[k];
+      if (isnan(v)) continue;
+      RollupStat& st = r.stat[k];
+      if (!st.count || v < st.min) st.min = v;
+      if (!st.count || v > st.max) st.max = v;
+      ++st.count;
+      st.mean += (v - st.mean) / st.count;
+    }
+  }
+}
+
+// Written and verified in place; a failed write moves to a fresh sector once.
+bool FlashLogger::rollupWrite(uint8_t tier) {
+  const RollupState& ro = *_rollup;
+  RollupRing& r = _rollup->ring[tier];
+  uint8_t rec[sizeof(RecordHeader) + sizeof(uint16_t) + sizeof(r.stat) + 1 + REC_TRAILER];
+  uint8_t* payload = rec + sizeof(RecordHeader);
+  uint16_t mask = 0, len = sizeof(mask);
+  for (uint8_t k = 0; k < ro.keys; ++k) {
+    if (!r.stat[k].count) continue;
+    mask |= 1u << k;
+    memcpy(payload + len, &r.stat[k], sizeof(RollupStat));
+    len += sizeof(RollupStat);
+  }
+  if (!mask) return true;
+  memcpy(payload, &mask, sizeof(mask));
+  const uint32_t need = sizeof(RecordHeader) + len + 1 + REC_TRAILER;
+
+  for (uint8_t attempt = 0; attempt < 2; ++attempt) {
+    if (r.cur < 0 || r.wp + need > sectorBaseAddr(r.cur) + ZONE_DATA_END) {
+      if (!rollupNextSector(tier)) continue;
+    }
+    RecordHeader rh{};
+    rh.len   = len;
+    rh.crc   = crc16(payload, len);
+    rh.ts    = r.bucket;
+    rh.seq   = r.seq;
+    rh.flags = REC_FLAG_BACKLINK | REC_FLAG_ROLLUP;
+    rh.rsv   = tier;
+    memcpy(rec, &rh, sizeof(rh));
+    const uint16_t commitOff = (uint16_t)(sizeof(rh) + len);
+    const uint16_t backOff = (uint16_t)(r.wp - sectorBaseAddr(r.cur));
+    rec[commitOff] = 0xFF;
+    memcpy(rec + commitOff + 1, &backOff, REC_TRAILER);
+    if (programBatch(r.wp, rec, need, &commitOff, 1)) {
+      r.wp += need;
+      r.seq++;
+      return true;
+    }
+    Serial.printf("Rollup verify FAIL on sector %d\n", r.cur);
+    r.wp = sectorBaseAddr(r.cur) + SECTOR_SIZE;
+  }
+  return false;
+}
+
+// The ring's next sector, oldest data and all, becomes the current one.
+// poll() has normally erased it already; otherwise it is erased here.
+bool FlashLogger::rollupNextSector(uint8_t tier) {
+  RollupRing& r = _rollup->ring[tier];
+  const int s = rollupAfter(r);
+  const uint32_t base = sectorBaseAddr(s);
+  while (eraseQueued(s)) {              // poll() is erasing it right now
+    if (_chipBusy || _eraseSuspended) prepareChip(false);
+    poll();
+  }
+  if (!r.nextClean) sectorErase(base);
+  r.nextClean = false;
+  SectorHeader hdr {};
+  hdr.magic      = ROLLUP_MAGIC;
+  hdr.dayID      = _rollup->crc;
+  hdr.reserved   = tier;
+  hdr.generation = r.gen + 1;
+  pageProgram(base, (const uint8_t*)&hdr, sizeof(hdr));
+  r.cur = s;
+  r.gen = hdr.generation;
+  r.wp  = base + sizeof(hdr);
+  if (verifyWrite(base, (const uint8_t*)&hdr, sizeof(hdr))) return true;
+  Serial.printf("Rollup header verify FAILED on sector %d\n", s);
+  r.wp = base + SECTOR_SIZE;
+  return false;
+}
+
+// Once a ring's current sector is half full, its next one is erased from
+// poll(), so the roll-over in rollupWrite() is a header program. A
+// one-sector ring has no next sector and erases when it wraps.
+bool FlashLogger::rollupEraseAhead() {
+  if (!_rollup || !_rollup->keys) return false;
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) {
+    const RollupRing& r = _rollup->ring[t];
+    if (!r.count || r.nextClean) continue;
+    if (r.cur >= 0 && (r.count < 2 || r.wp < sectorBaseAddr(r.cur) + SECTOR_SIZE / 2)) continue;
+    if (queueErase(rollupAfter(r), onRollupErase, this, true)) return true;
+  }
+  return false;
+}
+
+void FlashLogger::onRollupErase(FlashOpKind, bool ok, uint32_t ref, void* user) {
+  FlashLogger* self = static_cast<FlashLogger*>(user);
+  if (!ok || !self->_rollup) return;
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) {
+    RollupRing& r = self->_rollup->ring[t];
+    if (r.count && rollupAfter(r) == (int)ref) r.nextClean = true;
+  }
 }
 
-uint32_t FlashLogger::queryBattery(RowCallback onRow, void* user) {
-  QuerySpec q; q.out = _outFmt;
-  q.includeKeys[0] = "bat"; q.includeKeys[1] = nullptr;
-  return queryLogs(q, onRow, user);
+// Oldest first; stops at the first sector with a bucket inside the
+// retention. The sector being written is kept.
+void FlashLogger::rollupGc(uint16_t todayID) {
+  if (!_rollup) return;
+  RollupState& ro = *_rollup;
+  for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) {
+    RollupRing& r = ro.ring[t];
+    const uint16_t days = _cfg.rollupRetentionDays[t];
+    if (!r.count || !days || r.cur < 0) continue;
+    for (int k = 1; k < r.count; ++k) {
+      const int s = r.first + (r.cur - r.first + k) % r.count;
+      SectorHeader h;
+      readData(sectorBaseAddr(s), (uint8_t*)&h, sizeof(h));
+      if (h.magic == 0xFFFFFFFFUL) continue;
+      RecordIterator it(*this, RecordIterator::SKIM);
+      if (rollupSectorOk(s, t) && it.open(s) && it.last() &&
+          !isOlderThanNDays(todayID, (uint16_t)(it.header().ts / 86400UL), days)) {
+        break;
+      }
+      sectorErase(sectorBaseAddr(s));
+      if (k == 1) r.nextClean = true;
+      Serial.printf("  erased rollup sector %d (tier %u)\n", s, (unsigned)t);
+      yield();
+    }
+  }
+}
+
+// Stored buckets in ring order (oldest sector after the current one), then
+// the open bucket (sector -1, addr 0). Start with k = 0.
+bool FlashLogger::rollupNext(uint8_t tier, RecordIterator& it, int& k, RollupStat* stat,
+                             uint16_t& mask, RecordMeta& meta) {
+  const RollupState& ro = *_rollup;
+  const RollupRing& r = ro.ring[tier];
+  String spill;
+  while (r.cur >= 0 && k <= r.count) {
+    while (k > 0 && it.next()) {
+      const RecordHeader& rh = it.header();
+      if (!(rh.flags & REC_FLAG_ROLLUP) || rh.rsv != tier) continue;
+      mask = rollupStats(it.payload(spill), rh.len, ro.keys, stat);
+      meta.header = rh;
+      meta.dayID  = (uint16_t)(rh.ts / 86400UL);
+      meta.sector = (int16_t)it.sector();
+      meta.addr   = it.addr();
+      meta.sample = 0;
+      return true;
+    }
+    if (++k > r.count) break;
+    const int s = r.first + (r.cur - r.first + k) % r.count;
+    it.open(rollupSectorOk(s, tier) ? s : -1);
+  }
+  if (k > r.count + 1 || !r.open) return false;
+  k = r.count + 2;
+  mask = 0;
+  for (uint8_t i = 0; i < ro.keys; ++i) {
+    stat[i] = r.stat[i];
+    if (r.stat[i].count) mask |= 1u << i;
+  }
+  meta = RecordMeta{};
+  meta.header.ts = r.bucket;
+  meta.dayID  = (uint16_t)(r.bucket / 86400UL);
+  meta.sector = -1;
+  return true;
+}
+
+// A tier answers q exactly when its buckets nest in q's: the bucket width a
+// multiple of the tier's, the range on tier edges, no filters, and only what
+// a RollupStat keeps. The coarsest such tier wins.
+bool FlashLogger::rollupTierFor(const QuerySpec& q, uint8_t& tier, uint8_t* keyOf) const {
+  if (!_rollup || !_rollup->keys || q.predicateCount || q.where || (q.tags & REC_TAG_MASK)) return false;
+  const RollupState& ro = *_rollup;
+  for (uint8_t i = 0; i < q.aggCount; ++i) {
+    if (q.aggs[i].op == AGG_PCT) return false;
+    uint8_t k = 0;
+    while (k < ro.keys && strncmp(q.aggs[i].key, ro.key[k], sizeof(ro.key[k])) != 0) ++k;
+    if (k == ro.keys) return false;
+    keyOf[i] = k;
+  }
+  const bool byDay = q.day_from || q.day_to;
+  for (int t = ROLLUP_TIERS - 1; t >= 0; --t) {
+    const uint32_t w = rollupSeconds((RollupTier)t);
+    if (!ro.ring[t].count || q.group_by_seconds % w) continue;
+    if (!byDay && (q.ts_from % w || (q.ts_to != 0xFFFFFFFFUL && (q.ts_to + 1) % w))) continue;
+    tier = (uint8_t)t;
+    return true;
+  }
+  return false;
+}
+
+uint32_t FlashLogger::queryRollups(RollupTier tier, const QuerySpec& q, RowCallback onRow, void* user) {
+  if (!onRow) return 0;
+  RowCallbackSink adapter{onRow, user};
+  return queryRollups(tier, q, RowCallbackSink::call, &adapter);
 }
 
+uint32_t FlashLogger::queryRollups(RollupTier tier, const QuerySpec& q, RowSink sink, void* user,
+                                   RowBuffer* scratch) {
+  if (!sink || !rollupEnabled(tier) || !_rollup->keys) return 0;
+  const RollupState& ro = *_rollup;
+  static const AggOp kOps[] = { AGG_COUNT, AGG_MIN, AGG_MAX, AGG_AVG };
+  RowBuffer own;
+  RowBuffer& buf = scratch ? *scratch : own;
+  const bool csv = q.out == OUT_CSV;
+  RecordIterator it(*this);
+  RollupStat st[ROLLUP_KEYS_MAX];
+  RecordMeta meta;
+  uint16_t mask;
+  uint32_t emitted = 0;
+  int k = 0;
+  while (rollupNext(tier, it, k, st, mask, meta)) {
+    if (!recordMatchesTime(meta.dayID, meta.header.ts, q)) continue;
+    putAggTs(buf, csv, meta.header.ts);
+    for (uint8_t i = 0; i < ro.keys; ++i) {
+      AggSpec a {};
+      memcpy(a.key, ro.key[i], sizeof(a.key));
+      AggState acc;
+      acc.reset(a);
+      if (mask & (1u << i)) acc.merge(st[i]);
+      for (AggOp op : kOps) {
+        a.op = op;
+        putAggField(buf, csv, a, acc);
+      }
+    }
+    buf.put(csv ? "\n" : "}\n");
+    if (!sink(buf.data(), buf.length(), meta, user)) break;
+    ++emitted;
+    if (q.max_records && emitted >= q.max_records) break;
+    yield();
+  }
+  return emitted;
+}
+
+// ===== query shell =====
 bool FlashLogger::handleQueryCommand(const String& cmd, Stream& io) {
   // Patterns:
   // q latest <N> [keys...]
   // q day <YYYY-MM-DD> [keys...]
   // q range <YYYY-MM-DD>..<YYYY-MM-DD> [keys...]
   // Optional keys → filter fields in JSON; CSV ignores keys list and uses setCsvColumns()
+  // day/range: "where=<expr>" after the keys filters rows (PredicateProgram)
+  // q agg <field> <agg>[,<agg>] [<field> <agg>...] <bucket|all> [rollups] [<date>[..<date>]] [where=<expr>]
+  // q rollup <1m|1h|1d> [<date>[..<date>]]
+  // q tag <tag>[,<tag>] [N]   newest first; tags: measurement, event, alert, diag
 
   QuerySpec q; q.out = _outFmt; q.compact_json = true;
+  PredicateProgram where;
+  auto takeWhere = [&](String& args) -> bool {   // where= runs to the end (token= is cut first)
+    int w = args.indexOf("where=");
+    if (w < 0) return true;
+    String expr = args.substring(w + 6);
+    args = args.substring(0, w);
+    args.trim();
+    if (!where.compile(expr.c_str())) {
+      io.printf("bad where: %s\n", where.error());
+      return false;
+    }
+    q.where = &where;
+    return true;
+  };
+  auto takeDays = [&](const String& args) -> bool {   // "" or <date>[..<date>]
+    if (!args.length()) return true;
+    int dots = args.indexOf("..");
+    uint16_t D1 = 0, D2 = 0;
+    if (!parseDateYYYYMMDD(dots >= 0 ? args.substring(0, dots) : args, D1) ||
+        !parseDateYYYYMMDD(dots >= 0 ? args.substring(dots + 2) : args, D2)) {
+      io.println("bad date(s)");
+      return false;
+    }
+    q.day_from = min(D1, D2); q.day_to = max(D1, D2);
+    return true;
+  };
 
   // extract arguments
   String rest = cmd.substring(2); rest.trim(); // after "q "
@@ -1771,6 +5661,7 @@ bool FlashLogger::handleQueryCommand(const String& cmd, Stream& io) {
       tokenIn.trim();
       args.trim();
     }
+    if (!takeWhere(args)) return true;
     String date = args; date.trim();
     // split date & optional keys
     String keys; int sp = date.indexOf(' ');
@@ -1815,6 +5706,7 @@ bool FlashLogger::handleQueryCommand(const String& cmd, Stream& io) {
       tokenIn.trim();
       args.trim();
     }
+    if (!takeWhere(args)) return true;
     String rr = args; rr.trim();
     // "YYYY-MM-DD..YYYY-MM-DD" [keys...]
     String keys; int sp = rr.indexOf(' ');
@@ -1854,127 +5746,429 @@ bool FlashLogger::handleQueryCommand(const String& cmd, Stream& io) {
     return true;
   }
 
+  if (rest.startsWith("agg ")) {
+    String args = rest.substring(4); args.trim();
+    if (!takeWhere(args)) return true;
+    // field/agg pairs until the bucket ("15m", "1h", "all")
+    bool bucketSeen = false;
+    while (args.length()) {
+      int sp = args.indexOf(' ');
+      String tok = sp >= 0 ? args.substring(0, sp) : args;
+      args = sp >= 0 ? args.substring(sp + 1) : String();
+      args.trim();
+      if (tok == "all" || parseSeconds(tok.c_str(), q.group_by_seconds)) {
+        if (tok == "all") q.group_by_seconds = 0;
+        bucketSeen = true;
+        break;
+      }
+      sp = args.indexOf(' ');
+      String op = sp >= 0 ? args.substring(0, sp) : args;
+      args = sp >= 0 ? args.substring(sp + 1) : String();
+      args.trim();
+      if (!q.addAgg(tok.c_str(), op.c_str())) {
+        io.printf("bad aggregate: %s %s\n", tok.c_str(), op.c_str());
+        return true;
+      }
+    }
+    if (!bucketSeen || !q.aggCount) {
+      io.println("q agg <field> <count|min|max|avg|sum|pNN>[,...] <bucket|all> [rollups] [date[..date]]");
+      return true;
+    }
+    if (args.startsWith("rollups")) {
+      q.use_rollups = true;
+      args.remove(0, 7);
+      args.trim();
+    }
+    if (!takeDays(args)) return true;
+    if (q.out == OUT_CSV) {
+      io.print("ts");
+      for (uint8_t i = 0; i < q.aggCount; ++i) {
+        const AggSpec& a = q.aggs[i];
+        if (a.op == AGG_PCT) io.printf(",%s_p%u", a.key, a.pct);
+        else io.printf(",%s_%s", a.key, kAggName[a.op]);
+      }
+      io.println();
+    }
+    uint32_t outCount = queryAgg(q, [](const char* line, void* u){ ((Stream*)u)->print(line); }, &io);
+    io.printf("(%lu buckets)\n", (unsigned long)outCount);
+    return true;
+  }
+
+  if (rest.startsWith("rollup ")) {
+    String args = rest.substring(7); args.trim();
+    int sp = args.indexOf(' ');
+    String width = sp >= 0 ? args.substring(0, sp) : args;
+    args = sp >= 0 ? args.substring(sp + 1) : String();
+    args.trim();
+    uint32_t secs = 0;
+    int tier = -1;
+    if (parseSeconds(width.c_str(), secs)) {
+      for (uint8_t t = 0; t < ROLLUP_TIERS; ++t) if (rollupSeconds((RollupTier)t) == secs) tier = t;
+    }
+    if (tier < 0 || !rollupEnabled((RollupTier)tier)) {
+      io.println("q rollup <1m|1h|1d> [date[..date]] (tier off or unknown)");
+      return true;
+    }
+    if (!takeDays(args)) return true;
+    if (q.out == OUT_CSV) {
+      io.print("ts");
+      for (uint8_t i = 0; i < rollupKeyCount(); ++i) {
+        const char* k = rollupKey(i);
+        io.printf(",%s_count,%s_min,%s_max,%s_avg", k, k, k, k);
+      }
+      io.println();
+    }
+    uint32_t outCount = queryRollups((RollupTier)tier, q,
+                                     [](const char* line, void* u){ ((Stream*)u)->print(line); }, &io);
+    io.printf("(%lu buckets)\n", (unsigned long)outCount);
+    return true;
+  }
+
+  if (rest.startsWith("tag ")) {
+    String args = rest.substring(4); args.trim();
+    int sp = args.indexOf(' ');
+    String names = sp >= 0 ? args.substring(0, sp) : args;
+    uint32_t N = sp >= 0 ? args.substring(sp + 1).toInt() : 0;
+    uint8_t tags = 0;
+    if (!parseTags(names.c_str(), tags)) {
+      io.println("tags: measurement, event, alert, diag (joined by ',')");
+      return true;
+    }
+    uint32_t outCount = queryTagged(tags, N ? N : 20,
+                                    [](const char* line, void* u){ ((Stream*)u)->print(line); }, &io);
+    io.printf("(%lu rows)\n", (unsigned long)outCount);
+    return true;
+  }
+
   io.println("q latest <N> [keys...]");
-  io.println("q day <YYYY-MM-DD> [keys...]");
-  io.println("q range <YYYY-MM-DD>..<YYYY-MM-DD> [keys...]");
+  io.println("q day <YYYY-MM-DD> [keys...] [where=<expr>]");
+  io.println("q range <YYYY-MM-DD>..<YYYY-MM-DD> [keys...] [where=<expr>]");
+  io.println("q agg <field> <agg>[,<agg>] [<field> <agg>...] <bucket|all> [rollups] [<YYYY-MM-DD>[..<YYYY-MM-DD>]] [where=<expr>]");
+  io.println("q rollup <1m|1h|1d> [<YYYY-MM-DD>[..<YYYY-MM-DD>]]");
+  io.println("q tag <measurement|event|alert|diag>[,<tag>...] [N]");
   return true;
 }
 
-bool FlashLogger::readRecordMeta(uint32_t addr, RecordHeader& rh, uint16_t& recDay) const {
-  // determine sector & day from address
-  int sector = addr / SECTOR_SIZE;
-  if (sector < 0 || sector >= MAX_SECTORS || sector == FACTORY_SECTOR) return false;
-  SectorHeader sh;
-  if (!((FlashLogger*)this)->readSectorHeader(sector, sh)) return false;
-  recDay = sh.dayID;
-
-  // bounds
-  uint32_t base = sectorBaseAddr(sector);
-  if (addr < base + sizeof(SectorHeader) || addr + sizeof(RecordHeader) >= base + SECTOR_SIZE) return false;
+// ===== v2.1 record iterator =====
+bool RecordIterator::open(int sector, bool stopAtWritePtr) {
+  _sector = -1;
+  _started = _valid = false;
+  _sample = _samples = 0;
+  _winLen = 0;
+  if (sector < 0 || sector >= _log._sectorCount) return false;
+  if (_log.isMetaSector(sector) && !_log.isRollupSector(sector)) return false;
+  _sector = sector;
+  _base   = FlashLogger::sectorBaseAddr(sector);
+  _limit  = _base + SECTOR_SIZE;
+  if (stopAtWritePtr && sector == _log._currentSector) {
+    const uint32_t wp = _log._index.writePtr(sector);
+    if (wp < _limit) _limit = wp;
+  }
+  _day = _log._index.day(sector);
+  return true;
+}
+
+bool RecordIterator::next() {
+  if (_sector < 0 || (_started && !_valid)) return false;
+  if (_started && _sample + 1 < _samples) return decodeNext();
+  uint32_t a = _started ? nextAddr() : _base + sizeof(SectorHeader);
+  _started = true;
+  while (load(a, 0)) {
+    if (enter(false)) return true;
+    a = nextAddr();
+  }
+  return false;
+}
 
-  ((FlashLogger*)this)->readData(addr, (uint8_t*)&rh, sizeof(rh));
-  if (rh.len == 0xFFFF || rh.len == 0x0000) return false;
-  if (addr + sizeof(rh) + rh.len + 1 > base + SECTOR_SIZE) return false;
+bool RecordIterator::seek(uint32_t addr, uint32_t endHint) {
+  if (_sector < 0 || addr < _base + sizeof(SectorHeader)) return false;
+  _started = true;
+  return load(addr, endHint) && enter(false);
+}
 
-  // commit byte quick-check
-  uint8_t cm=0; ((FlashLogger*)this)->readData(addr + sizeof(rh) + rh.len, &cm, 1);
-  if (cm != REC_COMMIT) return false;
+// A freshly loaded record: plain ones are their own view; a block opens at
+// its first (or newest) sample once its CRC holds and its schema is known.
+bool RecordIterator::enter(bool newest) {
+  _vh = _rh;
+  _sample = 0;
+  _samples = 0;
+  if (_raw || !(_rh.flags & REC_FLAG_COMPRESSED)) return true;
+  const RecordSchema* s = _log.schema(_rh.rsv);
+  const uint8_t* p = blockData();
+  if (!s || !p || _rh.len < sizeof(uint16_t) || FlashLogger::crc16(p, _rh.len) != _rh.crc) return false;
+  uint16_t count;
+  memcpy(&count, p, sizeof(count));
+  if (!count) return false;
+  _samples = count;
+  _codec.begin(*s, _rh.ts);
+  return decodeNext() && (!newest || toSample(SAMPLE_LAST));
+}
 
+// Older neighbour of an undecodable block, until one can be entered.
+bool RecordIterator::enterBack() {
+  while (!enter(true)) {
+    if (!linkBack(_addr)) return false;
+  }
   return true;
 }
 
-bool FlashLogger::isValidRecordAt(uint32_t addr) const {
-  RecordHeader rh; uint16_t d;
-  return readRecordMeta(addr, rh, d);
+bool RecordIterator::decodeNext() {
+  const uint8_t* p = blockData();
+  uint32_t ts;
+  uint16_t len;
+  if (!p || !_codec.get(p + sizeof(uint16_t), _rh.len - sizeof(uint16_t), ts, _smp, len)) {
+    _valid = false;
+    return false;
+  }
+  _sample = _codec.samples() - 1;
+  _vh = _rh;
+  _vh.flags &= (uint8_t)~REC_FLAG_COMPRESSED;
+  _vh.ts  = ts;
+  _vh.seq = _rh.seq + _sample;
+  _vh.len = len;
+  _vh.crc = FlashLogger::crc16(_smp, len);
+  return true;
 }
 
-bool FlashLogger::findFirstRecord(int sector, uint32_t& outAddr) const{
-  if (sector < 0 || sector >= MAX_SECTORS || sector == FACTORY_SECTOR) return false;
-  if (!_index[sector].present) return false;
-  uint32_t base = sectorBaseAddr(sector);
-  uint32_t ptr  = base + sizeof(SectorHeader);
+// Samples only decode forwards: going back restarts the block.
+bool RecordIterator::toSample(uint16_t i) {
+  if (!_samples) return _valid;
+  if (i >= _samples) i = _samples - 1;
+  if (i < _sample) {
+    _codec.begin(*_codec.schema(), _rh.ts);
+    if (!decodeNext()) return false;
+  }
+  while (_sample < i) {
+    if (!decodeNext()) return false;
+  }
+  return true;
+}
 
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    if (isValidRecordAt(ptr)) { outAddr = ptr; return true; }
-    // if header not valid, break (we are at first gap)
-    RecordHeader rh; uint16_t d;
-    if (!readRecordMeta(ptr, rh, d)) break;
-    ptr += sizeof(rh) + rh.len + 1;
-    yield();
+bool RecordIterator::toSeq(uint32_t seq) {
+  if (!_samples || seq <= _rh.seq || seq - _rh.seq >= _samples) return _valid;
+  return toSample((uint16_t)(seq - _rh.seq));
+}
+
+// The block's payload in the window (blocks are sized to fit it).
+const uint8_t* RecordIterator::blockData() {
+  const uint32_t p = _addr + sizeof(RecordHeader);
+  if (!inWindow(p, _rh.len)) {
+    fill(_addr, _mode == SKIM ? recordSpan(_rh) + sizeof(RecordHeader) : WINDOW);
+    if (!inWindow(p, _rh.len)) return nullptr;
   }
-  return false;
+  return _win + (p - _winAddr);
 }
 
-bool FlashLogger::findNextRecordAddr(int sector, uint32_t curAddr, uint32_t& nextAddr) const{
-  if (sector < 0 || sector >= MAX_SECTORS || sector == FACTORY_SECTOR) return false;
-  uint32_t base = sectorBaseAddr(sector);
-  if (curAddr < base + sizeof(SectorHeader)) return false;
-
+// Bytes already in the window (a record split across the old window's end)
+// are moved to the front instead of read again.
+void RecordIterator::fill(uint32_t from, uint32_t len) {
+  if (len > WINDOW) len = WINDOW;
+  if (from + len > _limit) len = (from < _limit) ? _limit - from : 0;
+  uint32_t keep = 0;
+  if (from >= _winAddr && from < _winAddr + _winLen) {
+    keep = min<uint32_t>(_winAddr + _winLen - from, len);
+    memmove(_win, _win + (from - _winAddr), keep);
+  }
+  _winAddr = from;
+  _winLen  = (uint16_t)len;
+  if (len > keep) _log.readData(from + keep, _win + keep, len - keep);
+}
+
+bool RecordIterator::load(uint32_t addr, uint32_t endHint) {
+  _valid = false;
+  if (addr + sizeof(RecordHeader) >= _base + SECTOR_SIZE) return false;
+  if (addr + sizeof(RecordHeader) > _limit) return false;
+  if (!inWindow(addr, sizeof(RecordHeader))) {
+    if (endHint > addr) {
+      const uint32_t first = _base + sizeof(SectorHeader);
+      uint32_t from = (endHint >= first + WINDOW) ? endHint - WINDOW : first;
+      if (from > addr) from = addr;
+      fill(from, endHint - from);
+    } else {
+      fill(addr, _mode == SKIM ? sizeof(RecordHeader) : WINDOW);
+    }
+    if (!inWindow(addr, sizeof(RecordHeader))) return false;
+  }
+  memcpy(&_rh, _win + (addr - _winAddr), sizeof(_rh));
+  if (_rh.len == 0xFFFF || _rh.len == 0x0000) return false;
+  const uint32_t total  = recordSpan(_rh);
+  const uint32_t tail   = total - sizeof(RecordHeader) - _rh.len;        // commit + trailer
+  const uint32_t commit = addr + sizeof(RecordHeader) + _rh.len;
+  if (addr + total > _limit) return false;
+  if (!inWindow(commit, 1)) {
+    if (_mode == SKIM)         fill(commit, tail + sizeof(RecordHeader));   // + next header
+    else if (total <= WINDOW)  fill(addr, WINDOW);
+    else                       fill(commit, 1);
+  }
+  if (_win[commit - _winAddr] != REC_COMMIT) return false;
+  _addr  = addr;
+  _valid = true;
+  return true;
+}
+
+bool RecordIterator::last() {
+  if (_sector < 0) return false;
+  _started = true;
+  _valid = false;
+  return linkBack(dataEnd()) && enterBack();
+}
+
+bool RecordIterator::prev() {
+  if (_sector < 0 || !_valid) return false;
+  if (_sample) return toSample(_sample - 1);
+  return linkBack(_addr) && enterBack();
+}
+
+// The record ending at `end`: its trailer names the start, and the header
+// there must carry a trailer and span exactly up to `end`.
+bool RecordIterator::linkBack(uint32_t end) {
+  _valid = false;
+  const uint32_t first = _base + sizeof(SectorHeader);
+  if (end < first + sizeof(RecordHeader) + 2 + REC_TRAILER) return false;
+  if (!inWindow(end - REC_TRAILER, REC_TRAILER)) {
+    const uint32_t from = (end >= first + WINDOW) ? end - WINDOW : first;
+    fill(from, end - from);
+    if (!inWindow(end - REC_TRAILER, REC_TRAILER)) return false;
+  }
+  uint16_t off;
+  memcpy(&off, _win + (end - REC_TRAILER - _winAddr), REC_TRAILER);
+  const uint32_t start = _base + off;
+  if (off >= SECTOR_SIZE || start < first || start >= end) return false;
+  if (!load(start, end)) return false;
+  if (!(_rh.flags & REC_FLAG_BACKLINK) || nextAddr() != end) {
+    _valid = false;
+    return false;
+  }
+  return true;
+}
+
+// End of the programmed data: scan back from the limit over erased bytes.
+// Trailers and commit bytes are never 0xFF, and a closed sector has less
+// than one record of slack, so this is normally a single window.
+uint32_t RecordIterator::dataEnd() {
+  const uint32_t first = _base + sizeof(SectorHeader);
+  uint32_t end = min<uint32_t>(_limit, _base + ZONE_DATA_END);   // skip the zone footer
+  while (end > first) {
+    const uint32_t from = (end >= first + WINDOW) ? end - WINDOW : first;
+    fill(from, end - from);
+    uint32_t k = _winLen;
+    while (k && _win[k - 1] == 0xFF) --k;
+    if (k) return from + k;
+    end = from;
+  }
+  return first;
+}
+
+const uint8_t* RecordIterator::payload(String& spill) {
+  if (_samples) return _smp;
+  const uint32_t p = _addr + sizeof(RecordHeader);
+  if (inWindow(p, _rh.len)) return _win + (p - _winAddr);
+  spill = "";
+  spill.reserve(_rh.len);
+  for (uint32_t off = 0; off < _rh.len; ) {
+    const uint32_t n = min<uint32_t>(WINDOW, _rh.len - off);
+    _log.readData(p + off, _win, n);
+    spill.concat((const char*)_win, n);
+    off += n;
+  }
+  _winLen = 0;                        // window now holds payload bytes only
+  return (const uint8_t*)spill.c_str();
+}
+
+uint16_t RecordIterator::payloadCrc() {
+  if (_samples) return _vh.crc;
+  const uint32_t p = _addr + sizeof(RecordHeader);
+  if (inWindow(p, _rh.len)) return FlashLogger::crc16(_win + (p - _winAddr), _rh.len);
+  uint16_t crc = 0xFFFF;
+  for (uint32_t off = 0; off < _rh.len; ) {
+    const uint32_t n = min<uint32_t>(WINDOW, _rh.len - off);
+    _log.readData(p + off, _win, n);
+    crc = FlashLogger::crc16(_win, n, crc);
+    off += n;
+  }
+  _winLen = 0;
+  return crc;
+}
+
+bool FlashLogger::readRecordMeta(uint32_t addr, RecordHeader& rh, uint16_t& recDay) const {
+  const int sector = (int)(addr / SECTOR_SIZE);
+  if (!_index.present(sector)) return false;
+  RecordIterator it(*(FlashLogger*)this, RecordIterator::SKIM);
+  it.setRaw(true);
+  if (!it.open(sector) || !it.seek(addr)) return false;
+  rh = it.header();
+  recDay = it.day();
+  return true;
+}
+
+bool FlashLogger::isValidRecordAt(uint32_t addr) const {
   RecordHeader rh; uint16_t d;
-  if (!readRecordMeta(curAddr, rh, d)) return false;
+  return readRecordMeta(addr, rh, d);
+}
 
-  uint32_t ptr = curAddr + sizeof(rh) + rh.len + 1;
-  if (ptr + sizeof(RecordHeader) >= base + SECTOR_SIZE) return false;
+bool FlashLogger::findFirstRecord(int sector, uint32_t& outAddr) const{
+  if (!_index.present(sector)) return false;
+  RecordIterator it(*(FlashLogger*)this, RecordIterator::SKIM);
+  it.setRaw(true);
+  if (!it.open(sector) || !it.next()) return false;
+  outAddr = it.addr();
+  return true;
+}
 
-  if (isValidRecordAt(ptr)) { nextAddr = ptr; return true; }
-  // allow fast break if next header invalid
-  return false;
+bool FlashLogger::findNextRecordAddr(int sector, uint32_t curAddr, uint32_t& nextAddr) const{
+  if (!_index.present(sector)) return false;
+  RecordIterator it(*(FlashLogger*)this, RecordIterator::SKIM);
+  it.setRaw(true);
+  if (!it.open(sector) || !it.seek(curAddr) || !it.next()) return false;
+  nextAddr = it.addr();
+  return true;
 }
 
 bool FlashLogger::findLastRecord(int sector, uint32_t& outAddr) const{
-  if (sector < 0 || sector >= MAX_SECTORS || sector == FACTORY_SECTOR) return false;
-  if (!_index[sector].present) return false;
-  uint32_t base = sectorBaseAddr(sector);
-  uint32_t ptr  = base + sizeof(SectorHeader);
-  uint32_t last = 0;
-
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    RecordHeader rh; uint16_t recDay;
-    if (!readRecordMeta(ptr, rh, recDay)) break;
-    last = ptr;
-    uint32_t next = ptr + sizeof(rh) + rh.len + 1;
-    if (next >= base + SECTOR_SIZE) break;
-    ptr = next;
-    yield();
+  if (!_index.present(sector)) return false;
+  RecordIterator it(*(FlashLogger*)this, RecordIterator::SKIM);
+  it.setRaw(true);
+  if (!it.open(sector)) return false;
+  if (it.last()) {
+    outAddr = it.addr();
+    return true;
   }
+  it.open(sector);                    // no trailer at the end: walk forward
+  uint32_t last = 0;
+  while (it.next()) last = it.addr();
   if (!last) return false;
   outAddr = last;
   return true;
 }
 
 bool FlashLogger::findPrevRecordAddr(int sector, uint32_t curAddr, uint32_t& prevAddr) const{
-  if (sector < 0 || sector >= MAX_SECTORS || sector == FACTORY_SECTOR) return false;
-  if (!_index[sector].present) return false;
-  uint32_t base = sectorBaseAddr(sector);
-  if (curAddr < base + sizeof(SectorHeader)) return false;
-
-  uint32_t ptr   = base + sizeof(SectorHeader);
-  uint32_t prev  = 0;
-
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    RecordHeader rh; uint16_t recDay;
-    if (!readRecordMeta(ptr, rh, recDay)) break;
-    if (ptr == curAddr) {
-      if (prev) { prevAddr = prev; return true; }
-      return false;
+  if (!_index.present(sector)) return false;
+  RecordIterator it(*(FlashLogger*)this, RecordIterator::SKIM);
+  it.setRaw(true);
+  if (!it.open(sector)) return false;
+  if (it.seek(curAddr) && it.prev()) {
+    prevAddr = it.addr();
+    return true;
+  }
+  it.open(sector);
+  uint32_t prev = 0;
+  while (it.next()) {
+    if (it.addr() >= curAddr) {
+      if (it.addr() != curAddr || !prev) return false;
+      prevAddr = prev;
+      return true;
     }
-    prev = ptr;
-    uint32_t next = ptr + sizeof(rh) + rh.len + 1;
-    if (next >= base + SECTOR_SIZE) break;
-    ptr = next;
-    yield();
+    prev = it.addr();
   }
   return false;
 }
 
 bool FlashLogger::earliestCursor(SyncCursor& out) const {
-  // scan sectors in order, pick first with a valid record
-  for (int s=0; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
+  // oldest sector first (allocation chain), pick first with a valid record
+  for (int s = _index.chainFirst(); s >= 0; s = _index.chainNext(s)) {
     uint32_t addr;
     if (((FlashLogger*)this)->findFirstRecord(s, addr)) {
-      out.dayID  = _index[s].dayID;
+      out.dayID  = _index.day(s);
       out.sector = s;
       out.addr   = addr;
       out.seq_next = 0; // unknown; reader doesn’t require it
@@ -1992,13 +6186,11 @@ bool FlashLogger::advanceToNextValid(SyncCursor& c) const {
     c.addr = nxt;
     return true;
   }
-  // move to first record of next sector (same day or later)
-  for (int s=c.sector+1; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
+  // move to first record of the next sector in the chain
+  for (int s = _index.chainNext(c.sector); s >= 0; s = _index.chainNext(s)) {
     uint32_t addr;
     if (((FlashLogger*)this)->findFirstRecord(s, addr)) {
-      c.dayID  = _index[s].dayID;
+      c.dayID  = _index.day(s);
       c.sector = s;
       c.addr   = addr;
       return true;
@@ -2008,11 +6200,70 @@ bool FlashLogger::advanceToNextValid(SyncCursor& c) const {
   return false;
 }
 
+// ===== v2.1 seek by sequence =====
+// Chain position -> sector; empty sectors are skipped up to `end`.
+bool FlashLogger::chainSectorAt(uint32_t pos, uint32_t end, int& sector, uint32_t& at,
+                                uint32_t& firstSeq) {
+  uint32_t base = 0;
+  for (uint16_t r = 0; r < _index.chainRunCount() && pos < end; ++r) {
+    const SectorIndexMap::ChainRun& run = _index.chainRun(r);
+    for (; pos < end && pos < base + run.count; ++pos) {
+      const int s = run.first + (int)(pos - base);
+      if (!_index.present(s)) continue;
+      SectorHeader hdr;
+      SectorOrderKey key;
+      readSectorKey(s, hdr, key);
+      if (key.firstTs == 0xFFFFFFFFu) continue;
+      sector = s; at = pos; firstSeq = key.firstSeq;
+      return true;
+    }
+    base += run.count;
+  }
+  return false;
+}
+
+// Seqs grow along the chain, so the sector holding `seq` is the last one
+// whose first record is not newer: O(log sectors) 26-byte reads, then one
+// sector walk. Sectors written before v2.1 restart seq per boot and may be
+// passed over.
+bool FlashLogger::seekSeq(uint32_t seq, SyncCursor& out) {
+  uint32_t lo = 0, hi = 0;
+  for (uint16_t r = 0; r < _index.chainRunCount(); ++r) hi += _index.chainRun(r).count;
+  int best = -1;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    int s; uint32_t at, first;
+    if (!chainSectorAt(mid, hi, s, at, first) || first > seq) { hi = mid; continue; }
+    best = s;
+    lo = at + 1;
+    yield();
+  }
+
+  RecordIterator it(*this, RecordIterator::SKIM);
+  bool scan = best >= 0;                // past `best` any first record qualifies
+  for (int s = scan ? best : _index.chainFirst(); s >= 0; s = _index.chainNext(s)) {
+    if (!it.open(s)) continue;
+    if (scan && it.last() && it.header().seq < seq) { scan = false; continue; }
+    it.open(s);
+    while (it.next()) {
+      if (scan && it.header().seq < seq) continue;
+      out.dayID    = it.day();
+      out.sector   = s;
+      out.addr     = it.addr();
+      out.seq_next = it.header().seq;
+      return true;
+    }
+    scan = false;
+    yield();
+  }
+  return false;
+}
+
 bool FlashLogger::getCursor(SyncCursor& out) const {
   // “bookmark now”: point to NEXT record that would be written
   out.dayID  = _currentDay;
   out.sector = _currentSector;
-  out.addr   = _index[_currentSector].writePtr; // points at empty space (next header)
+  out.addr   = _index.writePtr(_currentSector); // points at empty space (next header)
   out.seq_next = _seqCounter;
   return true;
 }
@@ -2023,14 +6274,14 @@ bool FlashLogger::setCursor(const SyncCursor& in) {
   // 2) A sector’s first record if addr==0 → resolve automatically
   SyncCursor c = in;
 
-  if (c.sector < 0 || c.sector >= MAX_SECTORS || c.sector == FACTORY_SECTOR) return false;
-  if (!_index[c.sector].present) return false;
+  if (c.sector < 0 || c.sector >= _sectorCount || c.sector == _factorySector) return false;
+  if (!_index.present(c.sector)) return false;
 
   if (c.addr == 0) {
     if (!findFirstRecord(c.sector, c.addr)) return false;
   } else if (!isValidRecordAt(c.addr)) {
     // If it points to writePtr (future), bump to next existing sector with data
-    uint32_t wp = _index[c.sector].writePtr;
+    uint32_t wp = _index.writePtr(c.sector);
     if (c.addr == wp) {
       if (!advanceToNextValid(c)) return false;
     } else {
@@ -2049,98 +6300,115 @@ void FlashLogger::clearCursor() {
 
 uint32_t FlashLogger::exportSince(const SyncCursor& from, uint32_t max_rows,
                                   RowCallback onRow, void* user, String* nextToken) {
-  return exportSinceInternal(from, max_rows, onRow, user, nullptr, nullptr, nullptr, nextToken);
+  if (!onRow) return 0;
+  RowCallbackSink adapter{onRow, user};
+  return exportRows(from, max_rows, _outFmt, RowCallbackSink::call, &adapter, nullptr, nextToken);
 }
 
 uint32_t FlashLogger::exportSinceWithMeta(const SyncCursor& from, uint32_t max_rows,
                                           bool (*onRecord)(const RecordHeader&, const String&, void*),
                                           void* user, const QuerySpec* filter, String* nextToken) {
-  return exportSinceInternal(from, max_rows, nullptr, nullptr, onRecord, user, filter, nextToken);
+  if (!onRecord) return 0;
+  RecordCallbackSink adapter{onRecord, user, String()};
+  return exportSinceInternal(from, max_rows, nullptr, RecordCallbackSink::call, &adapter, filter,
+                             nextToken, nullptr);
 }
 
-uint32_t FlashLogger::exportSinceInternal(const SyncCursor& from, uint32_t max_rows,
-                                          RowCallback onRow, void* rowUser,
-                                          bool (*onRecord)(const RecordHeader&, const String&, void*),
-                                          void* recordUser, const QuerySpec* filter, String* nextToken) {
-  if (!onRow && !onRecord) return 0;
+uint32_t FlashLogger::exportRows(const SyncCursor& from, uint32_t max_rows, OutFmt fmt, RowSink sink,
+                                 void* user, const QuerySpec* filter, String* nextToken, RowBuffer* scratch) {
+  QuerySpec q;
+  q.out = fmt;
+  RowPlan plan;
+  rowPlan(q, plan);
+  return exportSinceInternal(from, max_rows, &plan, sink, user, filter, nextToken, scratch);
+}
+
+uint32_t FlashLogger::exportSinceInternal(const SyncCursor& from, uint32_t max_rows, const RowPlan* plan,
+                                          RowSink sink, void* user, const QuerySpec* filter, String* nextToken,
+                                          RowBuffer* scratch) {
+  if (!sink) return 0;
+  flush();
   if (nextToken) *nextToken = "";
 
+  uint32_t emitted = 0;
+  QuerySpec zoneQ;                        // the filter's predicates; exports ignore its time range
+  if (filter) {
+    memcpy(zoneQ.predicates, filter->predicates, sizeof(zoneQ.predicates));
+    zoneQ.predicateCount = filter->predicateCount;
+    zoneQ.where = filter->where;
+    zoneQ.tags = filter->tags;
+  }
+  PredicateProgram match;
+  if (filter && !compileFilter(*filter, match)) return 0;
+  RowBuffer own;
+  RowBuffer& buf = scratch ? *scratch : own;
+  String spill;
+  RecordIterator it(*this);
+  auto at = [&](const SyncCursor& c) -> bool {
+    return c.sector >= 0 && _index.present(c.sector) && it.open(c.sector) && it.seek(c.addr) &&
+           it.toSeq(c.seq_next);
+  };
+  // first record of the next sector in the chain that has one
+  auto nextSector = [&](SyncCursor& c) -> bool {
+    for (int s = _index.chainNext(c.sector); s >= 0; s = _index.chainNext(s)) {
+      if (filter && !sectorMayMatch(s, zoneQ)) continue;
+      if (it.open(s) && it.next()) {
+        c.sector = s;
+        c.dayID  = it.day();
+        c.addr   = it.addr();
+        return true;
+      }
+      yield();
+    }
+    return false;
+  };
+
   SyncCursor cur = from;
-  if (cur.sector < 0 || !isValidRecordAt(cur.addr)) {
+  bool more = at(cur);
+  if (!more) {
     if (!setCursor(from)) return 0;
     cur = _readCursor;
+    more = at(cur) || nextSector(cur);
   }
+  for (; more; more = it.next() || nextSector(cur)) {
+    const RecordHeader& rh = it.header();
+    cur.addr = it.addr();
+    cur.seq_next = rh.seq;
+    if (filter && !recordMatchesTags(rh, *filter)) continue;
+    const uint8_t* payload = it.payload(spill);
 
-  uint32_t emitted = 0;
-
-  while (true) {
-    RecordHeader rh; uint16_t recDay;
-    if (!readRecordMeta(cur.addr, rh, recDay)) {
-      if (!advanceToNextValid(cur)) break;
-      continue;
-    }
-
-    static uint8_t buf[PAGE_SIZE];
-    String payload;
-    uint32_t p = cur.addr + sizeof(rh);
-    uint16_t remaining = rh.len;
-    while (remaining) {
-      uint16_t chunk = min<uint16_t>(remaining, PAGE_SIZE);
-      readData(p, buf, chunk);
-      payload += String((const char*)buf, chunk);
-      p += chunk; remaining -= chunk; yield();
-    }
-
-    if (filter && !recordMatchesPredicates(payload.c_str(), payload.length(), *filter)) {
-      if (!advanceToNextValid(cur)) break;
-      continue;
-    }
-
-    if (onRow) {
-      QuerySpec q; q.out = _outFmt; q.compact_json = true;
-      emitRecord(recDay, rh.ts, (const uint8_t*)payload.c_str(), rh.len, q, onRow, rowUser);
-    }
-
-    if (onRecord) {
-      if (!onRecord(rh, payload, recordUser)) break;
-    }
+    if (!recordMatchesPredicates(rh, payload, match)) continue;
+    if (!emitRow(it, payload, plan, buf, sink, user)) break;
 
     emitted++;
     if (max_rows && emitted >= max_rows) {
       if (nextToken) {
         SyncCursor next = cur;
-        if (advanceToNextValid(next) && next.sector >= 0 && next.sector != FACTORY_SECTOR) {
-          uint16_t tokenDay = 0;
-          RecordHeader tmp;
-          if (!readRecordMeta(next.addr, tmp, tokenDay)) {
-            if (next.sector >= 0 && next.sector < MAX_SECTORS && _index[next.sector].present) {
-              tokenDay = _index[next.sector].dayID;
-            }
-          }
-          buildPageToken(next.sector, next.addr, tokenDay, PAGE_DIR_FWD, *nextToken);
-        } else {
-          nextToken->clear();
-        }
+        uint16_t nextSample = 0;
+        bool found = it.next();
+        if (found) { next.addr = it.addr(); next.dayID = it.day(); nextSample = it.sample(); }
+        else found = nextSector(next);
+        if (found) buildPageToken(next.sector, next.addr, nextSample, next.dayID, PAGE_DIR_FWD, *nextToken);
+        else       nextToken->clear();
       }
       _readCursor = cur;
       break;
     }
-
-    if (!advanceToNextValid(cur)) break;
+    yield();
   }
 
   return emitted;
 }
 
 void FlashLogger::markDaysPushedUntil(uint16_t dayID_inclusive) {
-  for (int s=0; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    if (_index[s].dayID <= dayID_inclusive) {
-      _index[s].pushed = true;
+  for (int s=0; s<_sectorCount; ++s) {
+    if (s == _factorySector) continue;
+    if (!_index.present(s)) continue;
+    if (_index.day(s) <= dayID_inclusive) {
+      _index.setPushed(s, true);
       SectorHeader hdr;
       if (readSectorHeader(s, hdr)) {
-        if (hdr.pushed == 0) {
+        if (hdr.pushed == 0xFF) {
           hdr.pushed = 1;
           pageProgram(sectorBaseAddr(s), (const uint8_t*)&hdr, sizeof(SectorHeader));
           verifyWrite(sectorBaseAddr(s), (const uint8_t*)&hdr, sizeof(SectorHeader));
@@ -2199,12 +6467,15 @@ bool FlashLogger::handleCursorCommand(const String& cmd, Stream& io) {
 
     SyncCursor start = _readCursor;
     if (tokenIn.length()) {
-      int tokSector; uint32_t tokAddr; uint16_t tokDay; uint8_t tokDir;
-      if (parsePageToken(tokenIn, tokSector, tokAddr, tokDay, tokDir) &&
+      int tokSector; uint32_t tokAddr; uint16_t tokSample, tokDay; uint8_t tokDir;
+      if (parsePageToken(tokenIn, tokSector, tokAddr, tokSample, tokDay, tokDir) &&
           tokDir == PAGE_DIR_FWD) {
         start.dayID  = tokDay;
         start.sector = tokSector;
         start.addr   = tokAddr;
+        start.seq_next = 0;                     // a block's sample goes by its seq
+        RecordHeader rh; uint16_t d;
+        if (tokSample && readRecordMeta(tokAddr, rh, d)) start.seq_next = rh.seq + tokSample;
       } else {
         io.println("export: invalid token");
         return true;
@@ -2227,21 +6498,16 @@ bool FlashLogger::handleCursorCommand(const String& cmd, Stream& io) {
 
 void FlashLogger::reinitAfterFactoryReset() {
   // rebuild indexes and pick a fresh sector for today
-  for (int i = 0; i < MAX_SECTORS; ++i) {
-    _index[i] = {false, 0, false, 0};
-  }
+  _index.clearAll();
   scanAllSectorsBuildIndex();
 
-  uint32_t storedUnix = 0;
-  if (!loadLastTimestampNVS(storedUnix)) storedUnix = 0;
-  _lastGoodUnix = storedUnix;
   if (_rtc) {
     uint32_t bootUnix = _rtc->now().unixtime();
     if (isRtcTimestampValid(bootUnix)) {
       _rtcHealthy = true;
       _rtcWarningShown = false;
       _lastGoodUnix = bootUnix;
-      saveLastTimestampNVS(bootUnix);
+      saveMetaState();
     } else {
       _rtcHealthy = false;
       _rtcWarningShown = false;
@@ -2258,7 +6524,7 @@ void FlashLogger::reinitAfterFactoryReset() {
   selectOrCreateTodaySector();
   if (_currentSector >= 0) {
     findLastWritePositionInSector(_currentSector);
-    _writeAddr = _index[_currentSector].writePtr;
+    _writeAddr = _index.writePtr(_currentSector);
   } else {
     Serial.println("FlashLogger: no sector available after reset!");
   }
@@ -2266,7 +6532,7 @@ void FlashLogger::reinitAfterFactoryReset() {
   // clear navigation caches/selection
   _dayCount = 0; _sectCount = 0;
   _selKind = SEL_NONE; _selDay = 0; _selSector = -1;
-  _seqCounter = 0;
+  // _seqCounter keeps counting: upload idempotency keys must not repeat
   _todayBytes = 0;
   _lowSpace = false;
 }
@@ -2279,12 +6545,6 @@ bool FlashLogger::loadLastTimestampNVS(uint32_t& outTs) {
   return outTs != 0;
 }
 
-void FlashLogger::saveLastTimestampNVS(uint32_t ts) {
-  Preferences p;
-  if (!p.begin("flog", false)) return;
-  p.putUInt("rtc_last", ts);
-  p.end();
-}
 
 bool FlashLogger::isRtcTimestampValid(uint32_t unixTs) const {
   constexpr uint32_t kMinAcceptable = 946684800UL; // 2000-01-01T00:00:00Z
@@ -2302,10 +6562,15 @@ bool FlashLogger::saveConfigToNVS(const FlashLoggerConfig& cfg, const char* ns)
   p.putInt("spi_mosi", cfg.spi_mosi_pin);
   p.putInt("spi_miso", cfg.spi_miso_pin);
   p.putUInt("spi_clk", cfg.spi_clock_hz);
+  p.putInt("spi_xfer", (int)cfg.spiXfer);
+  p.putInt("read_mode", (int)cfg.readMode);
   p.putUShort("retention", cfg.retentionDays);
   p.putUInt("daily_hint", cfg.dailyBytesHint);
   p.putUShort("max_sectors", cfg.maxSectorsPerDay);
   p.putUInt("total_bytes", cfg.totalSizeBytes);
+  p.putUInt("region_off", cfg.regionOffset);
+  p.putUInt("region_bytes", cfg.regionBytes);
+  p.putBool("en4b", cfg.en4b);
   p.putUInt("sector_size", cfg.sectorSize);
   p.putInt("date_style", (int)cfg.dateStyle);
   p.putInt("out_fmt", (int)cfg.defaultOut);
@@ -2327,10 +6592,15 @@ bool FlashLogger::loadConfigFromPrefs(FlashLoggerConfig& cfg, Preferences& p) {
   cfg.spi_mosi_pin     = p.getInt("spi_mosi", cfg.spi_mosi_pin);
   cfg.spi_miso_pin     = p.getInt("spi_miso", cfg.spi_miso_pin);
   cfg.spi_clock_hz     = p.getUInt("spi_clk", cfg.spi_clock_hz);
+  cfg.spiXfer          = (FlashSpiXfer)p.getInt("spi_xfer", (int)cfg.spiXfer);
+  cfg.readMode         = (FlashReadMode)p.getInt("read_mode", (int)cfg.readMode);
   cfg.retentionDays    = p.getUShort("retention", cfg.retentionDays);
   cfg.dailyBytesHint   = p.getUInt("daily_hint", cfg.dailyBytesHint);
   cfg.maxSectorsPerDay = p.getUShort("max_sectors", cfg.maxSectorsPerDay);
   cfg.totalSizeBytes   = p.getUInt("total_bytes", cfg.totalSizeBytes);
+  cfg.regionOffset     = p.getUInt("region_off", cfg.regionOffset);
+  cfg.regionBytes      = p.getUInt("region_bytes", cfg.regionBytes);
+  cfg.en4b             = p.getBool("en4b", cfg.en4b);
   cfg.sectorSize       = p.getUInt("sector_size", cfg.sectorSize);
   cfg.dateStyle        = (DateStyle)p.getInt("date_style", (int)cfg.dateStyle);
   cfg.defaultOut       = (OutFmt)p.getInt("out_fmt", (int)cfg.defaultOut);
@@ -2364,113 +6634,146 @@ bool FlashLogger::loadConfigFromNVS(FlashLoggerConfig& cfg, const char* ns) {
 
 
 
-bool FlashLogger::firstRecordInSector(int sector, uint32_t& firstAddr, uint32_t& firstTs, uint32_t& lastTs) {
-  if (sector < 0 || sector >= MAX_SECTORS || sector == FACTORY_SECTOR) return false;
-  if (!_index[sector].present) return false;
-
-  uint32_t base = sectorBaseAddr(sector);
-  uint32_t ptr  = base + sizeof(SectorHeader);
-  bool found = false;
-  firstTs = 0; lastTs = 0;
+// ===== v2.1 zone maps =====
+bool FlashLogger::zoneReadFooter(int sector, ZoneFooter& z) {
+  readData(sectorBaseAddr(sector) + ZONE_DATA_END, (uint8_t*)&z, sizeof(z));
+  return z.magic == ZONE_MAGIC && z.crc == crc16((const uint8_t*)&z, offsetof(ZoneFooter, crc));
+}
 
-  while (ptr + sizeof(RecordHeader) < base + SECTOR_SIZE) {
-    RecordHeader rh; uint16_t d;
-    if (!readRecordMeta(ptr, rh, d)) break;
-    if (!found) {
-      firstAddr = ptr;
-      firstTs   = rh.ts;
-      found = true;
-    }
-    lastTs = rh.ts;
-    ptr += sizeof(rh) + rh.len + 1;
-  }
-  return found;
-}
-
-void FlashLogger::buildAnchors(bool persist) {
-  _anchorCount = 0;
-  for (int s=0; s<MAX_SECTORS && _anchorCount<MAX_ANCHORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
-    if (!_index[s].present) continue;
-    uint32_t fa, fts, lts;
-    if (firstRecordInSector(s, fa, fts, lts)) {
-      Anchor& a = _anchors[_anchorCount++];
-      a.sector   = s;
-      a.dayID    = _index[s].dayID;
-      a.firstTs  = fts;
-      a.firstAddr= fa;
-      a.lastTs   = lts;
-    }
-    yield();
+void FlashLogger::zoneValues(const RecordHeader& rh, const uint8_t* payload, float* vals) const {
+  for (uint8_t i = 0; i < ZONE_FIELDS; ++i) {
+    vals[i] = NAN;
+    float v;
+    if (i < _zones.fields() && recordNumber(rh, payload, _zones.key(i), v)) vals[i] = v;
   }
-  if (persist) saveAnchorsToNVS();
 }
 
-bool FlashLogger::loadAnchorsFromNVS() {
-  _anchorCount = 0;
-  Preferences p;
-  if (!p.begin("flanchors", true)) return false;
-  uint32_t magic = p.getUInt("magic", 0);
-  if (magic != ANCHOR_MAGIC) { p.end(); return false; }
-  uint32_t gen = p.getUInt("generation", 0);
-  if (gen != _generation) { p.end(); return false; }
-  uint16_t count = p.getUShort("count", 0);
-  if (count > MAX_ANCHORS) count = MAX_ANCHORS;
-  size_t bytes = count * sizeof(Anchor);
-  if (bytes) {
-    size_t got = p.getBytes("data", _anchors, bytes);
-    p.end();
-    if (got != bytes) return false;
-  } else {
-    p.end();
-  }
-  for (int i=0; i<count; ++i) {
-    int sec = _anchors[i].sector;
-    if (sec < 0 || sec >= MAX_SECTORS) return false;
-    if (!_index[sec].present) return false;
-    if (_index[sec].dayID != _anchors[i].dayID) return false;
-  }
-  _anchorCount = count;
-  return true;
-}
-
-void FlashLogger::saveAnchorsToNVS() const {
-  Preferences p;
-  if (!p.begin("flanchors", false)) return;
-  p.putUInt("magic", ANCHOR_MAGIC);
-  p.putUInt("generation", _generation);
-  p.putUShort("count", _anchorCount);
-  if (_anchorCount) {
-    p.putBytes("data", _anchors, _anchorCount * sizeof(Anchor));
+void FlashLogger::zoneStart(ZoneFooter& z) const {
+  memset(&z, 0, sizeof(z));
+  z.magic = ZONE_MAGIC;
+  for (uint8_t i = 0; i < ZONE_FIELDS; ++i) {
+    z.keyCrc[i] = i < _zones.fields() ? _zones.keyCrc(i) : 0;
+    z.lo[i] = INFINITY;
+    z.hi[i] = -INFINITY;
   }
-  p.end();
 }
 
-bool FlashLogger::sectorMaybeInRangeByAnchor(int sector, uint16_t dayFrom, uint16_t dayTo,
-                                             uint32_t ts_from, uint32_t ts_to) const {
-  // if day range used, decide by day
-  if (dayFrom || dayTo) {
-    uint16_t d = _index[sector].dayID;
-    if (dayFrom && d < dayFrom) return false;
-    if (dayTo   && d > dayTo)   return false;
-    return true;
+void FlashLogger::zoneAdd(ZoneFooter& z, const RecordHeader& rh, const float* vals) const {
+  if (!z.count || rh.ts < z.tsMin) z.tsMin = rh.ts;
+  if (!z.count || rh.ts > z.tsMax) z.tsMax = rh.ts;
+  if (!z.count) z.firstSeq = rh.seq;
+  z.lastSeq = rh.seq;
+  z.count++;
+  z.tags |= rh.flags & REC_TAG_MASK;
+  for (uint8_t i = 0; i < _zones.fields(); ++i) {
+    if (isnan(vals[i])) continue;
+    if (vals[i] < z.lo[i]) z.lo[i] = vals[i];
+    if (vals[i] > z.hi[i]) z.hi[i] = vals[i];
+  }
+}
+
+// Zone map of the sector being written; a block adds each of its samples.
+void FlashLogger::zoneAppend(const RecordHeader& rh, const uint8_t* payload) {
+  if (!(rh.flags & REC_FLAG_COMPRESSED)) {
+    float vals[ZONE_FIELDS];
+    zoneValues(rh, payload, vals);
+    if (_zOpenSector == _currentSector) zoneAdd(_zOpen, rh, vals);
+    _zones.add(_currentSector, _currentDay, rh.ts, rh.flags, vals);
+    return;
   }
-  // else use timestamp window from anchors
-  for (int i=0;i<_anchorCount;++i) {
-    if (_anchors[i].sector == sector) {
-      // overlap check
-      return !(_anchors[i].lastTs < ts_from || _anchors[i].firstTs > ts_to);
+  const RecordSchema* s = schemaFor(rh);
+  uint16_t count;
+  if (!s || rh.len < sizeof(count)) return;
+  memcpy(&count, payload, sizeof(count));
+  SampleCodec dec;
+  dec.begin(*s, rh.ts);
+  uint8_t smp[2 + SCHEMA_FIELDS_MAX * 4];
+  RecordHeader v = rh;
+  v.flags &= (uint8_t)~REC_FLAG_COMPRESSED;
+  for (uint16_t k = 0; k < count; ++k) {
+    uint32_t ts;
+    uint16_t len;
+    if (!dec.get(payload + sizeof(count), rh.len - sizeof(count), ts, smp, len)) break;
+    v.ts  = ts;
+    v.len = len;
+    v.seq = rh.seq + k;
+    zoneAppend(v, smp);
+  }
+}
+
+void FlashLogger::zoneBuild(int sector, ZoneFooter& z) {
+  zoneStart(z);
+  RecordIterator it(*this, _zones.fields() ? RecordIterator::BURST : RecordIterator::SKIM);
+  if (it.open(sector)) {
+    while (it.next()) {
+      float vals[ZONE_FIELDS];
+      if (_zones.fields()) {
+        String spill;
+        zoneValues(it.header(), it.payload(spill), vals);
+      } else {
+        zoneValues(it.header(), nullptr, vals);
+      }
+      zoneAdd(z, it.header(), vals);
+      yield();
     }
   }
-  // unknown → fall back to true
+}
+
+// Closing a sector: the footer goes into its erased tail. Older sectors whose
+// records reach into that area are left without one.
+void FlashLogger::zoneSeal(int sector) {
+  if (sector < 0 || !_index.present(sector)) return;
+  const uint32_t at = sectorBaseAddr(sector) + ZONE_DATA_END;
+  if (_index.writePtr(sector) > at) return;           // sealed after a torn write
+  ZoneFooter z;
+  uint8_t* raw = (uint8_t*)&z;
+  readData(at, raw, sizeof(z));
+  for (uint32_t i = 0; i < sizeof(z); ++i) if (raw[i] != 0xFF) return;
+  if (sector == _zOpenSector) z = _zOpen;
+  else zoneBuild(sector, z);
+  z.crc = crc16(raw, offsetof(ZoneFooter, crc));
+  pageProgram(at, raw, sizeof(z));
+  if (!verifyWrite(at, raw, sizeof(z))) Serial.printf("Zone footer verify FAILED on sector %d\n", sector);
+  _zones.load(sector, _index.day(sector), z);
+}
+
+bool FlashLogger::zoneEnsure(int sector) {
+  if (!_zones.allocated() || !_index.present(sector)) return false;
+  if (_zones.loaded(sector)) return true;
+  ZoneFooter z;
+  if (!zoneReadFooter(sector, z)) zoneBuild(sector, z);   // still open, or older firmware
+  _zones.load(sector, _index.day(sector), z);
   return true;
 }
 
+bool FlashLogger::sectorMayMatch(int sector, const QuerySpec& q) {
+  const bool tagged = q.tags & REC_TAG_MASK;
+  if (tagged) _zones.trackTags();
+  const bool filtered = q.predicateCount || q.where || tagged;
+  if (q.day_from || q.day_to) {
+    const uint16_t d = _index.day(sector);
+    if ((q.day_from && d < q.day_from) || (q.day_to && d > q.day_to)) return false;
+    if (!filtered) return true;
+  } else if (!filtered && q.ts_from == 0 && q.ts_to == 0xFFFFFFFFUL) {
+    return true;                                      // unfiltered: nothing to load
+  }
+  if (!zoneEnsure(sector)) return true;
+  return _zones.mayMatch(sector, _index.day(sector), q);
+}
+
+// Every record of the sector is past the window. Sectors are walked in
+// allocation order, so no later one can match either.
+bool FlashLogger::sectorAfterRange(int sector, const QuerySpec& q) {
+  if (q.day_from || q.day_to) return q.day_to && _index.day(sector) > q.day_to;
+  if (q.ts_to == 0xFFFFFFFFUL || !zoneEnsure(sector)) return false;
+  return _zones.startsAfter(sector, _index.day(sector), q.ts_to);
+}
+
 void FlashLogger::scanBadAndQuarantine(Stream& io) {
   io.println("scanbad: scanning sectors...");
   int quarantined = 0;
-  for (int s=0; s<MAX_SECTORS; ++s) {
-    if (s == FACTORY_SECTOR) continue;
+  for (int s=0; s<_sectorCount; ++s) {
+    if (s == _factorySector) continue;
     uint32_t base = sectorBaseAddr(s);
 
     // Heuristic: try to read header; if magic is corrupt or repeated write/erase fails verification,
@@ -2496,24 +6799,20 @@ void FlashLogger::rescanAndRefresh(bool rebuildSummaries, bool keepSelection) {
   int      prevSector  = _selSector;
 
   // Clear fast state
-  for (int i=0; i<MAX_SECTORS; ++i) {
-    _index[i] = {false, 0, false, 0};
-  }
+  _index.clearAll();
 
   // Re-scan the world
   scanAllSectorsBuildIndex();
-  if (!loadAnchorsFromNVS()) buildAnchors(true);
 
   if (rebuildSummaries) {
     buildSummaries();                // also recomputes _days/_sects
-    // buildSummaries() can also call buildAnchors()—that’s fine (cheap)
   }
 
   // Re-pick today’s sector/write head
   selectOrCreateTodaySector();
   if (_currentSector >= 0) {
     findLastWritePositionInSector(_currentSector);
-    _writeAddr = _index[_currentSector].writePtr;
+    _writeAddr = _index.writePtr(_currentSector);
   }
 
   // Optionally restore selection (if it still exists)
@@ -2522,7 +6821,7 @@ void FlashLogger::rescanAndRefresh(bool rebuildSummaries, bool keepSelection) {
     if (prevKind == SEL_DAY) {
       if (selectDay(prevDay)) { /* ok */ }
     } else if (prevKind == SEL_SECTOR) {
-      if (_index[prevSector].present) {
+      if (_index.present(prevSector)) {
         selectSector(prevSector);
       }
     }
@@ -2533,23 +6832,16 @@ void FlashLogger::rescanAndRefresh(bool rebuildSummaries, bool keepSelection) {
 }
 
 bool FlashLogger::saveCursorNVS(const char* ns, const char* key) {
-  Preferences p; if (!p.begin(ns, false)) return false;
-
-  String k_day = String(key) + "_day";
-  String k_sec = String(key) + "_sec";
-  String k_adr = String(key) + "_adr";
-  String k_seq = String(key) + "_seq";
-
-  bool ok = true;
-  ok &= (p.putUShort(k_day.c_str(), _readCursor.dayID)   > 0);
-  ok &= (p.putInt   (k_sec.c_str(), _readCursor.sector)  > 0);
-  ok &= (p.putUInt  (k_adr.c_str(), _readCursor.addr)    > 0);
-  ok &= (p.putUInt  (k_seq.c_str(), _readCursor.seq_next)> 0);
-  p.end();
-  return ok;
+  const String name = String(ns) + "/" + key;
+  return journalAppend(JREC_CURSOR, name.c_str(), &_readCursor, sizeof(_readCursor));
 }
 
 bool FlashLogger::loadCursorNVS(SyncCursor& out, const char* ns, const char* key) {
+  const String name = String(ns) + "/" + key;
+  if (journalRead(JREC_CURSOR, name.c_str(), &out, sizeof(out)) == (int)sizeof(out))
+    return (out.sector >= 0) && isValidRecordAt(out.addr);
+
+  // saved before the journal existed
   Preferences p; if (!p.begin(ns, true)) return false;
 
   String k_day = String(key) + "_day";
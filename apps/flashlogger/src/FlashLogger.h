@@ -13,7 +13,7 @@ class Preferences;
 // =========================
 #define PAGE_SIZE     256
 #define SECTOR_SIZE   4096
-#define MAX_SECTORS   4096   // 16MB / 4KB
+#define MAX_SECTORS   16384  // 64MB / 4KB; upper bound, begin() sizes to the chip
 
 // Winbond W25Qxx
 #define CMD_READ      0x03
@@ -21,6 +21,26 @@ class Preferences;
 #define CMD_WREN      0x06
 #define CMD_SE        0x20
 #define CMD_RDSR1     0x05
+#define CMD_RDSR2     0x35
+#define CMD_WRSR      0x01
+#define CMD_WRSR2     0x31
+#define CMD_FAST_READ 0x0B   // + 1 dummy byte
+#define CMD_READ_DUAL 0x3B   // 1-1-2, + 1 dummy byte
+#define CMD_READ_QUAD 0x6B   // 1-1-4, + 1 dummy byte, needs SR2.QE
+#define CMD_JEDEC_ID  0x9F
+#define CMD_READ_SFDP 0x5A
+#define CMD_READ4       0x13 // 4-byte address forms (parts > 16 MB)
+#define CMD_FAST_READ4  0x0C
+#define CMD_READ_DUAL4  0x3C
+#define CMD_READ_QUAD4  0x6C
+#define CMD_PP4         0x12
+#define CMD_SE4         0x21
+#define CMD_EN4B        0xB7 // enter 4-byte mode (cfg.en4b)
+#define CMD_EX4B        0xE9
+#define CMD_ERASE_SUSPEND 0x75
+#define CMD_ERASE_RESUME  0x7A
+#define SR2_QE        0x02
+#define SR2_SUS       0x80
 
 // =========================
 // On-flash structures
@@ -30,17 +50,87 @@ class Preferences;
 struct SectorHeader {
   uint32_t magic;       // 'LOGG' = 0x4C4F4747
   uint16_t dayID;       // days since 2000-01-01
-  uint8_t  pushed;      // 0 = not pushed, 1 = pushed
-  uint8_t  reserved;    // padding / special markers
+  uint8_t  pushed;      // 1 = pushed; 0xFF (0 before v2.1) = not pushed
+  uint8_t  reserved;    // 0xA5 = erase intent; 0xFF (0 before v2.1) = none
   uint32_t generation;  // boot/generation id when this sector started
 };
 
-// ---- RAM index for quick lookups ----
-struct SectorIndex {
-  bool     present;   // header found
-  uint16_t dayID;
-  bool     pushed;
-  uint32_t writePtr;  // absolute next-write address inside this sector
+// Allocation order of a sector (v2.1): boot generation from its header, then
+// its first record. A sector adopted after a reboot keeps its generation, but
+// its first record is newer than anything else from that boot; empty sectors
+// sort last within theirs.
+struct SectorOrderKey {
+  uint32_t generation;
+  uint32_t firstTs;     // 0xFFFFFFFF = no record yet
+  uint32_t firstSeq;
+  bool operator<(const SectorOrderKey& o) const {
+    if (generation != o.generation) return generation < o.generation;
+    if (firstTs != o.firstTs) return firstTs < o.firstTs;
+    return firstSeq < o.firstSeq;
+  }
+};
+
+// ---- RAM index for quick lookups (v2.1: packed, sized at begin()) ----
+// present/pushed are bitmaps; days are runs of consecutive present sectors
+// (a day's sectors are mostly contiguous); write pointers are kept only for
+// the few sectors still open, the rest read as "just after the header".
+// The chain lists sectors oldest first as runs of ascending sector numbers
+// (round-robin allocation keeps it at one or two runs); sectors cleared
+// later stay behind as holes and are skipped.
+class SectorIndexMap {
+public:
+  ~SectorIndexMap() { release(); }
+  bool     allocate(int sectors);
+  void     release();
+  void     clearAll();
+  bool     present(int s) const { return inRange(s) && (_present[s >> 3] & (1u << (s & 7))); }
+  bool     pushed(int s) const  { return inRange(s) && (_pushed[s >> 3] & (1u << (s & 7))); }
+  uint16_t day(int s) const;
+  void     set(int s, uint16_t dayID, bool pushed);   // present, write pointer reset
+  void     setPushed(int s, bool on);
+  void     clear(int s);
+  uint32_t writePtr(int s) const;
+  void     setWritePtr(int s, uint32_t addr);
+  uint16_t runCount() const { return _runCount; }
+  uint32_t bytes() const;
+
+  struct ChainRun { uint16_t first, count; };
+  int      chainFirst() const;
+  int      chainLast() const;
+  int      chainNext(int s) const;    // -1 at the end; a sector not in the chain continues at the oldest
+  int      chainPrev(int s) const;    // -1 at the start or for a sector not in the chain
+  void     chainAppend(int s);        // s becomes the newest sector
+  bool     chainPushRun(const ChainRun& r);   // raw, for checkpoint loads
+  uint16_t chainRunCount() const { return _chainCount; }
+  const ChainRun& chainRun(int i) const { return _chain[i]; }
+
+private:
+  struct DayRun  { uint16_t first, count, day; };
+  struct OpenPtr { int16_t sector; uint16_t age; uint32_t addr; };
+  static constexpr uint8_t OPEN_MAX = 4;
+  bool inRange(int s) const { return s >= 0 && s < _sectors; }
+  int  runAtOrBefore(int s) const;
+  int  findRun(int s) const;                           // run holding s, or -1
+  bool insertRun(int at, const DayRun& r);
+  void dropFromRun(int s);
+  void dropOpen(int s);
+  bool chainInsert(int at, const ChainRun& r);
+  int  chainFind(int s) const;                         // chain run covering s, or -1
+  int  chainScan(int r, int from, int step) const;     // present sector from `from` on, or -1
+  void chainRemove(int s);
+  void chainTrim(int r);
+
+  int      _sectors  = 0;
+  uint8_t* _present  = nullptr;
+  uint8_t* _pushed   = nullptr;
+  DayRun*  _runs     = nullptr;
+  uint16_t _runCount = 0;
+  uint16_t _runCap   = 0;
+  ChainRun* _chain   = nullptr;
+  uint16_t _chainCount = 0;
+  uint16_t _chainCap = 0;
+  OpenPtr  _open[OPEN_MAX] = {};
+  uint16_t _openAge  = 0;
 };
 
 // ---- Factory info (binary, in last sector) ----
@@ -63,6 +153,38 @@ struct FactoryInfo {
   uint8_t  reserved[28];     // future use
 };
 
+// ---- Metadata journal (v2.1, two sectors below the factory sector) ----
+// Sector: {JOURNAL_MAGIC, epoch} in 16 bytes, then 16-byte aligned records.
+struct JournalRecHeader {
+  uint16_t magic;      // 'JR' = 0x4A52
+  uint8_t  type;       // JREC_*
+  uint8_t  keyed;      // 1 = payload starts with a 24-byte name
+  uint16_t len;        // payload bytes
+  uint16_t crc;        // CRC16 over seq + payload
+  uint32_t seq;        // newest valid record per (type, name) wins
+};
+
+// Fields of FactoryInfo that change at runtime, plus the RTC floor.
+struct MetaState {
+  uint32_t lastGoodUnix;
+  uint32_t bootCounter;
+  uint32_t totalEraseOps;
+  uint16_t startHint;
+  uint16_t badCount;
+  uint16_t badList[16];
+  uint32_t seqFloor;     // v2.1: record seq at the last save (absent in older records)
+};
+
+// Mount checkpoint head (v2.1): which index body to trust and which sectors
+// may have changed after it was written (current sector + erased pool).
+struct CkptHead {
+  uint32_t generation;   // boot that wrote it; 0 = void
+  uint16_t bodyId;       // JREC_INDEX body it refers to
+  uint8_t  touchCount;
+  uint8_t  reserved;
+  uint16_t touch[9];     // 1 + POOL_MAX
+};
+
 // ---- Flash stats for UI ----
 struct FlashStats {
   float totalMB;
@@ -95,17 +217,286 @@ struct FieldPredicate {
   float      value;
 };
 
+// ---- Aggregation (v2.1) ----
+#define FLASHLOGGER_HAS_AGG 1   // queryAgg() is available
+
+enum AggOp : uint8_t {
+  AGG_COUNT,
+  AGG_MIN,
+  AGG_MAX,
+  AGG_AVG,
+  AGG_SUM,
+  AGG_PCT      // streaming estimate (P-square), exact up to 5 values
+};
+
+struct AggSpec {
+  char    key[12];
+  AggOp   op;
+  uint8_t pct;      // AGG_PCT: 1..99
+};
+
 // ---- v1.7+ record header + commit marker ----
 struct __attribute__((packed)) RecordHeader {
   uint16_t len;   // payload length (no header/commit)
   uint16_t crc;   // CRC16 over payload
   uint32_t ts;    // seconds since 2000-01-01 (RTClib secondstime)
   uint32_t seq;   // monotonic sequence
-  uint8_t  flags; // reserved
+  uint8_t  flags; // REC_FLAG_* (0 before v2.1)
   uint8_t  rsv;   // reserved
 };
 static constexpr uint8_t REC_COMMIT = 0xA5;
 
+// v2.1: records carry a 2-byte trailer after the commit byte holding their
+// own start offset in the sector, so the sector can be walked backwards.
+// Records from older firmware have flags == 0 and no trailer.
+static constexpr uint8_t  REC_FLAG_BACKLINK = 0x01;
+static constexpr uint32_t REC_TRAILER       = 2;
+
+// v2.1 typed records: RecordHeader::rsv holds the schema id and the payload
+// is a u16 presence mask followed by the present fields in schema order,
+// little endian, no newline. Readers render them back to JSON/CSV.
+static constexpr uint8_t  REC_FLAG_TYPED    = 0x02;
+
+// v2.1 record tags: the high nibble of RecordHeader::flags says what a
+// record is (append(json, tags)). Each sector's zone map keeps the OR of its
+// records' tags, so a tag query skips sectors without one and the other
+// records by header alone. Records from older firmware have none.
+static constexpr uint8_t  REC_TAG_MEASUREMENT = 0x10;
+static constexpr uint8_t  REC_TAG_EVENT       = 0x20;
+static constexpr uint8_t  REC_TAG_ALERT       = 0x40;
+static constexpr uint8_t  REC_TAG_DIAG        = 0x80;
+static constexpr uint8_t  REC_TAG_MASK        = 0xF0;
+
+// header + payload + commit (+ trailer)
+inline uint32_t recordSpan(const RecordHeader& rh) {
+  return sizeof(RecordHeader) + rh.len + 1 + ((rh.flags & REC_FLAG_BACKLINK) ? REC_TRAILER : 0);
+}
+
+// ---- Record schemas (v2.1, typed records) ----
+enum FieldType : uint8_t {
+  FT_I16 = 1,
+  FT_U16,
+  FT_I32,
+  FT_U32,
+  FT_F32
+};
+
+// A field's id is its position in the schema. Integer types store
+// round(value * 10^decimals), clamped to the type; F32 stores the float.
+// Output prints `decimals` digits after the point either way.
+struct FieldDef {
+  char      key[12];    // JSON key on output, predicate / CSV column name
+  FieldType type;
+  uint8_t   decimals;
+};
+
+static constexpr uint8_t SCHEMA_FIELDS_MAX = 16;
+static constexpr uint8_t SCHEMA_SLOTS      = 4;    // schemas known at once
+
+struct RecordSchema {
+  uint8_t  id;          // 1..255; 0 = free slot
+  uint8_t  count;
+  FieldDef fields[SCHEMA_FIELDS_MAX];
+};
+
+// ---- Compressed sample blocks (v2.1, cfg.compressTyped) ----
+// One record holds a run of typed samples of one schema and is sealed when
+// it reaches the end of a page or of the sector's data area (or on flush()).
+// Payload: u16 sample count, then a bit stream, MSB first, per sample: the
+// time as delta-of-delta ('0' = same step), the presence mask ('0' = as
+// before), then each present field XORed with its previous value, Gorilla
+// style ('0' = unchanged, '10' = inside the last bit window, '11' = new
+// window). The header's ts/seq are the first sample's; seqs count up by one.
+// RecordIterator hands the samples out as plain typed records.
+static constexpr uint8_t  REC_FLAG_COMPRESSED = 0x04;
+
+class SampleCodec {
+public:
+  void     begin(const RecordSchema& s, uint32_t ts);   // before sample 0 (at ts)
+  // Adds one typed payload; false leaves the stream as it was (no room).
+  bool     put(uint8_t* buf, uint16_t cap, uint32_t ts, const uint8_t* payload, uint16_t len);
+  // Next sample as a typed payload (out: 2 + 4 * SCHEMA_FIELDS_MAX bytes).
+  bool     get(const uint8_t* buf, uint16_t len, uint32_t& ts, uint8_t* out, uint16_t& outLen);
+  uint16_t bytes() const   { return (uint16_t)((_bits + 7) >> 3); }
+  uint16_t samples() const { return _n; }
+  const RecordSchema* schema() const { return _s; }
+
+private:
+  bool     putBits(uint8_t* buf, uint16_t cap, uint32_t v, uint8_t n);
+  bool     getBits(const uint8_t* buf, uint16_t len, uint8_t n, uint32_t& v);
+  bool     putValue(uint8_t* buf, uint16_t cap, uint8_t field, uint8_t width, uint32_t raw);
+
+  const RecordSchema* _s = nullptr;
+  uint32_t _bits  = 0;
+  uint16_t _n     = 0;
+  uint16_t _mask  = 0;
+  uint32_t _ts    = 0;
+  int32_t  _delta = 0;
+  uint32_t _prev[SCHEMA_FIELDS_MAX];
+  uint8_t  _lead[SCHEMA_FIELDS_MAX];
+  uint8_t  _trail[SCHEMA_FIELDS_MAX];   // 0xFF: no window yet
+};
+
+// ---- Compiled predicates (v2.1, QuerySpec::where) ----
+// compile() turns a filter expression into postfix bytecode:
+//   expr := term ('||' term)*        term := factor ('&&' factor)*
+//   factor := '!' factor | '(' expr ')' | 'exists(' key ')' | key op value
+//   op := < <= > >= = == !=          value := number | "text"
+// Text compares with = and != only. A comparison on a missing field (or on
+// a string field against a number) is false, as with FieldPredicate.
+// The record is scanned once for all keys, then the program runs on the
+// collected values; sector zone maps are checked with the same program.
+class PredicateProgram {
+public:
+  static constexpr uint8_t MAX_KEYS = 8;
+  static constexpr uint8_t MAX_OPS  = 32;
+  static constexpr uint8_t MAX_TEXT = 48;    // bytes of text literals
+
+  // Values of the program's keys in one record.
+  struct Values {
+    uint8_t     present = 0;                 // bit per key
+    uint8_t     number  = 0;                 // bit per key: num[] holds it
+    float       num[MAX_KEYS];
+    const char* text[MAX_KEYS];              // string contents (unquoted)
+    uint8_t     textLen[MAX_KEYS];
+  };
+  // What a sector's zone map says about each key.
+  struct Bounds {
+    enum : uint8_t { UNKNOWN, RANGE, ABSENT };
+    uint8_t state[MAX_KEYS] = {};
+    float   lo[MAX_KEYS];
+    float   hi[MAX_KEYS];
+  };
+
+  bool        compile(const char* expr);     // false: see error()
+  bool        addCompare(const char* key, PredicateOp op, float value);   // ANDed on
+  bool        keySlot(const char* key, uint8_t& slot);   // slot of `key`, added if new; no test
+  void        clear();
+  bool        empty() const { return _ops == 0; }
+  const char* error() const { return _err; }
+  uint8_t     keys() const  { return _keys; }
+  const char* key(uint8_t i) const { return _key[i]; }
+  bool        eval(const Values& v) const;
+  bool        mayMatch(const Bounds& b) const;   // false: no record can match
+  static bool compare(PredicateOp op, float actual, float value);
+
+  // Schema field -> key slot (0xFF: unused) for the last schema seen.
+  mutable uint8_t schemaId = 0;
+  mutable uint8_t fieldKey[SCHEMA_FIELDS_MAX];
+
+private:
+  enum : uint8_t { I_CMP, I_TEXT, I_EXISTS, I_AND, I_OR, I_NOT };
+  struct Ins {
+    uint8_t code;
+    uint8_t key;
+    uint8_t op;        // PredicateOp
+    uint8_t textOff;
+    uint8_t textLen;
+    float   value;
+  };
+
+  bool parseOr(const char*& p, uint8_t depth);
+  bool parseAnd(const char*& p, uint8_t depth);
+  bool parseFactor(const char*& p, uint8_t depth);
+  bool parseKey(const char*& p, uint8_t& slot);
+  bool emit(const Ins& ins);
+  bool fail(const char* why) { if (!_err) _err = why; return false; }
+
+  Ins         _ins[MAX_OPS];
+  uint8_t     _ops  = 0;
+  uint8_t     _keys = 0;
+  uint8_t     _textUsed = 0;
+  char        _key[MAX_KEYS][12];
+  char        _text[MAX_TEXT];
+  const char* _err = nullptr;
+};
+
+// ---- Row plans (v2.1) ----
+// CSV columns or includeKeys, split once per query. A row is rendered from
+// one pass over the payload (FlashLogger::jsonFields) that notes where each
+// wanted value sits, then by copying those spans into the output.
+struct FieldSpan {
+  uint16_t off;    // value text in the payload; strings keep their quotes
+  uint16_t len;
+};
+
+class RowPlan {
+public:
+  static constexpr uint8_t MAX_COLS = 16;    // later columns / keys are dropped
+
+  RowPlan() = default;
+  RowPlan(const RowPlan&) = delete;          // names point into _names
+  RowPlan& operator=(const RowPlan&) = delete;
+
+  void     columns(const char* csv);         // CSV: "ts,pm25,temp"; ts is the header time
+  void     keys(const char* const* keys);    // JSONL: includeKeys, nullptr-terminated
+  bool     csv() const     { return _csv; }
+  uint8_t  count() const   { return _count; }
+  const char* const* names() const { return _name; }
+  bool     isTs(uint8_t i) const { return _tsMask & (1u << i); }
+
+  // Schema field -> column (0xFF: unused) for the last schema seen.
+  mutable uint8_t schemaId = 0;
+  mutable uint8_t fieldCol[SCHEMA_FIELDS_MAX];
+
+private:
+  bool     add(const char* name, size_t len);
+
+  bool        _csv    = false;
+  uint8_t     _count  = 0;
+  uint8_t     _used   = 0;
+  uint16_t    _tsMask = 0;
+  const char* _name[MAX_COLS];
+  char        _names[96];
+};
+
+// v2.1 zone map: written into the last ZONE_FOOTER bytes of a sector when the
+// logger moves off it; records stop short of that area. The magic's low half
+// is erased, so a forward record walk ends at it.
+static constexpr uint8_t ZONE_FIELDS = 2;
+struct __attribute__((packed)) ZoneFooter {
+  uint32_t magic;                 // ZONE_MAGIC
+  uint32_t tsMin, tsMax;          // oldest / newest record time
+  uint32_t firstSeq, lastSeq;
+  uint16_t count;                 // committed records
+  uint16_t keyCrc[ZONE_FIELDS];   // crc16 of the field name, 0 = unused
+  uint8_t  tags;                  // OR of the records' REC_TAG_* bits
+  uint8_t  rsv;
+  float    lo[ZONE_FIELDS];       // lo > hi: no numeric value seen
+  float    hi[ZONE_FIELDS];
+  uint16_t rsv2;
+  uint16_t crc;                   // CRC16 over the bytes before it
+};
+static constexpr uint32_t ZONE_MAGIC    = 0x5A4EFFFFUL;
+static constexpr uint32_t ZONE_FOOTER   = sizeof(ZoneFooter);
+static constexpr uint32_t ZONE_DATA_END = SECTOR_SIZE - ZONE_FOOTER;  // records end at or before
+
+// ---- Rollup tiers (v2.1, cfg.rollupSectors) ----
+// Count/min/max/mean of each cfg.rollupKeys field per 1-minute, 1-hour and
+// 1-day bucket, kept in RAM while the bucket is open and stored as one record
+// when the first record of a later bucket arrives. Each tier is a ring of
+// its own sectors between the log and the journal: raw GC never touches it,
+// cfg.rollupRetentionDays expires it separately, and a full ring overwrites
+// its oldest sector. Record: REC_FLAG_ROLLUP, rsv = tier, ts = bucket start,
+// seq counting per tier; payload a u16 key mask, then one RollupStat per
+// key present, in cfg.rollupKeys order.
+#define FLASHLOGGER_HAS_ROLLUPS 1   // queryRollups() is available
+
+static constexpr uint8_t REC_FLAG_ROLLUP = 0x08;
+static constexpr uint8_t ROLLUP_KEYS_MAX = 4;
+
+enum RollupTier : uint8_t {
+  ROLLUP_MINUTE = 0,
+  ROLLUP_HOUR   = 1,
+  ROLLUP_DAY    = 2,
+  ROLLUP_TIERS  = 3
+};
+
+struct __attribute__((packed)) RollupStat {
+  uint32_t count;   // 0: the field was in no record of the bucket
+  float    min, max, mean;
+};
+
 // =========================
 // v1.91 summaries & shell
 // =========================
@@ -134,6 +525,76 @@ enum SelKind { SEL_NONE, SEL_DAY, SEL_SECTOR };
 // =========================
 enum OutFmt { OUT_JSONL = 0, OUT_CSV = 1 };
 
+// =========================
+// v2.1 SPI transfer path
+// =========================
+enum FlashSpiXfer : uint8_t {
+  FLASH_XFER_BYTE = 0,   // legacy: one SPI.transfer() per byte
+  FLASH_XFER_BULK = 1,   // transferBytes()/writeBytes() bursts (default)
+  FLASH_XFER_DMA  = 2    // ESP-IDF spi_master, DMA for large reads (falls back to BULK)
+};
+
+// ---- Read command (v2.1) ----
+enum FlashReadMode : uint8_t {
+  FLASH_READ_NORMAL = 0,  // 0x03, <= 50 MHz
+  FLASH_READ_FAST   = 1,  // 0x0B, full clock
+  FLASH_READ_DUAL   = 2,  // 0x3B, data on IO0/IO1 (DMA path only)
+  FLASH_READ_QUAD   = 3,  // 0x6B, data on IO0..IO3 (DMA path + WP/HD pins, sets QE)
+  FLASH_READ_AUTO   = 4   // widest mode supported by chip and bus
+};
+
+// ---- Append durability (v2.1) ----
+enum FlashDurability : uint8_t {
+  FLASH_DURABLE_SYNC     = 0,  // on flash + verified before append() returns
+  FLASH_DURABLE_GROUP    = 1,  // RAM buffer; flushed when full, after groupCommitMs, or flush()
+  FLASH_DURABLE_DEFERRED = 2   // RAM buffer; flushed when full or flush() (e.g. before deep sleep)
+};
+
+// ---- Async engine completions (v2.1) ----
+enum FlashOpKind : uint8_t {
+  FLASH_OP_APPEND = 0,   // ref = record seq
+  FLASH_OP_ERASE  = 1    // ref = sector
+};
+// ok=false: read-back mismatch (append: sector sealed; erase: sector quarantined).
+// Runs inside poll()/flush(); must not call back into the logger.
+typedef void (*FlashOpCallback)(FlashOpKind kind, bool ok, uint32_t ref, void* user);
+
+// ---- Bus counters (reset with resetIoStats) ----
+struct FlashIoStats {
+  uint32_t transactions;   // CS-low frames
+  uint32_t bytesRead;      // payload bytes clocked in (excl. cmd/addr)
+  uint32_t bytesWritten;   // payload bytes clocked out (excl. cmd/addr)
+  uint32_t dmaReads;       // reads served by the DMA path
+  uint32_t eraseSuspends;  // async erases parked for a blocking read/program
+  uint32_t suspendMaxUs;   // worst 0x75 -> chip ready latency
+  uint32_t suspendHeldUs;  // total time erases sat suspended
+};
+
+// ---- RAM held by one FlashLogger (v2.1, memoryUsage()) ----
+struct FlashMemStats {
+  uint32_t objectBytes;    // sizeof(FlashLogger)
+  uint32_t indexBytes;     // bitmaps + day runs + open write pointers
+  uint32_t zoneBytes;      // zone map mirror + loaded bitmap (+ tag nibbles once queried)
+  uint32_t summaryBytes;   // day/sector listings; releaseCaches() frees them
+  uint32_t bufferBytes;    // write-behind buffer
+  uint32_t schemaBytes;    // record schemas, once one is registered or found
+  uint32_t rollupBytes;    // rollup rings and their open buckets, while a tier is on
+  uint32_t totalBytes;
+  uint16_t sectors;        // log region, from the probed chip size
+  uint16_t dayRuns;
+};
+
+// ---- runIoBenchmark() result ----
+struct FlashBenchResult {
+  float    readMBps;
+  float    programMBps;
+  float    headerScanMs;
+  uint32_t headerScanSectors;
+  uint32_t readBytes;
+  uint32_t programBytes;
+  FlashIoStats io;         // counters accumulated during the run
+};
+
 struct QuerySpec {
   // time filters
   uint32_t ts_from = 0;            // inclusive (seconds since 2000-01-01)
@@ -146,11 +607,24 @@ struct QuerySpec {
   static constexpr uint8_t MAX_PREDICATES = 4;
   FieldPredicate predicates[MAX_PREDICATES];
   uint8_t predicateCount = 0;
+  const PredicateProgram* where = nullptr;   // v2.1: compiled expression, ANDed with predicates
+  uint8_t tags = 0;                // v2.1: records with any of these REC_TAG_* bits (0 = all)
 
   // limits / sampling
-  uint32_t max_records = 0;        // 0 = no limit
+  uint32_t max_records = 0;        // 0 = no limit (queryAgg: buckets)
   uint16_t sample_every = 1;       // 1 = every record
 
+  // v2.1 aggregation (queryAgg): one row per bucket of record time
+  static constexpr uint8_t MAX_AGGS = 6;
+  uint32_t group_by_seconds = 0;   // 0 = a single bucket
+  AggSpec  aggs[MAX_AGGS];
+  uint8_t  aggCount = 0;
+  // op: count|min|max|avg|sum|p<1..99>, or several joined by ','
+  bool     addAgg(const char* key, const char* op);
+  // v2.1: answer from a rollup tier when it gives the same buckets (no
+  // filters or percentiles, rollup keys only, tier-aligned bucket and range)
+  bool     use_rollups = false;
+
   // output
   OutFmt out = OUT_JSONL;
   bool compact_json = true;        // for JSONL (ignored for CSV)
@@ -158,6 +632,50 @@ struct QuerySpec {
 
 typedef void (*RowCallback)(const char* line, void* user);
 
+// ---- Span rows (v2.1) ----
+// Rows handed out as (data, len) plus where they came from. The text lives
+// in a RowBuffer (or, for stored JSON, the read window) and is valid only
+// during the call; return false to stop. RowCallback and the onRecord
+// export callback are adapters over this path.
+struct RecordMeta {
+  RecordHeader header;     // as stored; a block sample gets its own ts/seq/len/crc
+  uint16_t dayID;
+  int16_t  sector;
+  uint32_t addr;           // record address (the block's, for its samples)
+  uint16_t sample;         // index in a compressed block, else 0
+};
+typedef bool (*RowSink)(const char* data, size_t len, const RecordMeta& meta, void* user);
+
+// Scratch rows are rendered into, reused for every row of a query. Hand in
+// your own storage to keep the heap out entirely; a row that does not fit
+// moves to a heap buffer that then stays (grows() counts those).
+class RowBuffer {
+public:
+  RowBuffer() = default;
+  RowBuffer(char* buf, size_t cap) : _buf(buf), _cap(cap) { if (cap) buf[0] = 0; }
+  ~RowBuffer();
+  RowBuffer(const RowBuffer&) = delete;
+  RowBuffer& operator=(const RowBuffer&) = delete;
+
+  void        clear()              { _len = 0; if (_cap) _buf[0] = 0; }
+  bool        put(const char* s, size_t n);
+  bool        put(const char* s)   { return put(s, strlen(s)); }
+  bool        put(char c)          { return put(&c, 1); }
+  bool        putUnsigned(uint32_t v);
+  const char* data() const         { return _cap ? _buf : ""; }   // NUL-terminated
+  size_t      length() const       { return _len; }
+  uint32_t    grows() const        { return _grows; }
+
+private:
+  bool        reserve(size_t n);
+
+  char*       _buf   = nullptr;
+  size_t      _cap   = 0;
+  size_t      _len   = 0;
+  bool        _owned = false;
+  uint32_t    _grows = 0;
+};
+
 // =========================
 // v1.93 sync cursors
 // =========================
@@ -165,7 +683,7 @@ struct SyncCursor {
   uint16_t dayID;     // day of next record to read
   int      sector;    // absolute sector index of next record
   uint32_t addr;      // absolute flash address of next record (RecordHeader addr)
-  uint32_t seq_next;  // next expected writer seq (informational)
+  uint32_t seq_next;  // next expected writer seq (v2.1: seekSeq() sets the record's seq)
 };
 
 // =========================
@@ -178,6 +696,18 @@ struct FlashLoggerConfig {
   int      spi_mosi_pin     = -1;
   int      spi_miso_pin     = -1;
   uint32_t spi_clock_hz     = 20'000'000;
+  SPIClass* spi             = nullptr; // nullptr = global SPI
+  FlashSpiXfer spiXfer      = FLASH_XFER_BULK;
+  int      spi_host         = -1;      // FLASH_XFER_DMA: spi_host_device_t, -1 = SPI2_HOST
+  uint16_t dmaMinBytes      = 64;      // FLASH_XFER_DMA: reads >= this use a queued DMA transaction
+  int      spi_wp_pin       = -1;      // IO2, quad reads only
+  int      spi_hd_pin       = -1;      // IO3, quad reads only
+  FlashReadMode readMode    = FLASH_READ_AUTO; // downgraded to what the chip/bus supports
+  FlashDurability durability = FLASH_DURABLE_SYNC;
+  uint16_t writeBufferBytes = 1024;    // group-commit buffer (GROUP/DEFERRED)
+  uint32_t groupCommitMs    = 5000;    // GROUP: max age of a buffered record
+  bool     compressTyped    = false;   // appendTyped() samples go into compressed blocks (v2.1)
+  uint8_t  erasedPoolSize   = 2;       // pre-erased sectors kept for roll-over (0..8)
   bool     persistConfig    = false;
   const char* configNamespace = "flcfg";
 
@@ -186,11 +716,20 @@ struct FlashLoggerConfig {
   DateStyle   dateStyle     = DATE_THAI;
 
   // Flash layout / policy
-  uint32_t totalSizeBytes   = 8 * 1024 * 1024; // 8MB default
+  uint32_t totalSizeBytes   = 8 * 1024 * 1024; // 8MB default; the JEDEC/SFDP size wins when probed
+  uint32_t regionOffset     = 0;               // log partition start (rounded up to a sector)
+  uint32_t regionBytes      = 0;               // log partition size, 0 = to the end of the chip
+  bool     en4b             = false;           // > 16 MB: enter 4-byte mode (0xB7) instead of 0x13/0x12/0x21
   uint32_t sectorSize       = SECTOR_SIZE;     // keep 4KB sectors
   uint16_t retentionDays    = 7;               // GC erase after pushed+N days
   uint32_t dailyBytesHint   = 3500;            // for stats/estimate
   uint16_t maxSectorsPerDay = 64;              // safety cap
+  // v2.1 rollup tiers (minute, hour, day): ring sizes in sectors, taken from
+  // the top of the log region (0 = tier off), and days gc() keeps each tier
+  // (0 = until the ring wraps)
+  uint16_t rollupSectors[ROLLUP_TIERS]       = { 0, 0, 0 };
+  uint16_t rollupRetentionDays[ROLLUP_TIERS] = { 0, 0, 0 };
+  const char* rollupKeys    = "pm25,temp";     // numeric fields rolled up (up to 4)
 
   // Factory & identity (set once if empty)
   const char* model         = "AirMonitor C6";
@@ -201,21 +740,125 @@ struct FlashLoggerConfig {
   // Output defaults
   OutFmt     defaultOut     = OUT_JSONL;
   const char* csvColumns    = "ts,bat,temp";
+  const char* zoneKeys      = "pm25,temp";   // v2.1: numeric fields kept per sector (up to 2)
 
   // Shell
   bool enableShell          = true;  // enable built-in commands
 };
 
-// ===== v1.95: Persisted cursor & anchors & diagnostics =====
-struct Anchor {
-  int      sector;
-  uint16_t dayID;
-  uint32_t firstTs;
-  uint32_t firstAddr;   // absolute addr of first valid record
-  uint32_t lastTs;
+// ---- Zone map mirror (v2.1, sized at begin()) ----
+// One packed entry per sector, filled from its footer (or a walk of a sector
+// that has none) the first time a query asks. Entry: the time span as
+// 6-minute slots of the sector's day (1..240; 0 = starts before the day,
+// 0xFF = ends after it), then per configured field the min and max as 8-bit
+// order-preserving codes rounded outwards. Queries test it in O(1).
+// Record tags get a nibble per sector, allocated by the first tag query.
+class SectorZoneMap {
+public:
+  ~SectorZoneMap() { release(); }
+  bool     allocate(int sectors, const char* keys);   // "pm25,temp"
+  void     release();
+  void     clearAll();                                // nothing loaded
+  bool     allocated() const { return _zones != nullptr; }
+  bool     loaded(int s) const { return inRange(s) && (_loaded[s >> 3] & (1u << (s & 7))); }
+  void     reset(int s);                              // loaded, no records
+  void     load(int s, uint16_t dayID, const ZoneFooter& z);
+  void     add(int s, uint16_t dayID, uint32_t ts, uint8_t tags, const float* vals);   // NAN = field absent
+  bool     trackTags();                               // entries reload with their tags
+  bool     mayMatch(int s, uint16_t dayID, const QuerySpec& q) const;    // false: no record can
+  bool     startsAfter(int s, uint16_t dayID, uint32_t ts) const;
+  uint8_t  fields() const { return _fields; }
+  const char* key(int i) const { return _keys[i]; }
+  uint16_t keyCrc(int i) const { return _crc[i]; }
+  uint32_t bytes() const;
+
+private:
+  bool inRange(int s) const { return s >= 0 && s < _sectors; }
+  uint8_t* entry(int s) const { return _zones + (uint32_t)s * _stride; }
+  uint8_t  tagsOf(int s) const { return (uint8_t)((_tags[s >> 1] >> ((s & 1) * 4)) << 4); }
+  void     setTags(int s, uint8_t tags);
+
+  int      _sectors = 0;
+  uint8_t  _fields  = 0;
+  uint8_t  _stride  = 2;
+  char     _keys[ZONE_FIELDS][12] = {};
+  uint16_t _crc[ZONE_FIELDS] = {};
+  uint8_t* _loaded  = nullptr;
+  uint8_t* _zones   = nullptr;
+  uint8_t* _tags    = nullptr;
 };
 
-static constexpr int MAX_ANCHORS = 128;
+// ---- Record iterator (v2.1) ----
+// Walks the committed records of one sector through a RAM window instead of
+// reading sector header, record header and commit byte per record.
+// BURST fills the window WINDOW bytes at a time (for payload readers);
+// SKIM reads each commit byte together with the next record header, one
+// 15-byte frame per record. header()/payload() are views into the window and
+// stay valid until the next next()/seek(). Reads stop at the write pointer of
+// the current sector. last()/prev() walk backwards through the record
+// trailers; prev() fails at the first record and at records without one.
+// Compressed blocks come out one sample at a time, all at the block's
+// address (sample() tells them apart); blocks that cannot be decoded are
+// skipped. setRaw(true) yields blocks as stored instead.
+class FlashLogger;
+class RecordIterator {
+public:
+  enum Mode : uint8_t { BURST, SKIM };
+  static constexpr uint16_t WINDOW = 512;
+  static constexpr uint16_t SAMPLE_LAST = 0xFFFF;
+
+  explicit RecordIterator(FlashLogger& log, Mode mode = BURST) : _log(log), _mode(mode) {}
+  bool open(int sector, bool stopAtWritePtr = true);  // no flash access; false for meta sectors but rollup rings
+  bool next();                                      // first call yields the sector's first record
+  bool seek(uint32_t addr, uint32_t endHint = 0);   // endHint: burst ends there (backward walks)
+  bool last();                                      // newest record of the sector
+  bool prev();                                      // older neighbour via its trailer
+  void setMode(Mode mode) { _mode = mode; }
+  void setRaw(bool raw)   { _raw = raw; }
+  bool toSample(uint16_t i);                        // within the current block; SAMPLE_LAST = newest
+  bool toSeq(uint32_t seq);                         // the block's sample with this seq, if it has one
+
+  uint32_t addr() const     { return _addr; }
+  uint32_t nextAddr() const { return _addr + recordSpan(_rh); }   // next stored record
+  int      sector() const   { return _sector; }
+  uint16_t day() const      { return _day; }
+  uint16_t sample() const   { return _sample; }     // index in a compressed block, else 0
+  const RecordHeader& header() const { return _vh; }
+  // In-window view; a record larger than the window is read into spill.
+  const uint8_t* payload(String& spill);
+  uint16_t payloadCrc();
+
+private:
+  bool load(uint32_t addr, uint32_t endHint);
+  bool enter(bool newest);
+  bool enterBack();
+  bool decodeNext();
+  const uint8_t* blockData();
+  bool linkBack(uint32_t end);
+  uint32_t dataEnd();
+  void fill(uint32_t from, uint32_t len);
+  bool inWindow(uint32_t a, uint32_t n) const { return a >= _winAddr && a + n <= _winAddr + _winLen; }
+
+  FlashLogger& _log;
+  Mode     _mode;
+  int      _sector  = -1;
+  uint32_t _base    = 0;
+  uint32_t _limit   = 0;
+  uint16_t _day     = 0;
+  bool     _started = false;
+  bool     _valid   = false;
+  uint32_t _addr    = 0;
+  RecordHeader _rh {};              // as stored
+  RecordHeader _vh {};              // header(): _rh, or the current sample of a block
+  bool     _raw     = false;
+  uint16_t _sample  = 0;
+  uint16_t _samples = 0;            // 0: not in a block
+  SampleCodec _codec;
+  uint8_t  _smp[2 + SCHEMA_FIELDS_MAX * 4];
+  uint32_t _winAddr = 0;
+  uint16_t _winLen  = 0;
+  uint8_t  _win[WINDOW];
+};
 
 // =========================
 // FlashLogger class
@@ -225,6 +868,7 @@ public:
   // --- constructors ---
   FlashLogger() = default;                 // v1.94 preferred (use begin(config))
   explicit FlashLogger(uint8_t csPin);     // legacy ctor (kept for compat)
+  ~FlashLogger();                          // buffered records are NOT flushed
 
   // --- initialization ---
   bool begin(const FlashLoggerConfig& cfg); // v1.94 parameterized init
@@ -232,6 +876,45 @@ public:
 
   // --- writing ---
   bool append(const String& json);          // crash-safe append (adds '\n')
+  bool append(const String& json, FlashDurability mode);  // per-call durability
+  bool append(const String& json, uint8_t tags);           // v2.1: REC_TAG_* bits
+  bool append(const String& json, uint8_t tags, FlashDurability mode);
+  bool flush();                             // program + commit buffered records
+  bool flushIfDue();                        // GROUP timer; call from loop()
+  void setDurability(FlashDurability mode) { _durability = mode; }
+  FlashDurability durability() const { return _durability; }
+  uint16_t pendingRecords() const { return _wbCount + (_blk ? _blk->count : 0); }
+
+  // --- typed records (v2.1) ---
+  // An id keeps its first definition (journalled, so old records stay
+  // readable): registering it again with the same fields is a no-op, with
+  // different ones it fails. Use a new id for a new layout.
+  bool registerSchema(uint8_t id, const FieldDef* fields, uint8_t count);
+  const RecordSchema* schema(uint8_t id) const;
+  // values[i] is fields[i]; NAN leaves the field out of the record. With
+  // cfg.compressTyped the sample waits in the open block until it seals (page
+  // or sector full, another schema or day, a plain append, flush(), or under
+  // GROUP groupCommitMs after the block's first sample). A SYNC sample seals
+  // the block before returning, so it is on flash like any SYNC record.
+  bool appendTyped(uint8_t schemaId, const float* values);
+  bool appendTyped(uint8_t schemaId, const float* values, FlashDurability mode);
+  // One JSON line for any record; typed payloads are rendered, others copied.
+  void renderJson(const RecordHeader& rh, const uint8_t* payload, String& out) const;
+  void renderJson(const RecordHeader& rh, const uint8_t* payload, RowBuffer& out) const;
+
+  // --- async engine (v2.1): queue and return, finish from poll() ---
+  bool appendAsync(const String& json, FlashOpCallback cb = nullptr, void* user = nullptr);
+  bool eraseAsync(int sector, FlashOpCallback cb = nullptr, void* user = nullptr);
+  uint8_t gcAsync();                        // queue GC erases; returns how many
+  bool poll();                              // one non-blocking step; true while work remains
+  bool asyncIdle() const { return _as == AS_IDLE && !_eraseCount && !(_wbAsync && _wbUsed); }
+  void drainAsync();                        // block until poll() has nothing left
+  void refillErasedPool();                  // blocking top-up (idle/sync time)
+  uint8_t erasedPoolCount() const { return _poolCount; }
+
+  // --- mount checkpoint (v2.1) ---
+  bool checkpoint();                        // before deep sleep: next begin() skips the full scan
+  bool mountedFromCheckpoint() const { return _ckptMounted; }
 
   // --- printing / debug ---
   void printFormattedLogs();                // grouped by day, date style respected
@@ -269,6 +952,30 @@ public:
   bool isLowSpace() const;
   bool rtcHealthy() const { return _rtcHealthy; }
 
+  // --- v2.1 bus path & throughput ---
+  bool setSpiTransfer(FlashSpiXfer mode);   // switch at runtime (DMA falls back to BULK)
+  FlashSpiXfer spiTransfer() const { return _xfer; }
+  const FlashIoStats& ioStats() const { return _io; }
+  void resetIoStats() { _io = FlashIoStats{}; }
+  bool setReadMode(FlashReadMode mode);     // false if downgraded
+  FlashReadMode readMode() const { return _readMode; }
+  uint32_t jedecId() const { return _jedecId; }  // 0xMMTTCC from the last probe
+  uint32_t chipBytes() const { return _chipBytes; }    // SFDP density, else JEDEC; 0 = unknown
+  uint32_t regionBase() const { return _regionBase; }  // chip address of sector 0
+  bool     addr4() const { return _addr4; }            // 4-byte addressing in use
+
+  // --- v2.1 RAM footprint ---
+  FlashMemStats memoryUsage() const;
+  void releaseCaches();                     // drop listing caches (e.g. before TLS)
+  int  sectorCount() const { return _sectorCount; }
+
+  // --- CRC16 (Modbus, poly 0xA001 reflected) ---
+  static uint16_t crc16(const uint8_t* data, uint32_t len, uint16_t seed = 0xFFFF);        // slice-by-4
+  static uint16_t crc16Bitwise(const uint8_t* data, uint32_t len, uint16_t seed = 0xFFFF); // reference
+  // Reads readBytes from the start of flash, programs/erases one scratch sector
+  // (pass -1 to pick a free one) and times a header scan of every sector.
+  bool runIoBenchmark(FlashBenchResult& out, uint32_t readBytes = 256UL * 1024UL, int scratchSector = -1);
+
   // --- v1.91 navigation/shell ---
   void    buildSummaries();
   void    listDays();                      // "ls"
@@ -298,7 +1005,39 @@ public:
                      const String* pageToken = nullptr, String* nextToken = nullptr);
   uint32_t queryLatest(uint32_t N, RowCallback onRow, void* user,
                        const String* pageToken = nullptr, String* nextToken = nullptr);
+  // v2.1 span rows: no heap per row; scratch = nullptr uses one per call.
+  // A sink returning false ends the query without a next token.
+  uint32_t queryLogs(const QuerySpec& q, RowSink sink, void* user, const String* pageToken = nullptr,
+                     String* nextToken = nullptr, RowBuffer* scratch = nullptr);
+  uint32_t queryLatest(uint32_t N, RowSink sink, void* user, const String* pageToken = nullptr,
+                       String* nextToken = nullptr, RowBuffer* scratch = nullptr);
   uint32_t queryRange(uint32_t ts_from, uint32_t ts_to, RowCallback onRow, void* user);
+  // v2.1 aggregation: q's time range and filters pick the records, q.aggs the
+  // values; one row per group_by_seconds bucket, in log order. JSONL:
+  // {"ts":<bucket start, unix>,"pm25_avg":12.3,...}; CSV: ts,<aggs...> with
+  // ts in device seconds like CSV rows. A bucket without the field gives null
+  // (JSONL) or an empty column. Returns rows; 0 on a bad spec.
+  uint32_t queryAgg(const QuerySpec& q, RowCallback onRow, void* user);
+  uint32_t queryAgg(const QuerySpec& q, RowSink sink, void* user, RowBuffer* scratch = nullptr);
+  static bool parseSeconds(const char* text, uint32_t& seconds);   // "90", "15m", "1h", "7d"
+  // v2.1 rollup tiers: the tier's stored buckets oldest first, then the open
+  // one from RAM (addr 0); q's time range (on bucket starts) and max_records
+  // apply. JSONL: {"ts":<bucket start, unix>,"pm25_count":12,"pm25_min":3,
+  // "pm25_max":9,"pm25_avg":5.5,...}; CSV: ts and four columns per key.
+  uint32_t queryRollups(RollupTier tier, const QuerySpec& q, RowCallback onRow, void* user);
+  uint32_t queryRollups(RollupTier tier, const QuerySpec& q, RowSink sink, void* user,
+                        RowBuffer* scratch = nullptr);
+  bool     rollupEnabled(RollupTier tier) const {
+    return _rollup && tier < ROLLUP_TIERS && _rollup->ring[tier].count > 0;
+  }
+  uint8_t  rollupKeyCount() const { return _rollup ? _rollup->keys : 0; }
+  const char* rollupKey(uint8_t i) const { return i < rollupKeyCount() ? _rollup->key[i] : ""; }
+  static uint32_t rollupSeconds(RollupTier tier);              // 60, 3600, 86400
+  // v2.1 record tags: the newest N records with any of `tags`, newest first.
+  // Sectors whose zone map has none of them are not read.
+  uint32_t queryTagged(uint8_t tags, uint32_t N, RowCallback onRow, void* user);
+  uint32_t queryTagged(uint8_t tags, uint32_t N, RowSink sink, void* user, RowBuffer* scratch = nullptr);
+  static bool parseTags(const char* text, uint8_t& tags);   // "alert,event" -> REC_TAG_* bits
   uint32_t queryBattery(RowCallback onRow, void* user);
   bool     handleQueryCommand(const String& cmd, Stream& io);
   uint32_t exportSinceWithMeta(const SyncCursor& from, uint32_t max_rows,
@@ -311,11 +1050,16 @@ public:
   bool     getCursor(SyncCursor& out) const;
   bool     setCursor(const SyncCursor& in);
   void     clearCursor();
+  bool     seekSeq(uint32_t seq, SyncCursor& out);   // v2.1: first record with seq >= `seq`
   uint32_t exportSince(const SyncCursor& from, uint32_t max_rows, RowCallback onRow, void* user,
                        String* nextToken = nullptr);
+  // v2.1: rows in `fmt` (JSONL lines or setCsvColumns() CSV) through a span sink
+  uint32_t exportRows(const SyncCursor& from, uint32_t max_rows, OutFmt fmt, RowSink sink, void* user,
+                      const QuerySpec* filter = nullptr, String* nextToken = nullptr,
+                      RowBuffer* scratch = nullptr);
   bool     handleCursorCommand(const String& cmd, Stream& io);
 
-  // Persist cursor in ESP32 NVS (Preferences)
+  // Persist cursor (v2.1: metadata journal as "ns/key"; old NVS value read as fallback)
   bool saveCursorNVS(const char* ns="flog", const char* key="cursor");
   bool loadCursorNVS(SyncCursor& out, const char* ns="flog", const char* key="cursor");
   bool loadCursorNVS(const char* ns="flog", const char* key="cursor") {
@@ -330,12 +1074,14 @@ public:
   //   cursor load [ns key]
   //   scanbad
 
-  // Re-scan index, (optionally) rebuild summaries, rebuild anchors,
+  // Re-scan index, (optionally) rebuild summaries, drop zone maps,
   // and (optionally) keep the current selection (day/sector).
   void rescanAndRefresh(bool rebuildSummaries = true, bool keepSelection = false);
 
 
 private:
+  friend class RecordIterator;
+
   // ===== config & runtime =====
   FlashLoggerConfig _cfg{};          // v1.94 stored config
   OutFmt  _outFmt = OUT_JSONL;
@@ -345,6 +1091,18 @@ private:
   // Legacy ctor pin (if used)
   uint8_t     _cs = 4;
 
+  // bus
+  SPIClass*    _spi  = &SPI;
+  FlashSpiXfer _xfer = FLASH_XFER_BULK;
+  FlashIoStats _io{};
+  void*        _dmaDev = nullptr;   // spi_device_handle_t (FLASH_XFER_DMA)
+  uint8_t*     _dmaBuf = nullptr;   // DMA-capable bounce buffer
+  FlashReadMode _readMode    = FLASH_READ_NORMAL; // effective
+  FlashReadMode _readModeReq = FLASH_READ_AUTO;   // requested
+  uint32_t     _jedecId   = 0;
+  uint32_t     _chipBytes = 0;
+  uint8_t      _readCaps  = 0;      // READ_CAP_* bits from JEDEC/SFDP probe
+
   // time & write head
   uint16_t    _currentDay   = 0;
   int         _currentSector = -1;
@@ -355,28 +1113,175 @@ private:
   bool        _rtcHealthy    = true;
   bool        _rtcWarningShown = false;
   uint32_t    _lastGoodUnix  = 0;
+  uint32_t    _stateSavedUnix = 0;  // _lastGoodUnix in the newest JREC_STATE
+
+  // write-behind buffer (v2.1 group commit). Holds records for one sector,
+  // contiguous from _wbAddr; commit bytes stay 0xFF until the batch is stamped.
+  static constexpr uint8_t WB_MAX_RECORDS = 32;
+  FlashDurability _durability = FLASH_DURABLE_SYNC;
+  uint8_t*    _wbBuf     = nullptr;
+  uint16_t    _wbCap     = 0;
+  uint16_t    _wbUsed    = 0;
+  uint8_t     _wbCount   = 0;
+  bool        _wbTimed   = false;   // holds a GROUP record (timer applies)
+  int         _wbSector  = -1;
+  uint32_t    _wbAddr    = 0;
+  uint32_t    _wbFirstMs = 0;
+  uint32_t    _wbLastUnix = 0;
+  uint16_t    _wbCommit[WB_MAX_RECORDS];  // commit-byte offsets in _wbBuf
+  FlashOpCallback _wbCb[WB_MAX_RECORDS];
+  void*       _wbCbUser[WB_MAX_RECORDS];
+  bool        _wbAsync   = false;   // holds appendAsync records (poll() programs them)
+
+  // open compressed block (v2.1): encoded in RAM, stored as one record when
+  // it seals. Sized on start to end at a page boundary or the sector's end.
+  static constexpr uint16_t BLOCK_STREAM_MAX = 320;
+  static constexpr uint16_t BLOCK_MIN        = 64;  // shorter page rest: run into the next page
+  struct OpenBlock {
+    SampleCodec codec;
+    uint8_t  schemaId;
+    uint16_t count;                 // 0 = no block open
+    uint16_t cap;                   // stream bytes
+    uint16_t day;
+    uint32_t ts, seq;               // first sample
+    uint32_t firstMs;
+    FlashDurability mode;           // strongest asked for by its samples
+    bool     timed;                 // holds a GROUP sample (groupCommitMs applies)
+    uint8_t  buf[BLOCK_STREAM_MAX];
+  };
+  OpenBlock*  _blk = nullptr;
+
+  // async engine (v2.1). poll() issues one PP/SE per step and returns; the
+  // batch in flight is the first _wbInflight bytes of _wbBuf.
+  enum AsyncState : uint8_t { AS_IDLE, AS_PROGRAM, AS_VERIFY, AS_COMMIT, AS_COMMIT_CHECK, AS_ERASE };
+  struct EraseJob { int sector; FlashOpCallback cb; void* user; bool count; };
+  static constexpr uint8_t ERASE_QUEUE = 8;
+  static constexpr uint32_t ERASE_MIN_RUN_US = 1000;  // erase time between resume and next suspend
+  AsyncState  _as         = AS_IDLE;
+  bool        _chipBusy   = false;  // a PP/SE was issued without waiting for WIP
+  bool        _eraseSuspended = false;
+  uint32_t    _suspendAtUs = 0;
+  uint32_t    _resumeAtUs  = 0;
+  uint16_t    _wbInflight = 0;
+  uint8_t     _wbInflightRecs = 0;
+  uint16_t    _asOff      = 0;      // AS_PROGRAM: bytes issued
+  uint8_t     _asRec      = 0;      // AS_COMMIT: records stamped
+  EraseJob    _eraseQ[ERASE_QUEUE];
+  uint8_t     _eraseHead  = 0;
+  uint8_t     _eraseCount = 0;
+
+  // pre-erased sector pool (v2.1). Blank-verified sectors for roll-over;
+  // any program into one drops it. Refilled by poll() when idle.
+  static constexpr uint8_t POOL_MAX = 8;
+  int         _pool[POOL_MAX];
+  uint8_t     _poolCount = 0;
+  int         _poolScan  = 0;       // next candidate sector
 
   // daily cap
   uint32_t    _maxDailyBytes = 0;
   uint32_t    _todayBytes     = 0;
   bool        _lowSpace       = false;
 
+  // geometry (v2.1): set by begin() from the probed chip size and the
+  // cfg region. The factory sector is the region's last, the journal the two
+  // below it, the rollup rings below that; the log ends at _logEnd.
+  int         _sectorCount   = 4096;
+  int         _factorySector = 4096 - 1;
+  int         _journalSector = 4096 - 3;
+  int         _logEnd        = 4096 - 3;
+  uint32_t    _regionBase    = 0;      // sector numbers are relative to this
+  bool        _addr4         = false;
+  bool        setGeometry(uint32_t capacityBytes);
+  uint8_t     addrOpcode(uint8_t op) const;
+
   // per-sector RAM index
-  SectorIndex _index[MAX_SECTORS];
+  SectorIndexMap _index;
+  SectorZoneMap  _zones;
+  ZoneFooter     _zOpen {};           // footer of the sector being written, kept as records land
+  int            _zOpenSector = -1;   // -1: adopted at mount, zoneSeal() walks it
 
   // factory storage (last sector)
   FactoryInfo _factory {};
-  static constexpr int FACTORY_SECTOR = MAX_SECTORS - 1;
   static constexpr uint8_t HEADER_INTENT_ERASE = 0xA5;
   static constexpr uint8_t PAGE_DIR_FWD = 0;
   static constexpr uint8_t PAGE_DIR_REV = 1;
-  static constexpr uint32_t ANCHOR_MAGIC = 0x414E4348UL;
+
+  // metadata journal (v2.1): _journalSector and _journalSector + 1, ping-pong.
+  // Everything from _logEnd up is off limits to the log.
+  static constexpr uint32_t JOURNAL_MAGIC = 0x4A524E4CUL;  // 'JRNL'
+  static constexpr uint16_t JREC_MAGIC = 0x4A52;
+  static constexpr uint8_t JREC_STATE   = 1;
+  static constexpr uint8_t JREC_INDEX   = 2;   // checkpoint body: index runs (old bodies also carry anchors)
+  static constexpr uint8_t JREC_CURSOR  = 3;
+  static constexpr uint8_t JREC_CKPT    = 4;   // checkpoint head (CkptHead)
+  static constexpr uint8_t JREC_SCHEMA  = 5;   // RecordSchema[] in use
+  static constexpr uint8_t JREC_ROLLUP  = 6;   // open rollup buckets at the last checkpoint()
+  static constexpr uint32_t STATE_SAVE_SECS = 3600;  // flush() journals JREC_STATE at most this often
+  int         _jActive     = -1;
+  uint32_t    _jEpoch      = 0;
+  uint32_t    _jHead       = 0;     // next free address in the active sector
+  uint32_t    _jSeq        = 0;
+  bool        _jSpareClean = false; // spare sector erased and ready for compaction
+  uint32_t    _jSchemaAt   = 0;     // newest JREC_SCHEMA seen by journalMount(), 0 = none
+
+  // mount checkpoint (v2.1). Written by checkpoint(); any write outside the
+  // head's touch list voids it, so begin() only rescans the listed sectors.
+  static constexpr uint32_t CKPT_MAGIC    = 0x434B5054UL;  // 'CKPT'
+  static constexpr uint16_t CKPT_BODY_MAX = 2048;   // fits a journal sector with every other record
+  CkptHead    _ckpt {};
+  bool        _ckptLive    = false; // _ckpt is the newest head in the journal
+  bool        _ckptMounted = false;
+  uint16_t    _mountDay    = 0;
+  bool isMetaSector(int s) const { return s >= _logEnd; }
+  bool isRollupSector(int s) const { return s >= _logEnd && s < _journalSector; }
+
+  // rollup tiers (v2.1): one ring per tier from _logEnd up, minute first.
+  // Sector header: ROLLUP_MAGIC, dayID = the key list's crc, reserved =
+  // tier, and a generation counting the sectors the ring has started (the
+  // newest is the current one). State is on the heap while a tier is on.
+  static constexpr uint32_t ROLLUP_MAGIC = 0x524F4C4CUL;  // 'ROLL'
+  struct RollupRing {
+    int        first, count;        // count 0: tier off
+    int        cur;                 // sector being written, -1 = none yet
+    uint32_t   wp;                  // its write pointer
+    uint32_t   gen;                 // cur's generation
+    uint32_t   seq;                 // next record seq
+    uint32_t   bucket;              // open bucket start, device seconds
+    bool       open;
+    bool       nextClean;           // the sector after cur is erased (poll() erases ahead)
+    RollupStat stat[ROLLUP_KEYS_MAX];
+  };
+  struct RollupState {
+    RollupRing ring[ROLLUP_TIERS];
+    char       key[ROLLUP_KEYS_MAX][12];
+    uint8_t    keys;
+    uint16_t   crc;                 // of key[]
+  };
+  RollupState* _rollup = nullptr;
 
   // ===== low level flash =====
+  void busBegin();                                  // transaction + CS low
+  void busEnd();                                    // CS high + end transaction
+  void busWrite(const uint8_t* data, uint32_t len);
+  void busRead(uint8_t* buf, uint32_t len, uint8_t lines = 1);
+  void busCmdAddr(uint8_t cmd, uint32_t addr, bool wide = false);
+  bool dmaInit();
+  void dmaRelease();
+  void probeReadCaps();
+  void readSfdp(uint32_t addr, uint8_t* buf, uint32_t len);
+  bool enableQuad();
+  void applyReadMode();
   void writeEnable();
   uint8_t readStatusReg();
   void waitWhileBusy(uint32_t timeout_ms = 0);
-  void readData(uint32_t addr, uint8_t* buf, uint16_t len);
+  void waitChipIdle();                              // settle an async PP/SE
+  void prepareChip(bool mayPreempt);                // before a blocking command
+  bool suspendErase();
+  void resumeErase();
+  void issueProgram(uint32_t addr, const uint8_t* buf, uint32_t len); // one page, no wait
+  void issueErase(uint32_t addr);                   // SE, no wait
+  bool finishErase(uint32_t addr, bool countErase);
+  void readData(uint32_t addr, uint8_t* buf, uint32_t len);
   void pageProgram(uint32_t addr, const uint8_t* buf, uint32_t len); // chunk-safe
   void sectorErase(uint32_t addr, bool countErase = true);
 
@@ -386,9 +1291,35 @@ private:
   void   writeSectorHeader(int sector, uint16_t dayID, bool pushed);
   bool   markSectorEraseIntent(int sector);
   bool   sectorIsEmpty(int sector);
-  void   scanAllSectorsBuildIndex();
+  void   scanAllSectorsBuildIndex();                 // also rebuilds the chain
+  void   scanSectorHeader(int sector, SectorOrderKey* key = nullptr);
+  bool   readSectorKey(int sector, SectorHeader& hdr, SectorOrderKey& key);
   void   selectOrCreateTodaySector();
-  void   findLastWritePositionInSector(int sector); // header-aware
+  void   findLastWritePositionInSector(int sector); // header-aware, seals torn tails
+  uint32_t scanWritePtr(int sector);                // past the last valid record; sector end if torn
+  bool   programBatch(uint32_t addr, const uint8_t* data, uint32_t len,
+                      const uint16_t* commitOffs, uint8_t commits);
+  void   sealSector(int sector);
+  uint8_t commitSpan(uint32_t addr, const uint16_t* commitOffs, uint8_t from, uint8_t commits,
+                     uint8_t* span, uint32_t& first, uint32_t& n) const;
+  bool   appendRecord(const String& json, uint8_t tags, FlashDurability mode, bool async,
+                      FlashOpCallback cb, void* user);
+  bool   appendPayload(const uint8_t* payload, uint16_t len, uint8_t flags, uint8_t schemaId,
+                       FlashDurability mode, bool async, FlashOpCallback cb, void* user,
+                       const RecordHeader* block = nullptr);   // block: its first ts/seq
+  bool   appendClock(DateTime& now, uint32_t& unixNow);
+  bool   appendSample(uint8_t schemaId, const uint8_t* payload, uint16_t len, FlashDurability mode);
+  void   blockStart(uint8_t schemaId, uint32_t ts, uint16_t day);
+  bool   sealBlock();
+  void   completeBatch(uint8_t recs, uint16_t bytes, bool ok);
+  void   drainBatch();
+  bool   eraseQueued(int sector) const;
+  bool   queueErase(int sector, FlashOpCallback cb, void* user, bool count);
+  bool   poolTake(int& sector);
+  void   poolDrop(int sector);
+  bool   poolRefillStep(bool blocking);
+  bool   sectorBlank(int sector);
+  static void onPoolErase(FlashOpKind kind, bool ok, uint32_t ref, void* user);
   bool   sectorHasSpace(int sector, uint32_t needBytes);
   bool   moveToNextSectorSameDay();
 
@@ -401,12 +1332,51 @@ private:
   bool   verifyErase(uint32_t base);
   bool   verifyWrite(uint32_t addr, const uint8_t* buf, uint32_t len);
 
+  // metadata journal
+  bool   journalMount();                          // false = freshly formatted (or refused)
+  bool   evictLogSector(int sector);              // move log data out of a meta sector first
+  bool   journalAppend(uint8_t type, const char* key, const void* a, uint16_t alen,
+                       const void* b = nullptr, uint16_t blen = 0);
+  int    journalRead(uint8_t type, const char* key, void* out, uint16_t maxLen);
+  bool   journalRecValid(uint32_t addr, const JournalRecHeader& rh);
+  bool   journalCompact(uint32_t need);           // need: bytes to append right after
+  bool   journalNameRoom(const char* name);       // name: JOURNAL_KEY bytes, zero padded
+  int    journalSpare() const { return _jActive == _journalSector ? _journalSector + 1 : _journalSector; }
+  static void onJournalErase(FlashOpKind kind, bool ok, uint32_t ref, void* user);
+  bool   restoreMetaState();
+  void   saveMetaState();
+  void   restoreSchemas();                        // right after journalMount()
+  void   mountIndex(uint32_t lastBoot);           // checkpoint, else full scan
+  void   recoverSeq();                            // continue after the newest record
+  bool   chainSectorAt(uint32_t pos, uint32_t end, int& sector, uint32_t& at,
+                       uint32_t& firstSeq);       // first non-empty chain sector in [pos, end)
+  bool   loadCheckpoint(uint32_t lastBoot);
+  uint16_t ckptBuildBody(uint8_t* out, uint16_t bodyId);  // 0 = does not fit
+  bool   ckptApplyBody(const uint8_t* in, int len, uint16_t bodyId);
+  bool   ckptTouched(int sector) const;
+  void   ckptTouch(int sector);                   // void the checkpoint if sector is not listed
+
+  // rollup tiers
+  bool   rollupClaim(bool& moved);                // before mountIndex(): raw data out of the rings
+  void   rollupMount();                           // after recoverSeq(): rings, seqs, open buckets
+  void   rollupFeed(const RecordHeader& rh, const uint8_t* payload);   // record just appended
+  bool   rollupWrite(uint8_t tier);               // store the open bucket
+  bool   rollupNextSector(uint8_t tier);          // start the ring's next sector
+  bool   rollupEraseAhead();                      // poll(): queue one ring's next sector
+  static void onRollupErase(FlashOpKind kind, bool ok, uint32_t ref, void* user);
+  static int rollupAfter(const RollupRing& r) { return r.cur < 0 ? r.first : r.first + (r.cur - r.first + 1) % r.count; }
+  bool   rollupSectorOk(int sector, uint8_t tier);
+  bool   rollupNext(uint8_t tier, RecordIterator& it, int& k, RollupStat* stat, uint16_t& mask,
+                    RecordMeta& meta);            // k = 0 first; stored buckets, then the open one
+  void   rollupSave();                            // open buckets to the journal
+  void   rollupGc(uint16_t todayID);
+  bool   rollupTierFor(const QuerySpec& q, uint8_t& tier, uint8_t* keyOf) const;
+
   // factory info helpers
   bool   loadFactoryInfo();
   void   saveFactoryInfo();
   static uint16_t dayIDFromDateTime_static(const DateTime& t); // internal static
-  bool   loadLastTimestampNVS(uint32_t& outTs);
-  void   saveLastTimestampNVS(uint32_t ts);
+  bool   loadLastTimestampNVS(uint32_t& outTs);      // pre-journal units only
   bool   isRtcTimestampValid(uint32_t unixTs) const;
   bool   loadConfigFromPrefs(FlashLoggerConfig& cfg, Preferences& p);
 
@@ -420,18 +1390,17 @@ private:
   // capacity helpers
   uint32_t countUsedSectors() const;
 
-  // CRC16 helper
-  static uint16_t crc16(const uint8_t* data, uint32_t len, uint16_t seed = 0xFFFF);
-
-  // ===== navigation caches =====
+  // ===== navigation caches (v2.1: heap, sized on use) =====
   static constexpr int MAX_DAYS_CACHE  = 366;
   static constexpr int MAX_SECT_CACHE  = 64;
 
-  DaySummary    _days[MAX_DAYS_CACHE];
+  DaySummary*   _days = nullptr;
   int           _dayCount = 0;
+  int           _dayCap   = 0;
 
-  SectorSummary _sects[MAX_SECT_CACHE];
+  SectorSummary* _sects = nullptr;
   int           _sectCount = 0;
+  int           _sectCap   = 0;
 
   // selection
   SelKind       _selKind = SEL_NONE;
@@ -446,13 +1415,28 @@ private:
 
   // ===== v1.92 helpers =====
   static bool recordMatchesTime(uint16_t recDay, uint32_t ts, const QuerySpec& q);
-  bool   emitRecord(uint16_t recDay, uint32_t ts, const uint8_t* payload, uint16_t len,
-                    const QuerySpec& q, RowCallback onRow, void* user);
-  bool   jsonExtractKeyValue(const char* json, const char* key, String& outVal) const;
-  void   buildCsvLine(uint32_t ts, const char* payload, uint16_t len, const char* cols, String& out) const;
-  void   buildJsonFiltered(const char* payload, uint16_t len, const char* const* keys, bool compact, String& out);
-  bool   buildPageToken(int sector, uint32_t addr, uint16_t dayID, uint8_t dir, String& out) const;
-  bool   parsePageToken(const String& token, int& sector, uint32_t& addr, uint16_t& dayID, uint8_t& dir) const;
+  static bool recordMatchesTags(const RecordHeader& rh, const QuerySpec& q) {
+    return !(q.tags & REC_TAG_MASK) || (rh.flags & q.tags & REC_TAG_MASK);
+  }
+  bool   emitRow(RecordIterator& it, const uint8_t* payload, const RowPlan* plan, RowBuffer& buf,
+                 RowSink sink, void* user) const;   // plan nullptr: stored JSON as is
+  static uint16_t jsonFields(const char* json, uint16_t len, const char* const* keys, uint8_t count,
+                             FieldSpan* out);   // bit per key found
+  static bool jsonSpanNumber(const char* json, const FieldSpan& v, float& out);
+  bool   jsonNumber(const char* json, uint16_t len, const char* key, float& out) const;
+  void   rowPlan(const QuerySpec& q, RowPlan& plan) const;
+  void   renderRow(const RecordHeader& rh, const uint8_t* payload, const RowPlan& plan, RowBuffer& out) const;
+
+  // v2.1 typed records: field access that works for both payload kinds
+  RecordSchema* _schemas = nullptr;             // SCHEMA_SLOTS, allocated on first use
+  const RecordSchema* schemaFor(const RecordHeader& rh) const;
+  bool   typedField(const RecordSchema& s, const uint8_t* payload, uint16_t len, uint8_t field,
+                    float* num, String* text) const;
+  bool   recordNumber(const RecordHeader& rh, const uint8_t* payload, const char* key, float& out) const;
+  bool   buildPageToken(int sector, uint32_t addr, uint16_t sample, uint16_t dayID, uint8_t dir,
+                        String& out) const;
+  bool   parsePageToken(const String& token, int& sector, uint32_t& addr, uint16_t& sample,
+                        uint16_t& dayID, uint8_t& dir) const;
 
   // ===== v1.93 cursor state & helpers =====
   SyncCursor _readCursor{0, -1, 0, 0};
@@ -469,25 +1453,29 @@ private:
   // reinit after factory reset
   void    reinitAfterFactoryReset();
 
-  // Anchor index for faster range scans
-  Anchor  _anchors[MAX_ANCHORS];
-  int     _anchorCount = 0;
-  void    buildAnchors(bool persist = false);      // build from current index
-  bool    loadAnchorsFromNVS();
-  void    saveAnchorsToNVS() const;
-  // fast sector prefilter for day/ts range
-  bool    sectorMaybeInRangeByAnchor(int sector, uint16_t dayFrom, uint16_t dayTo,
-                                     uint32_t ts_from, uint32_t ts_to) const;
+  // v2.1 zone maps: sector prefilter for time and predicates
+  bool    zoneEnsure(int sector);                  // load the RAM entry on first use
+  bool    zoneReadFooter(int sector, ZoneFooter& z);
+  void    zoneStart(ZoneFooter& z) const;         // no records yet
+  void    zoneAdd(ZoneFooter& z, const RecordHeader& rh, const float* vals) const;
+  void    zoneBuild(int sector, ZoneFooter& z);    // walk the records
+  void    zoneSeal(int sector);                    // write the footer as the logger moves on
+  void    zoneAppend(const RecordHeader& rh, const uint8_t* payload);   // record just written
+  void    zoneValues(const RecordHeader& rh, const uint8_t* payload, float* vals) const;
+  bool    sectorMayMatch(int sector, const QuerySpec& q);
+  bool    sectorAfterRange(int sector, const QuerySpec& q);
 
   // small helpers
-  bool    firstRecordInSector(int sector, uint32_t& firstAddr, uint32_t& firstTs, uint32_t& lastTs);
-  uint32_t exportSinceInternal(const SyncCursor& from, uint32_t max_rows,
-                               RowCallback onRow, void* rowUser,
-                               bool (*onRecord)(const RecordHeader&, const String&, void*),
-                               void* recordUser, const QuerySpec* filter, String* nextToken);
+  uint32_t exportSinceInternal(const SyncCursor& from, uint32_t max_rows, const RowPlan* plan,
+                               RowSink sink, void* user, const QuerySpec* filter, String* nextToken,
+                               RowBuffer* scratch);
   bool    parsePredicateExpr(const String& token, FieldPredicate& out) const;
   bool    addPredicateFromToken(QuerySpec& q, const String& token, Stream* err) const;
-  bool    recordMatchesPredicates(const char* payload, uint16_t len, const QuerySpec& q) const;
+  bool    compileFilter(const QuerySpec& q, PredicateProgram& out) const;
+  void    scanValues(const RecordHeader& rh, const uint8_t* payload, const PredicateProgram& prog,
+                     PredicateProgram::Values& v) const;
+  bool    recordMatchesPredicates(const RecordHeader& rh, const uint8_t* payload,
+                                  const PredicateProgram& filter) const;
   String  _loadedModel;
   String  _loadedFlashModel;
   String  _loadedDeviceId;
@@ -9,14 +9,13 @@ struct UploadContext {
   OutFmt fmt;
 };
 
-bool sendWithRetry(UploadContext& ctx, const RecordHeader& rh, const String& rawPayload) {
-  String formatted;
-  ctx.logger.formatPayload(rh.ts, rawPayload, ctx.fmt, formatted);
-  String seqKey = String((unsigned long)rh.seq);
+bool sendWithRetry(UploadContext& ctx, const char* data, size_t len, const RecordHeader& rh) {
+  char seqKey[12];
+  snprintf(seqKey, sizeof(seqKey), "%lu", (unsigned long)rh.seq);
 
   uint32_t backoff = ctx.policy.initialBackoffMs;
   for (uint8_t attempt = 1; attempt <= ctx.policy.maxAttempts; ++attempt) {
-    if (!ctx.sender || ctx.sender(formatted.c_str(), formatted.length(), seqKey.c_str(), ctx.user)) {
+    if (!ctx.sender || ctx.sender(data, len, seqKey, ctx.user)) {
       return true;
     }
     if (attempt < ctx.policy.maxAttempts) {
@@ -27,9 +26,9 @@ bool sendWithRetry(UploadContext& ctx, const RecordHeader& rh, const String& raw
   return false;
 }
 
-bool exportCallback(const RecordHeader& rh, const String& payload, void* user) {
+bool exportCallback(const char* data, size_t len, const RecordMeta& meta, void* user) {
   auto* ctx = static_cast<UploadContext*>(user);
-  return sendWithRetry(*ctx, rh, payload);
+  return sendWithRetry(*ctx, data, len, meta.header);
 }
 } // namespace
 
@@ -47,7 +46,9 @@ static bool uploadInternal(FlashLogger& logger,
   if (pol.backoffMultiplier < 1.0f) pol.backoffMultiplier = 1.0f;
 
   UploadContext ctx{logger, sender, user, pol, fmt};
-  uint32_t sent = logger.exportSinceWithMeta(cursor, maxRows, exportCallback, &ctx, nullptr, nextToken);
+  char row[256];                       // rows longer than this spill to the heap
+  RowBuffer scratch(row, sizeof(row));
+  uint32_t sent = logger.exportRows(cursor, maxRows, fmt, exportCallback, &ctx, nullptr, nextToken, &scratch);
   return sent > 0;
 }
 
@@ -0,0 +1,1912 @@
+#include "FlashLogger.h"
+#include "NorFlashEmulator.h"
+#include <Preferences.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+// Every heap allocation on the host goes through here (operator new, String).
+static uint32_t gMallocs = 0;
+extern "C" void* __libc_malloc(size_t n);
+extern "C" void* malloc(size_t n) {
+  ++gMallocs;
+  return __libc_malloc(n);
+}
+
+namespace {
+constexpr int kCs = 4;
+
+void collect(const char* line, void* user) {
+  static_cast<std::vector<std::string>*>(user)->push_back(line);
+}
+
+FlashLoggerConfig makeConfig(RTC_DS3231& rtc) {
+  FlashLoggerConfig cfg;
+  cfg.rtc = &rtc;
+  cfg.spi_cs_pin = kCs;
+  cfg.totalSizeBytes = 16UL * 1024UL * 1024UL;
+  return cfg;
+}
+
+void testEmulatorNorSemantics(NorFlashEmulator& emu) {
+  // program ANDs into the array and wraps inside the page
+  uint8_t* mem = emu.data();
+  SPI.beginTransaction(SPISettings(1000000, MSBFIRST, SPI_MODE0));
+  auto frame = [](std::initializer_list<uint8_t> bytes) {
+    digitalWrite(kCs, LOW);
+    for (uint8_t b : bytes) SPI.transfer(b);
+    digitalWrite(kCs, HIGH);
+  };
+  frame({0x06});
+  frame({0x02, 0x00, 0x00, 0xFE, 0x0F, 0xF0, 0x55});
+  assert(mem[0xFE] == 0x0F && mem[0xFF] == 0xF0);
+  assert(mem[0x00] == 0x55);                 // wrapped to the page start
+  hostsim::advanceUs(emu.timing().tPP_us);
+  frame({0x06});
+  frame({0x02, 0x00, 0x00, 0xFE, 0xFF, 0xF5});
+  assert(mem[0xFE] == 0x0F);                 // 0xFF leaves a byte alone
+  assert(mem[0xFF] == 0xF0);                 // 0 bits cannot be set by a program
+  assert(emu.stats().andViolations == 1);
+  hostsim::advanceUs(emu.timing().tPP_us);
+  frame({0x06});
+  frame({0x20, 0x00, 0x00, 0x00});
+  assert(mem[0xFE] == 0xFF && mem[0x00] == 0xFF);
+  hostsim::advanceUs(emu.timing().tSE_us);
+  SPI.endTransaction();
+  emu.resetStats();
+}
+
+void testCrc16MatchesReference() {
+  const uint8_t check[] = "123456789";
+  assert(FlashLogger::crc16(check, 9) == 0x4B37);     // CRC-16/MODBUS check value
+  uint8_t buf[257];
+  for (int i = 0; i < 257; ++i) buf[i] = (uint8_t)(i * 73 + 11);
+  for (uint32_t len = 0; len <= sizeof(buf); ++len) {
+    for (uint32_t off = 0; off < 4 && off <= len; ++off) {
+      uint16_t seed = FlashLogger::crc16Bitwise(buf, off);
+      assert(FlashLogger::crc16(buf + off, len - off, seed) == FlashLogger::crc16Bitwise(buf, len));
+    }
+  }
+}
+
+std::vector<int> recordIds(FlashLogger& log) {
+  std::vector<std::string> rows;
+  log.queryLatest(1000, collect, &rows);
+  std::vector<int> ids;
+  for (const std::string& r : rows) {
+    size_t p = r.find("\"i\":");
+    assert(p != std::string::npos);
+    ids.push_back(atoi(r.c_str() + p + 4));
+  }
+  return ids;   // newest first
+}
+
+// Power lost at every point of a group-commit flush: remount must show an
+// unbroken prefix of the records and keep appending cleanly.
+void testGroupCommitPowerLoss(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  for (uint32_t cut = 0; cut < 400; cut += 9) {
+    emu.powerCycle();
+    emu.eraseAll();
+    hostsim::nvs().ns.clear();
+    FlashLoggerConfig cfg = makeConfig(rtc);
+    cfg.durability = FLASH_DURABLE_GROUP;
+    {
+      FlashLogger log;
+      assert(log.begin(cfg));
+      for (int i = 0; i < 10; ++i) {
+        rtc.adjust(DateTime(unixNow += 1));
+        assert(log.append(String("{\"i\":") + String(i) + "}"));
+      }
+      assert(log.flush());
+      for (int i = 10; i < 15; ++i) {
+        rtc.adjust(DateTime(unixNow += 1));
+        assert(log.append(String("{\"i\":") + String(i) + "}"));
+      }
+      assert(log.pendingRecords() == 5);
+      emu.armPowerCut(cut);
+      log.flush();
+    }
+    emu.powerCycle();
+    FlashLogger log;
+    assert(log.begin(cfg));
+    std::vector<int> ids = recordIds(log);
+    assert(ids.size() >= 10 && ids.size() <= 15);
+    for (size_t k = 0; k < ids.size(); ++k) assert(ids[k] == (int)(ids.size() - 1 - k));
+
+    rtc.adjust(DateTime(unixNow += 1));
+    assert(log.append("{\"i\":99}", FLASH_DURABLE_SYNC));
+    ids = recordIds(log);
+    assert(ids[0] == 99 && ids[1] == ids[2] + 1);
+  }
+  emu.powerCycle();
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+  emu.resetStats();
+}
+struct AsyncLog {
+  std::vector<uint32_t> appended, erased;
+  int failures = 0;
+};
+
+void onAsyncDone(FlashOpKind kind, bool ok, uint32_t ref, void* user) {
+  AsyncLog* log = static_cast<AsyncLog*>(user);
+  if (!ok) log->failures++;
+  (kind == FLASH_OP_APPEND ? log->appended : log->erased).push_back(ref);
+}
+
+// appendAsync/eraseAsync return without waiting on WIP; each poll() issues at
+// most one program or erase, so no step costs anywhere near tSE.
+void testAsyncEngine(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+  FlashLogger log;
+  assert(log.begin(makeConfig(rtc)));
+  AsyncLog done;
+
+  const int victim = 200;
+  emu.data()[victim * 4096 + 7] = 0x00;
+  const uint32_t programsBefore = emu.stats().pagePrograms;
+  for (int i = 0; i < 6; ++i) {
+    rtc.adjust(DateTime(unixNow += 1));
+    assert(log.appendAsync(String("{\"i\":") + String(i) + "}", onAsyncDone, &done));
+  }
+  assert(log.eraseAsync(victim, onAsyncDone, &done));
+  assert(!log.eraseAsync(victim));                      // already queued
+  assert(emu.stats().pagePrograms == programsBefore);   // nothing issued yet
+  assert(!log.asyncIdle());
+
+  uint64_t worstStepUs = 0;
+  for (;;) {
+    const uint64_t t0 = hostsim::clockUs();
+    const bool more = log.poll();
+    worstStepUs = std::max<uint64_t>(worstStepUs, hostsim::clockUs() - t0);
+    if (!more) break;
+    hostsim::advanceUs(100);                            // rest of loop()
+  }
+  assert(worstStepUs < emu.timing().tSE_us / 10);
+  assert(log.asyncIdle() && log.pendingRecords() == 0);
+  assert(done.failures == 0);
+  assert(done.appended.size() == 6 && done.appended.back() == done.appended.front() + 5);
+  assert(done.erased.size() == 1 && done.erased[0] == (uint32_t)victim);
+  assert(emu.data()[victim * 4096 + 7] == 0xFF);
+
+  std::vector<int> ids = recordIds(log);
+  assert(ids.size() == 6 && ids[0] == 5);
+
+  // A blocking append/query during an async erase suspends it (0x75), runs,
+  // and poll() resumes it (0x7A); the erase still completes and verifies.
+  emu.data()[victim * 4096 + 9] = 0x00;
+  log.resetIoStats();
+  assert(log.eraseAsync(victim, onAsyncDone, &done));
+  assert(log.poll());                                   // SE issued
+  hostsim::advanceUs(5000);
+  const uint64_t t0 = hostsim::clockUs();
+  rtc.adjust(DateTime(unixNow += 1));
+  assert(log.append("{\"i\":6}", FLASH_DURABLE_SYNC));
+  assert(recordIds(log)[0] == 6);
+  assert(hostsim::clockUs() - t0 < 10000);              // not held for tSE
+  assert(log.ioStats().eraseSuspends >= 1 && emu.stats().suspends >= 1);
+  log.drainAsync();
+  assert(emu.stats().resumes == emu.stats().suspends);
+  assert(done.failures == 0 && done.erased.size() == 2);
+  assert(emu.data()[victim * 4096 + 9] == 0xFF);
+  assert(log.ioStats().suspendHeldUs > 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Sector roll-over pops a pre-erased sector: no erase on the append path, and
+// poll() tops the pool back up (erasing stale sectors in the background).
+void testErasedPool(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  for (int s = 0; s < 64; ++s) emu.data()[s * 4096 + 300] = 0x00;   // stale, unindexed
+  FlashLogger log;
+  assert(log.begin(makeConfig(rtc)));
+  assert(log.erasedPoolCount() == 2);
+  const std::string pad(200, 'x');
+  uint64_t worstUs = 0;
+  for (int i = 0; i < 100; ++i) {                       // ~5 roll-overs
+    while (log.poll()) hostsim::advanceUs(100);
+    assert(log.erasedPoolCount() == 2);
+    rtc.adjust(DateTime(unixNow += 5));
+    const uint32_t erases = emu.stats().sectorErases;
+    const uint64_t t0 = hostsim::clockUs();
+    assert(log.append(String("{\"i\":") + String(i) + ",\"p\":\"" + pad.c_str() + "\"}"));
+    worstUs = std::max<uint64_t>(worstUs, hostsim::clockUs() - t0);
+    assert(emu.stats().sectorErases == erases);
+  }
+  assert(worstUs < emu.timing().tSE_us / 4);
+  assert(recordIds(log)[0] == 99);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+// Metadata lives in the flash journal: appends touch neither NVS nor the
+// factory sector, cursors survive compaction, and a cut at any point of a
+// journal write (compaction included) recovers the newest complete record.
+void testMetadataJournal(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const uint32_t nvsWrites = hostsim::nvs().writes;
+  SyncCursor c{};
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    const uint32_t erases = emu.stats().sectorErases;
+    for (int i = 0; i < 30; ++i) {
+      rtc.adjust(DateTime(unixNow += 5));
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+    assert(emu.stats().sectorErases == erases);
+    assert(log.getCursor(c));
+    c.addr = 0;                                         // first record of c.sector
+    for (uint32_t i = 1; i <= 200; ++i) {              // ~3 compactions
+      c.seq_next = i;
+      assert(log.setCursor(c) && log.saveCursorNVS());
+    }
+  }
+  assert(hostsim::nvs().writes == nvsWrites);
+
+  for (uint64_t cut = 0; cut < 3000; cut += 97) {
+    uint32_t saved = 0;
+    {
+      FlashLogger log;
+      assert(log.begin(cfg));
+      SyncCursor got{};
+      assert(log.loadCursorNVS(got) && got.seq_next >= 200);
+      saved = got.seq_next;
+      emu.armPowerCut(cut);
+      for (uint32_t i = saved + 1; i <= saved + 80 && !emu.powerLost(); ++i) {
+        c.seq_next = i;
+        log.setCursor(c);
+        log.saveCursorNVS();
+      }
+    }
+    emu.powerCycle();
+    FlashLogger log;
+    assert(log.begin(cfg));
+    SyncCursor got{};
+    assert(log.loadCursorNVS(got));
+    assert(got.seq_next >= saved && got.seq_next <= saved + 80);
+  }
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Compaction keeps every record when they fit and the index body otherwise;
+// it never writes past the spare, whatever the journal holds, and a cursor
+// name past the budget is refused up front.
+void testJournalBudget(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.rollupSectors[ROLLUP_DAY] = 1;
+  FieldDef fields[SCHEMA_FIELDS_MAX];
+  for (uint8_t f = 0; f < SCHEMA_FIELDS_MAX; ++f) fields[f] = { {'f', (char)('a' + f), 0}, FT_I16, 1 };
+  const uint8_t* factory = emu.data() + emu.capacity() - 4096;
+  std::vector<uint8_t> before;
+  auto name = [](uint32_t k) { return "c" + std::to_string(k); };
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    before.assign(factory, factory + 4096);
+    for (uint8_t id = 1; id < SCHEMA_SLOTS; ++id) assert(log.registerSchema(id, fields, SCHEMA_FIELDS_MAX));
+    for (int d = 0; d < 1000; ++d) {                   // a sector a day: a ~2 KB index body
+      rtc.adjust(DateTime(unixNow += 86400));
+      assert(log.append("{\"pm25\":1}"));
+    }
+    assert(log.checkpoint());
+    SyncCursor c{};
+    assert(log.getCursor(c));
+    c.addr = 0;
+    for (uint32_t i = 1; i <= 300; ++i) {
+      c.seq_next = i;
+      assert(log.setCursor(c) && log.saveCursorNVS("flog", name(i % 11).c_str()));
+      if (i == 150) assert(log.registerSchema(SCHEMA_SLOTS, fields, SCHEMA_FIELDS_MAX));
+      if (i % 40 == 0) assert(log.checkpoint());
+    }
+    assert(!log.saveCursorNVS("flog", name(11).c_str()));   // a 12th name would not fit
+    assert(log.saveCursorNVS("flog", name(300 % 11).c_str()));
+    assert(log.checkpoint());
+  }
+  assert(std::equal(before.begin(), before.end(), factory));
+  FlashLogger log;
+  assert(log.begin(cfg) && log.mountedFromCheckpoint());
+  for (uint8_t id = 1; id <= SCHEMA_SLOTS; ++id) assert(log.schema(id));
+  for (uint32_t k = 0; k < 11; ++k) {
+    SyncCursor got{};
+    assert(log.loadCursorNVS(got, "flog", name(k).c_str()) && got.seq_next == 300 - (300 - k) % 11);
+  }
+  assert(emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// The RTC floor is journalled as logging goes on (hourly from flush(), and
+// by checkpoint()), so an RTC that comes back behind it is refused.
+void testRtcFloor(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const uint32_t t0 = unixNow += 60;
+  {
+    FlashLogger log;
+    rtc.adjust(DateTime(t0));
+    assert(log.begin(cfg));
+    for (int i = 0; i < 18; ++i) {                      // 3 h, no checkpoint
+      rtc.adjust(DateTime(unixNow += 600));
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+  }
+  {
+    FlashLogger log;
+    rtc.adjust(DateTime(t0 + 5400));
+    assert(log.begin(cfg) && !log.rtcHealthy());
+  }
+  const uint32_t t1 = unixNow += 60;
+  {
+    FlashLogger log;
+    rtc.adjust(DateTime(t1));
+    assert(log.begin(cfg) && log.rtcHealthy());
+    for (int i = 0; i < 10; ++i) {                      // 10 min, then a checkpoint
+      rtc.adjust(DateTime(unixNow += 60));
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+    assert(log.checkpoint());
+  }
+  {
+    FlashLogger log;
+    rtc.adjust(DateTime(t1 + 300));
+    assert(log.begin(cfg) && !log.rtcHealthy());
+  }
+  rtc.adjust(DateTime(unixNow += 60));
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// A unit logged on by older firmware has log sectors where the journal goes.
+// An unpushed one is moved into the log before the journal claims the spot
+// (a pushed one is dropped); with nowhere to move it the journal stays off
+// and the data stays put until a later boot.
+void testJournalUpgrade(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const int jSector = (int)(emu.capacity() / 4096) - 3;
+  uint8_t* mem = emu.data();
+  auto sector = [&](int i) {                            // log sector holding record i
+    const std::string want = "\"i\":" + std::to_string(i) + "}";
+    for (int s = 0; s < jSector; ++s) {
+      const uint8_t* p = mem + s * 4096;
+      if (memcmp(p, "GGOL", 4) == 0 && std::search(p, p + 4096, want.begin(), want.end()) != p + 4096) return s;
+    }
+    return -1;
+  };
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    unixNow += 86400 - unixNow % 86400;
+    for (int i = 0; i < 3; ++i) {                       // a sector a day
+      rtc.adjust(DateTime(unixNow += 86400));
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+    log.markDaysPushedUntil((uint16_t)((unixNow - DateTime::SECONDS_FROM_1970_TO_2000) / 86400UL) - 1);
+  }
+  const int pushed = sector(1), unpushed = sector(2);
+  assert(pushed >= 0 && unpushed >= 0);
+  memcpy(mem + jSector * 4096, mem + pushed * 4096, 4096);       // where old firmware put them
+  memcpy(mem + (jSector + 1) * 4096, mem + unpushed * 4096, 4096);
+  memset(mem + pushed * 4096, 0xFF, 4096);
+  memset(mem + unpushed * 4096, 0xFF, 4096);
+  const std::vector<uint8_t> old(mem + (jSector + 1) * 4096, mem + (jSector + 2) * 4096);
+
+  for (int s = 0; s < jSector; ++s) {                   // leave nowhere to move it
+    if (memcmp(mem + s * 4096, "GGOL", 4) == 0) mem[s * 4096 + 6] = 0xFF;   // unpushed
+    else if (mem[s * 4096] == 0xFF) mem[s * 4096] = 0x00;
+  }
+  {
+    FlashLogger log;
+    log.begin(cfg);                                     // full chip: fails, but keeps the data
+    assert(std::equal(old.begin(), old.end(), mem + (jSector + 1) * 4096));
+  }
+  for (int s = 0; s < jSector; ++s)
+    if (mem[s * 4096] == 0x00 && mem[s * 4096 + 1] == 0xFF) mem[s * 4096] = 0xFF;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    assert(recordIds(log) == std::vector<int>({2, 0}));
+    rtc.adjust(DateTime(unixNow += 60));
+    assert(log.append("{\"i\":3}"));
+  }
+  FlashLogger log;
+  assert(log.begin(cfg));
+  assert(recordIds(log) == std::vector<int>({3, 2, 0}));
+  assert(emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// A checkpoint replaces the header scan on the next mount. Appends after it
+// (roll-overs into pooled sectors included) are still found; a boot without
+// one, or a write to any other sector, falls back to the full scan.
+void testMountCheckpoint(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const std::string pad(200, 'x');
+  int next = 0;
+  auto add = [&](FlashLogger& log, int n) {
+    for (int k = 0; k < n; ++k, ++next) {
+      rtc.adjust(DateTime(unixNow += 5));
+      assert(log.append(String("{\"i\":") + String(next) + ",\"p\":\"" + pad.c_str() + "\"}"));
+    }
+  };
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && !log.mountedFromCheckpoint());
+    add(log, 40);
+    assert(log.checkpoint());
+    add(log, 25);                                       // rolls into the pool
+  }
+  uint64_t ckptFrames = 0, fullFrames = 0;
+  {
+    const uint64_t f0 = emu.stats().frames;
+    FlashLogger log;
+    assert(log.begin(cfg) && log.mountedFromCheckpoint());
+    ckptFrames = emu.stats().frames - f0;
+    const std::vector<int> ids = recordIds(log);
+    assert(ids.size() == 65 && ids[0] == 64);
+    add(log, 1);
+  }
+  {
+    const uint64_t f0 = emu.stats().frames;
+    FlashLogger log;
+    assert(log.begin(cfg) && !log.mountedFromCheckpoint());   // previous boot wrote none
+    fullFrames = emu.stats().frames - f0;
+    const std::vector<int> ids = recordIds(log);
+    assert(ids.size() == 66 && ids[0] == 65);
+    assert(log.checkpoint());
+    assert(log.eraseAsync(1000));                       // not in the touch list
+    log.drainAsync();
+  }
+  assert(ckptFrames * 4 < fullFrames);
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && !log.mountedFromCheckpoint());
+    assert(log.checkpoint());
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.mountedFromCheckpoint());
+    assert(recordIds(log).size() == 66);
+  }
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Scan paths read through RecordIterator: records larger than its window,
+// paging tokens in both directions and the frame count of a reverse walk.
+void testRecordIterator(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLogger log;
+  assert(log.begin(makeConfig(rtc)));
+  const int total = 60;
+  for (int i = 0; i < total; ++i) {
+    rtc.adjust(DateTime(unixNow += 60));
+    const size_t pad = (i % 15 == 7) ? 1500 : (size_t)(i * 37 % 300);   // a few > WINDOW
+    assert(log.append(String("{\"i\":") + String(i) + ",\"p\":\"" + std::string(pad, 'x').c_str() + "\"}"));
+  }
+  const std::vector<int> all = recordIds(log);
+  assert((int)all.size() == total);
+  for (int k = 0; k < total; ++k) assert(all[k] == total - 1 - k);
+
+  auto idOf = [](const std::string& r) { return atoi(r.c_str() + r.find("\"i\":") + 4); };
+  std::vector<int> seen;
+  String token;
+  do {                                                    // newest first, 7 per page
+    std::vector<std::string> rows;
+    String next;
+    log.queryLatest(7, collect, &rows, token.length() ? &token : nullptr, &next);
+    for (const std::string& r : rows) seen.push_back(idOf(r));
+    token = next;
+  } while (token.length());
+  assert(seen == all);
+
+  seen.clear();
+  QuerySpec q;
+  q.max_records = 9;
+  do {                                                    // oldest first, 9 per page
+    std::vector<std::string> rows;
+    String next;
+    log.queryLogs(q, collect, &rows, token.length() ? &token : nullptr, &next);
+    for (const std::string& r : rows) seen.push_back(idOf(r));
+    token = next;
+  } while (token.length());
+  assert((int)seen.size() == total);
+  for (int k = 0; k < total; ++k) assert(seen[k] == k);
+
+  SyncCursor from{};
+  log.clearCursor();                                      // earliest record
+  assert(log.saveCursorNVS("t", "c") && log.loadCursorNVS(from, "t", "c"));
+  std::vector<std::string> rows;
+  assert(log.exportSince(from, 0, collect, &rows) == (uint32_t)total);
+  assert(idOf(rows.front()) == 0 && idOf(rows.back()) == total - 1);
+
+  const uint64_t f0 = emu.stats().frames;
+  rows.clear();
+  assert(log.queryLatest(20, collect, &rows) == 20);
+  assert(emu.stats().frames - f0 < 20 * 3);              // was ~4 frames per record plus a walk per step
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Rewrites a closed sector as older firmware would have left it: the first
+// `legacy` records without trailers, the rest with trailers at their new offsets.
+void relayoutSector(NorFlashEmulator& emu, int sector, int legacy) {
+  uint8_t* base = emu.data() + sector * 4096;
+  std::vector<std::vector<uint8_t>> recs;
+  for (uint32_t p = sizeof(SectorHeader); p + sizeof(RecordHeader) < 4096; ) {
+    RecordHeader rh;
+    memcpy(&rh, base + p, sizeof(rh));
+    if (rh.len == 0xFFFF || base[p + sizeof(rh) + rh.len] != REC_COMMIT) break;
+    recs.emplace_back(base + p, base + p + sizeof(rh) + rh.len + 1);
+    p += recordSpan(rh);
+  }
+  memset(base + sizeof(SectorHeader), 0xFF, 4096 - sizeof(SectorHeader));
+  uint32_t p = sizeof(SectorHeader);
+  for (size_t k = 0; k < recs.size(); ++k) {
+    std::vector<uint8_t>& r = recs[k];
+    r[offsetof(RecordHeader, flags)] = ((int)k < legacy) ? 0 : REC_FLAG_BACKLINK;
+    memcpy(base + p, r.data(), r.size());
+    if ((int)k >= legacy) {
+      const uint16_t off = (uint16_t)p;
+      memcpy(base + p + r.size(), &off, REC_TRAILER);
+    }
+    p += r.size() + (((int)k < legacy) ? 0 : REC_TRAILER);
+  }
+}
+
+// queryLatest walks back through the record trailers; sectors written by
+// older firmware (no trailers, or a trailer-less prefix) still read in order.
+void testBackLinks(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLogger log;
+  assert(log.begin(makeConfig(rtc)));
+  const std::string pad(150, 'x');
+  const int total = 90;
+  for (int i = 0; i < total; ++i) {
+    rtc.adjust(DateTime(unixNow += 60));
+    assert(log.append(String("{\"i\":") + String(i) + ",\"p\":\"" + pad.c_str() + "\"}"));
+  }
+  const std::vector<int> all = recordIds(log);
+  assert((int)all.size() == total);
+
+  uint64_t f0 = emu.stats().frames;
+  std::vector<std::string> rows;
+  assert(log.queryLatest(30, collect, &rows) == 30);
+  assert(emu.stats().frames - f0 < 20);                  // ~1 burst per window, no forward skim
+
+  std::vector<int> data;
+  for (int s = 0; s < 4096; ++s) {
+    if (memcmp(emu.data() + s * 4096, "GGOL", 4) == 0) data.push_back(s);
+  }
+  assert(data.size() >= 3);                               // last one is the open sector
+  relayoutSector(emu, data[0], 1000);
+  relayoutSector(emu, data[1], 9);
+  assert(recordIds(log) == all);
+
+  auto idOf = [](const std::string& r) { return atoi(r.c_str() + r.find("\"i\":") + 4); };
+  std::vector<int> seen;
+  String token;
+  do {                                                    // pages cross the old/new seams
+    rows.clear();
+    String next;
+    log.queryLatest(7, collect, &rows, token.length() ? &token : nullptr, &next);
+    for (const std::string& r : rows) seen.push_back(idOf(r));
+    token = next;
+  } while (token.length());
+  assert(seen == all);
+
+  QuerySpec q;
+  rows.clear();
+  assert(log.queryLogs(q, collect, &rows) == (uint32_t)total);
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// After GC frees the oldest days the ring wraps: newer days land in lower
+// sectors. Queries, exports and paging follow the allocation chain, across a
+// full-scan mount and a checkpoint mount.
+void testWrapOrder(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.regionBytes = 48UL * 4096UL;
+  const std::string pad(300, 'x');
+  int next = 0;
+  auto day = [&](FlashLogger& log) {                     // 30 records, ~3 sectors
+    unixNow = (unixNow / 86400 + 1) * 86400 + 3600;
+    for (int k = 0; k < 30; ++k, ++next) {
+      rtc.adjust(DateTime(unixNow += 60));
+      assert(log.append(String("{\"i\":") + String(next) + ",\"p\":\"" + pad.c_str() + "\"}"));
+    }
+  };
+  auto idOf = [](const std::string& r) { return atoi(r.c_str() + r.find("\"i\":") + 4); };
+  auto check = [&](FlashLogger& log, int oldest) {
+    std::vector<std::string> rows;
+    QuerySpec q;
+    log.queryLogs(q, collect, &rows);
+    assert((int)rows.size() == next - oldest);
+    for (size_t k = 0; k < rows.size(); ++k) assert(idOf(rows[k]) == oldest + (int)k);
+
+    std::vector<int> seen;
+    String token;
+    do {                                                  // newest first, 7 per page
+      rows.clear();
+      String nextTok;
+      log.queryLatest(7, collect, &rows, token.length() ? &token : nullptr, &nextTok);
+      for (const std::string& r : rows) seen.push_back(idOf(r));
+      token = nextTok;
+    } while (token.length());
+    assert((int)seen.size() == next - oldest);
+    for (size_t k = 0; k < seen.size(); ++k) assert(seen[k] == next - 1 - (int)k);
+
+    seen.clear();
+    q.max_records = 9;
+    do {                                                  // oldest first, 9 per page
+      rows.clear();
+      String nextTok;
+      log.queryLogs(q, collect, &rows, token.length() ? &token : nullptr, &nextTok);
+      for (const std::string& r : rows) seen.push_back(idOf(r));
+      token = nextTok;
+    } while (token.length());
+    assert((int)seen.size() == next - oldest);
+    for (size_t k = 0; k < seen.size(); ++k) assert(seen[k] == oldest + (int)k);
+
+    SyncCursor from{};
+    log.clearCursor();                                    // oldest record
+    assert(log.saveCursorNVS("t", "c") && log.loadCursorNVS(from, "t", "c"));
+    rows.clear();
+    assert(log.exportSince(from, 0, collect, &rows) == (uint32_t)(next - oldest));
+    for (size_t k = 0; k < rows.size(); ++k) assert(idOf(rows[k]) == oldest + (int)k);
+    return from.sector;
+  };
+  int oldestSector;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int d = 0; d < 8; ++d) day(log);
+    SyncCursor c;
+    log.getCursor(c);
+    for (int s = 0; s < 48; ++s) {                        // drop days 0..3
+      SectorHeader h;
+      memcpy(&h, emu.data() + s * 4096, sizeof(h));
+      if (h.magic != 0x4C4F4747UL || h.dayID > c.dayID - 4) continue;
+      assert(log.eraseAsync(s));
+      log.drainAsync();
+    }
+    for (int d = 0; d < 7; ++d) day(log);
+    oldestSector = check(log, 120);
+    log.getCursor(c);
+    assert(c.sector < oldestSector);                      // wrapped
+  }
+  {
+    FlashLogger log;                                      // full scan rebuilds the chain
+    assert(log.begin(cfg) && !log.mountedFromCheckpoint());
+    assert(check(log, 120) == oldestSector);
+    day(log);
+    assert(log.checkpoint());
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.mountedFromCheckpoint());
+    assert(check(log, 120) == oldestSector);
+  }
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Record seqs keep counting across boots, also after the ring wraps, and
+// seekSeq() lands on any of them with a handful of small reads.
+void testSeqAcrossBoots(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.regionBytes = 48UL * 4096UL;
+  const std::string pad(300, 'x');
+  uint32_t next = 0;
+  auto day = [&](FlashLogger& log) {
+    unixNow = (unixNow / 86400 + 1) * 86400 + 3600;
+    for (int k = 0; k < 30; ++k, ++next) {
+      rtc.adjust(DateTime(unixNow += 60));
+      assert(log.append(String("{\"i\":") + String(next) + ",\"p\":\"" + pad.c_str() + "\"}"));
+    }
+  };
+  auto seqs = [](FlashLogger& log, const SyncCursor& from, uint32_t max) {
+    std::vector<uint32_t> out;
+    log.exportSinceWithMeta(from, max, [](const RecordHeader& rh, const String&, void* u) {
+      static_cast<std::vector<uint32_t>*>(u)->push_back(rh.seq);
+      return true;
+    }, &out);
+    return out;
+  };
+  auto check = [&](FlashLogger& log, uint32_t oldest) {
+    SyncCursor c{};
+    log.clearCursor();
+    assert(log.saveCursorNVS("t", "c") && log.loadCursorNVS(c, "t", "c"));
+    const std::vector<uint32_t> all = seqs(log, c, 0);
+    assert(all.size() == next - oldest);
+    for (size_t k = 0; k < all.size(); ++k) assert(all[k] == oldest + k);
+    for (uint32_t q = 0; q < next; q += 7) {
+      const uint64_t f0 = emu.stats().frames;
+      assert(log.seekSeq(q, c));
+      assert(emu.stats().frames - f0 < 24);              // ~log2(48) probes + one sector
+      assert(c.seq_next == std::max(q, oldest));
+      assert(seqs(log, c, 1) == std::vector<uint32_t>{c.seq_next});
+    }
+    assert(!log.seekSeq(next, c));
+  };
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    day(log);
+  }
+  for (int boot = 0; boot < 3; ++boot) {                  // deep-sleep wakes
+    FlashLogger log;
+    assert(log.begin(cfg));
+    day(log);
+    day(log);
+    check(log, 0);
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    SyncCursor c;
+    log.getCursor(c);
+    assert(c.seq_next == next);
+    for (int s = 0; s < 48; ++s) {                        // drop the first three days
+      SectorHeader h;
+      memcpy(&h, emu.data() + s * 4096, sizeof(h));
+      if (h.magic != 0x4C4F4747UL || h.dayID > c.dayID - 4) continue;
+      assert(log.eraseAsync(s));
+      log.drainAsync();
+    }
+    for (int d = 0; d < 8; ++d) day(log);
+    log.getCursor(c);
+    assert(c.sector < 9);                                 // wrapped
+    check(log, 90);
+    assert(log.checkpoint());
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.mountedFromCheckpoint());
+    day(log);
+    check(log, 90);
+  }
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Closed sectors carry a zone footer; queries skip sectors whose time span or
+// pm25/temp bounds cannot match, from footers, from walks of sectors without
+// one, and with a different set of zone keys.
+void testZoneMaps(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.regionBytes = 48UL * 4096UL;
+  const std::string pad(200, 'x');
+  std::vector<uint32_t> dayTs;
+  int total = 0;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int d = 0; d < 5; ++d) {                         // 40 records, ~3 sectors a day
+      unixNow = (unixNow / 86400 + 1) * 86400 + 3600;
+      dayTs.push_back(unixNow - DateTime::SECONDS_FROM_1970_TO_2000);
+      for (int k = 0; k < 40; ++k, ++total) {
+        rtc.adjust(DateTime(unixNow += 60));
+        assert(log.append(String("{\"pm25\":") + String(10 * d + k % 7) + ",\"temp\":" +
+                          String(d % 2 ? "-5.5" : "21.25") + ",\"p\":\"" + pad.c_str() + "\"}"));
+      }
+    }
+  }
+  int footers = 0, counted = 0, open = 0;
+  for (int s = 0; s < 45; ++s) {
+    if (memcmp(emu.data() + s * 4096, "GGOL", 4) != 0) continue;
+    ZoneFooter z;
+    memcpy(&z, emu.data() + s * 4096 + ZONE_DATA_END, sizeof(z));
+    if (z.magic != ZONE_MAGIC) { ++open; continue; }
+    if (!z.count) continue;                               // sealed before its first record
+    assert( z.tsMin <= z.tsMax && z.lastSeq - z.firstSeq == z.count - 1u);
+    assert(z.lo[0] <= z.hi[0] && z.hi[0] < 50 && (z.lo[1] == -5.5f || z.lo[1] == 21.25f));
+    ++footers;
+    counted += z.count;
+  }
+  assert(footers >= 12 && open == 1 && counted < total);
+
+  auto run = [&](FlashLogger& log, const QuerySpec& q) {
+    std::vector<std::string> rows;
+    log.queryLogs(q, collect, &rows);
+    return (int)rows.size();
+  };
+  auto pred = [](const char* key, PredicateOp op, float v) {
+    QuerySpec q;
+    strncpy(q.predicates[0].key, key, sizeof(q.predicates[0].key) - 1);
+    q.predicates[0].op = op;
+    q.predicates[0].value = v;
+    q.predicateCount = 1;
+    return q;
+  };
+  auto check = [&](FlashLogger& log, bool pruned, uint64_t firstMax) {
+    uint64_t f0 = emu.stats().frames;
+    assert(run(log, pred("pm25", PRED_GE, 40)) == 40);
+    const uint64_t first = emu.stats().frames - f0;
+    f0 = emu.stats().frames;
+    assert(run(log, pred("pm25", PRED_GE, 40)) == 40);
+    if (pruned) assert(emu.stats().frames - f0 < 40 && first < firstMax);   // day 4: 3 sectors
+    assert(run(log, pred("pm25", PRED_LT, 10)) == 40);
+    assert(run(log, pred("temp", PRED_LT, 0)) == 80);
+    assert(run(log, pred("pm25", PRED_EQ, 25)) == 5);
+    f0 = emu.stats().frames;
+    assert(run(log, pred("pm25", PRED_GT, 1000)) == 0);
+    if (pruned) assert(emu.stats().frames - f0 < 5);
+    QuerySpec q;
+    q.ts_from = dayTs[2];
+    q.ts_to = dayTs[2] + 3600;
+    assert(run(log, q) == 40);
+    q.ts_from = dayTs[4] + 600;
+    q.ts_to = 0xFFFFFFFF;
+    assert(run(log, q) == 31);
+  };
+  {
+    FlashLogger log;                                      // full scan, zones from footers
+    assert(log.begin(cfg) && !log.mountedFromCheckpoint());
+    check(log, true, 60);
+  }
+  cfg.zoneKeys = "temp,co2";                              // pm25 footers no longer map
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    check(log, false, 0);
+    uint64_t f0 = emu.stats().frames;
+    assert(run(log, pred("temp", PRED_GT, 100)) == 0);
+    assert(emu.stats().frames - f0 < 5);
+  }
+  cfg.zoneKeys = "pm25,temp";
+  for (int s = 0; s < 45; ++s) {                          // sectors from older firmware
+    if (memcmp(emu.data() + s * 4096, "GGOL", 4) == 0) memset(emu.data() + s * 4096 + ZONE_DATA_END, 0xFF, ZONE_FOOTER);
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    check(log, true, 200);                                // first query walks every sector
+  }
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Typed records render back to the JSON a producer would have logged, feed
+// predicates, CSV and key filters, and stay readable after a remount and
+// journal compactions; schemas keep their first definition.
+void testTypedRecords(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const FieldDef fields[] = {
+    {"pm25", FT_U16, 1}, {"temp", FT_I16, 2}, {"co2", FT_U32, 0}, {"ratio", FT_F32, 3}, {"neg", FT_I32, 1},
+  };
+  std::vector<std::string> expect;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    assert(!log.appendTyped(3, nullptr) && !log.schema(3));
+    assert(log.registerSchema(3, fields, 5) && log.registerSchema(3, fields, 5));
+    FieldDef other[5];
+    memcpy(other, fields, sizeof(other));
+    other[1].decimals = 1;
+    assert(!log.registerSchema(3, other, 5));          // an id keeps its layout
+    assert(!log.registerSchema(0, fields, 5) && !log.registerSchema(4, fields, 0));
+    other[1].decimals = 10;
+    assert(!log.registerSchema(4, other, 5));
+    assert(log.memoryUsage().schemaBytes == SCHEMA_SLOTS * sizeof(RecordSchema));
+
+    for (int i = 0; i < 60; ++i) {
+      rtc.adjust(DateTime(unixNow += 60));
+      char line[160];
+      if (i % 3 == 2) {
+        snprintf(line, sizeof(line), "{\"pm25\":%d.5,\"src\":\"json\"}", i);
+        assert(log.append(line));
+        expect.push_back(std::string(line) + "\n");
+        continue;
+      }
+      const float v[] = { i + 0.5f, -5.25f - i, 415.0f + i, i % 2 ? NAN : 0.5f, -1.5f };
+      assert(log.appendTyped(3, v));
+      if (i % 2) {
+        snprintf(line, sizeof(line), "{\"ts\":%u,\"pm25\":%d.5,\"temp\":-%d.25,\"co2\":%d,\"neg\":-1.5}\n",
+                 unixNow, i, 5 + i, 415 + i);
+      } else {
+        snprintf(line, sizeof(line), "{\"ts\":%u,\"pm25\":%d.5,\"temp\":-%d.25,\"co2\":%d,\"ratio\":0.500,\"neg\":-1.5}\n",
+                 unixNow, i, 5 + i, 415 + i);
+      }
+      expect.push_back(line);
+    }
+    rtc.adjust(DateTime(unixNow += 60));
+    const float big[] = { 7000.0f, -400.0f, -3.0f, NAN, NAN };   // clamped to each type
+    assert(log.appendTyped(3, big));
+    char line[96];
+    snprintf(line, sizeof(line), "{\"ts\":%u,\"pm25\":6553.5,\"temp\":-327.68,\"co2\":0}\n", unixNow);
+    expect.push_back(line);
+
+    SyncCursor c{};
+    assert(log.getCursor(c));
+    c.addr = 0;
+    for (uint32_t i = 1; i <= 200; ++i) {              // compactions keep the schema record
+      c.seq_next = i;
+      assert(log.setCursor(c) && log.saveCursorNVS());
+    }
+  }
+
+  FlashLogger log;
+  assert(log.begin(cfg) && log.schema(3) && log.schema(3)->count == 5);
+  std::vector<std::string> rows;
+  QuerySpec all;
+  assert(log.queryLogs(all, collect, &rows) == expect.size());
+  assert(rows == expect);
+
+  std::vector<std::pair<uint32_t, std::string>> raw;   // exports hand out JSON text
+  SyncCursor from{};
+  assert(log.seekSeq(0, from));
+  log.exportSinceWithMeta(from, 0, [](const RecordHeader& rh, const String& p, void* u) {
+    static_cast<std::vector<std::pair<uint32_t, std::string>>*>(u)->push_back({rh.len, p.c_str()});
+    return true;
+  }, &raw);
+  assert(raw.size() == expect.size() && raw[0].second == expect[0]);
+  assert(raw[0].first == 2 + 2 + 2 + 4 + 4 + 4 && raw[1].first == 2 + 2 + 2 + 4 + 4);
+
+  QuerySpec q;
+  strncpy(q.predicates[0].key, "pm25", sizeof(q.predicates[0].key) - 1);
+  q.predicates[0].op = PRED_GT;
+  q.predicates[0].value = 50;
+  q.predicateCount = 1;
+  rows.clear();
+  assert(log.queryLogs(q, collect, &rows) == 11);     // i = 50..59 (JSON and typed) + 7000
+  strncpy(q.predicates[1].key, "temp", sizeof(q.predicates[1].key) - 1);
+  q.predicates[1].op = PRED_LE;
+  q.predicates[1].value = -60;
+  q.predicateCount = 2;
+  rows.clear();
+  assert(log.queryLogs(q, collect, &rows) == 4);      // typed i = 55, 57, 58 + 7000
+
+  QuerySpec k;
+  k.includeKeys[0] = "temp";
+  k.includeKeys[1] = "ts";
+  k.max_records = 1;
+  rows.clear();
+  assert(log.queryLogs(k, collect, &rows) == 1);
+  assert(rows[0] == std::string("{\"temp\":-5.25,\"ts\":") + expect[0].substr(6, 10) + "}\n");
+
+  log.setCsvColumns("pm25,temp,co2,src");
+  QuerySpec csv;
+  csv.out = OUT_CSV;
+  rows.clear();
+  assert(log.queryLogs(csv, collect, &rows) == expect.size());
+  assert(rows[0] == "0.5,-5.25,415,\n" && rows[2] == "2.5,,,json\n");
+
+  const FieldDef one[] = { {"x", FT_U16, 0} };
+  for (uint8_t id = 10; id < 10 + SCHEMA_SLOTS - 1; ++id) assert(log.registerSchema(id, one, 1));
+  assert(!log.registerSchema(99, one, 1));             // all slots taken
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Compressed blocks read back exactly like the same samples stored plain:
+// scans, predicates, paging both ways, seq seeks and seq recovery at mount.
+// A block that fails its CRC drops out on its own.
+void testCompressedBlocks(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  const FieldDef fields[] = { {"pm25", FT_U16, 1}, {"temp", FT_I16, 2}, {"co2", FT_U32, 0}, {"ratio", FT_F32, 3} };
+  unixNow += 86400 - unixNow % 86400 + 86400 - 1800;  // 23:30 tomorrow: the run crosses midnight
+  const uint32_t start = unixNow;
+  struct Seen {
+    std::vector<std::string> all, latest, pages, back, hot, exported;
+    float usedMB;
+    uint32_t nextSeq;
+  };
+  auto run = [&](bool compress, Seen& out) {
+    FlashLoggerConfig cfg = makeConfig(rtc);
+    cfg.compressTyped = compress;
+    cfg.durability = compress ? FLASH_DURABLE_DEFERRED : FLASH_DURABLE_SYNC;   // SYNC seals every sample
+    rtc.adjust(DateTime(unixNow = start));
+    {
+      FlashLogger log;
+      assert(log.begin(cfg) && log.registerSchema(7, fields, 4));
+      for (int i = 0; i < 900; ++i) {
+        rtc.adjust(DateTime(unixNow += (i % 50 == 49) ? 17 : 5));
+        if (i % 150 == 100) {
+          assert(log.append(String("{\"i\":") + String(i) + "}"));
+          continue;
+        }
+        const float v[] = { 12.0f + (i / 7) % 9 * 0.1f, 24.5f + sinf(i / 40.0f), 420.0f + i / 30,
+                            i % 60 < 3 ? NAN : 0.25f };
+        assert(log.appendTyped(7, v));
+      }
+      assert((log.pendingRecords() > 0) == compress);
+      assert(log.flush() && log.pendingRecords() == 0);
+    }
+
+    FlashLogger log;
+    assert(log.begin(cfg) && log.schema(7));
+    QuerySpec all;
+    assert(log.queryLogs(all, collect, &out.all) == 900);
+    assert(log.queryLatest(5, collect, &out.latest) == 5);
+    QuerySpec page;
+    page.max_records = 37;
+    String token, next;
+    do {
+      log.queryLogs(page, collect, &out.pages, &token, &next);
+      token = next;
+    } while (token.length());
+    do {
+      log.queryLatest(37, collect, &out.back, &token, &next);
+      token = next;
+    } while (token.length());
+    std::reverse(out.back.begin(), out.back.end());
+
+    QuerySpec hot;
+    strncpy(hot.predicates[0].key, "pm25", sizeof(hot.predicates[0].key) - 1);
+    hot.predicates[0].op = PRED_GE;
+    hot.predicates[0].value = 12.7f;
+    hot.predicateCount = 1;
+    log.queryLogs(hot, collect, &out.hot);
+
+    for (uint32_t seq : { 0u, 1u, 299u, 450u, 898u }) {
+      SyncCursor c{};
+      assert(log.seekSeq(seq, c));
+      log.exportSinceWithMeta(c, 2, [](const RecordHeader& rh, const String& p, void* u) {
+        static_cast<std::vector<std::string>*>(u)->push_back(std::to_string(rh.seq) + " " + p.c_str());
+        return true;
+      }, &out.exported);
+    }
+    SyncCursor c{};
+    assert(log.getCursor(c));
+    out.nextSeq = c.seq_next;
+    out.usedMB = log.getUsedSpaceMB();
+  };
+
+  Seen plain, packed;
+  run(false, plain);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+  run(true, packed);
+  assert(packed.all == plain.all && packed.latest == plain.latest);
+  assert(packed.pages == plain.all && packed.back == plain.all);
+  assert(!plain.hot.empty() && packed.hot == plain.hot);
+  assert(packed.exported == plain.exported && packed.exported.size() == 10);
+  assert(packed.nextSeq == 900 && plain.nextSeq == 900);
+  assert(packed.usedMB * 3 < plain.usedMB);
+
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  SyncCursor c{};
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.seekSeq(420, c));
+  }
+  emu.data()[c.addr + sizeof(RecordHeader) + 8] ^= 0x10;
+  cfg.compressTyped = true;
+  FlashLogger log;
+  assert(log.begin(cfg));
+  std::vector<std::string> rows;
+  QuerySpec all;
+  const uint32_t n = log.queryLogs(all, collect, &rows);
+  assert(n < 900 && n > 850);                          // one block's samples
+  assert(rows.front() == plain.all.front() && rows.back() == plain.all.back());
+
+  // a SYNC sample seals the open block; other modes leave it open
+  const float v[] = { 12.0f, 24.5f, 420.0f, 0.25f };
+  rtc.adjust(DateTime(unixNow += 5));
+  assert(log.appendTyped(7, v, FLASH_DURABLE_DEFERRED) && log.pendingRecords() == 1);
+  rtc.adjust(DateTime(unixNow += 5));
+  assert(log.appendTyped(7, v, FLASH_DURABLE_SYNC) && log.pendingRecords() == 0);
+  rows.clear();
+  assert(log.queryLatest(2, collect, &rows) == 2);
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Filter expressions compile to one program that runs over a single field
+// scan of JSON and typed records alike, combines with the fixed predicates,
+// prunes sectors through the zone maps and drives the `q ... where=` shell.
+void testPredicateProgram(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  PredicateProgram p;
+  const char* bad[] = { "", "pm25>", "pm25 > 3 &&", "(pm25>3", "site<\"a\"", "pm25 ~ 3",
+                        "a_very_long_key>1", "a>1||b>1||c>1||d>1||e>1||f>1||g>1||h>1||i>1",
+                        "!!!!!!!!!(pm25>1)", "pm25>1 temp" };
+  for (const char* e : bad) assert(!p.compile(e) && p.error());
+  assert(p.compile(" pm25>35&&(temp>30 || humidity>=80.5) ") && !p.error() && p.keys() == 3);
+  assert(p.compile("exists(rain) || site == \"b\"") && p.keys() == 2);
+
+  struct Rec { bool typed; int pm25, temp, hum; char site; bool rain; };
+  std::vector<Rec> recs;
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const FieldDef fields[] = { {"pm25", FT_U16, 1}, {"temp", FT_I16, 2}, {"humidity", FT_U16, 1} };
+  uint32_t firstDay = 0, lastDay = 0;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.registerSchema(2, fields, 3));
+    for (int d = 0; d < 5; ++d) {
+      unixNow = (unixNow / 86400 + 1) * 86400 + 3600;
+      if (!d) firstDay = unixNow;
+      lastDay = unixNow;
+      for (int k = 0; k < 60; ++k) {
+        rtc.adjust(DateTime(unixNow += 60));
+        Rec r{ k % 3 == 0, 10 * d + k % 7, 20 + k % 15, 50 + (k * 7) % 45, k % 2 ? 'a' : 'b', k % 5 == 0 };
+        if (r.typed) {
+          const float v[] = { (float)r.pm25, (float)r.temp, (float)r.hum };
+          assert(log.appendTyped(2, v));
+        } else {
+          char line[128];
+          snprintf(line, sizeof(line), "{\"pm25\":%d,\"temp\":%d.0,\"humidity\":%d,\"site\":\"%c\"%s}",
+                   r.pm25, r.temp, r.hum, r.site, r.rain ? ",\"rain\":{\"mm\":1.5}" : "");
+          assert(log.append(line));
+        }
+        recs.push_back(r);
+      }
+    }
+  }
+
+  FlashLogger log;
+  assert(log.begin(cfg));
+  auto rows = [&](const QuerySpec& q) {
+    std::vector<std::string> out;
+    log.queryLogs(q, collect, &out);
+    return (int)out.size();
+  };
+  auto expect = [&](bool (*f)(const Rec&)) { return (int)std::count_if(recs.begin(), recs.end(), f); };
+  struct Case { const char* expr; bool (*f)(const Rec&); bool pruned; };
+  const Case cases[] = {
+    { "pm25>35 && (temp>30 || humidity>80)",
+      [](const Rec& r) { return r.pm25 > 35 && (r.temp > 30 || r.hum > 80); }, false },
+    { "site=\"b\" && !exists(rain)", [](const Rec& r) { return !r.typed && r.site == 'b' && !r.rain; }, false },
+    { "exists(rain) || pm25 <= 3", [](const Rec& r) { return (!r.typed && r.rain) || r.pm25 <= 3; }, false },
+    { "!(pm25 < 20) && temp != 25", [](const Rec& r) { return r.pm25 >= 20 && r.temp != 25; }, false },
+    { "site != \"a\"", [](const Rec& r) { return !r.typed && r.site != 'a'; }, false },
+    { "site > 1 || rain = 1", [](const Rec&) { return false; }, false },   // not numbers
+    { "pm25 > 1000 || temp > 1000", [](const Rec&) { return false; }, true },
+  };
+  for (const Case& c : cases) {
+    QuerySpec q;
+    assert(p.compile(c.expr));
+    q.where = &p;
+    const uint64_t f0 = emu.stats().frames;
+    assert(rows(q) == expect(c.f));
+    if (c.pruned) assert(emu.stats().frames - f0 < 10);   // every sector ruled out by its zone map
+  }
+
+  QuerySpec legacy;                                        // same rows as the fixed predicate
+  strncpy(legacy.predicates[0].key, "pm25", sizeof(legacy.predicates[0].key) - 1);
+  legacy.predicates[0].op = PRED_GT;
+  legacy.predicates[0].value = 35;
+  legacy.predicateCount = 1;
+  std::vector<std::string> a, b;
+  log.queryLogs(legacy, collect, &a);
+  QuerySpec expr;
+  assert(p.compile("pm25 > 35"));
+  expr.where = &p;
+  log.queryLogs(expr, collect, &b);
+  assert(!a.empty() && a == b);
+  assert(p.compile("temp > 30 || humidity > 80"));         // ANDed with the fixed predicate
+  legacy.where = &p;
+  assert(rows(legacy) == expect(cases[0].f));
+
+  SyncCursor from{};                                       // filtered export
+  assert(log.seekSeq(0, from));
+  uint32_t exported = 0;
+  log.exportSinceWithMeta(from, 0, [](const RecordHeader&, const String&, void* u) {
+    ++*static_cast<uint32_t*>(u);
+    return true;
+  }, &exported, &legacy);
+  assert((int)exported == expect(cases[0].f));
+
+  assert(!p.compile("pm25 >"));                            // a failed program matches nothing
+  assert(rows(expr) == 0);
+
+  auto date = [](uint32_t unix) {
+    DateTime t(unix);
+    char s[16];
+    snprintf(s, sizeof(s), "%04u-%02u-%02u", t.year(), t.month(), t.day());
+    return String(s);
+  };
+  StringStream io;
+  log.handleQueryCommand(String("q range ") + date(firstDay) + ".." + date(lastDay) +
+                         " pm25 where=pm25>35 && (temp>30 || humidity>80)", io);
+  char tail[32];
+  snprintf(tail, sizeof(tail), "(%d rows)\n", expect(cases[0].f));
+  assert(io.str().endsWith(tail) && io.str().indexOf("\"temp\"") < 0);
+  io.clear();
+  log.handleQueryCommand(String("q day ") + date(lastDay) + " where=pm25>", io);
+  assert(io.str().startsWith("bad where: "));
+  assert(emu.stats().busyViolations == 0 && emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// CSV columns and includeKeys are split once per query and filled from one
+// pass over each payload: strings lose their quotes in CSV, missing values
+// stay empty, and nested values and escaped quotes are stepped over whole.
+void testRowPlans(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  FlashLogger log;
+  assert(log.begin(cfg));
+  rtc.adjust(DateTime(unixNow += 60));
+  const std::string ts = std::to_string(unixNow - DateTime::SECONDS_FROM_1970_TO_2000);
+  const char* meta = "{\"pm25\":99,\"l\":[1,{\"x\":\"}\"}]}";
+  const std::string rec = std::string("{\"ts\":1,\"site\":\"a,\\\"b\\\"\",\"meta\":") + meta +
+                          ",\"pm25\": 12.5 ,\"temp\":-3,\"pm25\":7}";
+  assert(log.append(rec.c_str()));
+
+  std::vector<std::string> rows;
+  QuerySpec csv;
+  csv.out = OUT_CSV;
+  log.setCsvColumns(" TS, pm25 ,temp,missing,,site,meta");
+  assert(log.queryLogs(csv, collect, &rows) == 1);
+  assert(rows[0] == ts + ",12.5,-3,,,a,\\\"b\\\"," + meta + "\n");
+
+  QuerySpec keys;
+  keys.includeKeys[0] = "pm25";
+  keys.includeKeys[1] = "nope";
+  keys.includeKeys[2] = "meta";
+  keys.includeKeys[3] = "site";
+  rows.clear();
+  assert(log.queryLogs(keys, collect, &rows) == 1);
+  assert(rows[0] == std::string("{\"pm25\":12.5,\"meta\":") + meta + ",\"site\":\"a,\\\"b\\\"\"}\n");
+
+  log.setCsvColumns("ts,a,b,c,d,e,f,g,h,i,j,k,l,m,n,temp,pm25");   // 16 columns kept
+  log.setOutputFormat(OUT_CSV);
+  rows.clear();
+  assert(log.queryLatest(1, collect, &rows) == 1);
+  assert(rows[0] == ts + ",,,,,,,,,,,,,,,-3\n");
+  String line;
+  assert(log.formatPayload(7, String(rec.c_str()), OUT_CSV, line) && line == "7,,,,,,,,,,,,,,,-3\n");
+  log.setOutputFormat(OUT_JSONL);
+  rows.clear();
+  assert(log.queryLogs(QuerySpec(), collect, &rows) == 1 && rows[0] == rec + "\n");
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Span rows: queries and exports hand (data, len, meta) to a sink from one
+// scratch buffer, so a 300-row export costs the same allocations as a
+// 10-row one. A sink can stop early; the String callbacks still match.
+void testSpanRows(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  FlashLogger log;
+  assert(log.begin(cfg));
+  const FieldDef fields[] = { {"pm25", FT_U16, 1}, {"temp", FT_I16, 2} };
+  assert(log.registerSchema(5, fields, 2));
+  for (int i = 0; i < 300; ++i) {
+    rtc.adjust(DateTime(unixNow += 60));
+    if (i % 2) {
+      const float v[] = { i + 0.5f, -2.25f };
+      assert(log.appendTyped(5, v));
+    } else {
+      assert(log.append(String("{\"i\":") + String(i) + ",\"site\":\"north\"}"));
+    }
+  }
+
+  struct Seen { uint32_t rows, bytes, stopAt, lastSeq; std::string first; };
+  auto sink = [](const char* data, size_t len, const RecordMeta& meta, void* u) {
+    Seen* s = static_cast<Seen*>(u);
+    assert(data[len - 1] == '\n' && meta.sector >= 0 && meta.dayID);
+    assert(s->rows == 0 || meta.header.seq != s->lastSeq);
+    if (s->rows == 0) s->first.assign(data, len);
+    s->lastSeq = meta.header.seq;
+    s->bytes += len;
+    return ++s->rows != s->stopAt;
+  };
+  char mem[512];
+  RowBuffer scratch(mem, sizeof(mem));
+  auto exportAllocs = [&](uint32_t rows, OutFmt fmt) {
+    Seen seen{};
+    const uint32_t before = gMallocs;
+    assert(log.exportRows(SyncCursor{}, rows, fmt, sink, &seen, nullptr, nullptr, &scratch) == rows);
+    assert(seen.rows == rows);
+    return gMallocs - before;
+  };
+  exportAllocs(300, OUT_JSONL);                         // warm the read caches
+  assert(exportAllocs(300, OUT_JSONL) == exportAllocs(10, OUT_JSONL));
+  assert(exportAllocs(300, OUT_CSV) == exportAllocs(10, OUT_CSV));
+  assert(scratch.grows() == 0);
+
+  QuerySpec q;
+
+  Seen seen{};
+  uint32_t before = gMallocs;
+  assert(log.queryLogs(q, sink, &seen, nullptr, nullptr, &scratch) == 300);
+  const uint32_t all = gMallocs - before;
+  q.max_records = 10;
+  seen = Seen{};
+  before = gMallocs;
+  assert(log.queryLogs(q, sink, &seen, nullptr, nullptr, &scratch) == 10);
+  assert(gMallocs - before <= all && all <= 1);             // at most the one spill buffer
+
+  // stopping early: no page token, nothing past the refused row
+  String token = "x";
+  seen = Seen{};
+  seen.stopAt = 7;
+  assert(log.exportRows(SyncCursor{}, 0, OUT_JSONL, sink, &seen, nullptr, &token) == 6 && seen.rows == 7);
+  seen = Seen{};
+  seen.stopAt = 3;
+  assert(log.queryLatest(50, sink, &seen, nullptr, &token) == 2 && seen.rows == 3 && token == "");
+
+  // the String callbacks are adapters over the same rows
+  std::vector<std::string> rows;
+  assert(log.exportSince(SyncCursor{}, 2, collect, &rows) == 2);
+  seen = Seen{};
+  RowBuffer tiny(mem, 8);                               // too small: spills to the heap
+  assert(log.exportRows(SyncCursor{}, 2, OUT_JSONL, sink, &seen, nullptr, nullptr, &tiny) == 2);
+  assert(tiny.grows() > 0 && seen.first == rows[0] && rows[0] == "{\"i\":0,\"site\":\"north\"}\n");
+  assert(rows[1].find("\"pm25\":1.5,\"temp\":-2.25}") != std::string::npos);
+  uint32_t typedLen = 0;
+  log.exportSinceWithMeta(SyncCursor{}, 2, [](const RecordHeader& rh, const String& json, void* u) {
+    if (rh.flags & REC_FLAG_TYPED) *static_cast<uint32_t*>(u) = rh.len;
+    else assert(json == "{\"i\":0,\"site\":\"north\"}\n");   // the stored line
+    return true;
+  }, &typedLen);
+  assert(typedLen == 2 + 2 + 2);                        // mask + two 16-bit fields
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Aggregates stream one row per bucket from a single pass: JSON and typed
+// records mix, a bucket without the field reports null, where= filters
+// first, and percentiles come from a five-marker estimate.
+void testAggregation(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  FlashLogger log;
+  assert(log.begin(cfg));
+  const FieldDef fields[] = { {"pm25", FT_U16, 0} };
+  assert(log.registerSchema(6, fields, 1));
+  unixNow += 3600 - unixNow % 3600;                     // hour 0 starts on a bucket edge
+  const uint32_t hour0 = unixNow;
+  for (int i = 0; i < 180; ++i) {
+    rtc.adjust(DateTime(unixNow = hour0 + i * 60));
+    const int pm = (i * 37) % 60;                       // 0..59 once per hour, shuffled
+    if (i / 60 == 1) {
+      const float v[] = { (float)pm };
+      assert(log.appendTyped(6, v));
+    } else {
+      assert(log.append(String("{\"pm25\":") + String(pm) + ",\"temp\":" + String(i % 7) + "}"));
+    }
+  }
+
+  QuerySpec q;
+  assert(q.addAgg("pm25", "count,min,max,avg") && q.addAgg("temp", "max"));
+  assert(!q.addAgg("pm25", "avg,p100") && !q.addAgg("pm25", "median") && q.aggCount == 5);
+  q.group_by_seconds = 3600;
+  std::vector<std::string> rows;
+  assert(log.queryAgg(q, collect, &rows) == 3);
+  const std::string h0 = std::to_string(hour0);
+  assert(rows[0] == "{\"ts\":" + h0 + ",\"pm25_count\":60,\"pm25_min\":0,\"pm25_max\":59,"
+                    "\"pm25_avg\":29.5,\"temp_max\":6}\n");
+  assert(rows[1].find("\"pm25_avg\":29.5,\"temp_max\":null}") != std::string::npos);
+
+  QuerySpec pct;
+  PredicateProgram where;
+  assert(where.compile("pm25 >= 30"));
+  pct.where = &where;
+  assert(pct.addAgg("pm25", "count,p50,p90"));
+  pct.out = OUT_CSV;
+  rows.clear();
+  assert(log.queryAgg(pct, collect, &rows) == 1);       // one bucket for everything
+  // CSV ts is device time; a single bucket starts at its first record (minute 1)
+  const std::string devTs = std::to_string(hour0 + 60 - DateTime::SECONDS_FROM_1970_TO_2000);
+  assert(rows[0].compare(0, devTs.size() + 4, devTs + ",90,") == 0);
+  float p50, p90;
+  assert(sscanf(rows[0].c_str() + devTs.size() + 4, "%f,%f", &p50, &p90) == 2);
+  assert(fabsf(p50 - 44.5f) < 2 && fabsf(p90 - 56.1f) < 2);
+
+  q.max_records = 2;                                    // buckets
+  rows.clear();
+  assert(log.queryAgg(q, collect, &rows) == 2);
+  QuerySpec none;
+  assert(log.queryAgg(none, collect, &rows) == 0);      // nothing to aggregate
+
+  uint32_t secs = 0;
+  assert(FlashLogger::parseSeconds("15m", secs) && secs == 900);
+  assert(FlashLogger::parseSeconds("7d", secs) && secs == 604800);
+  assert(!FlashLogger::parseSeconds("1hh", secs) && !FlashLogger::parseSeconds("h", secs));
+
+  StringStream io;
+  log.handleQueryCommand("q agg pm25 avg,p90 temp count 1h where=pm25<10", io);
+  assert(io.str().endsWith("(3 buckets)\n") && io.str().indexOf("\"temp_count\":0}") > 0);
+  io.clear();
+  log.handleQueryCommand("q agg pm25 mean 1h", io);
+  assert(io.str().startsWith("bad aggregate: "));
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Rollup rings store a bucket when the next one starts and keep the open one
+// in RAM: the minute ring wraps, the hour rows match the raw aggregate, and
+// checkpoint() carries the open buckets across a remount.
+void testRollups(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.rollupSectors[ROLLUP_MINUTE] = 2;
+  cfg.rollupSectors[ROLLUP_HOUR]   = 2;
+  cfg.rollupSectors[ROLLUP_DAY]    = 1;
+  unixNow += 7200 - unixNow % 7200;                     // on a 2 h bucket edge
+  const uint32_t hour0 = unixNow;
+  std::vector<std::string> hours;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    assert(log.rollupEnabled(ROLLUP_HOUR) && log.rollupKeyCount() == 2 && !strcmp(log.rollupKey(1), "temp"));
+    for (int i = 0; i < 200; ++i) {
+      rtc.adjust(DateTime(unixNow = hour0 + i * 60));
+      if (i % 10 == 9) {
+        assert(log.append("{\"note\":\"no values\"}"));
+      } else {
+        assert(log.append(String("{\"pm25\":") + String(i % 50) + ",\"temp\":" + String(i % 7) + "}"));
+      }
+    }
+
+    QuerySpec q;
+    std::vector<std::string> minutes;
+    const uint32_t nMin = log.queryRollups(ROLLUP_MINUTE, q, collect, &minutes);
+    assert(nMin > 60 && nMin < 200);                      // two sectors, the oldest overwritten
+    assert(minutes.back() == "{\"ts\":" + std::to_string(hour0 + 199 * 60) + ",\"pm25_count\":0,"
+                             "\"pm25_min\":null,\"pm25_max\":null,\"pm25_avg\":null,\"temp_count\":0,"
+                             "\"temp_min\":null,\"temp_max\":null,\"temp_avg\":null}\n");
+    assert(log.queryRollups(ROLLUP_HOUR, q, collect, &hours) == 4);   // three stored + open
+    assert(hours[0] == "{\"ts\":" + std::to_string(hour0) + ",\"pm25_count\":54,\"pm25_min\":0,\"pm25_max\":48,"
+                      "\"pm25_avg\":20.667,\"temp_count\":54,\"temp_min\":0,\"temp_max\":6,\"temp_avg\":2.944}\n");
+
+    QuerySpec agg;
+    assert(agg.addAgg("pm25", "count,min,max,avg") && agg.addAgg("temp", "max"));
+    agg.group_by_seconds = 7200;
+    std::vector<std::string> raw, rolled;
+    assert(log.queryAgg(agg, collect, &raw) == 2);
+    agg.use_rollups = true;
+    auto fromRollups = [](const char* data, size_t len, const RecordMeta& meta, void* u) {
+      assert(meta.sector < 0 || meta.sector >= 4096 - 16 - 5);   // a ring sector or the open bucket
+      static_cast<std::vector<std::string>*>(u)->emplace_back(data, len);
+      return true;
+    };
+    assert(log.queryAgg(agg, fromRollups, &rolled) == 2 && rolled == raw);
+    agg.ts_from = hour0 - DateTime::SECONDS_FROM_1970_TO_2000 + 60;   // off the tier edges: raw records
+    rolled.clear();
+    assert(log.queryAgg(agg, collect, &rolled) == 2 && rolled != raw);
+    assert(log.checkpoint());
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.mountedFromCheckpoint());
+    QuerySpec q;
+    std::vector<std::string> again;
+    assert(log.queryRollups(ROLLUP_HOUR, q, collect, &again) == 4 && again == hours);
+    rtc.adjust(DateTime(unixNow = hour0 + 5 * 3600));
+    assert(log.append("{\"pm25\":1}"));                // stores the saved open hour
+    again.clear();
+    assert(log.queryRollups(ROLLUP_HOUR, q, collect, &again) == 5 && again[3] == hours[3]);
+
+    StringStream io;
+    log.handleQueryCommand("q rollup 1d", io);
+    assert(io.str().endsWith("(1 buckets)\n"));
+    io.clear();
+    log.handleQueryCommand("q agg pm25 max 1h rollups", io);
+    assert(io.str().endsWith("(5 buckets)\n"));
+    io.clear();
+    log.handleQueryCommand("q rollup 5m", io);
+    assert(io.str().startsWith("q rollup <1m|1h|1d>"));
+  }
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// With poll() running between appends, a ring rolls over into a sector it
+// erased ahead: append() itself never erases, and the ring keeps wrapping.
+void testRollupEraseAhead(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.rollupSectors[ROLLUP_MINUTE] = 2;
+  cfg.rollupSectors[ROLLUP_HOUR]   = 2;
+  FlashLogger log;
+  assert(log.begin(cfg));
+  uint64_t worstUs = 0;
+  for (int i = 0; i < 400; ++i) {                       // the minute ring wraps ~4 times
+    while (log.poll()) hostsim::advanceUs(100);
+    rtc.adjust(DateTime(unixNow += 60));
+    const uint32_t erases = emu.stats().sectorErases;
+    const uint64_t t0 = hostsim::clockUs();
+    assert(log.append(String("{\"pm25\":") + String(i % 50) + "}"));
+    worstUs = std::max<uint64_t>(worstUs, hostsim::clockUs() - t0);
+    assert(emu.stats().sectorErases == erases);
+  }
+  assert(worstUs < emu.timing().tSE_us / 4);
+  QuerySpec q;
+  std::vector<std::string> minutes;
+  const uint32_t n = log.queryRollups(ROLLUP_MINUTE, q, collect, &minutes);
+  assert(n > 60 && n < 400);
+  assert(minutes.back().find("\"ts\":" + std::to_string(unixNow - unixNow % 60) + ",") != std::string::npos);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// After rollupKeys changes, new buckets go to a fresh ring sector and can
+// be read back; the ones stored under the old keys are skipped.
+void testRollupKeysChange(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.rollupSectors[ROLLUP_HOUR] = 2;
+  unixNow += 3600 - unixNow % 3600;
+  auto run = [&](int hours) {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int i = 0; i < hours; ++i) {
+      rtc.adjust(DateTime(unixNow += 3600));
+      assert(log.append(String("{\"pm25\":") + String(i) + ",\"temp\":" + String(i + 20) + "}"));
+    }
+  };
+  cfg.rollupKeys = "pm25";
+  run(5);
+  cfg.rollupKeys = "temp,pm25";
+  run(4);
+  FlashLogger log;
+  assert(log.begin(cfg));
+  QuerySpec q;
+  std::vector<std::string> hours;
+  assert(log.queryRollups(ROLLUP_HOUR, q, collect, &hours) == 3);   // stored since the change
+  assert(hours[0].find("\"temp_max\":20,") != std::string::npos);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Turning rollups on claims the top of the log area. Raw sectors there are
+// moved into the log first: their records stay queryable, and the rings
+// start on erased sectors.
+void testRollupClaim(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  const int ring = (int)(emu.capacity() / 4096) - 3 - 2;    // hour ring, just below the journal
+  uint8_t* mem = emu.data();
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int i = 0; i < 2; ++i) {
+      rtc.adjust(DateTime(unixNow += 86400));
+      assert(log.append(String("{\"i\":") + String(i) + ",\"pm25\":1}"));
+    }
+  }
+  const std::string want = "\"i\":1,";
+  int last = 0;                                         // the sector holding record 1
+  while (std::search(mem + last * 4096, mem + (last + 1) * 4096, want.begin(), want.end()) == mem + (last + 1) * 4096)
+    ++last;
+  assert(last < ring);
+  memcpy(mem + (ring + 1) * 4096, mem + last * 4096, 4096);   // where a raw log once wrapped
+  memset(mem + last * 4096, 0xFF, 4096);
+
+  cfg.rollupSectors[ROLLUP_HOUR] = 2;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    assert(recordIds(log) == std::vector<int>({1, 0}));
+    assert(memcmp(mem + (ring + 1) * 4096, "GGOL", 4) != 0);
+    for (int i = 2; i < 6; ++i) {
+      rtc.adjust(DateTime(unixNow += 3600));
+      assert(log.append(String("{\"i\":") + String(i) + ",\"pm25\":1}"));
+    }
+  }
+  FlashLogger log;
+  assert(log.begin(cfg));
+  assert(recordIds(log) == std::vector<int>({5, 4, 3, 2, 1, 0}));
+  QuerySpec q;
+  std::vector<std::string> hours;
+  assert(log.queryRollups(ROLLUP_HOUR, q, collect, &hours) == 3);
+  assert(emu.stats().andViolations == 0);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Headers written before v2.1 hold pushed = 0 and reserved = 0, which NOR
+// can't reprogram. Their push marks live in the index, and gc() erases a
+// pushed one past retention without touching its header.
+void testLegacyHeaders(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  unixNow += 86400 - unixNow % 86400;                   // midnight
+  const uint32_t day0 = unixNow;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int i = 0; i < 10; ++i) {
+      rtc.adjust(DateTime(unixNow = day0 + i * 86400 + 3600));
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+  }
+  uint8_t* mem = emu.data();
+  for (uint32_t s = 0; s < emu.capacity() / 4096 - 3; ++s)
+    if (memcmp(mem + s * 4096, "GGOL", 4) == 0) mem[s * 4096 + 6] = mem[s * 4096 + 7] = 0x00;
+
+  FlashLogger log;
+  assert(log.begin(cfg));
+  const uint32_t violations = emu.stats().andViolations;
+  const uint16_t first = (uint16_t)((day0 - DateTime::SECONDS_FROM_1970_TO_2000) / 86400UL);
+  log.markDayPushed(first);
+  log.markDayPushed(first + 1);                         // day 2 stays unpushed
+  log.gc();                                             // days 0..2 are 7+ days old
+  assert(recordIds(log) == std::vector<int>({9, 8, 7, 6, 5, 4, 3, 2}));
+  assert(emu.stats().andViolations == violations);
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Tags ride in the record flags and each sector's footer ORs them: the last
+// alerts come back newest first without reading the sectors that have none,
+// queries and exports filter on them, and the footers keep them across a
+// remount.
+void testRecordTags(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  int alerts = 0;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int i = 0; i < 3000; ++i) {
+      rtc.adjust(DateTime(unixNow += 30));
+      const String body = String("{\"pm25\":") + String(i % 40) + ",\"temp\":21.5,\"i\":" + String(i) + "}";
+      if (i % 500 == 250) {
+        assert(log.append(String("{\"alert\":\"pm25_high\",\"i\":") + String(i) + "}", REC_TAG_ALERT));
+        ++alerts;
+      } else if (i % 700 == 0) {
+        assert(log.append("{\"event\":\"battery_low\",\"pct\":14.5}", REC_TAG_EVENT, FLASH_DURABLE_SYNC));
+      } else {
+        assert(i % 2 ? log.append(body) : log.append(body, REC_TAG_MEASUREMENT));
+      }
+    }
+    assert(alerts == 6);
+  }
+
+  FlashLogger log;
+  assert(log.begin(cfg));
+  struct Seen { std::vector<uint32_t> seqs; std::vector<std::string> rows; };
+  auto sink = [](const char* data, size_t len, const RecordMeta& meta, void* u) {
+    Seen* s = static_cast<Seen*>(u);
+    assert(meta.header.flags & REC_TAG_ALERT);
+    s->seqs.push_back(meta.header.seq);
+    s->rows.emplace_back(data, len);
+    return true;
+  };
+  Seen seen;
+  emu.resetStats();
+  assert(log.queryTagged(REC_TAG_ALERT, 20, sink, &seen) == 6);
+  const uint64_t taggedRead = emu.stats().bytesRead;
+  for (int k = 1; k < 6; ++k) assert(seen.seqs[k] < seen.seqs[k - 1]);   // newest first
+  assert(seen.rows[0].find("\"i\":2750") != std::string::npos && seen.rows[5].find("\"i\":250") != std::string::npos);
+
+  std::vector<std::string> rows;
+  emu.resetStats();
+  QuerySpec all;
+  assert(log.queryLogs(all, collect, &rows) == 3000);
+  assert(taggedRead * 5 < emu.stats().bytesRead);       // six sectors and the footers
+
+  QuerySpec events;
+  events.tags = REC_TAG_EVENT | REC_TAG_ALERT;
+  rows.clear();
+  assert(log.queryLogs(events, collect, &rows) == 11);   // oldest first
+  assert(rows[0].find("battery_low") != std::string::npos);
+  events.tags = REC_TAG_EVENT;
+  SyncCursor from{};
+  assert(log.seekSeq(0, from));
+  uint32_t n = 0;
+  log.exportSinceWithMeta(from, 100, [](const RecordHeader& rh, const String&, void* u) {
+    assert(rh.flags & REC_TAG_EVENT);
+    ++*static_cast<uint32_t*>(u);
+    return true;
+  }, &n, &events);
+  assert(n == 5);
+  QuerySpec measured;
+  measured.tags = REC_TAG_MEASUREMENT;
+  assert(log.queryLogs(measured, collect, &rows) == 1489);      // even i, less the alerts and events
+
+  uint8_t tags = 0;
+  assert(FlashLogger::parseTags("alert,event", tags) && tags == (REC_TAG_ALERT | REC_TAG_EVENT));
+  assert(!FlashLogger::parseTags("alert,,event", tags) && !FlashLogger::parseTags("", tags));
+  StringStream io;
+  log.handleQueryCommand("q tag alert,event 3", io);
+  assert(io.str().endsWith("(3 rows)\n") && io.str().indexOf("\"i\":2750") > 0);
+  io.clear();
+  log.handleQueryCommand("q tag warning", io);
+  assert(io.str().startsWith("tags: "));
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// gc() erases pushed sectors cfg.retentionDays days old or more; a pushed
+// day inside the window and an unpushed one stay.
+void testGcRetention(NorFlashEmulator& emu, RTC_DS3231& rtc, uint32_t& unixNow) {
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.retentionDays = 2;
+  FlashLogger log;
+  assert(log.begin(cfg));
+  unixNow += 86400 - unixNow % 86400;                   // midnight
+  const uint32_t day0 = unixNow;
+  for (int i = 0; i < 6; ++i) {
+    rtc.adjust(DateTime(unixNow = day0 + i * 86400 + 3600));
+    assert(log.append(String("{\"i\":") + String(i) + "}"));
+  }
+  const uint16_t today = (uint16_t)((unixNow - DateTime::SECONDS_FROM_1970_TO_2000) / 86400UL);
+  log.markDaysPushedUntil(today - 1);
+  log.gc();                                             // days 0..3 are 2+ days old
+  assert(recordIds(log) == std::vector<int>({5, 4}));
+  emu.eraseAll();
+  hostsim::nvs().ns.clear();
+}
+
+// Day runs split and merge as sectors come and go; an 8 MB chip gets 2048
+// sectors with the meta sectors at its end, and the whole logger stays small.
+void testCompactIndex(RTC_DS3231& rtc, uint32_t& unixNow) {
+  SectorIndexMap m;
+  assert(m.allocate(64));
+  for (int s = 10; s < 20; ++s) m.set(s, 500, false);
+  assert(m.runCount() == 1 && m.day(15) == 500);
+  m.clear(15);                                          // split
+  assert(m.runCount() == 2 && !m.present(15) && m.day(16) == 500);
+  m.set(15, 500, true);                                 // joined again
+  assert(m.runCount() == 1 && m.pushed(15) && !m.pushed(14));
+  m.set(12, 501, false);                                // three runs
+  assert(m.runCount() == 3 && m.day(12) == 501 && m.day(11) == 500 && m.day(13) == 500);
+  m.setWritePtr(12, 12 * 4096 + 700);
+  assert(m.writePtr(12) == 12 * 4096 + 700 && m.writePtr(13) == 13 * 4096 + sizeof(SectorHeader));
+  m.clearAll();
+  assert(m.runCount() == 0 && !m.present(12));
+
+  NorFlashEmulator small(8UL * 1024UL * 1024UL, kCs);
+  small.attach(SPI);
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  cfg.totalSizeBytes = 8UL * 1024UL * 1024UL;
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.sectorCount() == 2048);
+    for (int i = 0; i < 200; ++i) {
+      rtc.adjust(DateTime(unixNow += 600));             // a few day changes
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+    log.buildSummaries();
+    const FlashMemStats mem = log.memoryUsage();
+    assert(mem.sectors == 2048 && mem.dayRuns >= 2 && mem.summaryBytes > 0);
+    assert(mem.totalBytes < 16 * 1024);                 // was 62 KB for the object alone
+    log.releaseCaches();
+    assert(log.memoryUsage().summaryBytes == 0);
+    assert(log.checkpoint());
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && log.mountedFromCheckpoint());
+    assert(recordIds(log).size() == 200);
+  }
+  assert(small.stats().busyViolations == 0 && small.stats().andViolations == 0);
+  hostsim::nvs().ns.clear();
+}
+
+// A 32 MB part is sized from SFDP and driven with 4-byte addresses (the
+// 0x13/0x12/0x21 opcodes or EN4B). A region keeps the log, its journal and
+// its factory sector inside [regionOffset, regionOffset + regionBytes).
+void testGeometry(RTC_DS3231& rtc, uint32_t& unixNow) {
+  const uint32_t chip = 32UL * 1024UL * 1024UL;
+  NorFlashEmulator big(chip, kCs);
+  big.attach(SPI);
+  FlashLoggerConfig cfg = makeConfig(rtc);
+  auto fill = [&](FlashLogger& log, int n) {
+    for (int i = 0; i < n; ++i) {
+      rtc.adjust(DateTime(unixNow += 30));
+      assert(log.append(String("{\"i\":") + String(i) + "}"));
+    }
+  };
+  auto factoryAt = [&](uint32_t addr) { return memcmp(big.data() + addr, "TCAF", 4) == 0; };
+
+  for (int en4b = 0; en4b < 2; ++en4b) {
+    cfg.en4b = en4b != 0;
+    {
+      FlashLogger log;
+      assert(log.begin(cfg));
+      assert(log.chipBytes() == chip && log.sectorCount() == 8192 && log.addr4());
+      fill(log, 50);
+      assert(log.checkpoint());
+    }
+    assert(factoryAt(chip - 4096));
+    {
+      FlashLogger log;
+      assert(log.begin(cfg) && log.mountedFromCheckpoint());
+      assert(recordIds(log).size() == 50);
+    }
+    big.eraseAll();
+    hostsim::nvs().ns.clear();
+  }
+
+  cfg.en4b = false;
+  cfg.regionOffset = 1UL * 1024UL * 1024UL;
+  cfg.regionBytes  = 2UL * 1024UL * 1024UL;
+  memset(big.data(), 0x5A, cfg.regionOffset);            // another partition
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    assert(log.sectorCount() == 512 && !log.addr4() && log.regionBase() == cfg.regionOffset);
+    fill(log, 50);
+  }
+  {
+    FlashLogger log;
+    assert(log.begin(cfg) && recordIds(log).size() == 50);
+  }
+  assert(factoryAt(cfg.regionOffset + cfg.regionBytes - 4096));
+  assert(memcmp(big.data() + cfg.regionOffset, "GGOL", 4) == 0);   // sector 0 header
+  for (uint32_t a = 0; a < cfg.regionOffset; ++a) assert(big.data()[a] == 0x5A);
+  for (uint32_t a = cfg.regionOffset + cfg.regionBytes; a < chip; a += 257) assert(big.data()[a] == 0xFF);
+  cfg.regionOffset = chip - 8 * 4096;                    // too small for a log
+  FlashLogger tiny;
+  assert(!tiny.begin(cfg));
+  assert(big.stats().busyViolations == 0 && big.stats().andViolations == 0);
+  hostsim::nvs().ns.clear();
+}
+}  // namespace
+
+int main() {
+  Serial.setMuted(true);
+  testCrc16MatchesReference();
+  NorFlashEmulator emu(16UL * 1024UL * 1024UL, kCs);
+  emu.attach(SPI);
+  testEmulatorNorSemantics(emu);
+
+  RTC_DS3231 rtc;
+  uint32_t unixNow = 1735689600UL;
+  rtc.adjust(DateTime(unixNow));
+  testGroupCommitPowerLoss(emu, rtc, unixNow);
+  testAsyncEngine(emu, rtc, unixNow);
+  testErasedPool(emu, rtc, unixNow);
+  testMetadataJournal(emu, rtc, unixNow);
+  testJournalBudget(emu, rtc, unixNow);
+  testRtcFloor(emu, rtc, unixNow);
+  testJournalUpgrade(emu, rtc, unixNow);
+  testMountCheckpoint(emu, rtc, unixNow);
+  testRecordIterator(emu, rtc, unixNow);
+  testBackLinks(emu, rtc, unixNow);
+  testWrapOrder(emu, rtc, unixNow);
+  testSeqAcrossBoots(emu, rtc, unixNow);
+  testZoneMaps(emu, rtc, unixNow);
+  testTypedRecords(emu, rtc, unixNow);
+  testCompressedBlocks(emu, rtc, unixNow);
+  testPredicateProgram(emu, rtc, unixNow);
+  testRowPlans(emu, rtc, unixNow);
+  testSpanRows(emu, rtc, unixNow);
+  testAggregation(emu, rtc, unixNow);
+  testRollups(emu, rtc, unixNow);
+  testRollupEraseAhead(emu, rtc, unixNow);
+  testRollupKeysChange(emu, rtc, unixNow);
+  testRollupClaim(emu, rtc, unixNow);
+  testLegacyHeaders(emu, rtc, unixNow);
+  testRecordTags(emu, rtc, unixNow);
+  testGcRetention(emu, rtc, unixNow);
+  testCompactIndex(rtc, unixNow);
+  testGeometry(rtc, unixNow);
+  emu.attach(SPI);
+  FlashLoggerConfig cfg = makeConfig(rtc);
+
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    for (int i = 0; i < 100; ++i) {
+      rtc.adjust(DateTime(unixNow += 60));
+      assert(log.append(String("{\"i\":") + String(i) + ",\"pm25\":" + String(i % 40) + "}"));
+    }
+    std::vector<std::string> rows;
+    assert(log.queryLatest(3, collect, &rows) == 3);
+    assert(rows[0].find("\"i\":99") != std::string::npos);
+  }
+
+  // remount sees the same data and keeps appending after it
+  {
+    FlashLogger log;
+    assert(log.begin(cfg));
+    rtc.adjust(DateTime(unixNow += 60));
+    assert(log.append("{\"i\":100}"));
+    std::vector<std::string> rows;
+    assert(log.queryLatest(2, collect, &rows) == 2);
+    assert(rows[0].find("\"i\":100") != std::string::npos);
+    assert(rows[1].find("\"i\":99") != std::string::npos);
+
+    QuerySpec q;
+    strncpy(q.predicates[0].key, "pm25", sizeof(q.predicates[0].key) - 1);
+    q.predicates[0].op = PRED_GE;
+    q.predicates[0].value = 38.0f;
+    q.predicateCount = 1;
+    rows.clear();
+    assert(log.queryLogs(q, collect, &rows) == 4);   // i = 38, 39, 78, 79
+  }
+
+  assert(emu.stats().busyViolations == 0);
+  assert(emu.stats().andViolations == 0);
+  return 0;
+}
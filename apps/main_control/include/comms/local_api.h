@@ -26,6 +26,7 @@ class Service {
     if (!_cfg.enabled || _started) return;
     _server.on("/status", [this]() { handleStatus(); });
     _server.on("/logs/latest", [this]() { handleLogsLatest(); });
+    _server.on("/logs/agg", [this]() { handleLogsAgg(); });
     _server.onNotFound([this]() { handleNotFound(); });
     _server.begin();
     _started = true;
@@ -90,6 +91,62 @@ class Service {
     _server.send(200, "application/x-ndjson", buf.body);
   }
 
+  // GET /logs/agg?field=pm25&agg=avg,p95&bucket=1h[&from=<unix>&to=<unix>][&where=<expr>]
+  // One NDJSON row per bucket, computed on the device in a single pass.
+  void handleLogsAgg() {
+#if defined(FLASHLOGGER_HAS_AGG)
+    if (!_logger) {
+      _server.send(503, "text/plain", "logger unavailable");
+      return;
+    }
+    QuerySpec q;
+    const String field = _server.arg("field");
+    const String agg = _server.hasArg("agg") ? _server.arg("agg") : String("avg");
+    const String bucket = _server.hasArg("bucket") ? _server.arg("bucket") : String("1h");
+    if (!q.addAgg(field.c_str(), agg.c_str())) {
+      _server.send(400, "text/plain", "bad field/agg");
+      return;
+    }
+    if (bucket != "all" && !FlashLogger::parseSeconds(bucket.c_str(), q.group_by_seconds)) {
+      _server.send(400, "text/plain", "bad bucket");
+      return;
+    }
+    const uint32_t epoch2000 = DateTime::SECONDS_FROM_1970_TO_2000;
+    if (_server.hasArg("from")) {
+      const uint32_t from = (uint32_t)_server.arg("from").toInt();
+      q.ts_from = from > epoch2000 ? from - epoch2000 : 0;
+    }
+    if (_server.hasArg("to")) {
+      const uint32_t to = (uint32_t)_server.arg("to").toInt();
+      q.ts_to = to > epoch2000 ? to - epoch2000 : 0;
+    }
+    PredicateProgram where;
+    if (_server.hasArg("where")) {
+      if (!where.compile(_server.arg("where").c_str())) {
+        _server.send(400, "text/plain", String("bad where: ") + where.error());
+        return;
+      }
+      q.where = &where;
+    }
+    q.max_records = 1000;
+    struct Buffer { String body; } buf;
+    auto collector = [](const char* data, size_t len, const RecordMeta&, void* user) {
+      static_cast<Buffer*>(user)->body.concat(data, len);
+      return true;
+    };
+    char row[160];
+    RowBuffer scratch(row, sizeof(row));
+    if (!_logger->queryAgg(q, collector, &buf, &scratch)) {
+      _server.send(204, "text/plain", "");
+      return;
+    }
+    _server.send(200, "application/x-ndjson", buf.body);
+#else
+    // The labs logger this app builds against has no queryAgg().
+    _server.send(501, "text/plain", "aggregation needs the v2.1 logger");
+#endif
+  }
+
   void handleNotFound() {
     _server.send(404, "text/plain", "Not Found");
   }